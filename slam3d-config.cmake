@@ -5,9 +5,10 @@ if (NOT TARGET Eigen3::Eigen)
 		INTERFACE_INCLUDE_DIRECTORIES ${EIGEN3_INCLUDE_DIR})
 endif ()
 
-find_package(Boost REQUIRED COMPONENTS graph)
+find_package(Boost REQUIRED COMPONENTS thread graph iostreams)
 find_package(PCL 1.7 REQUIRED COMPONENTS registration)
 find_package(g2o REQUIRED)
 find_package(OpenGL REQUIRED)
+find_package(OpenMP)
 include("${CMAKE_CURRENT_LIST_DIR}/slam3d-targets.cmake")
 
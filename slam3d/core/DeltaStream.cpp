@@ -0,0 +1,394 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "DeltaStream.hpp"
+
+#include <boost/format.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/copy.hpp>
+
+#include <algorithm>
+#include <sstream>
+
+#define DELTA_MAGIC   0x44443353 // "S3DD" on little endian hosts
+#define DELTA_VERSION 1
+
+#define PAYLOAD_PRESENT    0x01
+#define PAYLOAD_COMPRESSED 0x02
+
+#define MAX_STRING_CHUNK 65536
+
+using namespace slam3d;
+
+// ==============================================
+// Primitive types
+// ==============================================
+
+template <typename T>
+static void write(std::ostream& out, const T& value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static T read(std::istream& in)
+{
+	T value;
+	in.read(reinterpret_cast<char*>(&value), sizeof(T));
+	if(!in)
+		throw BadDeltaStream("Unexpected end of delta stream!");
+	return value;
+}
+
+static void writeString(std::ostream& out, const std::string& s)
+{
+	write<uint32_t>(out, s.size());
+	out.write(s.data(), s.size());
+}
+
+// Strings grow with the data that actually arrives, so a corrupt
+// length cannot allocate more memory than the stream contains.
+static std::string readString(std::istream& in)
+{
+	uint32_t size = read<uint32_t>(in);
+	std::string s;
+	while(s.size() < size)
+	{
+		size_t offset = s.size();
+		s.resize(offset + std::min<size_t>(size - offset, MAX_STRING_CHUNK));
+		in.read(&s[offset], s.size() - offset);
+		if(!in)
+			throw BadDeltaStream("Unexpected end of delta stream!");
+	}
+	return s;
+}
+
+static void writeUuid(std::ostream& out, const boost::uuids::uuid& id)
+{
+	out.write(reinterpret_cast<const char*>(id.data), id.size());
+}
+
+static boost::uuids::uuid readUuid(std::istream& in)
+{
+	boost::uuids::uuid id;
+	in.read(reinterpret_cast<char*>(id.data), id.size());
+	if(!in)
+		throw BadDeltaStream("Unexpected end of delta stream!");
+	return id;
+}
+
+// Only the upper 3x4 block is written, the last row of an isometry is constant.
+static void writeTransform(std::ostream& out, const Transform& tf)
+{
+	for(unsigned r = 0; r < 3; r++)
+		for(unsigned c = 0; c < 4; c++)
+			write<double>(out, tf.matrix()(r,c));
+}
+
+static Transform readTransform(std::istream& in)
+{
+	Transform tf = Transform::Identity();
+	for(unsigned r = 0; r < 3; r++)
+		for(unsigned c = 0; c < 4; c++)
+			tf.matrix()(r,c) = read<double>(in);
+	return tf;
+}
+
+template <typename M>
+static void writeVector(std::ostream& out, const M& v)
+{
+	for(unsigned i = 0; i < v.size(); i++)
+		write<double>(out, v(i));
+}
+
+template <typename M>
+static void readVector(std::istream& in, M& v)
+{
+	for(unsigned i = 0; i < v.size(); i++)
+		v(i) = read<double>(in);
+}
+
+// Covariances are symmetric, so only the upper triangle is written.
+template <unsigned N>
+static void writeCovariance(std::ostream& out, const Covariance<N>& cov)
+{
+	for(unsigned r = 0; r < N; r++)
+		for(unsigned c = r; c < N; c++)
+			write<double>(out, cov(r,c));
+}
+
+template <unsigned N>
+static Covariance<N> readCovariance(std::istream& in)
+{
+	Covariance<N> cov;
+	for(unsigned r = 0; r < N; r++)
+		for(unsigned c = r; c < N; c++)
+			cov(r,c) = cov(c,r) = read<double>(in);
+	return cov;
+}
+
+// ==============================================
+// Compression
+// ==============================================
+
+static std::string compress(const std::string& data)
+{
+	std::string result;
+	boost::iostreams::filtering_ostream os;
+	os.push(boost::iostreams::zlib_compressor());
+	os.push(boost::iostreams::back_inserter(result));
+	os.write(data.data(), data.size());
+	boost::iostreams::close(os);
+	return result;
+}
+
+static std::string decompress(const std::string& data)
+{
+	std::string result;
+	try
+	{
+		boost::iostreams::filtering_istream is;
+		is.push(boost::iostreams::zlib_decompressor());
+		is.push(boost::iostreams::array_source(data.data(), data.size()));
+		boost::iostreams::copy(is, boost::iostreams::back_inserter(result));
+	}catch(boost::iostreams::zlib_error &e)
+	{
+		throw BadDeltaStream((boost::format("Could not decompress measurement: %1%") % e.what()).str());
+	}
+	return result;
+}
+
+// ==============================================
+// DeltaWriter
+// ==============================================
+
+DeltaWriter::DeltaWriter(std::ostream& out, RevisionType since, RevisionType until) : mOut(out)
+{
+	write<uint32_t>(mOut, DELTA_MAGIC);
+	write<uint16_t>(mOut, DELTA_VERSION);
+	write<uint64_t>(mOut, since);
+	write<uint64_t>(mOut, until);
+}
+
+void DeltaWriter::writeVertex(const VertexObject& v, const MeasurementCodec* codec, bool compressed)
+{
+	const Measurement::Ptr& m = v.measurement;
+	timeval stamp = m->getTimestamp();
+
+	write<uint8_t>(mOut, DELTA_VERTEX);
+	writeUuid(mOut, m->getUniqueId());
+	writeString(mOut, m->getRobotName());
+	writeString(mOut, m->getSensorName());
+	write<int64_t>(mOut, stamp.tv_sec);
+	write<int64_t>(mOut, stamp.tv_usec);
+	writeTransform(mOut, m->getSensorPose());
+	writeTransform(mOut, v.corrected_pose);
+
+	if(!codec)
+	{
+		write<uint8_t>(mOut, 0);
+		return;
+	}
+
+	std::ostringstream payload;
+	codec->encode(m, payload);
+	if(compressed)
+	{
+		write<uint8_t>(mOut, PAYLOAD_PRESENT | PAYLOAD_COMPRESSED);
+		writeString(mOut, compress(payload.str()));
+	}else
+	{
+		write<uint8_t>(mOut, PAYLOAD_PRESENT);
+		writeString(mOut, payload.str());
+	}
+}
+
+void DeltaWriter::writeConstraint(const boost::uuids::uuid& source, const boost::uuids::uuid& target, const Constraint::Ptr& c, bool replace)
+{
+	write<uint8_t>(mOut, replace ? DELTA_REPLACE_CONSTRAINT : DELTA_CONSTRAINT);
+	writeUuid(mOut, source);
+	writeUuid(mOut, target);
+	writeString(mOut, c->getSensorName());
+	write<uint8_t>(mOut, c->getType());
+	switch(c->getType())
+	{
+	case SE3:
+	{
+		const TransformWithCovariance& twc = boost::static_pointer_cast<SE3Constraint>(c)->getRelativePose();
+		writeTransform(mOut, twc.transform);
+		writeCovariance<6>(mOut, twc.covariance);
+		break;
+	}
+	case GRAVITY:
+	{
+		GravityConstraint::Ptr grav = boost::static_pointer_cast<GravityConstraint>(c);
+		writeVector(mOut, grav->getDirection());
+		writeVector(mOut, grav->getReference());
+		writeCovariance<2>(mOut, grav->getCovariance());
+		break;
+	}
+	case POSITION:
+	{
+		PositionConstraint::Ptr pos = boost::static_pointer_cast<PositionConstraint>(c);
+		writeVector(mOut, pos->getPosition());
+		writeCovariance<3>(mOut, pos->getCovariance());
+		break;
+	}
+	default:
+		throw BadDeltaStream((boost::format("Constraint of type %1% cannot be written to a delta stream!") % c->getTypeName()).str());
+	}
+}
+
+void DeltaWriter::writeConstraintRemoval(const boost::uuids::uuid& source, const boost::uuids::uuid& target, const std::string& sensor)
+{
+	write<uint8_t>(mOut, DELTA_REMOVE_CONSTRAINT);
+	writeUuid(mOut, source);
+	writeUuid(mOut, target);
+	writeString(mOut, sensor);
+}
+
+void DeltaWriter::writeVertexRemoval(const boost::uuids::uuid& id)
+{
+	write<uint8_t>(mOut, DELTA_REMOVE_VERTEX);
+	writeUuid(mOut, id);
+}
+
+void DeltaWriter::writePose(const boost::uuids::uuid& id, const Transform& pose)
+{
+	write<uint8_t>(mOut, DELTA_POSE);
+	writeUuid(mOut, id);
+	writeTransform(mOut, pose);
+}
+
+void DeltaWriter::finish()
+{
+	write<uint8_t>(mOut, DELTA_END);
+	mOut.flush();
+}
+
+// ==============================================
+// DeltaReader
+// ==============================================
+
+DeltaReader::DeltaReader(std::istream& in) : mIn(in)
+{
+	if(read<uint32_t>(mIn) != DELTA_MAGIC)
+		throw BadDeltaStream("Stream is not a delta stream or has a different byte order!");
+	uint16_t version = read<uint16_t>(mIn);
+	if(version != DELTA_VERSION)
+		throw BadDeltaStream((boost::format("Delta stream version %1% is not supported (expected %2%)!") % version % DELTA_VERSION).str());
+	mSince = read<uint64_t>(mIn);
+	mUntil = read<uint64_t>(mIn);
+}
+
+DeltaRecordType DeltaReader::next()
+{
+	uint8_t type = read<uint8_t>(mIn);
+	if(type > DELTA_REPLACE_CONSTRAINT)
+		throw BadDeltaStream((boost::format("Unknown record type %1% in delta stream!") % (unsigned)type).str());
+	return (DeltaRecordType)type;
+}
+
+void DeltaReader::readVertex(DeltaVertex& v)
+{
+	v.id = readUuid(mIn);
+	v.robot = readString(mIn);
+	v.sensor = readString(mIn);
+	v.stamp.tv_sec = read<int64_t>(mIn);
+	v.stamp.tv_usec = read<int64_t>(mIn);
+	v.sensor_pose = readTransform(mIn);
+	v.corrected_pose = readTransform(mIn);
+
+	uint8_t flags = read<uint8_t>(mIn);
+	v.has_payload = flags & PAYLOAD_PRESENT;
+	v.payload.clear();
+	if(v.has_payload)
+	{
+		v.payload = readString(mIn);
+		if(flags & PAYLOAD_COMPRESSED)
+			v.payload = decompress(v.payload);
+	}
+}
+
+void DeltaReader::readConstraint(DeltaConstraint& c)
+{
+	c.source = readUuid(mIn);
+	c.target = readUuid(mIn);
+	c.sensor = readString(mIn);
+	uint8_t type = read<uint8_t>(mIn);
+	switch(type)
+	{
+	case SE3:
+	{
+		TransformWithCovariance twc;
+		twc.transform = readTransform(mIn);
+		twc.covariance = readCovariance<6>(mIn);
+		c.constraint = SE3Constraint::create(c.sensor, twc);
+		break;
+	}
+	case GRAVITY:
+	{
+		Direction dir, ref;
+		readVector(mIn, dir);
+		readVector(mIn, ref);
+		Covariance<2> cov = readCovariance<2>(mIn);
+		c.constraint = GravityConstraint::create(c.sensor, dir, ref, cov);
+		break;
+	}
+	case POSITION:
+	{
+		Position pos;
+		readVector(mIn, pos);
+		Covariance<3> cov = readCovariance<3>(mIn);
+		c.constraint = PositionConstraint::create(c.sensor, pos, cov);
+		break;
+	}
+	default:
+		throw BadDeltaStream((boost::format("Unknown constraint type %1% in delta stream!") % (unsigned)type).str());
+	}
+}
+
+void DeltaReader::readConstraintRemoval(DeltaConstraint& c)
+{
+	c.source = readUuid(mIn);
+	c.target = readUuid(mIn);
+	c.sensor = readString(mIn);
+	c.constraint.reset();
+}
+
+void DeltaReader::readVertexRemoval(DeltaPose& p)
+{
+	p.id = readUuid(mIn);
+	p.pose = Transform::Identity();
+}
+
+void DeltaReader::readPose(DeltaPose& p)
+{
+	p.id = readUuid(mIn);
+	p.pose = readTransform(mIn);
+}
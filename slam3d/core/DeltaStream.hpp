@@ -0,0 +1,241 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_DELTASTREAM_HPP
+#define SLAM_DELTASTREAM_HPP
+
+#include "Types.hpp"
+
+#include <iostream>
+
+namespace slam3d
+{
+	/**
+	 * @class BadDeltaStream
+	 * @brief Exception thrown when a delta stream cannot be parsed.
+	 */
+	class BadDeltaStream : public std::exception
+	{
+	public:
+		BadDeltaStream(const std::string& msg) : message(msg) {}
+		virtual ~BadDeltaStream() throw() {}
+		virtual const char* what() const throw()
+		{
+			return message.c_str();
+		}
+
+		std::string message;
+	};
+
+	/**
+	 * @class MeasurementCodec
+	 * @brief Converts a sensor specific Measurement to a byte stream and back.
+	 * @details Codecs are registered at the Graph for each sensor whose
+	 * measurements should be transmitted within a delta stream. Vertices
+	 * from sensors without a codec are transmitted without their payload
+	 * and are reconstructed as plain Measurement objects.
+	 */
+	class MeasurementCodec
+	{
+	public:
+		virtual ~MeasurementCodec(){}
+
+		/**
+		 * @brief Write the sensor specific payload of the measurement.
+		 * @param m measurement to be encoded
+		 * @param out stream to write the payload to
+		 * @throw BadMeasurementType
+		 */
+		virtual void encode(const Measurement::Ptr& m, std::ostream& out) const = 0;
+
+		/**
+		 * @brief Create a measurement from the given payload.
+		 * @param in stream containing the payload written by encode()
+		 * @param robot name of the robot that recorded the measurement
+		 * @param sensor name of the sensor that recorded the measurement
+		 * @param sensor_pose pose of the sensor in the robot's coordinate frame
+		 * @param id unique identifier of the measurement
+		 * @param stamp time of the measurement
+		 */
+		virtual Measurement::Ptr decode(std::istream& in,
+		                                const std::string& robot,
+		                                const std::string& sensor,
+		                                const Transform& sensor_pose,
+		                                boost::uuids::uuid id,
+		                                timeval stamp) const = 0;
+	};
+
+	/**
+	 * @brief Record types within a delta stream.
+	 */
+	enum DeltaRecordType {DELTA_END = 0, DELTA_VERTEX = 1, DELTA_CONSTRAINT = 2, DELTA_REMOVE_CONSTRAINT = 3, DELTA_POSE = 4, DELTA_REMOVE_VERTEX = 5, DELTA_REPLACE_CONSTRAINT = 6};
+
+	/**
+	 * @struct DeltaVertex
+	 * @brief A new vertex within a delta stream.
+	 */
+	struct DeltaVertex
+	{
+		boost::uuids::uuid id;
+		std::string robot;
+		std::string sensor;
+		timeval stamp;
+		Transform sensor_pose;
+		Transform corrected_pose;
+		bool has_payload;
+		std::string payload; // already decompressed
+	};
+
+	/**
+	 * @struct DeltaConstraint
+	 * @brief A new, replaced or removed constraint within a delta stream.
+	 * @details For removals only the sensor name is set, the constraint is empty.
+	 */
+	struct DeltaConstraint
+	{
+		boost::uuids::uuid source;
+		boost::uuids::uuid target;
+		std::string sensor;
+		Constraint::Ptr constraint;
+	};
+
+	/**
+	 * @struct DeltaPose
+	 * @brief A corrected pose for a vertex that was transmitted before.
+	 * @details For removed vertices only the id is set.
+	 */
+	struct DeltaPose
+	{
+		boost::uuids::uuid id;
+		Transform pose;
+	};
+
+	/**
+	 * @class DeltaWriter
+	 * @brief Writes the binary change-log format used to exchange graph updates.
+	 * @details A stream starts with a header containing a magic number, the
+	 * format version and the revision range it covers. It is followed by an
+	 * arbitrary number of records and terminated by DELTA_END. Vertices are
+	 * referenced by the uuid of their measurement, as vertex ids are local
+	 * to each graph. Numbers are written in the host's byte order, which is
+	 * verified by the magic number when reading.
+	 */
+	class DeltaWriter
+	{
+	public:
+		/**
+		 * @brief Constructor, writes the stream header.
+		 * @param out stream to write to
+		 * @param since first revision (exclusive) covered by this delta
+		 * @param until last revision (inclusive) covered by this delta
+		 */
+		DeltaWriter(std::ostream& out, RevisionType since, RevisionType until);
+
+		/**
+		 * @brief Write a new vertex.
+		 * @param v vertex to be written
+		 * @param codec used to encode the measurement, may be NULL
+		 * @param compress whether to compress the encoded measurement
+		 */
+		void writeVertex(const VertexObject& v, const MeasurementCodec* codec, bool compress);
+
+		/**
+		 * @brief Write a new constraint between two measurements.
+		 * @param source uuid of the source measurement
+		 * @param target uuid of the target measurement
+		 * @param c constraint (SE3, gravity or position)
+		 * @param replace whether the constraint replaces an existing one between the two measurements
+		 */
+		void writeConstraint(const boost::uuids::uuid& source, const boost::uuids::uuid& target, const Constraint::Ptr& c, bool replace = false);
+
+		/**
+		 * @brief Write the removal of a constraint.
+		 * @param source uuid of the source measurement
+		 * @param target uuid of the target measurement
+		 * @param sensor name of the sensor that created the constraint
+		 */
+		void writeConstraintRemoval(const boost::uuids::uuid& source, const boost::uuids::uuid& target, const std::string& sensor);
+
+		/**
+		 * @brief Write the removal of a vertex together with all its constraints.
+		 * @param id uuid of the vertex' measurement
+		 */
+		void writeVertexRemoval(const boost::uuids::uuid& id);
+
+		/**
+		 * @brief Write a corrected pose for a known vertex.
+		 * @param id uuid of the vertex' measurement
+		 * @param pose new corrected pose
+		 */
+		void writePose(const boost::uuids::uuid& id, const Transform& pose);
+
+		/**
+		 * @brief Terminate the stream and flush it.
+		 */
+		void finish();
+
+	private:
+		std::ostream& mOut;
+	};
+
+	/**
+	 * @class DeltaReader
+	 * @brief Reads the binary change-log written by DeltaWriter.
+	 */
+	class DeltaReader
+	{
+	public:
+		/**
+		 * @brief Constructor, reads and verifies the stream header.
+		 * @param in stream to read from
+		 * @throw BadDeltaStream
+		 */
+		DeltaReader(std::istream& in);
+
+		RevisionType getSince() const { return mSince; }
+		RevisionType getUntil() const { return mUntil; }
+
+		/**
+		 * @brief Read the type of the next record.
+		 * @details Depending on the type, exactly one of the read methods below
+		 * has to be called before calling next() again.
+		 * @throw BadDeltaStream
+		 */
+		DeltaRecordType next();
+
+		void readVertex(DeltaVertex& v);
+		void readConstraint(DeltaConstraint& c);
+		void readConstraintRemoval(DeltaConstraint& c);
+		void readVertexRemoval(DeltaPose& p);
+		void readPose(DeltaPose& p);
+
+	private:
+		std::istream& mIn;
+		RevisionType mSince;
+		RevisionType mUntil;
+	};
+}
+
+#endif
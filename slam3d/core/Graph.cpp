@@ -27,8 +27,67 @@
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
 using namespace slam3d;
 
+typedef Eigen::Matrix<ScalarType,6,1> ErrorVector;
+typedef std::vector< std::vector<bool> > Adjacency;
+
+// Translation and vector part of the quaternion, as in g2o::EdgeSE3
+static ErrorVector toErrorVector(const Transform& t)
+{
+	Eigen::Quaternion<ScalarType> q(t.linear());
+	if(q.w() < 0)
+		q.coeffs() *= -1;
+	ErrorVector e;
+	e << t.translation(), q.vec();
+	return e;
+}
+
+// Bron-Kerbosch with pivoting, keeps the largest clique found in best
+static void findMaximumClique(const Adjacency& adj, std::vector<unsigned>& clique,
+	std::vector<unsigned> candidates, std::vector<unsigned> excluded, std::vector<unsigned>& best)
+{
+	if(candidates.empty() && excluded.empty())
+	{
+		if(clique.size() > best.size())
+			best = clique;
+		return;
+	}
+	if(clique.size() + candidates.size() <= best.size())
+		return;
+
+	// Only branch on vertices that are not adjacent to the pivot
+	unsigned pivot = candidates.empty() ? excluded[0] : candidates[0];
+	std::vector<unsigned> branches;
+	for(std::vector<unsigned>::iterator v = candidates.begin(); v != candidates.end(); ++v)
+	{
+		if(!adj[pivot][*v])
+			branches.push_back(*v);
+	}
+
+	for(std::vector<unsigned>::iterator v = branches.begin(); v != branches.end(); ++v)
+	{
+		std::vector<unsigned> next_candidates, next_excluded;
+		for(std::vector<unsigned>::iterator u = candidates.begin(); u != candidates.end(); ++u)
+			if(adj[*v][*u]) next_candidates.push_back(*u);
+		for(std::vector<unsigned>::iterator u = excluded.begin(); u != excluded.end(); ++u)
+			if(adj[*v][*u]) next_excluded.push_back(*u);
+
+		clique.push_back(*v);
+		findMaximumClique(adj, clique, next_candidates, next_excluded, best);
+		clique.pop_back();
+
+		candidates.erase(std::find(candidates.begin(), candidates.end(), *v));
+		excluded.push_back(*v);
+	}
+}
+
 // Re-orthogonalize the rotation-matrix
 Transform Graph::orthogonalize(const Transform& t)
 {
@@ -48,6 +107,11 @@ Graph::Graph(Logger* log)
 	mOptimized = false;
 	mConstraintsAdded = 0;
 	mOptimizationRate = 0;
+	mRevision = 0;
+	mLoopBufferSize = 0;
+	mLoopThreshold = 0;
+	mMinConsistentLoops = 2;
+	mSpatialResolution = 1.0;
 }
 
 Graph::~Graph()
@@ -81,8 +145,13 @@ bool Graph::optimize(unsigned iterations)
 	mOptimized = true;
 
 	// Retrieve results
-	IdPoseVector res = mSolver->getCorrections();
-	for(IdPoseVector::iterator it = res.begin(); it < res.end(); it++)
+	applyCorrections(mSolver->getCorrections());
+	return true;
+}
+
+void Graph::applyCorrections(const IdPoseVector& corrections)
+{
+	for(IdPoseVector::const_iterator it = corrections.begin(); it < corrections.end(); it++)
 	{
 		unsigned int id = it->first;
 		Transform tf = it->second;
@@ -94,7 +163,76 @@ bool Graph::optimize(unsigned iterations)
 			mLogger->message(ERROR, (boost::format("Vertex with id %1% does not exist!") % id).str());
 		}
 	}
-	return true;
+
+	boost::unique_lock<boost::mutex> guard(mJournalMutex);
+	++mRevision;
+}
+
+bool Graph::addConstraintsChecked(const EdgeObjectList& constraints, ScalarType threshold, unsigned iterations)
+{
+	if(!mSolver || !mSolver->checkpoint())
+	{
+		mLogger->message(ERROR, "Checked constraints require a solver that supports checkpoints!");
+		return false;
+	}
+
+	// Suspend the automatic optimization while adding the constraints
+	unsigned rate = mOptimizationRate;
+	mOptimizationRate = 0;
+	EdgeObjectList added;
+	bool accepted = false;
+	try
+	{
+		for(EdgeObjectList::const_iterator e = constraints.begin(); e != constraints.end(); ++e)
+		{
+			addConstraint(e->source, e->target, e->constraint);
+			added.push_back(*e);
+		}
+		if(optimize(iterations))
+		{
+			accepted = true;
+			for(EdgeObjectList::iterator e = added.begin(); e != added.end() && accepted; ++e)
+			{
+				ScalarType error = getResidual(*e);
+				if(error > threshold)
+				{
+					mLogger->message(WARNING, (boost::format("Constraint from %1% to %2% has an error of %3% after optimization, rejecting %4% constraints.")
+						% e->source % e->target % error % constraints.size()).str());
+					accepted = false;
+				}
+			}
+		}
+	}catch(...)
+	{
+		mOptimizationRate = rate;
+		throw;
+	}
+	mOptimizationRate = rate;
+
+	if(accepted)
+	{
+		mSolver->releaseCheckpoint();
+		return true;
+	}
+
+	// Remove the constraints and restore the previous poses
+	for(EdgeObjectList::iterator e = added.begin(); e != added.end(); ++e)
+	{
+		try
+		{
+			removeEdge(e->source, e->target, e->constraint->getSensorName());
+			journalEdge(e->source, e->target, e->constraint->getSensorName(), Constraint::Ptr());
+		}catch(std::exception &ex)
+		{
+			mLogger->message(ERROR, (boost::format("Could not remove rejected constraint from %1% to %2%: %3%")
+				% e->source % e->target % ex.what()).str());
+		}
+	}
+	if(mSolver->rollback())
+	{
+		applyCorrections(mSolver->getCorrections());
+	}
+	return false;
 }
 
 bool Graph::optimized()
@@ -125,6 +263,29 @@ IdType Graph::addVertex(Measurement::Ptr m, const Transform &corrected)
 
 	// Add it to the uuid-index, so we can find it by its uuid
 	mUuidIndex.insert(UuidIndex::value_type(m->getUniqueId(), id));
+
+	// Add a row to the trajectory table, ids are always increasing
+	{
+		boost::unique_lock<boost::mutex> guard(mTrajectoryMutex);
+		Trajectory& t = mTrajectories[m->getSensorName()];
+		t.ids.push_back(id);
+		t.stamps.push_back(m->getTimestamp());
+		t.translations.resize(t.translations.size() + 3);
+		t.rotations.resize(t.rotations.size() + 4);
+		t.revisions.push_back(0);
+	}
+	updateTrajectory(id, m->getSensorName(), corrected);
+	updateSpatialIndex(id, m->getSensorName(), corrected);
+
+	// Add it to the journal, so it will be part of the next delta
+	{
+		boost::unique_lock<boost::mutex> guard(mJournalMutex);
+		JournalEntry entry;
+		entry.revision = ++mRevision;
+		entry.vertex = id;
+		entry.source = m->getUniqueId();
+		mVertexJournal.push_back(entry);
+	}
 	
 	// Add it to the SLAM-Backend for incremental optimization
 	if(mSolver)
@@ -133,18 +294,19 @@ IdType Graph::addVertex(Measurement::Ptr m, const Transform &corrected)
 		if(mFixNext)
 		{
 			mSolver->setFixed(id);
+			mFixedVertices.insert(id);
 			mFixNext = false;
 		}
 	}
 	return id;
 }
 
-void Graph::addTentativeConstraint(IdType source_id, IdType target_id, std::string& sensor)
+void Graph::addTentativeConstraint(IdType source_id, IdType target_id, const std::string& sensor)
 {
 	EdgeObject eo;
 	eo.source = source_id;
 	eo.target = target_id;
-	eo.constraint = Constraint::Ptr(new TentativeConstraint(sensor));
+	eo.constraint = TentativeConstraint::create(sensor);
 	addEdge(eo);
 }
 
@@ -156,16 +318,152 @@ void Graph::addConstraint(IdType source_id, IdType target_id, Constraint::Ptr c)
 	eo.target = target_id;
 	eo.constraint = c;
 	addEdge(eo);
+	journalEdge(source_id, target_id, c->getSensorName(), c);
 	addToSolver(eo);
 }
 
 void Graph::replaceConstraint(IdType source_id, IdType target_id, Constraint::Ptr c)
 {
 	EdgeObject& eo = getEdgeInternal(source_id, target_id, c->getSensorName());
+
+	// Loop closures wait for the consistency check
+	if(mLoopBufferSize > 0 && eo.constraint->getType() == TENTATIVE && c->getType() == SE3)
+	{
+		boost::unique_lock<boost::mutex> guard(mLoopMutex);
+		EdgeObject candidate = eo;
+		candidate.constraint = c;
+		mLoopBuffer.push_back(candidate);
+		mLogger->message(DEBUG, (boost::format("Buffered loop closure from %1% to %2% (%3% of %4%).")
+			% source_id % target_id % mLoopBuffer.size() % mLoopBufferSize).str());
+		if(mLoopBuffer.size() < mLoopBufferSize)
+			return;
+		guard.unlock();
+		commitLoopClosures();
+		return;
+	}
+
 	eo.constraint = c;
+	journalEdge(source_id, target_id, c->getSensorName(), c, true);
 	addToSolver(eo);
 }
 
+void Graph::setLoopClosureBuffer(unsigned size, ScalarType threshold, unsigned min_consistent)
+{
+	mLoopBufferSize = size;
+	mLoopThreshold = threshold;
+	mMinConsistentLoops = min_consistent;
+}
+
+unsigned Graph::commitLoopClosures()
+{
+	boost::unique_lock<boost::mutex> guard(mLoopMutex);
+	EdgeObjectList loops;
+	loops.swap(mLoopBuffer);
+	if(loops.empty())
+		return 0;
+
+	// Current relative poses between the end points of each pair of loops
+	unsigned n = loops.size();
+	IdPairVector pairs;
+	for(unsigned a = 0; a < n; a++)
+	{
+		for(unsigned b = a + 1; b < n; b++)
+		{
+			pairs.push_back(IdPair(loops[a].target, loops[b].target));
+			pairs.push_back(IdPair(loops[b].source, loops[a].source));
+		}
+	}
+	bool from_marginals = false;
+	std::vector<TransformWithCovariance> transforms = getTransformsWithCovariance(pairs, &from_marginals);
+	if(!from_marginals && !pairs.empty())
+	{
+		mLogger->message(WARNING, "No marginals available, the consistency check of loop closures uses identity covariances.");
+	}
+
+	// Two loops are consistent, if the cycle through both is close to identity
+	Adjacency consistent(n, std::vector<bool>(n, false));
+	std::vector<TransformWithCovariance>::const_iterator t = transforms.begin();
+	for(unsigned a = 0; a < n; a++)
+	{
+		const TransformWithCovariance& za = boost::static_pointer_cast<SE3Constraint>(loops[a].constraint)->getRelativePose();
+		for(unsigned b = a + 1; b < n; b++, t += 2)
+		{
+			const TransformWithCovariance& zb = boost::static_pointer_cast<SE3Constraint>(loops[b].constraint)->getRelativePose();
+			TransformWithCovariance cycle = za * *t * zb.inverse() * *(t + 1);
+			ErrorVector e = toErrorVector(cycle.transform);
+			ScalarType chi2 = e.transpose() * cycle.covariance.inverse() * e;
+			consistent[a][b] = consistent[b][a] = (chi2 < mLoopThreshold);
+		}
+	}
+
+	std::vector<unsigned> clique, all, best;
+	for(unsigned i = 0; i < n; i++)
+		all.push_back(i);
+	findMaximumClique(consistent, clique, all, std::vector<unsigned>(), best);
+	if(best.size() < mMinConsistentLoops)
+	{
+		mLogger->message(WARNING, (boost::format("Only %1% of %2% loop closures are consistent, none will be added.")
+			% best.size() % n).str());
+		best.clear();
+	}
+
+	// Remove the placeholders of rejected loop closures, they never left this graph
+	std::vector<bool> accepted(n, false);
+	for(std::vector<unsigned>::const_iterator i = best.begin(); i != best.end(); ++i)
+		accepted[*i] = true;
+	for(unsigned i = 0; i < n; i++)
+	{
+		if(accepted[i])
+			continue;
+		const EdgeObject& loop = loops[i];
+		try
+		{
+			if(getEdge(loop.source, loop.target, loop.constraint->getSensorName()).constraint->getType() == TENTATIVE)
+				removeEdge(loop.source, loop.target, loop.constraint->getSensorName());
+		}catch(std::exception &e)
+		{
+			mLogger->message(WARNING, (boost::format("Could not remove rejected loop closure from %1% to %2%: %3%") % loop.source % loop.target % e.what()).str());
+		}
+	}
+	if(best.empty())
+		return 0;
+	mLogger->message(INFO, (boost::format("Adding %1% of %2% loop closures that are consistent.") % best.size() % n).str());
+
+	// Suspend the automatic optimization to optimize only once
+	unsigned committed = 0;
+	unsigned rate = mOptimizationRate;
+	mOptimizationRate = 0;
+	try
+	{
+		for(std::vector<unsigned>::iterator i = best.begin(); i != best.end(); ++i)
+		{
+			const EdgeObject& loop = loops[*i];
+			const std::string& sensor = loop.constraint->getSensorName();
+			try
+			{
+				EdgeObject& eo = getEdgeInternal(loop.source, loop.target, sensor);
+				eo.constraint = loop.constraint;
+				journalEdge(loop.source, loop.target, sensor, loop.constraint, true);
+				addToSolver(eo);
+				committed++;
+			}catch(std::exception &e)
+			{
+				mLogger->message(ERROR, (boost::format("Could not add loop closure from %1% to %2%: %3%") % loop.source % loop.target % e.what()).str());
+			}
+		}
+	}catch(...)
+	{
+		mOptimizationRate = rate;
+		throw;
+	}
+	mOptimizationRate = rate;
+	guard.unlock();
+
+	if(mSolver && committed > 0)
+		optimize();
+	return committed;
+}
+
 void Graph::addToSolver(const EdgeObject& eo)
 {
 	mConstraintsAdded++;
@@ -185,11 +483,95 @@ void Graph::removeConstraint(IdType source, IdType target, const std::string& se
 {
 	// Remove from graph
 	removeEdge(source, target, sensor);
+	journalEdge(source, target, sensor, Constraint::Ptr());
 	
 	// Remove from solver
 	// TODO
 }
 
+void Graph::removeVertex(IdType id)
+{
+	boost::uuids::uuid uuid;
+	std::string sensor;
+	try
+	{
+		uuid = getVertex(id).measurement->getUniqueId();
+		sensor = getVertex(id).measurement->getSensorName();
+	}catch(std::out_of_range &e)
+	{
+		throw InvalidVertex(id);
+	}
+
+	// Remove from graph and indexes
+	deleteVertex(id);
+	{
+		boost::unique_lock<boost::mutex> guard(mTrajectoryMutex);
+		Trajectory& t = mTrajectories[sensor];
+		std::vector<IdType>::iterator row = std::lower_bound(t.ids.begin(), t.ids.end(), id);
+		if(row != t.ids.end() && *row == id)
+		{
+			size_t r = row - t.ids.begin();
+			t.ids.erase(row);
+			t.stamps.erase(t.stamps.begin() + r);
+			t.translations.erase(t.translations.begin() + 3 * r, t.translations.begin() + 3 * r + 3);
+			t.rotations.erase(t.rotations.begin() + 4 * r, t.rotations.begin() + 4 * r + 4);
+			t.revisions.erase(t.revisions.begin() + r);
+		}
+	}
+	{
+		boost::unique_lock<boost::mutex> guard(mSpatialMutex);
+		SpatialIndex& si = mSpatialIndex[sensor];
+		std::map<IdType, Position>::iterator p = si.positions.find(id);
+		if(p != si.positions.end())
+		{
+			std::vector<IdType>& cell = si.cells[getSpatialCell(p->second)];
+			cell.erase(std::remove(cell.begin(), cell.end(), id), cell.end());
+			if(cell.empty())
+				si.cells.erase(getSpatialCell(p->second));
+			si.positions.erase(p);
+		}
+	}
+	mUuidIndex.erase(uuid);
+	mFixedVertices.erase(id);
+	for(std::map<IdType, IdType>::iterator n = mNeighborMap.begin(); n != mNeighborMap.end();)
+	{
+		if(n->second == id)
+			mNeighborMap.erase(n++);
+		else
+			++n;
+	}
+
+	// Drop the vertex from the journal and record its removal
+	{
+		boost::unique_lock<boost::mutex> guard(mJournalMutex);
+		Journal::iterator added = std::lower_bound(mVertexJournal.begin(), mVertexJournal.end(), id, vertexLess);
+		if(added != mVertexJournal.end() && added->vertex == id)
+			added->source = boost::uuids::nil_uuid();
+		JournalEntry entry;
+		entry.revision = ++mRevision;
+		entry.vertex = id;
+		entry.source = uuid;
+		entry.sensor = sensor;
+		mRemovalJournal.push_back(entry);
+	}
+
+	// Remove from solver
+	if(mSolver)
+	{
+		try
+		{
+			mSolver->removeVertex(id);
+		}catch(Solver::UnknownVertex &e)
+		{
+			mLogger->message(WARNING, e.what());
+		}catch(Solver::Unsupported &e)
+		{
+			mLogger->message(ERROR, (boost::format("Vertex %1% remains in the solver: %2%") % id % e.what()).str());
+		}
+	}
+	mLogger->message(INFO, (boost::format("Removed vertex %1%.") % id).str());
+}
+
 IdType Graph::getIndex(boost::uuids::uuid id) const
 {
 	return mUuidIndex.at(id);
@@ -200,20 +582,94 @@ bool Graph::hasMeasurement(boost::uuids::uuid id) const
 	return mUuidIndex.find(id) != mUuidIndex.end();
 }
 
-const VertexObject& Graph::getVertex(boost::uuids::uuid id) const
+VertexObject Graph::getVertex(boost::uuids::uuid id) const
 {
 	return getVertex(mUuidIndex.at(id));
 }
 
+ScalarType Graph::getResidual(const EdgeObject& edge) const
+{
+	Transform source = getVertex(edge.source).corrected_pose;
+	switch(edge.constraint->getType())
+	{
+	case SE3:
+	{
+		const TransformWithCovariance& twc = boost::static_pointer_cast<SE3Constraint>(edge.constraint)->getRelativePose();
+		ErrorVector e = toErrorVector(twc.transform.inverse() * source.inverse() * getVertex(edge.target).corrected_pose);
+		return e.transpose() * twc.covariance.inverse() * e;
+	}
+	case GRAVITY:
+	{
+		GravityConstraint::Ptr grav = boost::static_pointer_cast<GravityConstraint>(edge.constraint);
+		Direction d = source.linear().transpose() * grav->getReference().normalized() - grav->getDirection().normalized();
+		Eigen::Matrix<ScalarType,2,1> e = d.head<2>();
+		return e.transpose() * grav->getCovariance().inverse() * e;
+	}
+	case POSITION:
+	{
+		PositionConstraint::Ptr pos = boost::static_pointer_cast<PositionConstraint>(edge.constraint);
+		Position e = source.translation() - pos->getPosition();
+		return e.transpose() * pos->getCovariance().inverse() * e;
+	}
+	default:
+		return 0;
+	}
+}
+
 TransformWithCovariance Graph::getTransform(IdType source, IdType target) const
 {
-	// This method is a stub:
-	// Replace with something more elaborate, that calculates the covariance as well.
 	TransformWithCovariance twc;
 	twc.transform = getVertex(source).corrected_pose.inverse() * getVertex(target).corrected_pose;
 	return twc;
 }
 
+TransformWithCovariance Graph::getTransformWithCovariance(IdType source, IdType target) const
+{
+	return getTransformsWithCovariance(IdPairVector(1, IdPair(source, target))).at(0);
+}
+
+std::vector<TransformWithCovariance> Graph::getTransformsWithCovariance(const IdPairVector& pairs, bool* from_marginals) const
+{
+	// Vertices that have not been optimized yet are unknown to the solver
+	JointCovarianceVector marginals;
+	bool has_marginals = false;
+	if(mSolver)
+	{
+		try
+		{
+			has_marginals = mSolver->getJointMarginals(pairs, marginals);
+		}catch(Solver::UnknownVertex &e)
+		{
+			mLogger->message(DEBUG, e.what());
+		}
+	}
+	if(!has_marginals)
+	{
+		mLogger->message(DEBUG, "No marginals available, relative poses have identity covariance.");
+	}
+	if(from_marginals)
+		*from_marginals = has_marginals;
+
+	std::vector<TransformWithCovariance> transforms;
+	transforms.reserve(pairs.size());
+	for(unsigned i = 0; i < pairs.size(); i++)
+	{
+		TransformWithCovariance twc;
+		twc.transform = getVertex(pairs[i].first).corrected_pose.inverse() * getVertex(pairs[i].second).corrected_pose;
+		if(has_marginals)
+		{
+			// The source's error is moved into the target frame by the adjoint
+			const Covariance<12>& joint = marginals[i];
+			Covariance<6> adj = TransformWithCovariance::adjoint(twc.transform.inverse());
+			Covariance<6> cross = adj * joint.topRightCorner<6,6>();
+			twc.covariance = adj * joint.topLeftCorner<6,6>() * adj.transpose()
+			               + joint.bottomRightCorner<6,6>() - cross - cross.transpose();
+		}
+		transforms.push_back(twc);
+	}
+	return transforms;
+}
+
 void Graph::buildNeighborIndex(const std::string& sensor)
 {
 	VertexObjectList vertices = getVerticesFromSensor(sensor);
@@ -260,15 +716,592 @@ VertexObjectList Graph::getNearbyVertices(const Transform &tf, float radius) con
 	std::vector<NeighborIndex::DistanceType>::iterator d = distances[0].begin();
 	for(; it < neighbors[0].end(); ++it, ++d)
 	{
-		result.push_back(getVertex(mNeighborMap.at(*it)));
-		mLogger->message(DEBUG, (boost::format(" - vertex %1% nearby (d = %2%)") % mNeighborMap.at(*it) % *d).str());
+		// Vertices might have been removed since the index was built
+		std::map<IdType, IdType>::const_iterator n = mNeighborMap.find(*it);
+		if(n == mNeighborMap.end())
+			continue;
+		result.push_back(getVertex(n->second));
+		mLogger->message(DEBUG, (boost::format(" - vertex %1% nearby (d = %2%)") % n->second % *d).str());
 	}
 	
 	mLogger->message(DEBUG, (boost::format("Neighbor search found %1% vertices nearby.") % found).str());
 	return result;
 }
 
+Graph::SpatialCell Graph::getSpatialCell(const Position& p) const
+{
+	SpatialCell c;
+	c.x = (int)std::floor(p[0] / mSpatialResolution);
+	c.y = (int)std::floor(p[1] / mSpatialResolution);
+	c.z = (int)std::floor(p[2] / mSpatialResolution);
+	return c;
+}
+
+void Graph::updateSpatialIndex(IdType id, const std::string& sensor, const Transform& pose)
+{
+	boost::unique_lock<boost::mutex> guard(mSpatialMutex);
+	SpatialIndex& si = mSpatialIndex[sensor];
+	Position position = pose.translation();
+	SpatialCell cell = getSpatialCell(position);
+	std::map<IdType, Position>::iterator p = si.positions.find(id);
+	if(p != si.positions.end())
+	{
+		SpatialCell old_cell = getSpatialCell(p->second);
+		p->second = position;
+		if(!(old_cell < cell) && !(cell < old_cell))
+			return;
+		std::vector<IdType>& ids = si.cells[old_cell];
+		ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+		if(ids.empty())
+			si.cells.erase(old_cell);
+	}else
+	{
+		si.positions.insert(std::map<IdType, Position>::value_type(id, position));
+	}
+	si.cells[cell].push_back(id);
+}
+
+void Graph::setSpatialIndexResolution(ScalarType size)
+{
+	boost::unique_lock<boost::mutex> guard(mSpatialMutex);
+	mSpatialResolution = size;
+	for(SpatialIndexMap::iterator si = mSpatialIndex.begin(); si != mSpatialIndex.end(); ++si)
+	{
+		si->second.cells.clear();
+		for(std::map<IdType, Position>::const_iterator p = si->second.positions.begin(); p != si->second.positions.end(); ++p)
+			si->second.cells[getSpatialCell(p->second)].push_back(p->first);
+	}
+}
+
+VertexObjectList Graph::getNearbyVertices(const std::string& sensor, const Transform &tf, float radius) const
+{
+	typedef std::pair<ScalarType, IdType> DistanceId;
+	std::vector<DistanceId> found;
+	Position center = tf.translation();
+	ScalarType max_dist = radius * radius;
+	{
+		boost::unique_lock<boost::mutex> guard(mSpatialMutex);
+		SpatialIndexMap::const_iterator si = mSpatialIndex.find(sensor);
+		if(si != mSpatialIndex.end())
+		{
+			SpatialCell lo = getSpatialCell(center - Position::Constant(radius));
+			SpatialCell hi = getSpatialCell(center + Position::Constant(radius));
+			double cells = (double)(hi.x - lo.x + 1) * (hi.y - lo.y + 1) * (hi.z - lo.z + 1);
+			if(cells > si->second.positions.size())
+			{
+				// Large radius, checking every vertex is cheaper
+				for(std::map<IdType, Position>::const_iterator p = si->second.positions.begin(); p != si->second.positions.end(); ++p)
+				{
+					ScalarType d = (p->second - center).squaredNorm();
+					if(d <= max_dist)
+						found.push_back(DistanceId(d, p->first));
+				}
+			}else
+			{
+				SpatialCell c;
+				for(c.x = lo.x; c.x <= hi.x; c.x++)
+				for(c.y = lo.y; c.y <= hi.y; c.y++)
+				for(c.z = lo.z; c.z <= hi.z; c.z++)
+				{
+					std::map<SpatialCell, std::vector<IdType> >::const_iterator cell = si->second.cells.find(c);
+					if(cell == si->second.cells.end())
+						continue;
+					for(std::vector<IdType>::const_iterator id = cell->second.begin(); id != cell->second.end(); ++id)
+					{
+						ScalarType d = (si->second.positions.at(*id) - center).squaredNorm();
+						if(d <= max_dist)
+							found.push_back(DistanceId(d, *id));
+					}
+				}
+			}
+		}
+	}
+
+	// Vertices might be removed concurrently
+	std::sort(found.begin(), found.end());
+	VertexObjectList result;
+	for(std::vector<DistanceId>::const_iterator f = found.begin(); f != found.end(); ++f)
+	{
+		try
+		{
+			result.push_back(getVertex(f->second));
+		}catch(std::out_of_range &e)
+		{
+		}catch(InvalidVertex &e)
+		{
+		}
+	}
+	return result;
+}
+
 void Graph::setCorrectedPose(IdType id, const Transform& pose)
 {
-	getVertexInternal(id).corrected_pose = pose;
+	VertexObject& vertex = getVertexInternal(id);
+	vertex.corrected_pose = pose;
+	updateTrajectory(id, vertex.measurement->getSensorName(), pose);
+	updateSpatialIndex(id, vertex.measurement->getSensorName(), pose);
+}
+
+// ==============================================
+// Trajectory export
+// ==============================================
+
+void Graph::updateTrajectory(IdType id, const std::string& sensor, const Transform& pose)
+{
+	boost::unique_lock<boost::mutex> guard(mTrajectoryMutex);
+	TrajectoryMap::iterator t = mTrajectories.find(sensor);
+	if(t == mTrajectories.end())
+		return;
+	std::vector<IdType>::iterator row = std::lower_bound(t->second.ids.begin(), t->second.ids.end(), id);
+	if(row == t->second.ids.end() || *row != id)
+		return;
+
+	// Unchanged poses keep their revision, so deltas only contain actual changes
+	size_t r = row - t->second.ids.begin();
+	Eigen::Quaternion<ScalarType> q(pose.linear());
+	ScalarType* translation = &t->second.translations[3 * r];
+	ScalarType* rotation = &t->second.rotations[4 * r];
+	if(memcmp(translation, pose.translation().data(), 3 * sizeof(ScalarType)) == 0 &&
+	   memcmp(rotation, q.coeffs().data(), 4 * sizeof(ScalarType)) == 0)
+		return;
+
+	// The change becomes part of the next revision at the latest
+	memcpy(translation, pose.translation().data(), 3 * sizeof(ScalarType));
+	memcpy(rotation, q.coeffs().data(), 4 * sizeof(ScalarType));
+	t->second.revisions[r] = mRevision + 1;
+}
+
+size_t Graph::exportRows(const Trajectory& t, size_t begin, size_t end, IdType* ids, timeval* stamps,
+                         ScalarType* translations, ScalarType* rotations, size_t offset)
+{
+	size_t n = end - begin;
+	if(ids)
+		memcpy(ids + offset, &t.ids[begin], n * sizeof(IdType));
+	if(stamps)
+		memcpy(stamps + offset, &t.stamps[begin], n * sizeof(timeval));
+	if(translations)
+		memcpy(translations + 3 * offset, &t.translations[3 * begin], 3 * n * sizeof(ScalarType));
+	if(rotations)
+		memcpy(rotations + 4 * offset, &t.rotations[4 * begin], 4 * n * sizeof(ScalarType));
+	return n;
+}
+
+size_t Graph::exportTrajectory(IdType* ids, timeval* stamps,
+                               ScalarType* translations, ScalarType* rotations,
+                               size_t capacity, const std::string& sensor,
+                               RevisionType since) const
+{
+	boost::unique_lock<boost::mutex> guard(mTrajectoryMutex);
+	size_t found = 0;
+	size_t written = 0;
+	for(TrajectoryMap::const_iterator t = mTrajectories.begin(); t != mTrajectories.end(); ++t)
+	{
+		if(!sensor.empty() && t->first != sensor)
+			continue;
+
+		// Copy consecutive runs of changed rows at once
+		const std::vector<RevisionType>& revisions = t->second.revisions;
+		size_t rows = revisions.size();
+		size_t r = 0;
+		while(r < rows)
+		{
+			while(r < rows && revisions[r] <= since)
+				r++;
+			size_t begin = r;
+			while(r < rows && revisions[r] > since)
+				r++;
+			found += r - begin;
+			size_t end = std::min(r, begin + (capacity - written));
+			if(end > begin)
+				written += exportRows(t->second, begin, end, ids, stamps, translations, rotations, written);
+		}
+	}
+	return found;
+}
+
+size_t Graph::exportRemovals(IdType* ids, size_t capacity, const std::string& sensor, RevisionType since) const
+{
+	boost::unique_lock<boost::mutex> guard(mJournalMutex);
+	size_t found = 0;
+	Journal::const_iterator r = std::upper_bound(mRemovalJournal.begin(), mRemovalJournal.end(), since, revisionLess);
+	for(; r != mRemovalJournal.end(); ++r)
+	{
+		if(!sensor.empty() && r->sensor != sensor)
+			continue;
+		if(ids && found < capacity)
+			ids[found] = r->vertex;
+		found++;
+	}
+	return found;
+}
+
+// ==============================================
+// Sparsification
+// ==============================================
+
+static bool indexLess(const VertexObject& a, const VertexObject& b)
+{
+	return a.index < b.index;
+}
+
+unsigned Graph::marginalize(const VertexObject& vertex, const EdgeObjectList& edges, const std::string& sensor)
+{
+	// Get the most certain relative pose from the vertex to each neighbor
+	typedef std::map<IdType, TransformWithCovariance> NeighborPoses;
+	NeighborPoses neighbors;
+	for(EdgeObjectList::const_iterator e = edges.begin(); e != edges.end(); ++e)
+	{
+		const TransformWithCovariance& twc = boost::static_pointer_cast<SE3Constraint>(e->constraint)->getRelativePose();
+		IdType other;
+		TransformWithCovariance rel;
+		if(e->source == vertex.index)
+		{
+			other = e->target;
+			rel = twc;
+		}else
+		{
+			other = e->source;
+			rel = twc.inverse();
+		}
+		NeighborPoses::iterator n = neighbors.find(other);
+		if(n == neighbors.end() || rel.covariance.trace() < n->second.covariance.trace())
+			neighbors[other] = rel;
+	}
+	if(neighbors.size() < 2)
+		return 0;
+
+	// Root the tree at the neighbor with the most certain constraint
+	NeighborPoses::const_iterator root = neighbors.begin();
+	for(NeighborPoses::const_iterator n = neighbors.begin(); n != neighbors.end(); ++n)
+	{
+		if(n->second.covariance.trace() < root->second.covariance.trace())
+			root = n;
+	}
+
+	// The constraint to the root is part of all new constraints. They are treated
+	// as independent, so its covariance is scaled to not become overconfident.
+	TransformWithCovariance root_to_vertex = root->second.inverse();
+	root_to_vertex.covariance *= (neighbors.size() - 1);
+
+	unsigned created = 0;
+	for(NeighborPoses::const_iterator n = neighbors.begin(); n != neighbors.end(); ++n)
+	{
+		if(n == root)
+			continue;
+		try
+		{
+			getEdge(root->first, n->first, sensor);
+			continue;
+		}catch(InvalidEdge &e)
+		{
+		}
+
+		TransformWithCovariance twc = root_to_vertex * n->second;
+		twc.transform = orthogonalize(twc.transform);
+		addConstraint(root->first, n->first, SE3Constraint::create(sensor, twc));
+		created++;
+	}
+	return created;
+}
+
+unsigned Graph::sparsify(const std::string& sensor, ScalarType distance, ScalarType angle, unsigned keep)
+{
+	VertexObjectList vertices = getVerticesFromSensor(sensor);
+	if(vertices.size() <= keep)
+		return 0;
+	std::sort(vertices.begin(), vertices.end(), indexLess);
+
+	// Do not optimize while the graph is changed
+	unsigned rate = mOptimizationRate;
+	mOptimizationRate = 0;
+
+	unsigned removed = 0, created = 0;
+	for(VertexObjectList::const_iterator v = vertices.begin(); v < vertices.end() - keep; ++v)
+	{
+		if(mFixedVertices.find(v->index) != mFixedVertices.end())
+			continue;
+
+		// Only vertices with SE3 constraints can be marginalized
+		EdgeObjectList edges = getOutEdges(v->index);
+		bool removable = !edges.empty();
+		bool redundant = false;
+		for(EdgeObjectList::const_iterator e = edges.begin(); e != edges.end() && removable; ++e)
+		{
+			if(e->constraint->getType() != SE3)
+			{
+				removable = false;
+				break;
+			}
+			const VertexObject& n = getVertex(e->source == v->index ? e->target : e->source);
+			if(n.measurement->getSensorName() != sensor)
+				continue;
+			Transform diff = v->corrected_pose.inverse() * n.corrected_pose;
+			if(diff.translation().norm() <= distance && Eigen::AngleAxis<ScalarType>(diff.rotation()).angle() <= angle)
+				redundant = true;
+		}
+		if(!removable || !redundant)
+			continue;
+
+		created += marginalize(*v, edges, sensor);
+		removeVertex(v->index);
+		removed++;
+	}
+
+	mOptimizationRate = rate;
+	mLogger->message(INFO, (boost::format("Sparsification removed %1% vertices from %2% and created %3% constraints.")
+		% removed % sensor % created).str());
+	return removed;
+}
+
+// ==============================================
+// Delta synchronization
+// ==============================================
+
+void Graph::journalEdge(IdType source, IdType target, const std::string& sensor, Constraint::Ptr constraint, bool replace)
+{
+	boost::unique_lock<boost::mutex> guard(mJournalMutex);
+	JournalEntry entry;
+	entry.revision = ++mRevision;
+	entry.vertex = 0;
+	entry.source = getUniqueId(source);
+	entry.target = getUniqueId(target);
+	entry.sensor = sensor;
+	entry.constraint = constraint;
+	entry.replace = replace;
+	mEdgeJournal.push_back(entry);
+}
+
+boost::uuids::uuid Graph::getUniqueId(IdType id) const
+{
+	if(id == 0)
+		return boost::uuids::nil_uuid();
+	return getVertex(id).measurement->getUniqueId();
+}
+
+void Graph::setMeasurementCodec(const std::string& sensor, MeasurementCodec* codec, bool compress)
+{
+	CodecEntry entry;
+	entry.codec = codec;
+	entry.compress = compress;
+	mCodecs[sensor] = entry;
+}
+
+RevisionType Graph::writeDelta(std::ostream& out, RevisionType since)
+{
+	// Copy the changes, so they are encoded without blocking the graph
+	RevisionType revision;
+	Journal new_vertices, new_edges, new_removals;
+	{
+		boost::unique_lock<boost::mutex> guard(mJournalMutex);
+		revision = mRevision;
+		new_vertices.assign(std::upper_bound(mVertexJournal.begin(), mVertexJournal.end(), since, revisionLess), mVertexJournal.end());
+		new_edges.assign(std::upper_bound(mEdgeJournal.begin(), mEdgeJournal.end(), since, revisionLess), mEdgeJournal.end());
+		new_removals.assign(std::upper_bound(mRemovalJournal.begin(), mRemovalJournal.end(), since, revisionLess), mRemovalJournal.end());
+	}
+
+	DeltaWriter writer(out, since, revision);
+	unsigned vertices = 0, edges = 0, removals = 0, poses = 0;
+
+	// Vertices added after the given revision, skipping those removed in the meantime
+	for(Journal::const_iterator v = new_vertices.begin(); v != new_vertices.end(); ++v)
+	{
+		if(v->source.is_nil())
+			continue;
+		VertexObject vo;
+		try
+		{
+			vo = getVertex(v->vertex);
+		}catch(std::out_of_range &e)
+		{
+			continue;
+		}
+		CodecMap::const_iterator c = mCodecs.find(vo.measurement->getSensorName());
+		if(c != mCodecs.end())
+			writer.writeVertex(vo, c->second.codec, c->second.compress);
+		else
+			writer.writeVertex(vo, NULL, false);
+		vertices++;
+	}
+
+	// Constraints added or removed after the given revision
+	for(Journal::const_iterator e = new_edges.begin(); e != new_edges.end(); ++e)
+	{
+		if(e->constraint)
+			writer.writeConstraint(e->source, e->target, e->constraint, e->replace);
+		else
+			writer.writeConstraintRemoval(e->source, e->target, e->sensor);
+		edges++;
+	}
+
+	// Vertices removed after the given revision
+	for(Journal::const_iterator r = new_removals.begin(); r != new_removals.end(); ++r)
+	{
+		writer.writeVertexRemoval(r->source);
+		removals++;
+	}
+
+	// Corrected poses that changed after the given revision, new vertices already contain theirs
+	size_t count = exportTrajectory(NULL, NULL, NULL, NULL, 0, "", since);
+	std::vector<IdType> ids(count);
+	std::vector<ScalarType> translations(3 * count);
+	std::vector<ScalarType> rotations(4 * count);
+	if(count > 0)
+		count = std::min(count, exportTrajectory(&ids[0], NULL, &translations[0], &rotations[0], count, "", since));
+	IdType first_new = new_vertices.empty() ? std::numeric_limits<IdType>::max() : new_vertices.front().vertex;
+	for(size_t i = 0; i < count; i++)
+	{
+		if(ids[i] >= first_new)
+			continue;
+		boost::uuids::uuid id;
+		try
+		{
+			id = getUniqueId(ids[i]);
+		}catch(std::out_of_range &e)
+		{
+			continue;
+		}
+		Transform pose = Transform::Identity();
+		pose.translation() = Eigen::Map<const Position>(&translations[3 * i]);
+		pose.linear() = Eigen::Map<const Eigen::Quaternion<ScalarType> >(&rotations[4 * i]).toRotationMatrix();
+		writer.writePose(id, pose);
+		poses++;
+	}
+
+	writer.finish();
+	mLogger->message(DEBUG, (boost::format("Wrote delta (%1%, %2%] with %3% vertices, %4% constraints, %5% removals and %6% poses.")
+		% since % revision % vertices % edges % removals % poses).str());
+	return revision;
+}
+
+RevisionType Graph::applyDelta(std::istream& in)
+{
+	DeltaReader reader(in);
+	DeltaVertex dv;
+	DeltaConstraint dc;
+	DeltaPose dp;
+	unsigned vertices = 0, edges = 0, removals = 0, poses = 0, skipped = 0;
+
+	// Suspend the automatic optimization while applying the delta
+	unsigned rate = mOptimizationRate;
+	mOptimizationRate = 0;
+	try
+	{
+		DeltaRecordType type;
+		while((type = reader.next()) != DELTA_END)
+		{
+			switch(type)
+			{
+			case DELTA_VERTEX:
+			{
+				reader.readVertex(dv);
+				if(hasMeasurement(dv.id))
+				{
+					skipped++;
+					break;
+				}
+				Measurement::Ptr m;
+				CodecMap::const_iterator c = mCodecs.find(dv.sensor);
+				if(dv.has_payload && c != mCodecs.end())
+				{
+					std::istringstream payload(dv.payload);
+					m = c->second.codec->decode(payload, dv.robot, dv.sensor, dv.sensor_pose, dv.id, dv.stamp);
+				}else
+				{
+					m = allocatePooled<Measurement>(dv.robot, dv.sensor, dv.sensor_pose, dv.id, dv.stamp);
+				}
+				addVertex(m, dv.corrected_pose);
+				vertices++;
+				break;
+			}
+			case DELTA_CONSTRAINT:
+			case DELTA_REPLACE_CONSTRAINT:
+			case DELTA_REMOVE_CONSTRAINT:
+			{
+				if(type == DELTA_REMOVE_CONSTRAINT)
+					reader.readConstraintRemoval(dc);
+				else
+					reader.readConstraint(dc);
+
+				if(!hasMeasurement(dc.source) || !(dc.target.is_nil() || hasMeasurement(dc.target)))
+				{
+					mLogger->message(DEBUG, "Delta contains a constraint to an unknown vertex, it will be ignored.");
+					skipped++;
+					break;
+				}
+				IdType source = getIndex(dc.source);
+				IdType target = dc.target.is_nil() ? 0 : getIndex(dc.target);
+
+				if(type == DELTA_REMOVE_CONSTRAINT)
+				{
+					try
+					{
+						removeConstraint(source, target, dc.sensor);
+						edges++;
+					}catch(InvalidEdge &ie)
+					{
+						skipped++;
+					}
+					break;
+				}
+
+				// Replacements (e.g. a loop closure for a tentative edge) overwrite
+				// the existing constraint, plain additions of known edges are skipped.
+				if(target != 0)
+				{
+					try
+					{
+						EdgeObject& eo = getEdgeInternal(source, target, dc.sensor);
+						if(type == DELTA_REPLACE_CONSTRAINT)
+						{
+							eo.constraint = dc.constraint;
+							journalEdge(source, target, dc.sensor, dc.constraint, true);
+							addToSolver(eo);
+							edges++;
+						}else
+						{
+							skipped++;
+						}
+						break;
+					}catch(InvalidEdge &ie){}
+				}
+				addConstraint(source, target, dc.constraint);
+				edges++;
+				break;
+			}
+			case DELTA_REMOVE_VERTEX:
+				reader.readVertexRemoval(dp);
+				if(hasMeasurement(dp.id))
+				{
+					removeVertex(getIndex(dp.id));
+					removals++;
+				}else
+				{
+					skipped++;
+				}
+				break;
+			case DELTA_POSE:
+				reader.readPose(dp);
+				if(hasMeasurement(dp.id))
+				{
+					setCorrectedPose(getIndex(dp.id), dp.pose);
+					poses++;
+				}else
+				{
+					skipped++;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}catch(...)
+	{
+		mOptimizationRate = rate;
+		throw;
+	}
+	mOptimizationRate = rate;
+
+	mLogger->message(INFO, (boost::format("Applied delta (%1%, %2%] with %3% vertices, %4% constraints, %5% removals and %6% poses (%7% records skipped).")
+		% reader.getSince() % reader.getUntil() % vertices % edges % removals % poses % skipped).str());
+	return reader.getUntil();
 }
@@ -77,9 +77,13 @@ laser->addMeasurement(m);
 
 #include "PoseSensor.hpp"
 #include "Solver.hpp"
+#include "DeltaStream.hpp"
 
 #include <flann/flann.hpp>
+#include <boost/thread/mutex.hpp>
+#include <atomic>
 #include <map>
+#include <set>
 
 namespace slam3d
 {
@@ -215,7 +219,7 @@ namespace slam3d
 		 * @param target_id
 		 * @param sensor
 		 */
-		void addTentativeConstraint(IdType source_id, IdType target_id, std::string& sensor);
+		void addTentativeConstraint(IdType source_id, IdType target_id, const std::string& sensor);
 
 		/**
 		 * @brief Add a constraint (edge) between two vertices in the graph.
@@ -237,10 +241,60 @@ namespace slam3d
 		                               IdType target,
 		                               Constraint::Ptr constraint);
 
+		/**
+		 * @brief Collect loop closures and only add a consistent subset to the solver.
+		 * @details When enabled, SE3 constraints that replace a tentative
+		 * constraint (see ScanSensor::link) are held back until the given number
+		 * of candidates has been collected. Then commitLoopClosures() is called.
+		 * @param size number of candidates to collect, 0 to disable the buffer
+		 * @param threshold maximum chi2 error of the cycle formed by two consistent loop closures
+		 * @param min_consistent minimum number of consistent loop closures to commit them
+		 */
+		void setLoopClosureBuffer(unsigned size, ScalarType threshold, unsigned min_consistent = 2);
+
+		/**
+		 * @brief Commit the largest set of pairwise consistent loop closures from the buffer.
+		 * @details Two loop closures are consistent, if the cycle formed by them
+		 * and the current relative poses between their end points is close to the
+		 * identity, measured by the Mahalanobis distance. The largest set of
+		 * mutually consistent loop closures is the maximum clique of these pairs.
+		 * It is only committed if it has enough members. The tentative constraints
+		 * of all other candidates are removed from the graph, so the vertices can be
+		 * linked again later. The graph is optimized once afterwards.
+		 * @return number of committed loop closures
+		 */
+		unsigned commitLoopClosures();
+
 		virtual void removeConstraint(IdType source,
 		                              IdType target,
 		                              const std::string& sensor);
 
+		/**
+		 * @brief Remove a vertex together with all its constraints.
+		 * @details The vertex is removed from the graph, the solver and the
+		 * neighbor index. Constraints between the remaining vertices are not
+		 * changed, see sparsify() to keep the graph connected.
+		 * @param id vertex to be removed
+		 * @throw InvalidVertex
+		 */
+		void removeVertex(IdType id);
+
+		/**
+		 * @brief Remove redundant vertices of the given sensor.
+		 * @details A vertex is redundant, if it is connected to another vertex
+		 * of the same sensor whose pose differs less than the given thresholds.
+		 * Its SE3 constraints are replaced by a tree of constraints between its
+		 * former neighbors, that is rooted at the neighbor with the most
+		 * certain constraint. Fixed vertices, vertices with other constraint
+		 * types and the most recent vertices are never removed.
+		 * @param sensor remove vertices from this sensor
+		 * @param distance maximum translation to a redundant vertex' neighbor
+		 * @param angle maximum rotation (in rad) to a redundant vertex' neighbor
+		 * @param keep number of most recent vertices that are not considered
+		 * @return number of removed vertices
+		 */
+		unsigned sparsify(const std::string& sensor, ScalarType distance, ScalarType angle, unsigned keep = 10);
+
 		/**
 		 * @brief Set the corrected pose for the vertex with the given ID.
 		 * @details This method is designed to be used by Sensor and PoseSensor
@@ -260,6 +314,30 @@ namespace slam3d
 		 * @return true if optimization was successful
 		 */
 		virtual bool optimize(unsigned iterations = 100);
+
+		/**
+		 * @brief Add a batch of constraints only if they are consistent with the graph.
+		 * @details A checkpoint is created in the solver before the constraints
+		 * are added and the graph is optimized. If the error of any of the new
+		 * constraints exceeds the threshold afterwards, the constraints are
+		 * removed again and the previous poses are restored by a rollback.
+		 * This is meant for loop closures and requires a Solver that supports
+		 * checkpoints.
+		 * @param constraints edges to be added
+		 * @param threshold maximum error (see getResidual) of each new constraint
+		 * @param iterations maximum number of iteration steps
+		 * @return true if the constraints have been added
+		 */
+		bool addConstraintsChecked(const EdgeObjectList& constraints, ScalarType threshold, unsigned iterations = 100);
+
+		/**
+		 * @brief Get the error of a constraint with the current corrected poses.
+		 * @details The error is the squared Mahalanobis distance, using the same
+		 * error functions as the G2oSolver. Tentative constraints have no error.
+		 * @param edge
+		 * @throw InvalidVertex
+		 */
+		ScalarType getResidual(const EdgeObject& edge) const;
 		
 		/**
 		 * @brief Returns whether optimize() has been called since the last call to this.
@@ -297,6 +375,27 @@ namespace slam3d
 		 */
 		VertexObjectList getNearbyVertices(const Transform &tf, float radius) const;
 
+		/**
+		 * @brief Search for vertices of a sensor near the given pose.
+		 * @details In contrast to the method above, this uses a spatial hash
+		 * of the corrected poses that is updated with every added, moved or
+		 * removed vertex. It does not have to be rebuilt and can be used
+		 * concurrently with modifications of the graph. The cost depends on
+		 * the number of grid cells within the radius, not on the graph size.
+		 * @param sensor only vertices from this sensor are returned
+		 * @param tf The pose where to search for nodes
+		 * @param radius The radius within nodes should be returned
+		 * @return list of spatially near vertices, sorted by distance
+		 */
+		VertexObjectList getNearbyVertices(const std::string& sensor, const Transform &tf, float radius) const;
+
+		/**
+		 * @brief Set the cell size of the spatial hash used by getNearbyVertices.
+		 * @details It should be in the order of the search radius.
+		 * @param size edge length of a grid cell
+		 */
+		void setSpatialIndexResolution(ScalarType size);
+
 		/**
 		 * @brief Gets the index of the vertex with the given Measurement
 		 * @param id uuid of a measurement
@@ -308,16 +407,16 @@ namespace slam3d
 		 * vertex upon creation and then never changed. These id's are local and
 		 * cannot be compared between different agents in a distributed setup.
 		 * @param id identifier for a vertex
-		 * @return constant reference to a vertex
+		 * @return copy of the vertex, so it stays valid when the graph changes
 		 */
-		virtual const VertexObject& getVertex(IdType id) const = 0;
+		virtual VertexObject getVertex(IdType id) const = 0;
 
 		/**
 		 * @brief Gets a vertex by the uuid of the attached Measurement.
 		 * @param id uuid of a measurement
-		 * @return constant reference to a vertex
+		 * @return copy of the vertex
 		 */
-		const VertexObject& getVertex(boost::uuids::uuid id) const;
+		VertexObject getVertex(boost::uuids::uuid id) const;
 
 		/**
 		 * @brief Check if the measurement with this id is stored in the graph.
@@ -327,19 +426,42 @@ namespace slam3d
 
 		/**
 		 * @brief Get the transformation between source and target node.
+		 * @details Only the relative pose is calculated from the corrected poses,
+		 * the covariance is the identity. Use getTransformWithCovariance, if the
+		 * uncertainty is required.
 		 * @param source
 		 * @param target
 		 */
 		TransformWithCovariance getTransform(IdType source, IdType target) const;
 
+		/**
+		 * @brief Get the transformation between source and target node with its uncertainty.
+		 * @details The covariance of the relative pose is calculated from the
+		 * joint marginals of both vertices, if the solver provides them (see
+		 * Solver::getJointMarginals). Otherwise it is the identity.
+		 * @param source
+		 * @param target
+		 */
+		TransformWithCovariance getTransformWithCovariance(IdType source, IdType target) const;
+
+		/**
+		 * @brief Get the transformations with covariance for many pairs of nodes at once.
+		 * @details This is much faster than calling getTransformWithCovariance()
+		 * for each pair, as all marginals are recovered from the solver at once.
+		 * @param pairs source and target of each transformation
+		 * @param from_marginals set to whether the covariances come from the solver (optional)
+		 */
+		std::vector<TransformWithCovariance> getTransformsWithCovariance(const IdPairVector& pairs, bool* from_marginals = NULL) const;
+
 		/**
 		 * @brief Get the edge between source and traget from the given sensor.
 		 * @param source
 		 * @param target
 		 * @param sensor
+		 * @return copy of the edge, so it stays valid when the graph changes
 		 * @throw InvalidVertex, InvalidEdge
 		 */
-		virtual const EdgeObject& getEdge(IdType source, IdType target, const std::string& sensor) const = 0;
+		virtual EdgeObject getEdge(IdType source, IdType target, const std::string& sensor) const = 0;
 
 		/**
 		 * @brief Get all outgoing edges from given source.
@@ -383,6 +505,88 @@ namespace slam3d
 		 */
 		virtual float calculateGraphDistance(IdType source, IdType target) = 0;
 
+		/**
+		 * @brief Register a codec to transmit measurements of a sensor within delta streams.
+		 * @details Measurements of sensors without a codec are transmitted
+		 * without their sensor specific data. The graph does not take
+		 * ownership of the codec.
+		 * @param sensor name of the sensor
+		 * @param codec used to encode and decode the measurements
+		 * @param compress whether to compress the encoded measurements
+		 */
+		void setMeasurementCodec(const std::string& sensor, MeasurementCodec* codec, bool compress = false);
+
+		/**
+		 * @brief Get the current revision of the graph.
+		 * @details The revision is increased whenever a vertex or constraint
+		 * is added or removed and after each optimization. It can be called
+		 * from any thread.
+		 * @return current revision
+		 */
+		RevisionType getRevision() const { return mRevision; }
+
+		/**
+		 * @brief Copy the corrected poses of the vertices into contiguous arrays.
+		 * @details The graph keeps the poses in the same layout, so the arrays
+		 * are filled with a few memcpy calls. The poses of each sensor are
+		 * ordered by vertex id, multiple sensors are ordered by their name.
+		 * Any of the arrays may be NULL to skip it. Pass a capacity of 0 to
+		 * get the number of poses without copying.
+		 * @param ids vertex ids, one per pose
+		 * @param stamps timestamps of the measurements, one per pose
+		 * @param translations x, y, z of each pose
+		 * @param rotations quaternion x, y, z, w of each pose (as Eigen's coeffs)
+		 * @param capacity maximum number of poses to copy
+		 * @param sensor only export vertices of this sensor, all if empty
+		 * @param since only export poses that changed after this revision,
+		 * which may include some that did not change. Vertices removed in the
+		 * meantime are not part of the result, see exportRemovals.
+		 * @return number of poses that match, which may exceed capacity
+		 */
+		size_t exportTrajectory(IdType* ids, timeval* stamps,
+		                        ScalarType* translations, ScalarType* rotations,
+		                        size_t capacity, const std::string& sensor = "",
+		                        RevisionType since = 0) const;
+
+		/**
+		 * @brief Copy the ids of the vertices removed after a revision.
+		 * @details Together with exportTrajectory, this keeps a copy of the
+		 * trajectory up to date: apply the removals and then the changed poses
+		 * since the revision of the previous export. Ids are ordered by the
+		 * time of their removal.
+		 * @param ids removed vertex ids, may be NULL
+		 * @param capacity maximum number of ids to copy
+		 * @param sensor only export vertices of this sensor, all if empty
+		 * @param since only export vertices removed after this revision
+		 * @return number of removed vertices, which may exceed capacity
+		 */
+		size_t exportRemovals(IdType* ids, size_t capacity, const std::string& sensor = "",
+		                      RevisionType since = 0) const;
+
+		/**
+		 * @brief Write all changes since the given revision to a delta stream.
+		 * @details The delta contains all vertices and constraints added or
+		 * removed after revision since, followed by the corrected poses of the
+		 * previously sent vertices that changed in the meantime. The changes
+		 * are copied from the journal first, so encoding them does not block
+		 * other threads that modify the graph. Passing 0 writes the complete graph.
+		 * @param out stream to write the delta to
+		 * @param since last revision known to the receiver
+		 * @return revision of the graph covered by this delta
+		 */
+		RevisionType writeDelta(std::ostream& out, RevisionType since = 0);
+
+		/**
+		 * @brief Apply all changes from a delta stream to this graph.
+		 * @details Vertices that are already in the graph are skipped, so the
+		 * same delta can be applied multiple times. The automatic optimization
+		 * is suspended until the complete delta has been applied.
+		 * @param in stream to read the delta from
+		 * @return revision of the sending graph covered by this delta
+		 * @throw BadDeltaStream
+		 */
+		RevisionType applyDelta(std::istream& in);
+
 	protected:
 		// Graph access
 		/**
@@ -409,6 +613,15 @@ namespace slam3d
 		 */
 		virtual void removeEdge(IdType source, IdType target, const std::string& sensor) = 0;
 
+		/**
+		 * @brief Remove the vertex and all its edges from the actual graph.
+		 * @details This method has to be implemented by the specification class.
+		 * It should not be used directly, but is used internally.
+		 * @param id
+		 * @throw InvalidVertex
+		 */
+		virtual void deleteVertex(IdType id) = 0;
+
 		/**
 		 * @brief Get a writable reference to a VertexObject.
 		 * @param id
@@ -431,6 +644,12 @@ namespace slam3d
 		 */
 		virtual void addToSolver(const EdgeObject& eo);
 
+		/**
+		 * @brief Set the corrected poses of all vertices in the list.
+		 * @param corrections
+		 */
+		void applyCorrections(const IdPoseVector& corrections);
+
 		/**
 		 * @brief Re-orthogonalize the rotation-matrix
 		 * @param t input tranform
@@ -438,6 +657,46 @@ namespace slam3d
 		 */
 		static Transform orthogonalize(const Transform& t);
 
+		/**
+		 * @brief Replace the SE3 constraints of a vertex by constraints between its neighbors.
+		 * @param vertex the vertex to be marginalized
+		 * @param edges all edges of the vertex
+		 * @param sensor name for the new constraints
+		 * @return number of created constraints
+		 */
+		unsigned marginalize(const VertexObject& vertex, const EdgeObjectList& edges, const std::string& sensor);
+
+		/**
+		 * @brief Record a change of an edge for delta streams.
+		 * @param source
+		 * @param target
+		 * @param sensor
+		 * @param constraint the added constraint, empty if the edge has been removed
+		 */
+		void journalEdge(IdType source, IdType target, const std::string& sensor, Constraint::Ptr constraint, bool replace = false);
+
+		/**
+		 * @brief Get the uuid of the measurement of a vertex (nil for 0).
+		 * @param id
+		 */
+		boost::uuids::uuid getUniqueId(IdType id) const;
+
+		/**
+		 * @brief Update the pose of a vertex in the trajectory table.
+		 * @param id
+		 * @param sensor
+		 * @param pose
+		 */
+		void updateTrajectory(IdType id, const std::string& sensor, const Transform& pose);
+
+		/**
+		 * @brief Insert or move a vertex in the spatial hash.
+		 * @param id
+		 * @param sensor
+		 * @param pose
+		 */
+		void updateSpatialIndex(IdType id, const std::string& sensor, const Transform& pose);
+
 	protected:
 		Solver* mSolver;
 		Logger* mLogger;
@@ -455,6 +714,83 @@ namespace slam3d
 		NeighborIndex mNeighborIndex;
 		std::map<IdType, IdType> mNeighborMap; // vertex-id --> neighbor-id
 
+		// Spatial hash of the vertex positions of each sensor, which
+		// is kept up to date for the incremental getNearbyVertices.
+		struct SpatialCell
+		{
+			int x, y, z;
+			bool operator<(const SpatialCell& o) const
+			{
+				return x < o.x || (x == o.x && (y < o.y || (y == o.y && z < o.z)));
+			}
+		};
+		struct SpatialIndex
+		{
+			std::map<SpatialCell, std::vector<IdType> > cells;
+			std::map<IdType, Position> positions;
+		};
+		typedef std::map<std::string, SpatialIndex> SpatialIndexMap;
+		SpatialCell getSpatialCell(const Position& p) const;
+		SpatialIndexMap mSpatialIndex;
+		ScalarType mSpatialResolution;
+		mutable boost::mutex mSpatialMutex;
+
+		// Journal of changes to create delta streams
+		// Vertices are referenced by their uuid, as they might be removed later.
+		struct JournalEntry
+		{
+			JournalEntry() : revision(0), vertex(0), replace(false) {}
+			RevisionType revision;
+			IdType vertex;
+			boost::uuids::uuid source; // nil if the vertex has been removed
+			boost::uuids::uuid target;
+			std::string sensor;
+			Constraint::Ptr constraint;
+			bool replace; // constraint replaces an existing one
+		};
+		typedef std::vector<JournalEntry> Journal;
+		static bool revisionLess(RevisionType rev, const JournalEntry& entry) { return rev < entry.revision; }
+		static bool vertexLess(const JournalEntry& entry, IdType id) { return entry.vertex < id; }
+		Journal mVertexJournal;
+		Journal mEdgeJournal;
+		Journal mRemovalJournal;
+		std::atomic<RevisionType> mRevision; // read without mJournalMutex by getRevision
+		mutable boost::mutex mJournalMutex;
+
+		// Corrected poses of each sensor as structure of arrays for
+		// exportTrajectory, the rows are sorted by vertex id.
+		struct Trajectory
+		{
+			std::vector<IdType> ids;
+			std::vector<timeval> stamps;
+			std::vector<ScalarType> translations;
+			std::vector<ScalarType> rotations;
+			std::vector<RevisionType> revisions;
+		};
+		typedef std::map<std::string, Trajectory> TrajectoryMap;
+		static size_t exportRows(const Trajectory& t, size_t begin, size_t end, IdType* ids, timeval* stamps,
+		                         ScalarType* translations, ScalarType* rotations, size_t offset);
+		TrajectoryMap mTrajectories;
+		mutable boost::mutex mTrajectoryMutex;
+
+		struct CodecEntry
+		{
+			MeasurementCodec* codec;
+			bool compress;
+		};
+		typedef std::map<std::string, CodecEntry> CodecMap;
+		CodecMap mCodecs;
+
+		// Vertices that have been fixed in the solver
+		std::set<IdType> mFixedVertices;
+
+		// Loop closures waiting for the consistency check
+		EdgeObjectList mLoopBuffer;
+		unsigned mLoopBufferSize;
+		ScalarType mLoopThreshold;
+		unsigned mMinConsistentLoops;
+		boost::mutex mLoopMutex;
+
 		// Parameters
 		bool mFixNext;
 		bool mOptimized;
@@ -1,5 +1,12 @@
 #include <slam3d/core/Graph.hpp>
+#include <slam3d/core/Mapper.hpp>
+#include <slam3d/core/ScanSensor.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/stream.hpp>
+
+#include <unistd.h>
+#include <sstream>
 
 #include <boost/test/unit_test.hpp>
 
@@ -41,4 +48,384 @@ void test_graph_construction(slam3d::Graph* graph)
 	BOOST_CHECK_EQUAL(s1_edges.size(), 1);
 	BOOST_CHECK_EQUAL(s1_edges.at(0).source, 1);
 	BOOST_CHECK_EQUAL(s1_edges.at(0).target, 2);
+
+	// Relative poses, without a solver there are no marginals
+	slam3d::Transform pose(Eigen::Translation<slam3d::ScalarType, 3>(1,2,3));
+	graph->setCorrectedPose(3, pose);
+	slam3d::TransformWithCovariance twc = graph->getTransform(1, 3);
+	BOOST_CHECK(twc.transform.isApprox(pose));
+	BOOST_CHECK(twc.covariance.isIdentity());
+	twc = graph->getTransformWithCovariance(3, 1);
+	BOOST_CHECK(twc.transform.isApprox(pose.inverse()));
+	BOOST_CHECK(twc.covariance.isIdentity());
+}
+
+void test_delta_sync(slam3d::Graph* source, slam3d::Graph* target)
+{
+	using namespace boost::iostreams;
+
+	// Exchange the deltas via a local pipe
+	int fd[2];
+	BOOST_REQUIRE_EQUAL(pipe(fd), 0);
+	stream<file_descriptor_sink> out(fd[1], close_handle);
+	stream<file_descriptor_source> in(fd[0], close_handle);
+
+	addVertexToGraph(source, 1, "R1", "S1");
+	addVertexToGraph(source, 2, "R1", "S1");
+	slam3d::Transform tf(Eigen::Translation<slam3d::ScalarType, 3>(1,0,0));
+	slam3d::SE3Constraint::Ptr c1(new slam3d::SE3Constraint("S1", slam3d::TransformWithCovariance(tf, slam3d::Covariance<6>::Identity() * 0.5)));
+	source->addConstraint(1, 2, c1);
+
+	slam3d::RevisionType rev = source->writeDelta(out, 0);
+	BOOST_CHECK_EQUAL(rev, source->getRevision());
+	BOOST_CHECK_EQUAL(target->applyDelta(in), rev);
+
+	slam3d::Measurement::Ptr m1 = source->getVertex(1).measurement;
+	slam3d::Measurement::Ptr m2 = source->getVertex(2).measurement;
+	BOOST_REQUIRE(target->hasMeasurement(m1->getUniqueId()));
+	BOOST_REQUIRE(target->hasMeasurement(m2->getUniqueId()));
+	BOOST_CHECK_EQUAL(target->getVertex(m1->getUniqueId()).measurement->getRobotName(), "R1");
+
+	slam3d::EdgeObject edge;
+	BOOST_CHECK_NO_THROW(edge = target->getEdge(target->getIndex(m1->getUniqueId()), target->getIndex(m2->getUniqueId()), "S1"));
+	slam3d::SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<slam3d::SE3Constraint>(edge.constraint);
+	BOOST_REQUIRE(se3);
+	BOOST_CHECK(se3->getRelativePose().transform.isApprox(tf));
+	BOOST_CHECK(se3->getRelativePose().covariance.isApprox(c1->getRelativePose().covariance));
+
+	// The next delta only contains the changes
+	addVertexToGraph(source, 3, "R1", "S2");
+	slam3d::SE3Constraint::Ptr c2(new slam3d::SE3Constraint("S2", slam3d::TransformWithCovariance::Identity()));
+	source->addConstraint(2, 3, c2);
+
+	std::ostringstream full, delta;
+	source->writeDelta(full, 0);
+	source->writeDelta(delta, rev);
+	BOOST_CHECK_LT(delta.str().size(), full.str().size());
+
+	rev = source->writeDelta(out, rev);
+	BOOST_CHECK_EQUAL(target->applyDelta(in), rev);
+	slam3d::Measurement::Ptr m3 = source->getVertex(3).measurement;
+	BOOST_REQUIRE(target->hasMeasurement(m3->getUniqueId()));
+	BOOST_CHECK_NO_THROW(target->getEdge(target->getIndex(m2->getUniqueId()), target->getIndex(m3->getUniqueId()), "S2"));
+
+	// Applying a delta twice must not duplicate anything
+	slam3d::RevisionType target_rev = target->getRevision();
+	std::istringstream again(full.str());
+	target->applyDelta(again);
+	BOOST_CHECK_EQUAL(target->getRevision(), target_rev);
+
+	// Only the changed poses are sent after a correction
+	slam3d::Transform moved(Eigen::Translation<slam3d::ScalarType, 3>(0,5,0));
+	source->setCorrectedPose(1, moved);
+	source->setCorrectedPose(2, source->getVertex(2).corrected_pose);
+	std::stringstream correction;
+	rev = source->writeDelta(correction, rev);
+	slam3d::DeltaReader reader(correction);
+	slam3d::DeltaPose pose;
+	BOOST_REQUIRE_EQUAL(reader.next(), slam3d::DELTA_POSE);
+	reader.readPose(pose);
+	BOOST_CHECK(pose.id == m1->getUniqueId());
+	BOOST_CHECK_EQUAL(reader.next(), slam3d::DELTA_END);
+	correction.seekg(0);
+	target->applyDelta(correction);
+	BOOST_CHECK(target->getVertex(m1->getUniqueId()).corrected_pose.isApprox(moved));
+
+	// Garbage is rejected
+	std::istringstream garbage("This is not a delta stream.");
+	BOOST_CHECK_THROW(target->applyDelta(garbage), slam3d::BadDeltaStream);
+
+	// A corrupt string length is rejected without allocating it
+	std::string corrupt = full.str().substr(0, 64);
+	uint32_t huge = 0xfffffff0;
+	corrupt.replace(39, sizeof(huge), reinterpret_cast<const char*>(&huge), sizeof(huge));
+	std::istringstream corrupt_in(corrupt);
+	BOOST_CHECK_THROW(target->applyDelta(corrupt_in), slam3d::BadDeltaStream);
+}
+
+// Codec with a well compressible payload, remembers what it decoded
+class TestCodec : public slam3d::MeasurementCodec
+{
+public:
+	void encode(const slam3d::Measurement::Ptr& m, std::ostream& out) const
+	{
+		for(int i = 0; i < 100; i++)
+			out << m->getSensorName() << ";";
+	}
+
+	slam3d::Measurement::Ptr decode(std::istream& in, const std::string& robot, const std::string& sensor,
+	                                const slam3d::Transform& sensor_pose, boost::uuids::uuid id, timeval stamp) const
+	{
+		std::ostringstream payload;
+		payload << in.rdbuf();
+		decoded = payload.str();
+		return slam3d::Measurement::Ptr(new slam3d::Measurement(robot, sensor, sensor_pose, id, stamp));
+	}
+
+	mutable std::string decoded;
+};
+
+void test_delta_codec_and_replace(slam3d::Graph* source, slam3d::Graph* target)
+{
+	timeval stamp;
+	stamp.tv_sec = 1234;
+	stamp.tv_usec = 5678;
+	slam3d::Measurement::Ptr m1(new slam3d::Measurement("R1", "S1", slam3d::Transform::Identity(), boost::uuids::nil_uuid(), stamp));
+	slam3d::Measurement::Ptr m2(new slam3d::Measurement("R1", "S2", slam3d::Transform::Identity(), boost::uuids::nil_uuid(), stamp));
+	source->addVertex(m1, slam3d::Transform::Identity());
+	source->addVertex(m2, slam3d::Transform::Identity());
+	slam3d::SE3Constraint::Ptr c1(new slam3d::SE3Constraint("S1", slam3d::TransformWithCovariance::Identity()));
+	source->addConstraint(1, 2, c1);
+
+	// Payloads of S2 are compressed, S1 has no codec at all
+	TestCodec codec;
+	std::ostringstream plain, compressed;
+	source->setMeasurementCodec("S2", &codec, false);
+	source->writeDelta(plain, 0);
+	source->setMeasurementCodec("S2", &codec, true);
+	source->writeDelta(compressed, 0);
+	BOOST_CHECK_LT(compressed.str().size(), plain.str().size());
+
+	target->setMeasurementCodec("S2", &codec, true);
+	std::istringstream in(compressed.str());
+	slam3d::RevisionType rev = target->applyDelta(in);
+	std::ostringstream expected;
+	codec.encode(m2, expected);
+	BOOST_CHECK_EQUAL(codec.decoded, expected.str());
+
+	// Time stamps are kept with and without a codec
+	BOOST_REQUIRE(target->hasMeasurement(m1->getUniqueId()));
+	BOOST_REQUIRE(target->hasMeasurement(m2->getUniqueId()));
+	BOOST_CHECK_EQUAL(target->getVertex(m1->getUniqueId()).measurement->getTimestamp().tv_sec, 1234);
+	BOOST_CHECK_EQUAL(target->getVertex(m1->getUniqueId()).measurement->getTimestamp().tv_usec, 5678);
+	BOOST_CHECK_EQUAL(target->getVertex(m2->getUniqueId()).measurement->getTimestamp().tv_sec, 1234);
+
+	// A replaced constraint overwrites the one the receiver already has
+	slam3d::Transform tf(Eigen::Translation<slam3d::ScalarType, 3>(2,0,0));
+	slam3d::SE3Constraint::Ptr c2(new slam3d::SE3Constraint("S1", slam3d::TransformWithCovariance(tf, slam3d::Covariance<6>::Identity())));
+	source->replaceConstraint(1, 2, c2);
+	std::stringstream delta;
+	source->writeDelta(delta, rev);
+	target->applyDelta(delta);
+
+	slam3d::EdgeObject edge;
+	BOOST_REQUIRE_NO_THROW(edge = target->getEdge(target->getIndex(m1->getUniqueId()), target->getIndex(m2->getUniqueId()), "S1"));
+	slam3d::SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<slam3d::SE3Constraint>(edge.constraint);
+	BOOST_REQUIRE(se3);
+	BOOST_CHECK(se3->getRelativePose().transform.isApprox(tf));
+}
+
+void test_sparsification(slam3d::Graph* source, slam3d::Graph* target)
+{
+	// A trajectory that revisits the pose of vertex 2 with vertex 3
+	slam3d::Transform step(Eigen::Translation<slam3d::ScalarType, 3>(1,0,0));
+	slam3d::Transform pose = slam3d::Transform::Identity();
+	for(slam3d::IdType id = 1; id <= 6; id++)
+	{
+		addVertexToGraph(source, id, "R1", "S1");
+		if(id != 3)
+			pose = pose * step;
+		source->setCorrectedPose(id, pose);
+		if(id > 1)
+		{
+			slam3d::Transform rel = (id == 3) ? slam3d::Transform::Identity() : step;
+			slam3d::SE3Constraint::Ptr c(new slam3d::SE3Constraint("S1", slam3d::TransformWithCovariance(rel, slam3d::Covariance<6>::Identity())));
+			source->addConstraint(id - 1, id, c);
+		}
+	}
+
+	std::stringstream full;
+	slam3d::RevisionType rev = source->writeDelta(full, 0);
+	target->applyDelta(full);
+	boost::uuids::uuid removed_id = source->getVertex(2).measurement->getUniqueId();
+	BOOST_REQUIRE(target->hasMeasurement(removed_id));
+
+	// Only vertex 2 is redundant, the last two are not considered
+	BOOST_CHECK_EQUAL(source->sparsify("S1", 0.1, 0.1, 2), 1);
+	BOOST_CHECK(!source->hasMeasurement(removed_id));
+	BOOST_CHECK_THROW(source->getEdge(1, 2, "S1"), slam3d::InvalidEdge);
+	BOOST_CHECK_THROW(source->removeVertex(2), slam3d::InvalidVertex);
+
+	// Its neighbors are connected by the marginalized constraint
+	slam3d::EdgeObject edge;
+	BOOST_REQUIRE_NO_THROW(edge = source->getEdge(3, 1, "S1"));
+	slam3d::SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<slam3d::SE3Constraint>(edge.constraint);
+	BOOST_REQUIRE(se3);
+	BOOST_CHECK_EQUAL(edge.source, 3);
+	BOOST_CHECK(se3->getRelativePose().transform.isApprox(step.inverse()));
+	BOOST_CHECK_GT(se3->getRelativePose().covariance.trace(), 6);
+
+	// Nothing is left to remove
+	BOOST_CHECK_EQUAL(source->sparsify("S1", 0.1, 0.1, 2), 0);
+
+	// The other vertices are still found by their id
+	BOOST_CHECK_EQUAL(source->getVertex(1).index, 1);
+	for(slam3d::IdType id = 3; id <= 6; id++)
+		BOOST_CHECK_EQUAL(source->getVertex(id).index, id);
+
+	// The removal is propagated to other graphs
+	std::stringstream delta;
+	BOOST_CHECK_EQUAL(source->writeDelta(delta, rev), source->getRevision());
+	target->applyDelta(delta);
+	BOOST_CHECK(!target->hasMeasurement(removed_id));
+	BOOST_CHECK_NO_THROW(target->getEdge(target->getIndex(source->getVertex(1).measurement->getUniqueId()),
+	                                     target->getIndex(source->getVertex(3).measurement->getUniqueId()), "S1"));
+}
+
+void test_loop_closure_buffer(slam3d::Graph* graph)
+{
+	// A straight trajectory with loop closures to the vertices four steps back
+	slam3d::Transform step(Eigen::Translation<slam3d::ScalarType, 3>(1,0,0));
+	slam3d::Transform pose = slam3d::Transform::Identity();
+	for(slam3d::IdType id = 1; id <= 8; id++)
+	{
+		addVertexToGraph(graph, id, "R1", "S1");
+		graph->setCorrectedPose(id, pose);
+		pose = pose * step;
+		if(id > 1)
+			graph->addConstraint(id - 1, id, slam3d::SE3Constraint::Ptr(new slam3d::SE3Constraint("S1", slam3d::TransformWithCovariance(step, slam3d::Covariance<6>::Identity()))));
+	}
+	graph->setLoopClosureBuffer(4, 1.0);
+
+	// The last loop closure is a false match
+	std::string sensor("L");
+	slam3d::Transform loop(Eigen::Translation<slam3d::ScalarType, 3>(4,0,0));
+	slam3d::Transform wrong(Eigen::Translation<slam3d::ScalarType, 3>(4,3,0));
+	for(slam3d::IdType id = 1; id <= 4; id++)
+	{
+		graph->addTentativeConstraint(id, id + 4, sensor);
+		slam3d::TransformWithCovariance twc((id < 4) ? loop : wrong, slam3d::Covariance<6>::Identity() * 0.01);
+		graph->replaceConstraint(id, id + 4, slam3d::SE3Constraint::Ptr(new slam3d::SE3Constraint(sensor, twc)));
+		if(id < 4)
+			BOOST_CHECK_EQUAL(graph->getEdge(id, id + 4, sensor).constraint->getType(), slam3d::TENTATIVE);
+	}
+
+	// Only the consistent loop closures have been committed, the false match is removed
+	for(slam3d::IdType id = 1; id <= 3; id++)
+		BOOST_CHECK_EQUAL(graph->getEdge(id, id + 4, sensor).constraint->getType(), slam3d::SE3);
+	BOOST_CHECK_THROW(graph->getEdge(4, 8, sensor), slam3d::InvalidEdge);
+	BOOST_CHECK_EQUAL(graph->commitLoopClosures(), 0);
+
+	// Too few consistent candidates are all removed
+	graph->setLoopClosureBuffer(2, 1.0, 2);
+	slam3d::TransformWithCovariance first(loop, slam3d::Covariance<6>::Identity() * 0.01);
+	slam3d::TransformWithCovariance second(wrong, slam3d::Covariance<6>::Identity() * 0.01);
+	graph->addTentativeConstraint(1, 6, sensor);
+	graph->replaceConstraint(1, 6, slam3d::SE3Constraint::Ptr(new slam3d::SE3Constraint(sensor, first)));
+	graph->addTentativeConstraint(2, 7, sensor);
+	graph->replaceConstraint(2, 7, slam3d::SE3Constraint::Ptr(new slam3d::SE3Constraint(sensor, second)));
+	BOOST_CHECK_THROW(graph->getEdge(1, 6, sensor), slam3d::InvalidEdge);
+	BOOST_CHECK_THROW(graph->getEdge(2, 7, sensor), slam3d::InvalidEdge);
+}
+
+void test_trajectory_export(slam3d::Graph* graph)
+{
+	for(slam3d::IdType id = 1; id <= 5; id++)
+	{
+		addVertexToGraph(graph, id, "R1", (id == 3) ? "S2" : "S1");
+		slam3d::Transform pose(Eigen::Translation<slam3d::ScalarType, 3>(id, 0, 0));
+		pose.rotate(Eigen::AngleAxis<slam3d::ScalarType>(0.1 * id, slam3d::Direction::UnitZ()));
+		graph->setCorrectedPose(id, pose);
+	}
+	BOOST_CHECK_EQUAL(graph->exportTrajectory(NULL, NULL, NULL, NULL, 0), 5);
+
+	slam3d::IdType ids[5];
+	slam3d::ScalarType translations[15];
+	slam3d::ScalarType rotations[20];
+	BOOST_REQUIRE_EQUAL(graph->exportTrajectory(ids, NULL, translations, rotations, 5, "S1"), 4);
+	BOOST_CHECK_EQUAL(ids[2], 4);
+	BOOST_CHECK_EQUAL(translations[6], 4);
+	Eigen::Map<Eigen::Quaternion<slam3d::ScalarType> > q(rotations + 8);
+	BOOST_CHECK(q.isApprox(Eigen::Quaternion<slam3d::ScalarType>(graph->getVertex(4).corrected_pose.linear())));
+
+	// Only the changed pose is exported since a revision
+	slam3d::SE3Constraint::Ptr c(new slam3d::SE3Constraint("S1", slam3d::TransformWithCovariance::Identity()));
+	graph->addConstraint(1, 2, c);
+	slam3d::RevisionType rev = graph->getRevision();
+	graph->setCorrectedPose(2, slam3d::Transform::Identity());
+	BOOST_REQUIRE_EQUAL(graph->exportTrajectory(ids, NULL, translations, NULL, 5, "", rev), 1);
+	BOOST_CHECK_EQUAL(ids[0], 2);
+	BOOST_CHECK_EQUAL(translations[0], 0);
+
+	// Removed vertices are left out and reported separately
+	BOOST_CHECK_EQUAL(graph->exportRemovals(NULL, 0), 0);
+	rev = graph->getRevision();
+	graph->removeVertex(4);
+	BOOST_REQUIRE_EQUAL(graph->exportTrajectory(ids, NULL, NULL, NULL, 2, "S1"), 3);
+	BOOST_CHECK_EQUAL(ids[1], 2);
+	BOOST_REQUIRE_EQUAL(graph->exportRemovals(ids, 5, "S1", rev), 1);
+	BOOST_CHECK_EQUAL(ids[0], 4);
+	BOOST_CHECK_EQUAL(graph->exportRemovals(ids, 5, "S2", rev), 0);
+	BOOST_CHECK_EQUAL(graph->exportRemovals(ids, 5, "", graph->getRevision()), 0);
+}
+
+// Scan sensor whose registration always confirms the initial guess
+class PerfectScanSensor : public slam3d::ScanSensor
+{
+public:
+	PerfectScanSensor(const std::string& n, slam3d::Logger* l) : slam3d::ScanSensor(n, l) {}
+
+	slam3d::Measurement::Ptr createCombinedMeasurement(const slam3d::VertexObjectList& vertices, slam3d::Transform pose) const
+	{
+		return vertices.at(0).measurement;
+	}
+
+	slam3d::Constraint::Ptr createConstraint(const slam3d::Measurement::Ptr& source, const slam3d::Measurement::Ptr& target,
+	                                         const slam3d::Transform& odometry, bool loop)
+	{
+		return slam3d::SE3Constraint::create(mName, slam3d::TransformWithCovariance(odometry, slam3d::Covariance<6>::Identity()));
+	}
+};
+
+void test_scan_sensor_localization(slam3d::Graph* graph, slam3d::Logger* logger)
+{
+	// Prior map with vertices at x = 0, 2 and 4
+	for(int i = 0; i < 3; i++)
+	{
+		slam3d::Measurement::Ptr m(new slam3d::Measurement("R1", "S1", slam3d::Transform::Identity()));
+		graph->addVertex(m, slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(2 * i, 0, 0)));
+	}
+
+	slam3d::Mapper mapper(graph, logger);
+	PerfectScanSensor sensor("S1", logger);
+	mapper.registerSensor(&sensor);
+	sensor.setNeighborRadius(1.5, 0);
+	sensor.setLocalizationMode(true);
+
+	// The first odometry sample does not move the robot
+	slam3d::Measurement::Ptr scan(new slam3d::Measurement("R1", "S1", slam3d::Transform::Identity()));
+	slam3d::Transform odom(Eigen::Translation<slam3d::ScalarType, 3>(100, 0, 0));
+	BOOST_CHECK(!sensor.addMeasurement(scan, odom));
+	BOOST_CHECK_SMALL(sensor.getLocalizationPose().translation().norm(), (slam3d::ScalarType)1e-4);
+	BOOST_CHECK_EQUAL(sensor.getLastVertexId(), 1);
+
+	// Following samples are registered against the closest vertex
+	odom = slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(101.9, 0, 0));
+	BOOST_CHECK(!sensor.addMeasurement(scan, odom));
+	BOOST_CHECK_CLOSE(sensor.getLocalizationPose().translation()[0], (slam3d::ScalarType)1.9, 1e-3);
+	BOOST_CHECK_EQUAL(sensor.getLastVertexId(), 2);
+	BOOST_CHECK_EQUAL(graph->getVerticesFromSensor("S1").size(), 3);
+
+	// Unmapped areas extend the map, the new vertex is found right away
+	odom = slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(110, 0, 0));
+	slam3d::Measurement::Ptr scan2(new slam3d::Measurement("R1", "S1", slam3d::Transform::Identity()));
+	BOOST_CHECK(sensor.addMeasurement(scan2, odom));
+	BOOST_CHECK_EQUAL(graph->getVerticesFromSensor("S1").size(), 4);
+	BOOST_CHECK_NO_THROW(graph->getEdge(2, 4, "S1"));
+
+	odom = slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(110.5, 0, 0));
+	BOOST_CHECK(!sensor.addMeasurement(scan, odom));
+	BOOST_CHECK_EQUAL(sensor.getLastVertexId(), 4);
+	BOOST_CHECK_CLOSE(sensor.getLocalizationPose().translation()[0], (slam3d::ScalarType)10.5, 1e-3);
+
+	// The spatial index follows moved and removed vertices
+	graph->setCorrectedPose(4, slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(-10, 0, 0)));
+	slam3d::VertexObjectList near = graph->getNearbyVertices("S1", slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(-10, 0, 0)), 1.0);
+	BOOST_REQUIRE_EQUAL(near.size(), 1);
+	BOOST_CHECK_EQUAL(near[0].index, 4);
+	graph->removeVertex(4);
+	near = graph->getNearbyVertices("S1", slam3d::Transform(Eigen::Translation<slam3d::ScalarType, 3>(-10, 0, 0)), 1.0);
+	BOOST_CHECK(near.empty());
+	near = graph->getNearbyVertices("S1", slam3d::Transform::Identity(), 100.0);
+	BOOST_CHECK_EQUAL(near.size(), 3);
 }
@@ -67,6 +67,13 @@ namespace slam3d
 		 * @param lvl new log-level
 		 */
 		virtual void setLogLevel(LOG_LEVEL lvl){mLogLevel = lvl;}
+
+		/**
+		 * @brief Whether messages of the given level are printed.
+		 * @details Allows to skip formatting messages that would be ignored.
+		 * @param lvl log-level of a message
+		 */
+		virtual bool isEnabled(LOG_LEVEL lvl) const { return lvl >= mLogLevel; }
 		
 		/**
 		 * @brief Prints a message, showing log-level and timestamp.
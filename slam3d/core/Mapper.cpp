@@ -104,7 +104,7 @@ void Mapper::addExternalMeasurement(Measurement::Ptr m, boost::uuids::uuid s, co
 	Transform pose = mGraph->getVertex(s).corrected_pose * twc.transform;
 	IdType source = mGraph->getIndex(s);
 	IdType target = mGraph->addVertex(m, pose);
-	SE3Constraint::Ptr se3(new SE3Constraint(sensor, twc));
+	SE3Constraint::Ptr se3 = SE3Constraint::create(sensor, twc);
 	mGraph->addConstraint(source, target, se3);
 }
 
@@ -119,7 +119,7 @@ void Mapper::addExternalConstraint(boost::uuids::uuid s, boost::uuids::uuid t, c
 		throw DuplicateEdge(source, target, sensor);
 	}catch(InvalidEdge &ie)
 	{
-		SE3Constraint::Ptr se3(new SE3Constraint(sensor, twc));
+		SE3Constraint::Ptr se3 = SE3Constraint::create(sensor, twc);
 		mGraph->addConstraint(source, target, se3);
 	}
 }
@@ -0,0 +1,95 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "Pool.hpp"
+
+#include <algorithm>
+#include <set>
+
+#define MAX_CHUNK_BLOCKS 4096
+#define RECENT_NAMES 8
+
+using namespace slam3d;
+
+const std::string& slam3d::internName(const std::string& name)
+{
+	// Interned names are recognized by their address without locking,
+	// as each thread mostly passes the names of the same few sensors.
+	static thread_local const std::string* recent[RECENT_NAMES] = {};
+	static thread_local unsigned next = 0;
+	for(unsigned i = 0; i < RECENT_NAMES; i++)
+	{
+		if(recent[i] == &name)
+			return name;
+	}
+
+	// Never destroyed, as names might be used during static destruction
+	static std::mutex* mutex = new std::mutex;
+	static std::set<std::string>* names = new std::set<std::string>;
+
+	std::lock_guard<std::mutex> guard(*mutex);
+	const std::string& interned = *names->insert(name).first;
+	recent[next] = &interned;
+	next = (next + 1) % RECENT_NAMES;
+	return interned;
+}
+
+FreeList::FreeList(size_t size, size_t alignment)
+ : mChunkBlocks(16), mFree(NULL)
+{
+	mAlignment = std::max(alignment, alignof(Block));
+	mBlockSize = std::max(size, sizeof(Block));
+	mBlockSize = (mBlockSize + mAlignment - 1) / mAlignment * mAlignment;
+}
+
+void* FreeList::allocate()
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	if(!mFree)
+	{
+		// Get a new chunk, each one twice as large as the previous
+		char* chunk = static_cast<char*>(::operator new(mChunkBlocks * mBlockSize + mAlignment));
+		char* first = chunk + (mAlignment - (size_t)chunk % mAlignment) % mAlignment;
+		for(size_t i = mChunkBlocks; i > 0; i--)
+		{
+			Block* b = reinterpret_cast<Block*>(first + (i - 1) * mBlockSize);
+			b->next = mFree;
+			mFree = b;
+		}
+		mChunkBlocks = std::min(2 * mChunkBlocks, (size_t)MAX_CHUNK_BLOCKS);
+	}
+	Block* b = mFree;
+	mFree = b->next;
+	return b;
+}
+
+void FreeList::deallocate(void* p)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	Block* b = static_cast<Block*>(p);
+	b->next = mFree;
+	mFree = b;
+}
@@ -0,0 +1,160 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SLAM3D_POOL_HPP
+#define SLAM3D_POOL_HPP
+
+#include <boost/make_shared.hpp>
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+
+namespace slam3d
+{
+	/**
+	 * @brief Get the shared copy of a name, e.g. of a sensor or a robot.
+	 * @details Each distinct name is stored only once and never released,
+	 * so the returned reference stays valid until the program ends. Passing
+	 * a reference returned by this function is cheap, so names that are
+	 * used repeatedly should be interned once, like Sensor does.
+	 * @param name
+	 */
+	const std::string& internName(const std::string& name);
+
+	/**
+	 * @class FreeList
+	 * @brief Thread-safe pool of equally sized memory blocks.
+	 * @details Memory is requested from the system in chunks of many blocks
+	 * and is never returned, released blocks are reused instead.
+	 */
+	class FreeList
+	{
+	public:
+		FreeList(size_t size, size_t alignment);
+
+		void* allocate();
+		void deallocate(void* p);
+
+	private:
+		struct Block
+		{
+			Block* next;
+		};
+
+		size_t mBlockSize;
+		size_t mAlignment;
+		size_t mChunkBlocks;
+		Block* mFree;
+		std::mutex mMutex;
+	};
+
+	/**
+	 * @class PoolAllocator
+	 * @brief Allocator that takes single objects from a pool of their type.
+	 * @details Arrays are allocated with the aligned operator new, if available. The pools are never
+	 * destroyed, so objects may even be released during static destruction.
+	 */
+	template <typename T>
+	class PoolAllocator
+	{
+	public:
+		typedef T value_type;
+		typedef T* pointer;
+		typedef const T* const_pointer;
+		typedef T& reference;
+		typedef const T& const_reference;
+		typedef size_t size_type;
+		typedef ptrdiff_t difference_type;
+
+		template <typename U>
+		struct rebind
+		{
+			typedef PoolAllocator<U> other;
+		};
+
+		PoolAllocator() {}
+
+		template <typename U>
+		PoolAllocator(const PoolAllocator<U>&) {}
+
+		T* allocate(size_t n)
+		{
+			if(n == 1)
+				return static_cast<T*>(getPool().allocate());
+#ifdef __cpp_aligned_new
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+#else
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+#endif
+		}
+
+		void deallocate(T* p, size_t n)
+		{
+			if(n == 1)
+				getPool().deallocate(p);
+			else
+#ifdef __cpp_aligned_new
+				::operator delete(p, std::align_val_t(alignof(T)));
+#else
+				::operator delete(p);
+#endif
+		}
+
+		size_t max_size() const { return size_t(-1) / sizeof(T); }
+
+		template <typename U, typename... Args>
+		void construct(U* p, Args&&... args) { ::new((void*)p) U(std::forward<Args>(args)...); }
+
+		template <typename U>
+		void destroy(U* p) { p->~U(); }
+
+		bool operator==(const PoolAllocator&) const { return true; }
+		bool operator!=(const PoolAllocator&) const { return false; }
+
+	private:
+		static FreeList& getPool()
+		{
+			static FreeList* pool = new FreeList(sizeof(T), alignof(T));
+			return *pool;
+		}
+	};
+
+	/**
+	 * @brief Create a shared object, the object and its reference count are
+	 * taken from a pool for this type.
+	 * @param args arguments of the constructor
+	 */
+	template <typename T, typename... Args>
+	boost::shared_ptr<T> allocatePooled(Args&&... args)
+	{
+		return boost::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+	}
+}
+
+#endif
@@ -0,0 +1,139 @@
+#define BOOST_TEST_MODULE "PoolTest"
+
+#include <boost/test/unit_test.hpp>
+
+#include "Pool.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <set>
+#include <vector>
+
+// Count the memory requested from the system
+static size_t gAllocations = 0;
+
+// The replaced operators are inlined, so GCC would see free() of memory from operator new
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+	gAllocations++;
+	void* p = std::malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	gAllocations++;
+	std::size_t a = static_cast<std::size_t>(alignment);
+	void* p = std::aligned_alloc(a, size ? (size + a - 1) / a * a : a);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+using namespace slam3d;
+
+struct alignas(64) Aligned
+{
+	char data[40];
+};
+
+BOOST_AUTO_TEST_CASE(free_list_reuse)
+{
+	FreeList pool(sizeof(Aligned), alignof(Aligned));
+	std::vector<void*> blocks;
+	for(int i = 0; i < 100; i++)
+	{
+		void* p = pool.allocate();
+		BOOST_CHECK_EQUAL((uintptr_t)p % alignof(Aligned), 0);
+		blocks.push_back(p);
+	}
+	BOOST_CHECK_EQUAL(std::set<void*>(blocks.begin(), blocks.end()).size(), blocks.size());
+
+	// Released blocks are reused without asking the system for memory
+	for(std::vector<void*>::iterator b = blocks.begin(); b != blocks.end(); ++b)
+		pool.deallocate(*b);
+	std::vector<void*> reused(blocks.size());
+	size_t before = gAllocations;
+	for(size_t i = 0; i < reused.size(); i++)
+		reused[i] = pool.allocate();
+	BOOST_CHECK_EQUAL(gAllocations - before, 0);
+	BOOST_CHECK(std::set<void*>(reused.begin(), reused.end()) == std::set<void*>(blocks.begin(), blocks.end()));
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_shared_objects)
+{
+	// The first objects fill the pools of the object and its reference count
+	std::vector<boost::shared_ptr<Aligned> > objects;
+	for(int i = 0; i < 100; i++)
+	{
+		objects.push_back(allocatePooled<Aligned>());
+		BOOST_CHECK_EQUAL((uintptr_t)objects.back().get() % alignof(Aligned), 0);
+	}
+	objects.clear();
+	objects.reserve(100);
+
+	size_t before = gAllocations;
+	for(int i = 0; i < 100; i++)
+		objects.push_back(allocatePooled<Aligned>());
+	BOOST_CHECK_EQUAL(gAllocations - before, 0);
+
+	// Arrays bypass the pool
+	PoolAllocator<Aligned> allocator;
+	before = gAllocations;
+	Aligned* array = allocator.allocate(4);
+	BOOST_CHECK_EQUAL(gAllocations - before, 1);
+#ifdef __cpp_aligned_new
+	BOOST_CHECK_EQUAL((uintptr_t)array % alignof(Aligned), 0);
+#endif
+	allocator.deallocate(array, 4);
+}
+
+BOOST_AUTO_TEST_CASE(intern_name)
+{
+	const std::string& interned = internName("pool_test_sensor_with_a_long_name");
+	BOOST_CHECK_EQUAL(interned, "pool_test_sensor_with_a_long_name");
+
+	// Equal names share one copy
+	std::string copy(interned);
+	BOOST_CHECK_EQUAL(&internName(copy), &interned);
+	BOOST_CHECK(&internName("pool_test_other_sensor") != &interned);
+
+	// Interned names are recognized without a copy
+	size_t before = gAllocations;
+	BOOST_CHECK_EQUAL(&internName(interned), &interned);
+	BOOST_CHECK_EQUAL(gAllocations - before, 0);
+}
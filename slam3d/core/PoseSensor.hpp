@@ -62,7 +62,7 @@ namespace slam3d
 	{
 	public:
 		// Ctor / Dtor
-		PoseSensor(const std::string& n, Graph* g, Logger* l) : mGraph(g), mLogger(l), mName(n), mCovarianceScale(1.0) {}
+		PoseSensor(const std::string& n, Graph* g, Logger* l) : mGraph(g), mLogger(l), mName(internName(n)), mCovarianceScale(1.0) {}
 		virtual ~PoseSensor(){};
 		
 		// Virtual methods
@@ -87,7 +87,7 @@ namespace slam3d
 		 * @brief Get this sensor's registered name.
 		 * @return Name of the sensor.
 		 */
-		std::string getName(){ return mName; }
+		const std::string& getName(){ return mName; }
 	
 		/**
 		 * @brief Set the covariance scale for measurements of this sensor.
@@ -99,7 +99,7 @@ namespace slam3d
 		Graph* mGraph;
 		Logger* mLogger;
 		
-		std::string mName;
+		const std::string& mName; // interned once, see internName
 		ScalarType mCovarianceScale;
 	};
 	
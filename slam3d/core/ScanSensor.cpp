@@ -39,6 +39,10 @@ ScanSensor::ScanSensor(const std::string& n, Logger* l)
 	mMinLoopLength = 10;
 	mLinkPrevious = true;
 	mLastTransform = Transform::Identity();
+	mLastOdometry = Transform::Identity();
+	mLocalizationMode = false;
+	mHasOdometry = false;
+	mLocalizationPose = Transform::Identity();
 }
 
 ScanSensor::~ScanSensor()
@@ -47,6 +51,11 @@ ScanSensor::~ScanSensor()
 
 bool ScanSensor::addMeasurement(const Measurement::Ptr& m)
 {
+	if(mLocalizationMode)
+	{
+		return localize(m, Transform::Identity());
+	}
+
 	if(mLastVertex == 0)
 	{
 		mLastVertex = mMapper->addMeasurement(m);
@@ -57,8 +66,9 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m)
 	try
 	{
 		Constraint::Ptr c = createConstraint(source, m, mLastTransform, false);
-		SE3Constraint::Ptr se3 = boost::dynamic_pointer_cast<SE3Constraint>(c);
-		mLastTransform = se3->getRelativePose().transform;
+		const SE3Constraint* se3 = (c->getType() == SE3) ? static_cast<const SE3Constraint*>(c.get()) : NULL;
+		if(se3)
+			mLastTransform = se3->getRelativePose().transform;
 		if(!se3 || checkMinDistance(mLastTransform))
 		{
 			IdType newVertex = mMapper->addMeasurement(m);
@@ -80,10 +90,20 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m)
 
 bool ScanSensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom)
 {
+	if(mLocalizationMode)
+	{
+		// The first odometry sample only defines the origin of the motion
+		Transform motion = mHasOdometry ? Transform(mLastOdometry.inverse() * odom) : Transform::Identity();
+		mLastOdometry = odom;
+		mHasOdometry = true;
+		return localize(m, motion);
+	}
+
 	if(mLastVertex == 0)
 	{
 		mLastVertex = mMapper->addMeasurement(m);
 		mLastOdometry = odom;
+		mHasOdometry = true;
 		return true;
 	}
 	
@@ -105,6 +125,7 @@ bool ScanSensor::addMeasurement(const Measurement::Ptr& m, const Transform& odom
 			}
 		}
 		mLastOdometry = odom;
+		mHasOdometry = true;
 		mLastVertex = newVertex;
 		return true;
 	}
@@ -143,9 +164,8 @@ void ScanSensor::link(IdType source_id, IdType target_id, const Transform& guess
 
 void ScanSensor::linkToNeighbors(IdType vertex)
 {
-	mMapper->getGraph()->buildNeighborIndex(mName);
 	VertexObject obj = mMapper->getGraph()->getVertex(vertex);
-	VertexObjectList neighbors = mMapper->getGraph()->getNearbyVertices(obj.corrected_pose, mNeighborRadius);
+	VertexObjectList neighbors = mMapper->getGraph()->getNearbyVertices(mName, obj.corrected_pose, mNeighborRadius);
 	
 	int count = 0;
 	for(auto i = neighbors.rbegin(); i != neighbors.rend() && count < mMaxNeighorLinks; i++)
@@ -240,3 +260,76 @@ Measurement::Ptr ScanSensor::buildPatch(IdType source)
 	}
 	return createCombinedMeasurement(v_objects, mMapper->getGraph()->getVertex(source).corrected_pose);
 }
+
+void ScanSensor::setLocalizationMode(bool l)
+{
+	mLocalizationMode = l;
+	if(!l)
+		return;
+
+	if(mMapper->getGraph()->getVerticesFromSensor(mName).empty())
+		mLogger->message(WARNING, (boost::format("Localization without prior map, there are no vertices from %1%.") % mName).str());
+	if(mLastVertex)
+		mLocalizationPose = mMapper->getGraph()->getVertex(mLastVertex).corrected_pose;
+}
+
+bool ScanSensor::localize(const Measurement::Ptr& m, const Transform& motion)
+{
+	Graph* graph = mMapper->getGraph();
+	mLocalizationPose = mLocalizationPose * motion;
+
+	// Find the closest vertex of the map
+	VertexObjectList neighbors = graph->getNearbyVertices(mName, mLocalizationPose, mNeighborRadius);
+
+	const VertexObject* closest = NULL;
+	ScalarType min_dist = 0;
+	for(VertexObjectList::const_iterator v = neighbors.begin(); v != neighbors.end(); ++v)
+	{
+		ScalarType dist = (v->corrected_pose.translation() - mLocalizationPose.translation()).norm();
+		if(!closest || dist < min_dist)
+		{
+			closest = &(*v);
+			min_dist = dist;
+		}
+	}
+
+	// Unmapped area, so extend the map with a new vertex
+	if(!closest)
+	{
+		IdType newVertex = mMapper->addMeasurement(m);
+		graph->setCorrectedPose(newVertex, mLocalizationPose);
+		if(mLastVertex)
+		{
+			const VertexObject& last = graph->getVertex(mLastVertex);
+			Transform guess = last.corrected_pose.inverse() * mLocalizationPose;
+			try
+			{
+				Constraint::Ptr c = createConstraint(last.measurement, m, guess, false);
+				graph->addConstraint(mLastVertex, newVertex, c);
+			}catch(std::exception &e)
+			{
+				mLogger->message(WARNING, (boost::format("Could not link new vertex to the map: %1%") % e.what()).str());
+			}
+		}
+		mLogger->message(INFO, (boost::format("Localization entered unmapped area, added vertex %1%.") % newVertex).str());
+		mLastVertex = newVertex;
+		return true;
+	}
+
+	// Register the measurement against the closest vertex
+	Transform guess = closest->corrected_pose.inverse() * mLocalizationPose;
+	try
+	{
+		Constraint::Ptr c = createConstraint(closest->measurement, m, guess, false);
+		const SE3Constraint* se3 = (c->getType() == SE3) ? static_cast<const SE3Constraint*>(c.get()) : NULL;
+		if(se3)
+		{
+			mLocalizationPose = closest->corrected_pose * se3->getRelativePose().transform;
+		}
+		mLastVertex = closest->index;
+	}catch(std::exception &e)
+	{
+		mLogger->message(WARNING, (boost::format("Localization against vertex %1% failed: %2%") % closest->index % e.what()).str());
+	}
+	return false;
+}
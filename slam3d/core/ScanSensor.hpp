@@ -43,7 +43,8 @@ namespace slam3d
 		 * @brief Sets a specific solver to optimize local patches.
 		 * @details This must not be the same instance used as the backend,
 		 * as it will be reset after every optimization. If it is not set,
-		 * patches will not be optimized before matching.
+		 * patches will not be optimized before matching. The DenseSolver is
+		 * meant for this, as patches are small.
 		 * @param solver used for patch optimization
 		 */
 		void setPatchSolver(Solver* solver) { mPatchSolver = solver; }
@@ -78,6 +79,35 @@ namespace slam3d
 		 */
 		void setLinkPrevious(bool l) { mLinkPrevious = l; }
 
+		/**
+		 * @brief Switch between mapping and localization against a prior map.
+		 * @details In localization mode, new measurements are registered against
+		 * the nearest vertex of this sensor found by Graph::getNearbyVertices,
+		 * but they are not added to the graph. Only the tracked pose is updated.
+		 * New vertices are only created in unmapped areas, when no vertex is
+		 * within the neighbor radius (see setNeighborRadius). The prior map can
+		 * be loaded with Graph::applyDelta before enabling this mode.
+		 * @param l whether to localize only
+		 */
+		void setLocalizationMode(bool l);
+
+		/**
+		 * @brief Whether the sensor is in localization mode.
+		 */
+		bool getLocalizationMode() const { return mLocalizationMode; }
+
+		/**
+		 * @brief Set the current pose for localization, e.g. an initial guess.
+		 * @param pose robot pose in map coordinates
+		 */
+		void setLocalizationPose(const Transform& pose) { mLocalizationPose = pose; }
+
+		/**
+		 * @brief Get the current pose from localization.
+		 * @return robot pose in map coordinates
+		 */
+		const Transform& getLocalizationPose() const { return mLocalizationPose; }
+
 		/**
 		 * @brief Add a new measurement from this sensor.
 		 * @param scan
@@ -147,6 +177,15 @@ namespace slam3d
 		 */
 		void linkLastToNeighbors(bool mt = false);
 
+	protected:
+		/**
+		 * @brief Register a measurement against the nearest vertex of the map.
+		 * @param scan measurement to be localized
+		 * @param motion relative motion since the previous measurement
+		 * @return whether a new vertex has been added (unmapped area)
+		 */
+		bool localize(const Measurement::Ptr& scan, const Transform& motion);
+
 	private:
 		Solver* mPatchSolver;
 		std::mutex mPatchSolverMutex;
@@ -159,6 +198,10 @@ namespace slam3d
 
 		Transform mLastOdometry;
 		Transform mLastTransform;
+
+		bool mLocalizationMode;
+		bool mHasOdometry;
+		Transform mLocalizationPose;
 	};
 }
 
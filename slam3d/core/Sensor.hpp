@@ -83,7 +83,7 @@ namespace slam3d
 	{
 	public:
 		Sensor(const std::string& n, Logger* l)
-		 :mMapper(NULL), mLogger(l), mName(n), mLastVertex(0), mCovarianceScale(1.0){}
+		 :mMapper(NULL), mLogger(l), mName(internName(n)), mLastVertex(0), mCovarianceScale(1.0){}
 		virtual ~Sensor(){}
 		
 		/**
@@ -97,7 +97,7 @@ namespace slam3d
 		 * measurements that have been recorded by this sensor.
 		 * @return name of the sensor
 		 */
-		std::string getName() const { return mName; }
+		const std::string& getName() const { return mName; }
 		
 		/**
 		 * @brief Set minimal change in pose between adjacent nodes.
@@ -138,7 +138,7 @@ namespace slam3d
 		Mapper* mMapper;
 		Logger* mLogger;
 
-		std::string mName;
+		const std::string& mName; // interned once, see internName
 		IdType mLastVertex; // This is the last vertex from THIS sensor!
 		
 		float mMinTranslation;
@@ -35,6 +35,9 @@ namespace slam3d
 {
 	typedef std::pair<IdType, Transform> IdPose;
 	typedef std::vector<IdPose> IdPoseVector;
+	typedef std::pair<IdType, IdType> IdPair;
+	typedef std::vector<IdPair> IdPairVector;
+	typedef std::vector< Covariance<12> > JointCovarianceVector;
 	
 	/**
 	 * @class Solver
@@ -98,6 +101,23 @@ namespace slam3d
 			IdType target;
 		};
 
+		/**
+		 * @class Unsupported
+		 * @brief Exception thrown when a solver does not implement an operation.
+		 */
+		class Unsupported: public std::exception
+		{
+		public:
+			Unsupported(const std::string& op):message("The solver does not support " + op + "!"){}
+			virtual ~Unsupported() throw() {}
+			virtual const char* what() const throw()
+			{
+				return message.c_str();
+			}
+			
+			std::string message;
+		};
+
 	public:
 		/**
 		 * @brief Constructor setting the used logging device.
@@ -116,6 +136,16 @@ namespace slam3d
 		 * @param pose initial pose of the new vertex
 		 */
 		virtual void addVertex(IdType id, const Transform& pose) = 0;
+
+		/**
+		 * @brief Removes a vertex and all its edges from the internal graph representation.
+		 * @details The default implementation throws, as not every backend
+		 * can remove vertices.
+		 * @param id identifier of the vertex to be removed
+		 * @throw UnknownVertex
+		 * @throw Unsupported
+		 */
+		virtual void removeVertex(IdType /*id*/) { throw Unsupported("the removal of vertices"); }
 		
 		/**
 		 * @brief Add an edge to the internal graph representation.
@@ -198,7 +228,45 @@ namespace slam3d
 		 * given ID to minimize the error in the PoseGraph.
 		 */
 		virtual IdPoseVector getCorrections() = 0;
-		
+
+		/**
+		 * @brief Store the current state, so that later changes can be reverted.
+		 * @details Checkpoints can be nested. Solvers that do not support
+		 * checkpoints return false, which is the default implementation.
+		 * @return true if the checkpoint has been created
+		 */
+		virtual bool checkpoint() { return false; }
+
+		/**
+		 * @brief Revert all changes since the last checkpoint and discard it.
+		 * @details Vertices and constraints that have been added since then are
+		 * removed and the estimates of all vertices are restored. The restored
+		 * poses are provided by getCorrections() afterwards.
+		 * @return true if there was a checkpoint to return to
+		 */
+		virtual bool rollback() { return false; }
+
+		/**
+		 * @brief Keep all changes since the last checkpoint and discard it.
+		 * @return true if there was a checkpoint to discard
+		 */
+		virtual bool releaseCheckpoint() { return false; }
+
+		/**
+		 * @brief Get the joint marginal covariances for pairs of vertices.
+		 * @details Each covariance contains the blocks of the first and the
+		 * second vertex of a pair, in the error parametrization of the SE3
+		 * constraints (translation followed by the vector part of the
+		 * rotation's quaternion). They refer to the result of the last call
+		 * to compute(). Solvers that do not support marginals return false,
+		 * which is the default implementation.
+		 * @param pairs vertices to get the joint marginals for
+		 * @param marginals one 12x12 covariance for each pair
+		 * @return true if the marginals have been computed
+		 * @throw UnknownVertex
+		 */
+		virtual bool getJointMarginals(const IdPairVector& /*pairs*/, JointCovarianceVector& /*marginals*/) { return false; }
+
 		/**
 		 * @brief Set the Logger to be used by the Solver.
 		 * @param log Specialized logger implementation.
@@ -1,5 +1,6 @@
 #include <slam3d/core/Solver.hpp>
 
+#include <map>
 #include <iostream>
 #include <boost/test/unit_test.hpp>
 
@@ -7,12 +8,12 @@ using namespace slam3d;
 
 void test_optimization(Solver* solver)
 {	
-	Transform pose(Eigen::Translation<double, 3>(0,0,0));
+	Transform pose(Eigen::Translation<ScalarType, 3>(0,0,0));
 
-	TransformWithCovariance tf_1_2(Transform(Eigen::Translation<double, 3>(1,0,0)), Covariance<6>::Identity());
-	TransformWithCovariance tf_2_3(Transform(Eigen::Translation<double, 3>(0,1,0)), Covariance<6>::Identity());
-	TransformWithCovariance tf_3_1(Transform(Eigen::Translation<double, 3>(-0.8, -0.7, 0.1)), Covariance<6>::Identity());
-	TransformWithCovariance tf_3_4(Transform(Eigen::Translation<double, 3>(0, 1, 0)), Covariance<6>::Identity());
+	TransformWithCovariance tf_1_2(Transform(Eigen::Translation<ScalarType, 3>(1,0,0)), Covariance<6>::Identity());
+	TransformWithCovariance tf_2_3(Transform(Eigen::Translation<ScalarType, 3>(0,1,0)), Covariance<6>::Identity());
+	TransformWithCovariance tf_3_1(Transform(Eigen::Translation<ScalarType, 3>(-0.8, -0.7, 0.1)), Covariance<6>::Identity());
+	TransformWithCovariance tf_3_4(Transform(Eigen::Translation<ScalarType, 3>(0, 1, 0)), Covariance<6>::Identity());
 	
 	solver->addVertex(1, pose);
 	solver->addVertex(2, pose);
@@ -45,5 +46,53 @@ void test_optimization(Solver* solver)
 	corr = solver->getCorrections();
 	BOOST_CHECK_EQUAL(corr.size(), 4);
 
+	BOOST_CHECK_NO_THROW(solver->removeVertex(4));
+	BOOST_CHECK_THROW(solver->removeVertex(4), Solver::UnknownVertex);
+	solver->compute();
+	corr = solver->getCorrections();
+	BOOST_CHECK_EQUAL(corr.size(), 3);
+
 	BOOST_CHECK_NO_THROW(solver->saveGraph("graph_optimized.g2o"));
 }
+
+void test_checkpoint(Solver* solver)
+{
+	Transform pose(Eigen::Translation<ScalarType, 3>(0,0,0));
+	TransformWithCovariance step(Transform(Eigen::Translation<ScalarType, 3>(1,0,0)), Covariance<6>::Identity());
+	TransformWithCovariance wrong(Transform(Eigen::Translation<ScalarType, 3>(5,5,0)), Covariance<6>::Identity());
+
+	solver->addVertex(1, pose);
+	solver->addVertex(2, pose);
+	solver->setFixed(1);
+	solver->addEdge(1, 2, SE3Constraint::Ptr(new SE3Constraint("DummySensor", step)));
+	BOOST_REQUIRE(solver->compute());
+	IdPoseVector corr = solver->getCorrections();
+	std::map<IdType, Transform> before(corr.begin(), corr.end());
+	BOOST_REQUIRE_EQUAL(before.size(), 2);
+
+	// A wrong loop closure is reverted
+	BOOST_REQUIRE(solver->checkpoint());
+	solver->addVertex(3, pose);
+	solver->addEdge(2, 3, SE3Constraint::Ptr(new SE3Constraint("DummySensor", step)));
+	solver->addEdge(3, 1, SE3Constraint::Ptr(new SE3Constraint("DummySensor", wrong)));
+	BOOST_REQUIRE(solver->compute());
+	BOOST_REQUIRE(solver->rollback());
+	corr = solver->getCorrections();
+	BOOST_CHECK_EQUAL(corr.size(), 2);
+	for(IdPoseVector::iterator c = corr.begin(); c != corr.end(); ++c)
+	{
+		BOOST_CHECK(c->second.isApprox(before.at(c->first)));
+	}
+	BOOST_CHECK_THROW(solver->addEdge(2, 3, SE3Constraint::Ptr(new SE3Constraint("DummySensor", step))), Solver::BadEdge);
+	BOOST_CHECK(!solver->rollback());
+
+	// Changes are kept when the checkpoint is released
+	BOOST_REQUIRE(solver->checkpoint());
+	solver->addVertex(3, pose);
+	solver->addEdge(2, 3, SE3Constraint::Ptr(new SE3Constraint("DummySensor", step)));
+	BOOST_REQUIRE(solver->compute());
+	BOOST_CHECK(solver->releaseCheckpoint());
+	BOOST_CHECK(!solver->releaseCheckpoint());
+	BOOST_CHECK(solver->compute());
+	BOOST_CHECK_EQUAL(solver->getCorrections().size(), 3);
+}
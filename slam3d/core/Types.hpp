@@ -26,7 +26,10 @@
 #ifndef SLAM_TYPES_HPP
 #define SLAM_TYPES_HPP
 
+#include "Pool.hpp"
+
 #include <sys/time.h>
+#include <stdint.h>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <Eigen/Geometry>
@@ -38,7 +41,14 @@
 namespace slam3d
 {
 	typedef unsigned IdType;
+	typedef uint64_t RevisionType;
+	// Build with SLAM3D_SCALAR_FLOAT to halve the memory of poses and
+	// covariances, solvers convert to their own precision internally.
+#ifdef SLAM3D_SCALAR_FLOAT
+	typedef float ScalarType;
+#else
 	typedef double ScalarType;
+#endif
 	typedef Eigen::Matrix<ScalarType,3,1> Position;
 	typedef Eigen::Matrix<ScalarType,3,1> Direction;
 	typedef Eigen::Transform<ScalarType,3,Eigen::Isometry> Transform;
@@ -56,6 +66,46 @@ namespace slam3d
 		TransformWithCovariance() : transform(Transform::Identity()), covariance(Covariance<6>::Identity()) {}
 		TransformWithCovariance(const Transform& t, const Covariance<6>& cov) : transform(t), covariance(cov) {}
 		static TransformWithCovariance Identity() {return TransformWithCovariance();}
+
+		/**
+		 * @brief Adjoint to transform a covariance through the given transform.
+		 * @details Uses the same error parametrization as the solvers, translation
+		 * followed by the vector part of the rotation's quaternion.
+		 * @param t transform
+		 */
+		static Covariance<6> adjoint(const Transform& t)
+		{
+			Eigen::Matrix<ScalarType,3,1> p = t.translation();
+			Eigen::Matrix<ScalarType,3,3> skew;
+			skew <<     0, -p(2),  p(1),
+			         p(2),     0, -p(0),
+			        -p(1),  p(0),     0;
+
+			// The rotational error is half the rotation angle, thus the factor 2
+			Covariance<6> adj = Covariance<6>::Zero();
+			adj.block<3,3>(0,0) = t.linear();
+			adj.block<3,3>(0,3) = 2 * skew * t.linear();
+			adj.block<3,3>(3,3) = t.linear();
+			return adj;
+		}
+
+		/**
+		 * @brief Get the inverse transform with the covariance in its frame.
+		 */
+		TransformWithCovariance inverse() const
+		{
+			Covariance<6> adj = adjoint(transform);
+			return TransformWithCovariance(transform.inverse(), adj * covariance * adj.transpose());
+		}
+
+		/**
+		 * @brief Concatenate two transforms with independent covariances.
+		 */
+		TransformWithCovariance operator*(const TransformWithCovariance& other) const
+		{
+			Covariance<6> adj = adjoint(other.transform.inverse());
+			return TransformWithCovariance(transform * other.transform, adj * covariance * adj.transpose() + other.covariance);
+		}
 		
 		bool isValid()
 		{
@@ -78,6 +128,22 @@ namespace slam3d
 		IdType mNextID;
 	};
 	
+	/**
+	 * @brief Type tag of the measurement classes, see Measurement::getAs.
+	 * @details Measurement classes outside of this library take their tag
+	 * from the user range, see userMeasurementType.
+	 */
+	enum class MeasurementType : uint16_t {GENERIC, POINT_CLOUD, SCAN_2D, GPS, USER = 0x100};
+
+	/**
+	 * @brief Get the n-th type tag of the user range.
+	 * @param n index of the measurement class within the application
+	 */
+	constexpr MeasurementType userMeasurementType(uint16_t n)
+	{
+		return static_cast<MeasurementType>(static_cast<uint16_t>(MeasurementType::USER) + n);
+	}
+
 	/**
 	 * @class Measurement
 	 * @brief Base class for a single reading from a sensor.
@@ -92,10 +158,13 @@ namespace slam3d
 		
 	public:
 		Measurement(const std::string& r, const std::string& s,
-		            const Transform& p, const boost::uuids::uuid id = boost::uuids::nil_uuid())
+		            const Transform& p, const boost::uuids::uuid id = boost::uuids::nil_uuid(),
+		            const timeval& stamp = timeval())
 		{
-			mRobotName = r;
-			mSensorName = s;
+			mType = MeasurementType::GENERIC;
+			mStamp = stamp;
+			mRobotName = &internName(r);
+			mSensorName = &internName(s);
 			mSensorPose = p;
 			mInverseSensorPose = p.inverse();
 			if(id.is_nil())
@@ -105,17 +174,29 @@ namespace slam3d
 		}
 		virtual ~Measurement(){}
 		
+		MeasurementType getType() const { return mType; }
+
+		/**
+		 * @brief Get this measurement as a derived type without a dynamic_cast.
+		 * @details The type is checked by comparing the type tag with T::TYPE.
+		 * The pointer is only valid as long as this measurement exists.
+		 * @return pointer to the derived measurement, NULL if it has another type
+		 */
+		template <typename T>
+		const T* getAs() const { return (mType == T::TYPE) ? static_cast<const T*>(this) : NULL; }
+
 		timeval getTimestamp() const { return mStamp; }
-		std::string getRobotName() const { return mRobotName; }
-		std::string getSensorName() const { return mSensorName; }
+		const std::string& getRobotName() const { return *mRobotName; }
+		const std::string& getSensorName() const { return *mSensorName; }
 		boost::uuids::uuid getUniqueId() const { return mUniqueId; }
 		Transform getSensorPose() const { return mSensorPose; }
 		Transform getInverseSensorPose() const { return mInverseSensorPose; }
 		
 	protected:
+		MeasurementType mType;  // set by the derived class
 		timeval mStamp;
-		std::string mRobotName;
-		std::string mSensorName;
+		const std::string* mRobotName;  // see internName
+		const std::string* mSensorName;
 		boost::uuids::uuid mUniqueId;
 		
 		Transform mSensorPose;
@@ -136,17 +217,17 @@ namespace slam3d
 		typedef boost::shared_ptr<Constraint> Ptr;
 		
 	public:
-		Constraint(const std::string& sensor) : mSensorName(sensor) {}
+		Constraint(const std::string& sensor) : mSensorName(&internName(sensor)) {}
 		virtual ~Constraint(){}
 		virtual ConstraintType getType() = 0;
 		virtual const char* getTypeName() = 0;
 
 		timeval getTimestamp() const { return mStamp; }
-		std::string getSensorName() const { return mSensorName; }
+		const std::string& getSensorName() const { return *mSensorName; }
 
 	protected:
 		timeval mStamp;
-		std::string mSensorName;
+		const std::string* mSensorName; // see internName
 	};
 	
 	/**
@@ -161,6 +242,9 @@ namespace slam3d
 		SE3Constraint(const std::string& s, const TransformWithCovariance& twc)
 		: Constraint(s), mRelativePose(twc) {}
 
+		static Ptr create(const std::string& s, const TransformWithCovariance& twc)
+		{ return allocatePooled<SE3Constraint>(s, twc); }
+
 		ConstraintType getType() { return SE3; }
 		const char* getTypeName() { return "SE(3)"; }
 		
@@ -182,6 +266,9 @@ namespace slam3d
 		
 		GravityConstraint(const std::string& s, const Direction& d, const Direction& r, const Covariance<2>& c)
 		: Constraint(s), mDirection(d), mReference(r), mCovariance(c) {}
+
+		static Ptr create(const std::string& s, const Direction& d, const Direction& r, const Covariance<2>& c)
+		{ return allocatePooled<GravityConstraint>(s, d, r, c); }
 		
 		ConstraintType getType() { return GRAVITY; }
 		const char* getTypeName() { return "Gravity"; }
@@ -207,6 +294,9 @@ namespace slam3d
 		
 		PositionConstraint(const std::string& s, const Position& p, const Covariance<3>& c)
 		: Constraint(s), mPosition(p), mCovariance(c) {}
+
+		static Ptr create(const std::string& s, const Position& p, const Covariance<3>& c)
+		{ return allocatePooled<PositionConstraint>(s, p, c); }
 		
 		ConstraintType getType() { return POSITION; }
 		const char* getTypeName() { return "Position"; }
@@ -226,7 +316,11 @@ namespace slam3d
 	class TentativeConstraint : public Constraint
 	{
 	public:
+		typedef boost::shared_ptr<TentativeConstraint> Ptr;
+
 		TentativeConstraint(const std::string& s):  Constraint(s){}
+
+		static Ptr create(const std::string& s) { return allocatePooled<TentativeConstraint>(s); }
 		
 		ConstraintType getType() { return TENTATIVE; }
 		const char* getTypeName() { return "Tentative"; }
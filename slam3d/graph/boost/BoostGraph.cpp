@@ -14,6 +14,7 @@
 #include <boost/property_map/property_map.hpp>
 #include <boost/graph/graphviz.hpp>
 
+#include <algorithm>
 #include <fstream>
 
 using namespace slam3d;
@@ -29,6 +30,7 @@ BoostGraph::~BoostGraph()
 
 EdgeObjectList BoostGraph::getEdgesFromSensor(const std::string& sensor) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	EdgeObjectList objectList;
 	EdgeRange edges = boost::edges(mPoseGraph);
 	for(EdgeIterator it = edges.first; it != edges.second; ++it)
@@ -84,13 +86,48 @@ void BoostGraph::addEdge(const EdgeObject& e)
 	}
 }
 
+void BoostGraph::deleteVertex(IdType id)
+{
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	IndexMap::iterator it = mIndexMap.find(id);
+	if(it == mIndexMap.end())
+	{
+		throw InvalidVertex(id);
+	}
+	Vertex v = it->second;
+	
+	// Edges are stored in both directions, so we only have to look at the neighbors
+	std::set<Vertex> neighbors;
+	AdjacencyIterator n, n_end;
+	for(boost::tie(n, n_end) = boost::adjacent_vertices(v, mPoseGraph); n != n_end; ++n)
+	{
+		if(*n != v)
+			neighbors.insert(*n);
+	}
+	for(std::set<Vertex>::iterator u = neighbors.begin(); u != neighbors.end(); ++u)
+	{
+		boost::remove_edge(*u, v, mPoseGraph);
+	}
+	boost::clear_out_edges(v, mPoseGraph);
+
+	// Vertices are stored in a list, so the other descriptors stay valid
+	boost::remove_vertex(v, mPoseGraph);
+	mIndexMap.erase(it);
+}
+
 void BoostGraph::removeEdge(IdType source, IdType target, const std::string& sensor)
 {
-	boost::remove_edge(getEdgeIterator(source, target, sensor), mPoseGraph);
+	// Edges are stored in both directions
+	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
+	OutEdgeIterator forward = getEdgeIterator(source, target, sensor);
+	OutEdgeIterator inverse = getEdgeIterator(target, source, sensor);
+	boost::remove_edge(forward, mPoseGraph);
+	boost::remove_edge(inverse, mPoseGraph);
 }
 
 VertexObjectList BoostGraph::getVerticesFromSensor(const std::string& sensor) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	VertexObjectList objectList;
 	VertexRange vertices = boost::vertices(mPoseGraph);
 	for(VertexIterator it = vertices.first; it != vertices.second; ++it)
@@ -103,8 +140,9 @@ VertexObjectList BoostGraph::getVerticesFromSensor(const std::string& sensor) co
 	return objectList;
 }
 
-const VertexObject& BoostGraph::getVertex(IdType id) const
+VertexObject BoostGraph::getVertex(IdType id) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	return mPoseGraph[mIndexMap.at(id)];
 }
 
@@ -113,8 +151,9 @@ VertexObject& BoostGraph::getVertexInternal(IdType id)
 	return mPoseGraph[mIndexMap.at(id)];
 }
 
-const EdgeObject& BoostGraph::getEdge(IdType source, IdType target, const std::string& sensor) const
+EdgeObject BoostGraph::getEdge(IdType source, IdType target, const std::string& sensor) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	OutEdgeIterator it = getEdgeIterator(source, target, sensor);
 	return mPoseGraph[*it];
 }
@@ -149,6 +188,7 @@ OutEdgeIterator BoostGraph::getEdgeIterator(IdType source, IdType target, const
 
 EdgeObjectList BoostGraph::getOutEdges(IdType source) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	OutEdgeIterator it, it_end;
 	boost::tie(it, it_end) = boost::out_edges(mIndexMap.at(source), mPoseGraph);
 	EdgeObjectList edges;
@@ -162,6 +202,7 @@ EdgeObjectList BoostGraph::getOutEdges(IdType source) const
 
 EdgeObjectList BoostGraph::getEdges(const VertexObjectList& vertices) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
 	std::set<int> v_ids;
 	for(VertexObjectList::const_iterator v = vertices.begin(); v != vertices.end(); v++)
 	{
@@ -212,6 +253,11 @@ struct EdgeFilter
 	std::string name;
 };
 
+static bool indexLess(const VertexObject& a, const VertexObject& b)
+{
+	return a.index < b.index;
+}
+
 typedef boost::filtered_graph<AdjacencyGraph, EdgeFilter> FilteredGraph;
 typedef std::map<FilteredGraph::vertex_descriptor, boost::default_color_type> ColorMap;
 typedef std::map<FilteredGraph::vertex_descriptor, unsigned> DepthMap;
@@ -240,6 +286,8 @@ private:
 
 VertexObjectList BoostGraph::getVerticesInRange(IdType source_id, unsigned range) const
 {
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
+
 	// Create required data structures
 	Vertex source = mIndexMap.at(source_id);
 	DepthMap depth_map;
@@ -257,24 +305,33 @@ VertexObjectList BoostGraph::getVerticesInRange(IdType source_id, unsigned range
 	{
 	}
 
-	// Write the result
+	// Write the result in the order of creation
 	VertexObjectList vertices;
 	for(DepthMap::iterator it = depth_map.begin(); it != depth_map.end(); ++it)
 	{
 		vertices.push_back(mPoseGraph[it->first]);
 	}
+	std::sort(vertices.begin(), vertices.end(), indexLess);
 	return vertices;
 }
 
 float BoostGraph::calculateGraphDistance(IdType source_id, IdType target_id)
 {
-	boost::unique_lock<boost::shared_mutex> guard(mGraphMutex);
-	int num = boost::num_vertices(mPoseGraph);
-	std::vector<Vertex> parent(num);
-	std::vector<float> distance(num);
+	boost::shared_lock<boost::shared_mutex> guard(mGraphMutex);
+
+	// Vertices are stored in a list, so they have to be enumerated for the search
+	std::map<Vertex, size_t> index;
+	VertexRange vertices = boost::vertices(mPoseGraph);
+	for(VertexIterator it = vertices.first; it != vertices.second; ++it)
+	{
+		index.insert(std::make_pair(*it, index.size()));
+	}
+	boost::associative_property_map<std::map<Vertex, size_t> > index_map(index);
+	std::vector<Vertex> parent(index.size());
+	std::vector<float> distance(index.size());
 	std::map<Edge, float> weight;
 	EdgeRange edges = boost::edges(mPoseGraph);
-	EdgeFilter filter(&mPoseGraph, getVertex(source_id).measurement->getSensorName());
+	EdgeFilter filter(&mPoseGraph, mPoseGraph[mIndexMap.at(source_id)].measurement->getSensorName());
 	for(EdgeIterator it = edges.first; it != edges.second; ++it)
 	{
 		if(filter(*it))
@@ -284,9 +341,10 @@ float BoostGraph::calculateGraphDistance(IdType source_id, IdType target_id)
 	}
 	
 	boost::dijkstra_shortest_paths(mPoseGraph, mIndexMap.at(source_id),
-		boost::distance_map(boost::make_iterator_property_map(distance.begin(), boost::get(boost::vertex_index, mPoseGraph)))
-		.predecessor_map(boost::make_iterator_property_map(parent.begin(), boost::get(boost::vertex_index, mPoseGraph)))
-		.weight_map(boost::make_assoc_property_map(weight)) );
+		boost::distance_map(boost::make_iterator_property_map(distance.begin(), index_map))
+		.predecessor_map(boost::make_iterator_property_map(parent.begin(), index_map))
+		.weight_map(boost::make_assoc_property_map(weight))
+		.vertex_index_map(index_map));
 
-	return distance[mIndexMap.at(target_id)];
+	return distance[index[mIndexMap.at(target_id)]];
 }
@@ -10,10 +10,11 @@
 namespace slam3d
 {
 	// Definitions of boost-graph related types
+	// Vertices are stored in a list, so their descriptors stay valid when others are removed
 	typedef boost::listS VRep;
-	typedef boost::vecS ERep;
+	typedef boost::listS ERep;
 	typedef boost::directedS GType;
-	typedef boost::adjacency_list<VRep, ERep, GType, VertexObject, EdgeObject> AdjacencyGraph;
+	typedef boost::adjacency_list<ERep, VRep, GType, VertexObject, EdgeObject> AdjacencyGraph;
 	
 	typedef boost::graph_traits<AdjacencyGraph>::vertex_descriptor Vertex;
 	typedef boost::graph_traits<AdjacencyGraph>::vertex_iterator VertexIterator;
@@ -54,18 +55,20 @@ namespace slam3d
 		bool optimize(unsigned iterations = 100);
 		
 		/**
-		 * @brief 
+		 * @brief Get a copy of a vertex while holding the shared graph lock.
 		 * @param id
+		 * @throw std::out_of_range
 		 */
-		const VertexObject& getVertex(IdType id) const;
+		VertexObject getVertex(IdType id) const;
 		
 		/**
-		 * @brief 
+		 * @brief Get a copy of an edge while holding the shared graph lock.
 		 * @param source
 		 * @param target
 		 * @param sensor
+		 * @throw InvalidVertex, InvalidEdge
 		 */
-		const EdgeObject& getEdge(IdType source, IdType target, const std::string& sensor) const;
+		EdgeObject getEdge(IdType source, IdType target, const std::string& sensor) const;
 		
 		/**
 		 * @brief Get all outgoing edges from given source.
@@ -125,6 +128,12 @@ namespace slam3d
 		 * @param e
 		 */
 		virtual void addEdge(const EdgeObject& e);
+
+		/**
+		 * @brief Remove the vertex and all its edges from the internal graph.
+		 * @param id
+		 */
+		virtual void deleteVertex(IdType id);
 		
 		/**
 		 * @brief 
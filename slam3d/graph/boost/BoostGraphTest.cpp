@@ -16,3 +16,68 @@ BOOST_AUTO_TEST_CASE(boost_graph_construction)
 	test_graph_construction(graph);
 	delete graph;
 }
+
+BOOST_AUTO_TEST_CASE(boost_graph_delta_sync)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph_delta.log");
+	logger.setLogLevel(DEBUG);
+	Graph* source = new BoostGraph(&logger);
+	Graph* target = new BoostGraph(&logger);
+	test_delta_sync(source, target);
+	delete source;
+	delete target;
+}
+
+BOOST_AUTO_TEST_CASE(boost_graph_delta_codec)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph_codec.log");
+	logger.setLogLevel(DEBUG);
+	Graph* source = new BoostGraph(&logger);
+	Graph* target = new BoostGraph(&logger);
+	test_delta_codec_and_replace(source, target);
+	delete source;
+	delete target;
+}
+
+BOOST_AUTO_TEST_CASE(boost_graph_sparsification)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph_sparse.log");
+	logger.setLogLevel(DEBUG);
+	Graph* source = new BoostGraph(&logger);
+	Graph* target = new BoostGraph(&logger);
+	test_sparsification(source, target);
+	delete source;
+	delete target;
+}
+
+BOOST_AUTO_TEST_CASE(boost_graph_loop_closure_buffer)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph_loops.log");
+	logger.setLogLevel(DEBUG);
+	Graph* graph = new BoostGraph(&logger);
+	test_loop_closure_buffer(graph);
+	delete graph;
+}
+
+BOOST_AUTO_TEST_CASE(boost_graph_trajectory_export)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph_trajectory.log");
+	Graph* graph = new BoostGraph(&logger);
+	test_trajectory_export(graph);
+	delete graph;
+}
+
+BOOST_AUTO_TEST_CASE(boost_graph_scan_localization)
+{
+	Clock clock;
+	FileLogger logger(clock, "boost_graph_localization.log");
+	logger.setLogLevel(DEBUG);
+	Graph* graph = new BoostGraph(&logger);
+	test_scan_sensor_localization(graph, &logger);
+	delete graph;
+}
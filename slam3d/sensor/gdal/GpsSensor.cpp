@@ -73,7 +73,7 @@ void GpsSensor::addMeasurement(const GpsMeasurement::Ptr &m)
 	mLastVertex = mMapper->addMeasurement(m);
 	Position rel_pos = m->getPosition() - mReference;
 	mLogger->message(DEBUG, (boost::format("GPS: relative pose (%1%, %2%, %3%)") % rel_pos(0) % rel_pos(1) % rel_pos(2)).str());
-	PositionConstraint::Ptr position(new PositionConstraint(mName, rel_pos, m->getCovariance()));
+	PositionConstraint::Ptr position = PositionConstraint::create(mName, rel_pos, m->getCovariance());
 	mMapper->getGraph()->addConstraint(mLastVertex, 0, position);
 	mLastPosition = m->getPosition();
 }
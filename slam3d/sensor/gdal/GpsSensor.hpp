@@ -36,11 +36,12 @@ namespace slam3d
 	{
 	public:
 		typedef boost::shared_ptr<GpsMeasurement> Ptr;
+		static const MeasurementType TYPE = MeasurementType::GPS;
 		
 		GpsMeasurement(const Position& pos, const Covariance<3>& cov,
 		               timeval t, const std::string& r, const std::string& s,
 	                   const Transform& p, const boost::uuids::uuid id = boost::uuids::nil_uuid())
-		: Measurement(r, s, p, id), mPosition(pos), mCovariance(cov){ mStamp = t; }
+		: Measurement(r, s, p, id), mPosition(pos), mCovariance(cov){ mType = TYPE; mStamp = t; }
 
 		~GpsMeasurement() {}
 		
@@ -0,0 +1,338 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "MultiResolutionMap.hpp"
+#include "PointCloudSensor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <stdexcept>
+
+using namespace slam3d;
+
+// Key of the voxel that contains the given one on a coarser level
+MultiResolutionMap::Key MultiResolutionMap::shift(const Key& k, unsigned levels)
+{
+	Key parent = {k.x >> levels, k.y >> levels, k.z >> levels};
+	return parent;
+}
+
+// Bit of the given voxel within the children of its parent
+uint8_t MultiResolutionMap::childBit(const Key& k)
+{
+	return 1 << ((k.x & 1) | ((k.y & 1) << 1) | ((k.z & 1) << 2));
+}
+
+// Clamps a voxel coordinate to the range of the keys
+static int32_t clampToKey(double v)
+{
+	const double min = std::numeric_limits<int32_t>::min();
+	const double max = std::numeric_limits<int32_t>::max();
+	return (int32_t)std::max(min, std::min(max, std::floor(v)));
+}
+
+size_t MultiResolutionMap::KeyHash::operator()(const Key& k) const
+{
+	uint64_t h = (uint64_t)(uint32_t)k.x * 0x9E3779B97F4A7C15ULL;
+	h ^= (uint64_t)(uint32_t)k.y * 0xC2B2AE3D27D4EB4FULL;
+	h ^= (uint64_t)(uint32_t)k.z * 0x165667B19E3779F9ULL;
+	return h ^ (h >> 29);
+}
+
+MultiResolutionMap::MultiResolutionMap(double resolution, unsigned levels)
+ : mResolution(resolution), mLevels(levels), mFilter(resolution)
+{
+	if(resolution <= 0)
+		throw std::invalid_argument("MultiResolutionMap requires a positive resolution!");
+	if(levels == 0 || levels > 16)
+		throw std::invalid_argument("MultiResolutionMap requires between 1 and 16 levels!");
+}
+
+bool MultiResolutionMap::getKey(double x, double y, double z, Key& key) const
+{
+	const double limit = std::numeric_limits<int32_t>::max();
+	double vx = x / mResolution;
+	double vy = y / mResolution;
+	double vz = z / mResolution;
+	if(!(std::fabs(vx) < limit && std::fabs(vy) < limit && std::fabs(vz) < limit))
+		return false;
+	key.x = std::floor(vx);
+	key.y = std::floor(vy);
+	key.z = std::floor(vz);
+	return true;
+}
+
+void MultiResolutionMap::insert(const Keyframe& keyframe)
+{
+	for(PointCloud::const_iterator p = keyframe.cloud->begin(); p != keyframe.cloud->end(); ++p)
+	{
+		Position q = keyframe.pose * Position(p->x, p->y, p->z);
+		Key key;
+		if(!getKey(q[0], q[1], q[2], key))
+			continue;
+		for(unsigned l = 0; l < mLevels.size(); l++)
+		{
+			Key k = shift(key, l);
+			Node& node = mLevels[l][k];
+			node.x += q[0];
+			node.y += q[1];
+			node.z += q[2];
+			node.count++;
+			if(l > 0)
+				node.children |= childBit(shift(key, l - 1));
+		}
+	}
+}
+
+void MultiResolutionMap::remove(const Keyframe& keyframe)
+{
+	for(PointCloud::const_iterator p = keyframe.cloud->begin(); p != keyframe.cloud->end(); ++p)
+	{
+		Position q = keyframe.pose * Position(p->x, p->y, p->z);
+		Key key;
+		if(!getKey(q[0], q[1], q[2], key))
+			continue;
+		bool erased_child = false;
+		for(unsigned l = 0; l < mLevels.size(); l++)
+		{
+			Key k = shift(key, l);
+			Level::iterator n = mLevels[l].find(k);
+			if(n == mLevels[l].end())
+				throw std::logic_error("MultiResolutionMap lost a voxel of a keyframe!");
+			if(erased_child)
+				n->second.children &= ~childBit(shift(key, l - 1));
+			if(--n->second.count == 0)
+			{
+				mLevels[l].erase(n);
+				erased_child = true;
+			}else
+			{
+				n->second.x -= q[0];
+				n->second.y -= q[1];
+				n->second.z -= q[2];
+				erased_child = false;
+			}
+		}
+	}
+}
+
+void MultiResolutionMap::addKeyframeInternal(IdType id, const PointCloud& cloud, const Transform& pose, const Position& origin)
+{
+	KeyframeMap::iterator k = mKeyframes.find(id);
+	if(k == mKeyframes.end())
+	{
+		Keyframe keyframe;
+		keyframe.cloud = PointCloud::Ptr(new PointCloud);
+		mFilter.filter(cloud, *keyframe.cloud);
+		keyframe.pose = pose;
+		keyframe.origin = origin;
+		k = mKeyframes.insert(KeyframeMap::value_type(id, keyframe)).first;
+	}else
+	{
+		remove(k->second);
+		k->second.pose = pose;
+		k->second.origin = origin;
+	}
+	insert(k->second);
+}
+
+void MultiResolutionMap::addKeyframe(IdType id, const PointCloud& cloud, const Transform& pose)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	KeyframeMap::iterator k = mKeyframes.find(id);
+	if(k != mKeyframes.end())
+	{
+		// The cloud might have changed as well
+		remove(k->second);
+		mKeyframes.erase(k);
+	}
+	addKeyframeInternal(id, cloud, pose, pose.translation());
+}
+
+bool MultiResolutionMap::removeKeyframe(IdType id)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	KeyframeMap::iterator k = mKeyframes.find(id);
+	if(k == mKeyframes.end())
+		return false;
+	remove(k->second);
+	mKeyframes.erase(k);
+	return true;
+}
+
+unsigned MultiResolutionMap::updateInternal(const VertexObjectList& vertices)
+{
+	unsigned changed = 0;
+	for(VertexObjectList::const_iterator v = vertices.begin(); v != vertices.end(); ++v)
+	{
+		const PointCloudMeasurement* m = v->measurement->getAs<PointCloudMeasurement>();
+		if(!m)
+			continue;
+		Transform pose = v->corrected_pose * m->getSensorPose();
+		KeyframeMap::const_iterator k = mKeyframes.find(v->index);
+		if(k != mKeyframes.end() && k->second.pose.matrix() == pose.matrix())
+			continue;
+		addKeyframeInternal(v->index, *m->getPointCloud(), pose, v->corrected_pose.translation());
+		changed++;
+	}
+	return changed;
+}
+
+unsigned MultiResolutionMap::update(const Graph* graph, const std::string& sensor)
+{
+	VertexObjectList vertices = graph->getVerticesFromSensor(sensor);
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	// Remove keyframes of vertices that are no longer in the graph
+	std::set<IdType> ids;
+	for(VertexObjectList::const_iterator v = vertices.begin(); v != vertices.end(); ++v)
+		ids.insert(v->index);
+	for(KeyframeMap::iterator k = mKeyframes.begin(); k != mKeyframes.end();)
+	{
+		if(ids.count(k->first) == 0)
+		{
+			remove(k->second);
+			mKeyframes.erase(k++);
+		}else
+		{
+			++k;
+		}
+	}
+	return updateInternal(vertices);
+}
+
+unsigned MultiResolutionMap::update(const Graph* graph, const std::string& sensor, const Transform& center, float radius)
+{
+	VertexObjectList vertices = graph->getNearbyVertices(sensor, center, radius);
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	// Remove keyframes in the region whose vertices have not been found
+	std::set<IdType> ids;
+	for(VertexObjectList::const_iterator v = vertices.begin(); v != vertices.end(); ++v)
+		ids.insert(v->index);
+	Position c = center.translation();
+	ScalarType max_dist = radius * radius;
+	for(KeyframeMap::iterator k = mKeyframes.begin(); k != mKeyframes.end();)
+	{
+		if(ids.count(k->first) == 0 && (k->second.origin - c).squaredNorm() <= max_dist)
+		{
+			remove(k->second);
+			mKeyframes.erase(k++);
+		}else
+		{
+			++k;
+		}
+	}
+	return updateInternal(vertices);
+}
+
+size_t MultiResolutionMap::getKeyframeCount() const
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	return mKeyframes.size();
+}
+
+void MultiResolutionMap::descend(unsigned level, const Key& key, const Node& node, unsigned target,
+                                 const Key* low, const Key* high, const Position& min, const Position& max,
+                                 PointCloud& out) const
+{
+	if(level == target)
+	{
+		Position c(node.x / node.count, node.y / node.count, node.z / node.count);
+		if((c.array() >= min.array()).all() && (c.array() <= max.array()).all())
+			out.push_back(PointType(c[0], c[1], c[2]));
+		return;
+	}
+
+	const Level& children = mLevels[level - 1];
+	const Key& lo = low[level - 1];
+	const Key& hi = high[level - 1];
+	for(unsigned b = 0; b < 8; b++)
+	{
+		if(!(node.children & (1 << b)))
+			continue;
+		Key k = {2 * key.x + (int32_t)(b & 1), 2 * key.y + (int32_t)((b >> 1) & 1), 2 * key.z + (int32_t)((b >> 2) & 1)};
+		if(k.x < lo.x || k.x > hi.x || k.y < lo.y || k.y > hi.y || k.z < lo.z || k.z > hi.z)
+			continue;
+		Level::const_iterator child = children.find(k);
+		if(child != children.end())
+			descend(level - 1, k, child->second, target, low, high, min, max, out);
+	}
+}
+
+void MultiResolutionMap::getMap(const Position& min, const Position& max, double resolution, PointCloud& out) const
+{
+	out.clear();
+	out.height = 1;
+	out.is_dense = true;
+
+	unsigned target = 0;
+	while(target + 1 < mLevels.size() && getResolution(target + 1) <= resolution)
+		target++;
+
+	// Range of keys within the box on each level
+	std::vector<Key> low(mLevels.size());
+	std::vector<Key> high(mLevels.size());
+	Key lo0 = {clampToKey(min[0] / mResolution), clampToKey(min[1] / mResolution), clampToKey(min[2] / mResolution)};
+	Key hi0 = {clampToKey(max[0] / mResolution), clampToKey(max[1] / mResolution), clampToKey(max[2] / mResolution)};
+	for(unsigned l = 0; l < mLevels.size(); l++)
+	{
+		low[l] = shift(lo0, l);
+		high[l] = shift(hi0, l);
+	}
+
+	std::lock_guard<std::mutex> guard(mMutex);
+	unsigned top = mLevels.size() - 1;
+	const Level& roots = mLevels[top];
+	const Key& lo = low[top];
+	const Key& hi = high[top];
+	double volume = (hi.x - (double)lo.x + 1) * (hi.y - (double)lo.y + 1) * (hi.z - (double)lo.z + 1);
+	if(volume <= roots.size())
+	{
+		// Look up the few voxels that are within the box
+		for(int64_t x = lo.x; x <= hi.x; x++)
+			for(int64_t y = lo.y; y <= hi.y; y++)
+				for(int64_t z = lo.z; z <= hi.z; z++)
+				{
+					Key k = {(int32_t)x, (int32_t)y, (int32_t)z};
+					Level::const_iterator root = roots.find(k);
+					if(root != roots.end())
+						descend(top, k, root->second, target, low.data(), high.data(), min, max, out);
+				}
+	}else
+	{
+		for(Level::const_iterator root = roots.begin(); root != roots.end(); ++root)
+		{
+			const Key& k = root->first;
+			if(k.x < lo.x || k.x > hi.x || k.y < lo.y || k.y > hi.y || k.z < lo.z || k.z > hi.z)
+				continue;
+			descend(top, k, root->second, target, low.data(), high.data(), min, max, out);
+		}
+	}
+	out.width = out.size();
+}
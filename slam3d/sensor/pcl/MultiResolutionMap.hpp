@@ -0,0 +1,174 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SLAM3D_MULTIRESOLUTIONMAP_HPP
+#define SLAM3D_MULTIRESOLUTIONMAP_HPP
+
+#include <slam3d/sensor/pcl/VoxelFilter.hpp>
+#include <slam3d/core/Graph.hpp>
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace slam3d
+{
+	/**
+	 * @class MultiResolutionMap
+	 * @brief Global point cloud map with several levels of detail.
+	 * @details The map is a hashed octree: each level is a hash map of voxels,
+	 * where each level doubles the voxel size of the one below. Each voxel
+	 * holds the sum of all points inside, so the centroids of all levels are
+	 * maintained when keyframes are added, moved or removed. Queries descend
+	 * from the top level only into occupied children within the requested
+	 * region, so their cost depends on the size of the result and not on the
+	 * size of the map. All methods can be called from different threads.
+	 */
+	class MultiResolutionMap
+	{
+	public:
+		/**
+		 * @brief Constructor.
+		 * @param resolution voxel size of the finest level
+		 * @param levels number of levels, each doubling the voxel size
+		 * @throw std::invalid_argument
+		 */
+		MultiResolutionMap(double resolution, unsigned levels);
+
+		/**
+		 * @brief Add the cloud of a keyframe to the map.
+		 * @details The cloud is downsampled to the finest resolution and kept,
+		 * so that it can be removed again. If the keyframe exists, it is
+		 * moved to the new pose.
+		 * @param id identifier of the keyframe, e.g. its vertex
+		 * @param cloud point cloud in the keyframe's frame
+		 * @param pose pose of the cloud in map coordinates
+		 */
+		void addKeyframe(IdType id, const PointCloud& cloud, const Transform& pose);
+
+		/**
+		 * @brief Remove the cloud of a keyframe from the map.
+		 * @param id identifier of the keyframe
+		 * @return false if the keyframe is not part of the map
+		 */
+		bool removeKeyframe(IdType id);
+
+		/**
+		 * @brief Synchronize the map with all vertices of a sensor.
+		 * @details New vertices are added, vertices with a changed pose are
+		 * moved and keyframes of removed vertices are removed.
+		 * @param graph pose graph with PointCloudMeasurements
+		 * @param sensor name of the sensor
+		 * @return number of keyframes that have been added or moved
+		 */
+		unsigned update(const Graph* graph, const std::string& sensor);
+
+		/**
+		 * @brief Synchronize the map with the vertices of a sensor in a region.
+		 * @details The vertices are found with the incremental spatial index of
+		 * the graph, see Graph::getNearbyVertices, so the graph is not modified.
+		 * Keyframes within the region whose vertices have been removed or have
+		 * left the region are removed as well.
+		 * @param graph pose graph with PointCloudMeasurements
+		 * @param sensor name of the sensor
+		 * @param center center of the region
+		 * @param radius radius of the region
+		 * @return number of keyframes that have been added or moved
+		 */
+		unsigned update(const Graph* graph, const std::string& sensor, const Transform& center, float radius);
+
+		/**
+		 * @brief Get the map within a box at the given resolution.
+		 * @details The coarsest level that is at least as fine as the given
+		 * resolution is used. Each voxel with its centroid inside the box
+		 * contributes one point.
+		 * @param min lower corner of the box
+		 * @param max upper corner of the box
+		 * @param resolution requested resolution
+		 * @param out resulting point cloud
+		 */
+		void getMap(const Position& min, const Position& max, double resolution, PointCloud& out) const;
+
+		/**
+		 * @brief Voxel size of the given level.
+		 * @param level
+		 */
+		double getResolution(unsigned level) const { return mResolution * (1 << level); }
+
+		unsigned getLevels() const { return mLevels.size(); }
+
+		size_t getKeyframeCount() const;
+
+	protected:
+		struct Key
+		{
+			int32_t x, y, z;
+			bool operator==(const Key& other) const { return x == other.x && y == other.y && z == other.z; }
+		};
+
+		struct KeyHash
+		{
+			size_t operator()(const Key& k) const;
+		};
+
+		struct Node
+		{
+			double x, y, z;   // sum of the points
+			uint32_t count;   // number of points
+			uint8_t children; // occupied children, one bit per octant
+		};
+
+		struct Keyframe
+		{
+			PointCloud::Ptr cloud;
+			Transform pose;
+			Position origin; // position of the vertex, used for regional updates
+		};
+
+		typedef std::unordered_map<Key, Node, KeyHash> Level;
+		typedef std::map<IdType, Keyframe> KeyframeMap;
+
+		static Key shift(const Key& k, unsigned levels);
+		static uint8_t childBit(const Key& k);
+		bool getKey(double x, double y, double z, Key& key) const;
+		void insert(const Keyframe& keyframe);
+		void remove(const Keyframe& keyframe);
+		void addKeyframeInternal(IdType id, const PointCloud& cloud, const Transform& pose, const Position& origin);
+		unsigned updateInternal(const VertexObjectList& vertices);
+		void descend(unsigned level, const Key& key, const Node& node, unsigned target,
+		             const Key* low, const Key* high, const Position& min, const Position& max,
+		             PointCloud& out) const;
+
+	protected:
+		double mResolution;
+		std::vector<Level> mLevels;
+		KeyframeMap mKeyframes;
+		VoxelFilter mFilter;
+		mutable std::mutex mMutex;
+	};
+}
+
+#endif
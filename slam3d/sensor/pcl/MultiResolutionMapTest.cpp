@@ -0,0 +1,102 @@
+#define BOOST_TEST_MODULE "MultiResolutionMapTest"
+
+#include <boost/test/unit_test.hpp>
+
+#include "MultiResolutionMap.hpp"
+#include "PointCloudSensor.hpp"
+
+#include <slam3d/graph/boost/BoostGraph.hpp>
+
+using namespace slam3d;
+
+// A 1 x 1 m square of points with 0.1 m spacing
+static PointCloud::Ptr createSquare()
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	for(int x = 0; x < 10; x++)
+		for(int y = 0; y < 10; y++)
+			cloud->push_back(PointType(0.1 * x + 0.05, 0.1 * y + 0.05, 0.05));
+	return cloud;
+}
+
+static Transform createPose(ScalarType x, ScalarType y)
+{
+	Transform pose = Transform::Identity();
+	pose.translation() = Position(x, y, 0);
+	return pose;
+}
+
+BOOST_AUTO_TEST_CASE(multi_resolution_map_keyframes)
+{
+	MultiResolutionMap map(0.1, 3);
+	PointCloud::Ptr square = createSquare();
+	PointCloud out;
+	Position min(-100, -100, -100);
+	Position max(100, 100, 100);
+
+	// Each point fills one voxel of the finest level
+	map.addKeyframe(1, *square, createPose(0, 0));
+	map.getMap(min, max, 0.1, out);
+	BOOST_CHECK_EQUAL(out.size(), 100);
+
+	// Coarser levels merge 2 x 2 and 4 x 4 points
+	map.getMap(min, max, 0.2, out);
+	BOOST_CHECK_EQUAL(out.size(), 25);
+	map.getMap(min, max, 0.4, out);
+	BOOST_CHECK_EQUAL(out.size(), 9);
+
+	// Only voxels with their centroid in the box are returned
+	map.getMap(Position(0, 0, 0), Position(0.5, 0.5, 1), 0.1, out);
+	BOOST_CHECK_EQUAL(out.size(), 25);
+
+	// Moving a keyframe does not leave points behind
+	map.addKeyframe(2, *square, createPose(5, 0));
+	map.addKeyframe(2, *square, createPose(10, 0));
+	BOOST_CHECK_EQUAL(map.getKeyframeCount(), 2);
+	map.getMap(Position(4, -1, -1), Position(7, 2, 1), 0.1, out);
+	BOOST_CHECK_EQUAL(out.size(), 0);
+	map.getMap(min, max, 0.1, out);
+	BOOST_CHECK_EQUAL(out.size(), 200);
+
+	// Removed keyframes are gone on all levels
+	BOOST_CHECK(map.removeKeyframe(1));
+	BOOST_CHECK(!map.removeKeyframe(1));
+	map.getMap(min, max, 0.4, out);
+	BOOST_CHECK_EQUAL(out.size(), 9);
+	BOOST_CHECK(map.removeKeyframe(2));
+	map.getMap(min, max, 0.1, out);
+	BOOST_CHECK_EQUAL(out.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(multi_resolution_map_regional_update)
+{
+	Clock clock;
+	Logger logger(clock);
+	BoostGraph boost_graph(&logger);
+	Graph& graph = boost_graph;
+	MultiResolutionMap map(0.1, 3);
+
+	IdType ids[3];
+	for(int i = 0; i < 3; i++)
+	{
+		Measurement::Ptr m(new PointCloudMeasurement(createSquare(), "R1", "S1", Transform::Identity()));
+		ids[i] = graph.addVertex(m, createPose(10 * i, 0));
+	}
+
+	// Only vertices within the region are added
+	BOOST_CHECK_EQUAL(map.update(&graph, "S1", createPose(0, 0), 15), 2);
+	BOOST_CHECK_EQUAL(map.getKeyframeCount(), 2);
+	BOOST_CHECK_EQUAL(map.update(&graph, "S1", createPose(0, 0), 15), 0);
+
+	// Keyframes of removed vertices are dropped
+	graph.removeVertex(ids[0]);
+	BOOST_CHECK_EQUAL(map.update(&graph, "S1", createPose(0, 0), 15), 0);
+	BOOST_CHECK_EQUAL(map.getKeyframeCount(), 1);
+	PointCloud out;
+	map.getMap(Position(-1, -1, -1), Position(2, 2, 1), 0.1, out);
+	BOOST_CHECK_EQUAL(out.size(), 0);
+
+	// The global update adds the rest of the map
+	BOOST_CHECK_EQUAL(map.update(&graph, "S1"), 1);
+	BOOST_CHECK_EQUAL(map.getKeyframeCount(), 2);
+}
@@ -24,25 +24,117 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "PointCloudSensor.hpp"
+#include "PointKernels.hpp"
 
 #include <slam3d/core/Mapper.hpp>
 
 #include <pcl/registration/gicp.h>
 #include <pcl/registration/ndt.h>
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/filters/radius_outlier_removal.h>
 #include <pcl/pcl_config.h>
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#define MAX_RESERVED_POINTS 1048576
+
 using namespace slam3d;
 
+// GICP counts its iterations, but does not provide them
+class CountingGICP : public pcl::GeneralizedIterativeClosestPoint<PointType, PointType>
+{
+public:
+	int getIterations() const { return nr_iterations_; }
+};
+
+// Registration engines and buffers that are reused by all calls within a thread.
+// They are shared by all sensors of the thread and reconfigured on each call,
+// so the buffers grow to the largest cloud any of them registers. Only these
+// buffers are allocation free when warm: PCL allocates within the engines, and
+// transform, downsample and removeOutliers return newly allocated clouds.
+struct RegistrationContext
+{
+	RegistrationContext()
+	 : filtered_source(new PointCloud), filtered_target(new PointCloud), shifted_target(new PointCloud),
+	   source_filter(1.0), target_filter(1.0) {}
+
+	CountingGICP icp;
+	pcl::NormalDistributionsTransform<PointType, PointType> ndt;
+	RegistrationStatistics statistics;
+	PointCloud::Ptr filtered_source;
+	PointCloud::Ptr filtered_target;
+	PointCloud::Ptr shifted_target;
+	PointCloud result;
+	VoxelFilter source_filter;
+	VoxelFilter target_filter;
+};
+
+static RegistrationContext& getRegistrationContext()
+{
+	static thread_local RegistrationContext context;
+	return context;
+}
+
+// Each thread filters with its own VoxelFilter, so sensors can be
+// used from several threads without sharing the filter's buffers.
+static VoxelFilter& getVoxelFilter()
+{
+	static thread_local VoxelFilter filter(0.1);
+	return filter;
+}
+
+void PointCloudCodec::encode(const Measurement::Ptr& m, std::ostream& out) const
+{
+	const PointCloudMeasurement* pcl = m->getAs<PointCloudMeasurement>();
+	if(!pcl)
+		throw BadMeasurementType();
+
+	const PointCloud& cloud = *(pcl->getPointCloud());
+	uint32_t size = cloud.size();
+	out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	for(PointCloud::const_iterator p = cloud.begin(); p != cloud.end(); ++p)
+	{
+		out.write(reinterpret_cast<const char*>(p->data), 3 * sizeof(float));
+	}
+}
+
+Measurement::Ptr PointCloudCodec::decode(std::istream& in, const std::string& robot, const std::string& sensor,
+                                         const Transform& sensor_pose, boost::uuids::uuid id, timeval stamp) const
+{
+	uint32_t size = 0;
+	if(!in.read(reinterpret_cast<char*>(&size), sizeof(size)))
+		throw BadDeltaStream("Point cloud in delta stream is truncated!");
+
+	// The cloud grows with the points that actually arrive, so a
+	// corrupt size cannot allocate more memory than the payload holds.
+	PointCloud::Ptr cloud(new PointCloud);
+	cloud->reserve(std::min<uint32_t>(size, MAX_RESERVED_POINTS));
+	float xyz[3];
+	for(uint32_t i = 0; i < size; i++)
+	{
+		if(!in.read(reinterpret_cast<char*>(xyz), sizeof(xyz)))
+			throw BadDeltaStream("Point cloud in delta stream is truncated!");
+		cloud->push_back(PointType(xyz[0], xyz[1], xyz[2]));
+	}
+
+	cloud->header.stamp = (uint64_t)stamp.tv_sec * 1000000 + stamp.tv_usec;
+	return allocatePooled<PointCloudMeasurement>(cloud, robot, sensor, sensor_pose, id);
+}
+
 PointCloudSensor::PointCloudSensor(const std::string& n, Logger* l)
  : ScanSensor(n, l)
 {
+	mVoxelMode = CENTROID;
 	mMapResolution = 0.1;
 	mMapOutlierRadius = 0.2;
 	mMapOutlierNeighbors = 3;
+	mMaxScanRange = 30.0;
+	mFusionResolution = 0;
+	mCloudCacheResolution = 0;
+	mCloudCacheSize = 1000;
 }
 
 PointCloudSensor::~PointCloudSensor()
@@ -53,13 +145,20 @@ PointCloudSensor::~PointCloudSensor()
 PointCloud::Ptr PointCloudSensor::downsample(PointCloud::ConstPtr in, double leaf_size) const
 {
 	PointCloud::Ptr out(new PointCloud);
-	pcl::VoxelGrid<PointType> grid;
-	grid.setLeafSize (leaf_size, leaf_size, leaf_size);
-	grid.setInputCloud(in);
-	grid.filter(*out);
+	filterVoxels(*in, *out, leaf_size);
 	return out;
 }
 
+void PointCloudSensor::filterVoxels(const PointCloud& in, PointCloud& out, double resolution,
+                                    unsigned min_neighbors, unsigned range) const
+{
+	VoxelFilter& filter = getVoxelFilter();
+	filter.setLeafSize(resolution);
+	filter.setMode(mVoxelMode);
+	filter.setMinSupport(min_neighbors, range);
+	filter.filter(in, out);
+}
+
 PointCloud::Ptr PointCloudSensor::removeOutliers(PointCloud::ConstPtr in, double radius, unsigned min_neighbors) const
 {
 	PointCloud::Ptr out(new PointCloud);
@@ -74,7 +173,12 @@ PointCloud::Ptr PointCloudSensor::removeOutliers(PointCloud::ConstPtr in, double
 PointCloud::Ptr PointCloudSensor::transform(PointCloud::ConstPtr source, const Transform tf) const
 {
 	PointCloud::Ptr transformedCloud(new PointCloud);
-	pcl::transformPointCloud(*source, *transformedCloud, tf.matrix());
+	transformedCloud->header = source->header;
+	transformedCloud->points.resize(source->size());
+	transformedCloud->width = source->width;
+	transformedCloud->height = source->height;
+	transformedCloud->is_dense = source->is_dense;
+	PointKernels::transform(source->points.data(), transformedCloud->points.data(), source->size(), tf.matrix().cast<float>());
 	return transformedCloud;
 }
 
@@ -83,7 +187,7 @@ PointCloud::Ptr PointCloudSensor::getAccumulatedCloud(const VertexObjectList& ve
 	PointCloud::Ptr accu(new PointCloud);
 	for(VertexObjectList::const_reverse_iterator it = vertices.rbegin(); it != vertices.rend(); it++)
 	{
-		PointCloudMeasurement::Ptr pcl = boost::dynamic_pointer_cast<PointCloudMeasurement>(it->measurement);
+		const PointCloudMeasurement* pcl = it->measurement->getAs<PointCloudMeasurement>();
 		if(!pcl)
 		{
 			mLogger->message(ERROR, "Measurement in getAccumulatedCloud() is not a point cloud!");
@@ -96,16 +200,158 @@ PointCloud::Ptr PointCloudSensor::getAccumulatedCloud(const VertexObjectList& ve
 	return accu;
 }
 
+RegistrationStatistics PointCloudSensor::getLastRegistrationStatistics()
+{
+	return getRegistrationContext().statistics;
+}
+
+double PointCloudSensor::getPatchResolution() const
+{
+	double fine = mFineConfiguration.point_cloud_density;
+	double coarse = mCoarseConfiguration.point_cloud_density;
+	if(fine <= 0 || coarse <= 0)
+		return 0;
+	return std::min(fine, coarse);
+}
+
+PointCloud::ConstPtr PointCloudSensor::getCachedCloud(const PointCloudMeasurement& m, double resolution) const
+{
+	{
+		std::lock_guard<std::mutex> guard(mCloudCacheMutex);
+		if(resolution != mCloudCacheResolution)
+		{
+			mCloudCache.clear();
+			mCloudCacheOrder.clear();
+			mCloudCacheResolution = resolution;
+		}
+
+		CloudCache::iterator cached = mCloudCache.find(m.getUniqueId());
+		if(cached != mCloudCache.end())
+		{
+			mCloudCacheOrder.splice(mCloudCacheOrder.begin(), mCloudCacheOrder, cached->second.position);
+			return cached->second.cloud;
+		}
+	}
+
+	// Other threads may use the cache in the meantime
+	PointCloud::Ptr cloud = downsample(m.getPointCloud(), resolution);
+
+	std::lock_guard<std::mutex> guard(mCloudCacheMutex);
+	if(resolution != mCloudCacheResolution || mCloudCacheSize == 0)
+		return cloud;
+
+	CloudCache::iterator cached = mCloudCache.find(m.getUniqueId());
+	if(cached != mCloudCache.end())
+		return cached->second.cloud;
+
+	mCloudCacheOrder.push_front(m.getUniqueId());
+	CachedCloud entry = {cloud, mCloudCacheOrder.begin()};
+	mCloudCache.insert(CloudCache::value_type(m.getUniqueId(), entry));
+	while(mCloudCache.size() > mCloudCacheSize)
+	{
+		mCloudCache.erase(mCloudCacheOrder.back());
+		mCloudCacheOrder.pop_back();
+	}
+	return cloud;
+}
+
+void PointCloudSensor::setCloudCacheSize(size_t n)
+{
+	std::lock_guard<std::mutex> guard(mCloudCacheMutex);
+	mCloudCacheSize = n;
+	while(mCloudCache.size() > mCloudCacheSize)
+	{
+		mCloudCache.erase(mCloudCacheOrder.back());
+		mCloudCacheOrder.pop_back();
+	}
+}
+
 Measurement::Ptr PointCloudSensor::createCombinedMeasurement(const VertexObjectList& vertices, Transform pose) const
 {
-	PointCloud::Ptr cloud = getAccumulatedCloud(vertices);
-	PointCloud::Ptr shifted(new PointCloud);
-	pcl::transformPointCloud(*cloud, *shifted, pose.inverse().matrix());
-	mLogger->message(DEBUG, (boost::format("Patch pointcloud has %1% points.") % cloud->size()).str());
-	Measurement::Ptr m(new PointCloudMeasurement(shifted, "AccumulatedPointcloud", mName, Transform::Identity()));
+	double resolution = getPatchResolution();
+	Transform origin = pose.inverse();
+	PointCloud::Ptr accu(new PointCloud);
+	for(VertexObjectList::const_reverse_iterator it = vertices.rbegin(); it != vertices.rend(); it++)
+	{
+		const PointCloudMeasurement* pcl = it->measurement->getAs<PointCloudMeasurement>();
+		if(!pcl)
+		{
+			mLogger->message(ERROR, "Measurement in createCombinedMeasurement() is not a point cloud!");
+			throw BadMeasurementType();
+		}
+
+		// Transform each cloud only once, directly into the patch's frame
+		PointCloud::ConstPtr cloud = pcl->getPointCloud();
+		if(resolution > 0)
+			cloud = getCachedCloud(*pcl, resolution);
+		PointCloud::Ptr tempCloud = transform(cloud, origin * it->corrected_pose * pcl->getSensorPose());
+		*accu += *tempCloud;
+	}
+
+	// Overlapping clouds are merged into one voxel grid at patch resolution
+	PointCloud::Ptr patch = accu;
+	if(resolution > 0)
+		patch = downsample(accu, resolution);
+	mLogger->message(DEBUG, (boost::format("Patch pointcloud has %1% points.") % patch->size()).str());
+	static const std::string& robot = internName("AccumulatedPointcloud");
+	Measurement::Ptr m = allocatePooled<PointCloudMeasurement>(patch, robot, mName, Transform::Identity());
 	return m;
 }
 
+PointCloudMeasurement::Ptr PointCloudSensor::fuseMeasurements(const std::vector<PointCloudMeasurement::Ptr>& clouds,
+                                                              PoseSensor* odometry) const
+{
+	if(clouds.empty())
+		throw std::invalid_argument("Cannot fuse an empty list of point clouds!");
+
+	// The latest cloud defines the timestamp of the keyframe
+	size_t latest = 0;
+	for(size_t i = 1; i < clouds.size(); i++)
+	{
+		if(clouds[i]->getPointCloud()->header.stamp > clouds[latest]->getPointCloud()->header.stamp)
+			latest = i;
+	}
+
+	// Get the poses and the position of each cloud within the merged one
+	std::vector<Transform> poses(clouds.size());
+	std::vector<size_t> offsets(clouds.size() + 1, 0);
+	Transform reference = Transform::Identity();
+	if(odometry)
+		reference = odometry->getPose(clouds[latest]->getTimestamp()).inverse();
+	bool dense = true;
+	for(size_t i = 0; i < clouds.size(); i++)
+	{
+		poses[i] = clouds[i]->getSensorPose();
+		if(odometry)
+			poses[i] = reference * odometry->getPose(clouds[i]->getTimestamp()) * poses[i];
+		offsets[i + 1] = offsets[i] + clouds[i]->getPointCloud()->size();
+		dense = dense && clouds[i]->getPointCloud()->is_dense;
+	}
+
+	PointCloud::Ptr merged(new PointCloud);
+	merged->header = clouds[latest]->getPointCloud()->header;
+	merged->points.resize(offsets.back());
+	merged->width = merged->size();
+	merged->height = 1;
+	merged->is_dense = dense;
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int i = 0; i < (int)clouds.size(); i++)
+	{
+		const PointCloud& cloud = *clouds[i]->getPointCloud();
+		PointKernels::transform(cloud.points.data(), merged->points.data() + offsets[i], cloud.size(),
+		                        poses[i].matrix().cast<float>());
+	}
+
+	PointCloud::Ptr fused = merged;
+	if(mFusionResolution > 0)
+	{
+		fused.reset(new PointCloud);
+		filterVoxels(*merged, *fused, mFusionResolution);
+	}
+	mLogger->message(DEBUG, (boost::format("Fused %1% point clouds into %2% points.") % clouds.size() % fused->size()).str());
+	return allocatePooled<PointCloudMeasurement>(fused, clouds[latest]->getRobotName(), mName, Transform::Identity());
+}
 
 Constraint::Ptr PointCloudSensor::createConstraint(const Measurement::Ptr& source,
                                                    const Measurement::Ptr& target,
@@ -115,8 +361,8 @@ Constraint::Ptr PointCloudSensor::createConstraint(const Measurement::Ptr& sourc
 	Transform guess = source->getInverseSensorPose() * odometry * target->getSensorPose();
 	
 	// Cast to this sensors measurement type
-	PointCloudMeasurement::Ptr sourceCloud = boost::dynamic_pointer_cast<PointCloudMeasurement>(source);
-	PointCloudMeasurement::Ptr targetCloud = boost::dynamic_pointer_cast<PointCloudMeasurement>(target);
+	const PointCloudMeasurement* sourceCloud = source->getAs<PointCloudMeasurement>();
+	const PointCloudMeasurement* targetCloud = target->getAs<PointCloudMeasurement>();
 	if(!sourceCloud || !targetCloud)
 	{
 		mLogger->message(ERROR, "Measurement given to createConstraint() is not a PointCloud!");
@@ -126,32 +372,40 @@ Constraint::Ptr PointCloudSensor::createConstraint(const Measurement::Ptr& sourc
 	// For large loops, refine guess by a coarse ICP
 	if(loop)
 	{
-		guess = align(sourceCloud, targetCloud, guess, mCoarseConfiguration);
+		guess = align(*sourceCloud, *targetCloud, guess, mCoarseConfiguration);
 	}
 	
 	// Calculate precise alignement with fine ICP
-	Transform icp_result = align(sourceCloud, targetCloud, guess, mFineConfiguration);
+	Transform icp_result = align(*sourceCloud, *targetCloud, guess, mFineConfiguration);
 	
 	// Transform back to robot frame
 	TransformWithCovariance twc;
 	twc.transform = source->getSensorPose() * icp_result * target->getInverseSensorPose();
 	twc.covariance = Covariance<6>::Identity() * mCovarianceScale;
 	
-	return Constraint::Ptr(new SE3Constraint(mName, twc));
+	return SE3Constraint::create(mName, twc);
 }
 
-Transform PointCloudSensor::align(PointCloudMeasurement::Ptr source,
-                                  PointCloudMeasurement::Ptr target,
+Transform PointCloudSensor::align(const PointCloudMeasurement& source,
+                                  const PointCloudMeasurement& target,
                                   const Transform& guess,
                                   const RegistrationParameters& config)
 {
-	// Downsample the scans
-	PointCloud::Ptr filtered_source = source->getPointCloud();
-	PointCloud::Ptr filtered_target = target->getPointCloud();
+	// Downsample the scans into this thread's buffers
+	RegistrationContext& context = getRegistrationContext();
+	context.statistics = RegistrationStatistics();
+	PointCloud::Ptr filtered_source = source.getPointCloud();
+	PointCloud::Ptr filtered_target = target.getPointCloud();
 	if(config.point_cloud_density > 0)
 	{
-		PointCloud::Ptr filtered_source = downsample(source->getPointCloud(), config.point_cloud_density);
-		PointCloud::Ptr filtered_target = downsample(target->getPointCloud(), config.point_cloud_density);
+		context.source_filter.setLeafSize(config.point_cloud_density);
+		context.source_filter.setMode(mVoxelMode);
+		context.source_filter.filter(*source.getPointCloud(), *context.filtered_source);
+		context.target_filter.setLeafSize(config.point_cloud_density);
+		context.target_filter.setMode(mVoxelMode);
+		context.target_filter.filter(*target.getPointCloud(), *context.filtered_target);
+		filtered_source = context.filtered_source;
+		filtered_target = context.filtered_target;
 	}
 	
 	// Make sure that there are enough points left (ICP will crash if not)
@@ -168,12 +422,22 @@ Transform PointCloudSensor::align(PointCloudMeasurement::Ptr source,
 	}
 }
 
+void PointCloudSensor::getRegistrationBuffers(const PointCloud*& source, const PointCloud*& target,
+                                              const PointCloud*& result)
+{
+	RegistrationContext& context = getRegistrationContext();
+	source = context.filtered_source.get();
+	target = context.filtered_target.get();
+	result = &context.result;
+}
+
 Transform PointCloudSensor::doICP(PointCloud::Ptr source,
                                   PointCloud::Ptr target,
                                   const Transform& guess,
                                   const RegistrationParameters& config)
 {
-	pcl::GeneralizedIterativeClosestPoint<PointType, PointType> icp;
+	RegistrationContext& context = getRegistrationContext();
+	CountingGICP& icp = context.icp;
 	icp.setMaxCorrespondenceDistance(config.max_correspondence_distance);
 	icp.setMaximumIterations(config.maximum_iterations);
 	icp.setTransformationEpsilon(config.transformation_epsilon);
@@ -182,14 +446,14 @@ Transform PointCloudSensor::doICP(PointCloud::Ptr source,
 	icp.setMaximumOptimizerIterations(config.maximum_optimizer_iterations);
 	icp.setRotationEpsilon(config.rotation_epsilon);
 	
-	PointCloud result;
+	PointCloud& result = context.result;
 
 #if PCL_VERSION_COMPARE(<, 1, 8, 1)
 	// We cannot use the "guess" parameter from align() due to a bug in PCL.
 	// Instead we have to shift the source cloud to the target frame before
 	// calling align on it.
 	// > https://github.com/PointCloudLibrary/pcl/pull/989
-	PointCloud::Ptr shifted_target(new PointCloud);
+	PointCloud::Ptr shifted_target = context.shifted_target;
 	pcl::transformPointCloud(*target, *shifted_target, guess.matrix());
 	
 	// Source and target are switched at this point!
@@ -206,6 +470,8 @@ Transform PointCloudSensor::doICP(PointCloud::Ptr source,
 
 	// Check if ICP was successful (kind of...)
 	double score = icp.getFitnessScore(config.max_correspondence_distance);
+	context.statistics.iterations = icp.getIterations();
+	context.statistics.fitness_score = score;
 	if(!icp.hasConverged() || score > config.max_fitness_score)
 	{
 		throw NoMatch((boost::format("ICP failed with Fitness-Score %1% > %2%") % score % config.max_fitness_score).str());
@@ -224,7 +490,8 @@ Transform PointCloudSensor::doNDT(PointCloud::Ptr source,
                                   const Transform& guess,
                                   const RegistrationParameters& config)
 {
-	pcl::NormalDistributionsTransform<PointType, PointType> ndt;
+	RegistrationContext& context = getRegistrationContext();
+	pcl::NormalDistributionsTransform<PointType, PointType>& ndt = context.ndt;
 	ndt.setMaxCorrespondenceDistance(config.max_correspondence_distance);
 	ndt.setMaximumIterations(config.maximum_iterations);
 	ndt.setTransformationEpsilon(config.transformation_epsilon);
@@ -238,11 +505,13 @@ Transform PointCloudSensor::doNDT(PointCloud::Ptr source,
 	// but ICP calculates the transformation from target to source.
 	ndt.setInputSource(target);
 	ndt.setInputTarget(source);
-	PointCloud result;
+	PointCloud& result = context.result;
 	ndt.align(result, guess.matrix().cast<float>());
 
 	// Check if NDT was successful (kind of...)
 	double score = ndt.getFitnessScore(config.max_correspondence_distance);
+	context.statistics.iterations = ndt.getFinalNumIteration();
+	context.statistics.fitness_score = score;
 	mLogger->message(DEBUG, (boost::format("NDT: fitness(%1%) probability(%2%) iterations(%3%)")
 		%score % ndt.getTransformationProbability() % ndt.getFinalNumIteration()).str());
 	if(!ndt.hasConverged() || score > config.max_fitness_score)
@@ -258,6 +527,59 @@ Transform PointCloudSensor::doNDT(PointCloud::Ptr source,
 PointCloud::Ptr PointCloudSensor::buildMap(const VertexObjectList& vertices) const
 {
 	PointCloud::Ptr accu = getAccumulatedCloud(vertices);
-	PointCloud::Ptr cleaned = removeOutliers(accu, mMapOutlierRadius, mMapOutlierNeighbors);
-	return downsample(cleaned, mMapResolution);
+	PointCloud::Ptr map(new PointCloud);
+	filterVoxels(*accu, *map, mMapResolution, mMapOutlierNeighbors,
+	             std::max(1.0, std::ceil(mMapOutlierRadius / mMapResolution)));
+	return map;
+}
+
+PointCloud::Ptr PointCloudSensor::buildLocalMap(const Transform& center, double radius, double resolution)
+{
+	Graph* graph = mMapper->getGraph();
+	VertexObjectList vertices = graph->getNearbyVertices(mName, center, radius + mMaxScanRange);
+	mLogger->message(DEBUG, (boost::format("Building local map from %1% keyframes.") % vertices.size()).str());
+
+	// Use the cached clouds, if they are fine enough
+	double patch_resolution = getPatchResolution();
+	std::vector<PointCloud::ConstPtr> clouds(vertices.size());
+	std::vector<Transform> poses(vertices.size());
+	for(size_t i = 0; i < vertices.size(); i++)
+	{
+		const PointCloudMeasurement* pcl = vertices[i].measurement->getAs<PointCloudMeasurement>();
+		if(!pcl)
+		{
+			mLogger->message(ERROR, "Measurement in buildLocalMap() is not a point cloud!");
+			throw BadMeasurementType();
+		}
+		if(patch_resolution > 0 && patch_resolution <= resolution)
+			clouds[i] = getCachedCloud(*pcl, patch_resolution);
+		else
+			clouds[i] = pcl->getPointCloud();
+		poses[i] = vertices[i].corrected_pose * pcl->getSensorPose();
+	}
+
+	// Transform the keyframes in parallel and drop all points outside the region
+	const Eigen::Vector3f origin = center.translation().cast<float>();
+	const float squared_radius = radius * radius;
+	std::vector<PointCloud> parts(vertices.size());
+	#pragma omp parallel for schedule(dynamic)
+	for(int i = 0; i < (int)vertices.size(); i++)
+	{
+		const PointCloud& cloud = *clouds[i];
+		PointCloud& part = parts[i];
+		part.points.resize(cloud.size());
+		PointKernels::transform(cloud.points.data(), part.points.data(), cloud.size(), poses[i].matrix().cast<float>());
+		part.points.resize(PointKernels::crop(part.points.data(), part.points.data(), cloud.size(), origin, squared_radius));
+		part.width = part.size();
+		part.height = 1;
+	}
+
+	PointCloud accu;
+	for(std::vector<PointCloud>::const_iterator part = parts.begin(); part != parts.end(); ++part)
+		accu += *part;
+
+	PointCloud::Ptr map(new PointCloud);
+	filterVoxels(accu, *map, resolution, mMapOutlierNeighbors,
+	             std::max(1.0, std::ceil(mMapOutlierRadius / resolution)));
+	return map;
 }
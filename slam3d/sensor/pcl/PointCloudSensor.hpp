@@ -27,19 +27,19 @@
 #define SLAM_POINTCLOUDSENSOR_HPP
 
 #include <slam3d/sensor/pcl/RegistrationParameters.hpp>
+#include <slam3d/sensor/pcl/VoxelFilter.hpp>
 
 #include <slam3d/core/Graph.hpp>
+#include <slam3d/core/DeltaStream.hpp>
 #include <slam3d/core/ScanSensor.hpp>
 #include <slam3d/core/PoseSensor.hpp>
 
-#include <pcl/point_types.h>
-#include <pcl/point_cloud.h>
+#include <list>
+#include <map>
+#include <mutex>
 
 namespace slam3d
 {
-	typedef pcl::PointXYZ PointType;
-	typedef pcl::PointCloud<PointType> PointCloud;
-	
 	/**
 	 * @class PointCloudMeasurement
 	 * @brief Specific Measurement of the PointCloudSensor. 
@@ -48,6 +48,7 @@ namespace slam3d
 	{
 	public:
 		typedef boost::shared_ptr<PointCloudMeasurement> Ptr;
+		static const MeasurementType TYPE = MeasurementType::POINT_CLOUD;
 	
 	public:
 		/**
@@ -63,6 +64,7 @@ namespace slam3d
 		                      const Transform& p, const boost::uuids::uuid id = boost::uuids::nil_uuid())
 		: Measurement(r, s, p, id)
 		{
+			mType = TYPE;
 			mPointCloud = cloud;
 
 			// PCL header should contain microseconds
@@ -74,12 +76,29 @@ namespace slam3d
 		 * @brief Gets the point cloud contained within this measurement.
 		 * @return Constant shared pointer to the point cloud
 		 */
-		const PointCloud::Ptr getPointCloud() const {return mPointCloud;}
+		const PointCloud::Ptr& getPointCloud() const {return mPointCloud;}
 		
 	protected:
 		PointCloud::Ptr mPointCloud;
 	};
 
+	/**
+	 * @class PointCloudCodec
+	 * @brief Encodes PointCloudMeasurements to be exchanged within delta streams.
+	 * @details Only the coordinates of the points are transmitted.
+	 */
+	class PointCloudCodec : public MeasurementCodec
+	{
+	public:
+		void encode(const Measurement::Ptr& m, std::ostream& out) const;
+		Measurement::Ptr decode(std::istream& in,
+		                        const std::string& robot,
+		                        const std::string& sensor,
+		                        const Transform& sensor_pose,
+		                        boost::uuids::uuid id,
+		                        timeval stamp) const;
+	};
+
 	/**
 	 * @class PointCloudSensor
 	 * @brief Plugin for the mapper that manages point cloud measurements.
@@ -101,11 +120,34 @@ namespace slam3d
 		
 		/**
 		 * @brief Create a virtual measurement by accumulating pointclouds from given vertices.
+		 * @details The clouds are combined at the patch resolution, see
+		 * getPatchResolution. Each vertex contributes its cached downsampled
+		 * cloud, so the cost depends on the size of the result.
 		 * @param vertices list of vertices that should contain a PointCloudMeasurement
 		 * @param pose origin of the accumulated pointcloud
 		 * @throw BadMeasurementType
 		 */		
 		Measurement::Ptr createCombinedMeasurement(const VertexObjectList& vertices, Transform pose) const;
+
+		/**
+		 * @brief Merge time-synchronized clouds of several sensors into one keyframe.
+		 * @details This allows to use multiple LiDARs with a single instance,
+		 * so they share one trajectory and one stream of loop closures. Each
+		 * cloud is moved into the robot's frame by the sensor pose of its
+		 * measurement. If odometry is given, the robot's motion between the
+		 * timestamp of a cloud and the latest timestamp is compensated, which
+		 * becomes the timestamp of the result. The clouds are transformed in
+		 * parallel and downsampled with the fusion resolution, see
+		 * setFusionResolution. The result belongs to this sensor and has an
+		 * identity sensor pose, so it can be passed to addMeasurement.
+		 * @param clouds measurements of the individual sensors
+		 * @param odometry pose sensor to compensate the motion, NULL to disable
+		 * @return fused measurement in the robot's frame
+		 * @throw std::invalid_argument if no clouds are given
+		 * @throw InvalidPose if the odometry has no pose for a timestamp
+		 */
+		PointCloudMeasurement::Ptr fuseMeasurements(const std::vector<PointCloudMeasurement::Ptr>& clouds,
+		                                            PoseSensor* odometry = NULL) const;
 		
 		/**
 		 * @brief 
@@ -137,14 +179,62 @@ namespace slam3d
 		void setMapResolution(double r) { mMapResolution = r; }
 		
 		/**
-		 * @brief 
-		 * @param r
-		 * @param n
+		 * @brief Sets the outlier removal used by buildMap.
+		 * @details Voxels of the map with less than n neighboring points
+		 * within about the radius r are dropped, see VoxelFilter::setMinSupport.
+		 * @param r radius to look for neighbors, rounded up to full voxels
+		 * @param n minimum number of neighbors, 0 to disable outlier removal
 		 */
 		void setMapOutlierRemoval(double r, unsigned n) { mMapOutlierRadius = r; mMapOutlierNeighbors = n; }
+
+		/**
+		 * @brief Sets the voxel size of clouds merged by fuseMeasurements.
+		 * @details Overlapping regions of the sensors are merged into one
+		 * point per voxel.
+		 * @param r voxel size, 0 to keep all points (default)
+		 */
+		void setFusionResolution(double r) { mFusionResolution = r; }
+
+		/**
+		 * @brief Sets the number of downsampled clouds kept in the cache.
+		 * @details The least recently used clouds are dropped first, this
+		 * includes the clouds of vertices that have been removed from the graph.
+		 * @param n maximum number of cached clouds (default 1000)
+		 */
+		void setCloudCacheSize(size_t n);
 		
+		/**
+		 * @brief Get the statistics of the last registration in this thread.
+		 * @details This includes registrations that failed with NoMatch. The
+		 * statistics are shared by all sensors registering in the same thread.
+		 */
+		static RegistrationStatistics getLastRegistrationStatistics();
+
+		/**
+		 * @brief Resolution of the clouds combined into patches.
+		 * @details This is the finer point_cloud_density of the fine and the
+		 * coarse configuration, as registration would not use more points.
+		 * @return voxel size, 0 if patches are combined at full resolution
+		 */
+		double getPatchResolution() const;
+
+		/**
+		 * @brief Sets the maximum range of the scans.
+		 * @details This is used by buildLocalMap to find all keyframes that
+		 * might contribute points to a region.
+		 * @param r maximum distance of points from the sensor
+		 */
+		void setMaxScanRange(double r) { mMaxScanRange = r; }
+
+		/**
+		 * @brief Sets which point of a voxel is kept when downsampling.
+		 * @param mode either the centroid (default) or the first point of each voxel
+		 */
+		void setVoxelMode(VoxelMode mode) { mVoxelMode = mode; }
+
 		/**
 		 * @brief Reduces the size of the source cloud by sampling with the given resolution.
+		 * @details This uses the sensor's VoxelFilter with the mode set by setVoxelMode.
 		 * @param source
 		 * @param resolution 
 		 */
@@ -176,25 +266,91 @@ namespace slam3d
 		 */
 		PointCloud::Ptr getAccumulatedCloud(const VertexObjectList& vertices) const;
 		
+		/**
+		 * @brief Creates a downsampled map from all measurements in vertices.
+		 * @details Outliers are removed while downsampling with the map
+		 * resolution, see setMapOutlierRemoval.
+		 * @param vertices
+		 * @return map pointcloud
+		 * @throw BadMeasurementType
+		 */
 		PointCloud::Ptr buildMap(const VertexObjectList& vertices) const;
+
+		/**
+		 * @brief Creates a downsampled map of the region around a point.
+		 * @details Keyframes are found with the graph's spatial index of this
+		 * sensor, taking the maximum scan range into account. Only points within the radius
+		 * are accumulated. Outliers are removed like in buildMap.
+		 * @param center center of the region in map coordinates
+		 * @param radius radius of the region
+		 * @param resolution voxel size of the map
+		 * @return map pointcloud
+		 */
+		PointCloud::Ptr buildLocalMap(const Transform& center, double radius, double resolution);
 	
 	protected:
-		Transform align(PointCloudMeasurement::Ptr source, PointCloudMeasurement::Ptr target,
+		/**
+		 * @brief Get the downsampled cloud of a measurement from the cache.
+		 * @details The cloud is created on the first request, the least
+		 * recently used cloud is dropped when the cache is full. The cache is
+		 * cleared when the resolution changes.
+		 * @param m measurement of this sensor
+		 * @param resolution voxel size
+		 */
+		PointCloud::ConstPtr getCachedCloud(const PointCloudMeasurement& m, double resolution) const;
+
+		Transform align(const PointCloudMeasurement& source, const PointCloudMeasurement& target,
 		                const Transform& guess, const RegistrationParameters& config);
 
+		/**
+		 * @brief Get the clouds that registration in this thread reuses between calls.
+		 * @param source downsampled source cloud
+		 * @param target downsampled target cloud
+		 * @param result aligned cloud of the last registration
+		 */
+		static void getRegistrationBuffers(const PointCloud*& source, const PointCloud*& target,
+		                                   const PointCloud*& result);
+
 		Transform doICP(PointCloud::Ptr source, PointCloud::Ptr target,
 		                const Transform& guess, const RegistrationParameters& config);
 
 		Transform doNDT(PointCloud::Ptr source, PointCloud::Ptr target,
 		                const Transform& guess, const RegistrationParameters& config);
 
+		/**
+		 * @brief Downsample with the calling thread's VoxelFilter, whose buffers are reused between calls.
+		 * @param in source cloud
+		 * @param out downsampled cloud
+		 * @param resolution edge length of the voxels
+		 * @param min_neighbors minimum support of each voxel, see VoxelFilter::setMinSupport
+		 * @param range neighboring voxels in each direction that support a voxel
+		 */
+		void filterVoxels(const PointCloud& in, PointCloud& out, double resolution,
+		                  unsigned min_neighbors = 0, unsigned range = 0) const;
+
 	protected:
 		RegistrationParameters mFineConfiguration;
 		RegistrationParameters mCoarseConfiguration;
 		
+		VoxelMode mVoxelMode;
 		double   mMapResolution;
 		double   mMapOutlierRadius;
+		double   mMaxScanRange;
+		double   mFusionResolution;
 		unsigned mMapOutlierNeighbors;
+
+		typedef std::list<boost::uuids::uuid> CloudCacheOrder;
+		struct CachedCloud
+		{
+			PointCloud::Ptr cloud;
+			CloudCacheOrder::iterator position; // in mCloudCacheOrder, most recent first
+		};
+		typedef std::map<boost::uuids::uuid, CachedCloud> CloudCache;
+		mutable CloudCache mCloudCache;
+		mutable CloudCacheOrder mCloudCacheOrder;
+		size_t mCloudCacheSize;
+		mutable double mCloudCacheResolution;
+		mutable std::mutex mCloudCacheMutex;
 	};
 }
 
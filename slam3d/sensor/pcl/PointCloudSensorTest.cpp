@@ -0,0 +1,284 @@
+#define BOOST_TEST_MODULE "PointCloudSensorTest"
+
+#include <boost/test/unit_test.hpp>
+
+#include "PointCloudSensor.hpp"
+
+#include <slam3d/core/Mapper.hpp>
+#include <slam3d/graph/boost/BoostGraph.hpp>
+
+#include <iostream>
+#include <sstream>
+
+using namespace slam3d;
+
+// A measurement class defined by an application
+class MarkerMeasurement : public Measurement
+{
+public:
+	static const MeasurementType TYPE = userMeasurementType(1);
+
+	MarkerMeasurement(const Transform& p) : Measurement("R1", "S1", p) { mType = TYPE; }
+};
+
+// Odometry that moves along the x-axis with 1 m/s
+class LinearOdometry : public PoseSensor
+{
+public:
+	LinearOdometry() : PoseSensor("Odometry", NULL, NULL) {}
+	void handleNewVertex(IdType vertex) {}
+	Transform getPose(timeval stamp)
+	{
+		return Transform(Eigen::Translation<ScalarType, 3>(stamp.tv_sec + stamp.tv_usec * 1e-6, 0, 0));
+	}
+};
+
+BOOST_AUTO_TEST_CASE(point_cloud_codec_round_trip)
+{
+	PointCloud::Ptr cloud(new PointCloud);
+	for(int i = 0; i < 10; i++)
+		cloud->push_back(PointType(i, 0.5 * i, -0.25 * i));
+	Transform sensor_pose(Eigen::Translation<ScalarType, 3>(0, 0, 1));
+	PointCloudMeasurement::Ptr m(new PointCloudMeasurement(cloud, "R1", "S1", sensor_pose));
+
+	PointCloudCodec codec;
+	std::stringstream payload;
+	codec.encode(m, payload);
+
+	timeval stamp;
+	stamp.tv_sec = 12;
+	stamp.tv_usec = 345;
+	Measurement::Ptr decoded = codec.decode(payload, "R1", "S1", sensor_pose, m->getUniqueId(), stamp);
+	const PointCloudMeasurement* pcl = decoded->getAs<PointCloudMeasurement>();
+	BOOST_REQUIRE(pcl);
+	BOOST_CHECK(decoded->getUniqueId() == m->getUniqueId());
+	BOOST_CHECK_EQUAL(decoded->getTimestamp().tv_sec, 12);
+	BOOST_CHECK_EQUAL(decoded->getTimestamp().tv_usec, 345);
+	BOOST_CHECK(decoded->getSensorPose().isApprox(sensor_pose));
+
+	const PointCloud& out = *(pcl->getPointCloud());
+	BOOST_REQUIRE_EQUAL(out.size(), cloud->size());
+	for(size_t i = 0; i < out.size(); i++)
+	{
+		BOOST_CHECK_EQUAL(out[i].x, (*cloud)[i].x);
+		BOOST_CHECK_EQUAL(out[i].y, (*cloud)[i].y);
+		BOOST_CHECK_EQUAL(out[i].z, (*cloud)[i].z);
+	}
+
+	// Truncated payloads are rejected
+	std::istringstream in(payload.str().substr(0, payload.str().size() / 2));
+	BOOST_CHECK_THROW(codec.decode(in, "R1", "S1", sensor_pose, m->getUniqueId(), stamp), BadDeltaStream);
+
+	// A corrupt size is rejected without allocating it
+	std::string corrupt = payload.str();
+	uint32_t huge = 0xffffffff;
+	corrupt.replace(0, sizeof(huge), reinterpret_cast<const char*>(&huge), sizeof(huge));
+	std::istringstream corrupt_in(corrupt);
+	BOOST_CHECK_THROW(codec.decode(corrupt_in, "R1", "S1", sensor_pose, m->getUniqueId(), stamp), BadDeltaStream);
+
+	// Other measurements cannot be encoded
+	Measurement::Ptr generic(new Measurement("R1", "S1", sensor_pose));
+	BOOST_CHECK_THROW(codec.encode(generic, std::cout), BadMeasurementType);
+	Measurement::Ptr marker(new MarkerMeasurement(sensor_pose));
+	BOOST_CHECK(marker->getAs<MarkerMeasurement>());
+	BOOST_CHECK(!marker->getAs<PointCloudMeasurement>());
+	BOOST_CHECK_THROW(codec.encode(marker, std::cout), BadMeasurementType);
+}
+
+// Exposes the cloud cache of the sensor
+class CachingSensor : public PointCloudSensor
+{
+public:
+	CachingSensor(Logger* l) : PointCloudSensor("S1", l) {}
+	using PointCloudSensor::getCachedCloud;
+};
+
+BOOST_AUTO_TEST_CASE(point_cloud_cache_eviction)
+{
+	Clock clock;
+	Logger logger(clock);
+	CachingSensor sensor(&logger);
+	sensor.setCloudCacheSize(2);
+
+	std::vector<PointCloudMeasurement::Ptr> m;
+	for(int i = 0; i < 3; i++)
+	{
+		PointCloud::Ptr cloud(new PointCloud);
+		for(int j = 0; j < 10; j++)
+			cloud->push_back(PointType(0.1 * j, i, 0));
+		m.push_back(PointCloudMeasurement::Ptr(new PointCloudMeasurement(cloud, "R1", "S1", Transform::Identity())));
+	}
+
+	// Cached clouds are shared until they are evicted
+	PointCloud::ConstPtr first = sensor.getCachedCloud(*m[0], 0.5);
+	PointCloud::ConstPtr second = sensor.getCachedCloud(*m[1], 0.5);
+	BOOST_CHECK_EQUAL(first->size(), 2);
+	BOOST_CHECK(sensor.getCachedCloud(*m[0], 0.5) == first);
+
+	// The least recently used cloud is dropped first
+	sensor.getCachedCloud(*m[2], 0.5);
+	BOOST_CHECK(sensor.getCachedCloud(*m[0], 0.5) == first);
+	BOOST_CHECK(sensor.getCachedCloud(*m[1], 0.5) != second);
+
+	// A new resolution clears the cache
+	BOOST_CHECK(sensor.getCachedCloud(*m[0], 0.25) != first);
+}
+
+// Exposes the registration of the sensor
+class AligningSensor : public PointCloudSensor
+{
+public:
+	AligningSensor(Logger* l) : PointCloudSensor("S1", l) {}
+	using PointCloudSensor::align;
+	using PointCloudSensor::getRegistrationBuffers;
+};
+
+BOOST_AUTO_TEST_CASE(point_cloud_registration_buffers)
+{
+	Clock clock;
+	Logger logger(clock);
+	AligningSensor sensor(&logger);
+
+	// A 4 x 4 m square of points with 0.1 m spacing, 400 points remain after filtering
+	PointCloud::Ptr square(new PointCloud);
+	for(int x = 0; x < 40; x++)
+		for(int y = 0; y < 40; y++)
+			square->push_back(PointType(0.1 * x + 0.05, 0.1 * y + 0.05, 0.05));
+	PointCloudMeasurement large(square, "R1", "S1", Transform::Identity());
+
+	// A smaller square with 144 points after filtering
+	PointCloud::Ptr small_square(new PointCloud);
+	for(int x = 0; x < 24; x++)
+		for(int y = 0; y < 24; y++)
+			small_square->push_back(PointType(0.1 * x + 0.05, 0.1 * y + 0.05, 0.05));
+	PointCloudMeasurement small(small_square, "R1", "S1", Transform::Identity());
+	RegistrationParameters config;
+
+	// The first registration sizes the buffers of this thread
+	sensor.align(large, large, Transform::Identity(), config);
+	const PointCloud* filtered_source;
+	const PointCloud* filtered_target;
+	const PointCloud* result;
+	sensor.getRegistrationBuffers(filtered_source, filtered_target, result);
+	BOOST_REQUIRE_GE(filtered_source->size(), 100);
+	BOOST_REQUIRE_GE(filtered_target->size(), 100);
+	BOOST_REQUIRE(!result->points.empty());
+	const PointType* source_data = filtered_source->points.data();
+	const PointType* target_data = filtered_target->points.data();
+	const PointType* result_data = result->points.data();
+
+	// Later registrations reuse them without reallocating, also for smaller clouds
+	for(int i = 0; i < 10; i++)
+	{
+		if(i % 2)
+			sensor.align(large, large, Transform::Identity(), config);
+		else
+			sensor.align(small, small, Transform::Identity(), config);
+		const PointCloud* s;
+		const PointCloud* t;
+		const PointCloud* r;
+		sensor.getRegistrationBuffers(s, t, r);
+		BOOST_CHECK(s == filtered_source);
+		BOOST_CHECK(t == filtered_target);
+		BOOST_CHECK(r == result);
+		BOOST_CHECK(s->points.data() == source_data);
+		BOOST_CHECK(t->points.data() == target_data);
+		BOOST_CHECK(r->points.data() == result_data);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(point_cloud_local_map)
+{
+	Clock clock;
+	Logger logger(clock);
+	BoostGraph boost_graph(&logger);
+	Graph& graph = boost_graph;
+	Mapper mapper(&graph, &logger);
+	PointCloudSensor sensor("S1", &logger);
+	mapper.registerSensor(&sensor);
+	sensor.setMaxScanRange(2.0);
+	sensor.setMapOutlierRemoval(0.2, 0);
+
+	// A 1 x 1 m square of points with 0.1 m spacing at each keyframe
+	PointCloud::Ptr square(new PointCloud);
+	for(int x = 0; x < 10; x++)
+		for(int y = 0; y < 10; y++)
+			square->push_back(PointType(0.1 * x + 0.05, 0.1 * y + 0.05, 0.05));
+	for(int i = 0; i < 3; i++)
+	{
+		Measurement::Ptr m(new PointCloudMeasurement(square, "R1", "S1", Transform::Identity()));
+		graph.addVertex(m, Transform(Eigen::Translation<ScalarType, 3>(10 * i, 0, 0)));
+	}
+
+	// Only keyframes within the radius plus the scan range contribute
+	Transform center = Transform::Identity();
+	BOOST_CHECK_EQUAL(sensor.buildLocalMap(center, 5, 0.1)->size(), 100);
+	BOOST_CHECK_EQUAL(sensor.buildLocalMap(center, 15, 0.1)->size(), 200);
+
+	// Points outside of the radius are dropped
+	PointCloud::Ptr map = sensor.buildLocalMap(center, 0.5, 0.1);
+	size_t inside = 0;
+	for(PointCloud::const_iterator p = square->begin(); p != square->end(); ++p)
+		if(p->x * p->x + p->y * p->y + p->z * p->z <= 0.25)
+			inside++;
+	BOOST_CHECK_EQUAL(map->size(), inside);
+	for(PointCloud::const_iterator p = map->begin(); p != map->end(); ++p)
+		BOOST_CHECK_LE(p->x * p->x + p->y * p->y + p->z * p->z, 0.25 + 1e-4);
+
+	// New keyframes are found without rebuilding an index
+	Measurement::Ptr m(new PointCloudMeasurement(square, "R1", "S1", Transform::Identity()));
+	graph.addVertex(m, Transform(Eigen::Translation<ScalarType, 3>(2, 0, 0)));
+	BOOST_CHECK_EQUAL(sensor.buildLocalMap(center, 5, 0.1)->size(), 200);
+}
+
+BOOST_AUTO_TEST_CASE(point_cloud_fusion)
+{
+	Clock clock;
+	Logger logger(clock);
+	PointCloudSensor sensor("Fused", &logger);
+	BOOST_CHECK_THROW(sensor.fuseMeasurements(std::vector<PointCloudMeasurement::Ptr>()), std::invalid_argument);
+
+	// Two sensors on either side of the robot, the first one is the latest
+	std::vector<PointCloudMeasurement::Ptr> clouds;
+	uint64_t stamps[2] = {1500000, 1000000};
+	ScalarType offsets[2] = {1, -1};
+	for(int k = 0; k < 2; k++)
+	{
+		PointCloud::Ptr cloud(new PointCloud);
+		for(int i = 0; i < 5; i++)
+			cloud->push_back(PointType(i, 0, 0));
+		cloud->header.stamp = stamps[k];
+		Transform sensor_pose(Eigen::Translation<ScalarType, 3>(0, offsets[k], 0));
+		clouds.push_back(PointCloudMeasurement::Ptr(new PointCloudMeasurement(cloud, "R1", "S1", sensor_pose)));
+	}
+
+	// Without odometry the clouds are only moved by their sensor pose
+	PointCloudMeasurement::Ptr fused = sensor.fuseMeasurements(clouds);
+	const PointCloud& points = *fused->getPointCloud();
+	BOOST_REQUIRE_EQUAL(points.size(), 10);
+	BOOST_CHECK_EQUAL(fused->getSensorName(), "Fused");
+	BOOST_CHECK_EQUAL(fused->getRobotName(), "R1");
+	BOOST_CHECK_EQUAL(fused->getTimestamp().tv_sec, 1);
+	BOOST_CHECK_EQUAL(fused->getTimestamp().tv_usec, 500000);
+	BOOST_CHECK(fused->getSensorPose().isApprox(Transform::Identity()));
+	BOOST_CHECK_CLOSE(points[0].y, 1.0f, 1e-4f);
+	BOOST_CHECK_CLOSE(points[9].x, 4.0f, 1e-4f);
+	BOOST_CHECK_CLOSE(points[9].y, -1.0f, 1e-4f);
+
+	// The earlier cloud is moved back by the motion until the latest stamp
+	LinearOdometry odometry;
+	fused = sensor.fuseMeasurements(clouds, &odometry);
+	const PointCloud& moved = *fused->getPointCloud();
+	BOOST_REQUIRE_EQUAL(moved.size(), 10);
+	BOOST_CHECK_EQUAL(fused->getTimestamp().tv_usec, 500000);
+	for(int i = 0; i < 5; i++)
+	{
+		BOOST_CHECK_SMALL(moved[i].x - i, 1e-4f);
+		BOOST_CHECK_SMALL(moved[i + 5].x - (i - 0.5f), 1e-4f);
+	}
+
+	// The fusion resolution merges the points
+	sensor.setFusionResolution(2.0);
+	fused = sensor.fuseMeasurements(clouds);
+	BOOST_CHECK_LT(fused->getPointCloud()->size(), 10);
+}
@@ -0,0 +1,405 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "PointKernels.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SLAM3D_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace slam3d;
+
+// The vector code loads and stores whole points, including the padding
+static_assert(sizeof(PointType) == 4 * sizeof(float), "PointKernels require points of four floats");
+
+namespace
+{
+	struct KernelTable
+	{
+		void (*transform)(const PointType*, PointType*, size_t, const Eigen::Matrix4f&);
+		void (*voxelize)(const PointType*, int32_t*, size_t, double);
+		size_t (*crop)(const PointType*, PointType*, size_t, const Eigen::Vector3f&, float);
+	};
+
+	// Scalar code for single points, also handles the remainders of the vector loops
+	inline void transformPoint(const PointType& in, PointType& out, const float* m)
+	{
+		const float x = in.x, y = in.y, z = in.z;
+		out.x = m[0] * x + m[4] * y + m[8] * z + m[12];
+		out.y = m[1] * x + m[5] * y + m[9] * z + m[13];
+		out.z = m[2] * x + m[6] * y + m[10] * z + m[14];
+		out.data[3] = 1.0f;
+	}
+
+	// Same rounding as VoxelFilter::getVoxel
+	inline void voxelizePoint(const PointType& in, int32_t* voxel, double scale)
+	{
+		const double limit = std::numeric_limits<int32_t>::max();
+		double v[3] = {in.x * scale, in.y * scale, in.z * scale};
+		if(!(std::fabs(v[0]) < limit && std::fabs(v[1]) < limit && std::fabs(v[2]) < limit))
+		{
+			voxel[0] = voxel[1] = voxel[2] = voxel[3] = 0;
+			return;
+		}
+		for(int k = 0; k < 3; k++)
+		{
+			int32_t i = (int32_t)v[k];
+			voxel[k] = i - (v[k] < i);
+		}
+		voxel[3] = 1;
+	}
+
+	inline bool isInside(const PointType& p, const Eigen::Vector3f& c, float squared_radius)
+	{
+		const float dx = p.x - c[0], dy = p.y - c[1], dz = p.z - c[2];
+		return (dx * dx + dy * dy) + dz * dz <= squared_radius;
+	}
+
+	void transformGeneric(const PointType* in, PointType* out, size_t n, const Eigen::Matrix4f& tf)
+	{
+		for(size_t i = 0; i < n; i++)
+			transformPoint(in[i], out[i], tf.data());
+	}
+
+	void voxelizeGeneric(const PointType* in, int32_t* voxels, size_t n, double scale)
+	{
+		for(size_t i = 0; i < n; i++)
+			voxelizePoint(in[i], voxels + 4 * i, scale);
+	}
+
+	size_t cropGeneric(const PointType* in, PointType* out, size_t n, const Eigen::Vector3f& c, float squared_radius)
+	{
+		size_t k = 0;
+		for(size_t i = 0; i < n; i++)
+		{
+			if(isInside(in[i], c, squared_radius))
+				out[k++] = in[i];
+		}
+		return k;
+	}
+
+#ifdef SLAM3D_X86_KERNELS
+	// SSE4.2, one point per register. The fourth coordinate of transformed
+	// points is blended in, as non-finite points would make it NaN.
+
+	__attribute__((target("sse4.2")))
+	void transformSSE42(const PointType* in, PointType* out, size_t n, const Eigen::Matrix4f& tf)
+	{
+		const float* m = tf.data();
+		const __m128 c0 = _mm_setr_ps(m[0], m[1], m[2], 0);
+		const __m128 c1 = _mm_setr_ps(m[4], m[5], m[6], 0);
+		const __m128 c2 = _mm_setr_ps(m[8], m[9], m[10], 0);
+		const __m128 c3 = _mm_setr_ps(m[12], m[13], m[14], 1);
+		for(size_t i = 0; i < n; i++)
+		{
+			__m128 p = _mm_loadu_ps(in[i].data);
+			__m128 r = _mm_add_ps(_mm_mul_ps(c0, _mm_shuffle_ps(p, p, 0x00)), _mm_mul_ps(c1, _mm_shuffle_ps(p, p, 0x55)));
+			r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(p, p, 0xAA)));
+			r = _mm_add_ps(r, c3);
+			_mm_storeu_ps(out[i].data, _mm_blend_ps(r, c3, 0x8));
+		}
+	}
+
+	__attribute__((target("sse4.2")))
+	void voxelizeSSE42(const PointType* in, int32_t* voxels, size_t n, double scale)
+	{
+		const __m128d s = _mm_set1_pd(scale);
+		const __m128d limit = _mm_set1_pd(std::numeric_limits<int32_t>::max());
+		const __m128d sign = _mm_set1_pd(-0.0);
+		for(size_t i = 0; i < n; i++)
+		{
+			__m128 p = _mm_loadu_ps(in[i].data);
+			__m128d xy = _mm_mul_pd(_mm_cvtps_pd(p), s);
+			__m128d zw = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(p, p)), s);
+			int valid = _mm_movemask_pd(_mm_cmplt_pd(_mm_andnot_pd(sign, xy), limit)) == 3
+			         && (_mm_movemask_pd(_mm_cmplt_pd(_mm_andnot_pd(sign, zw), limit)) & 1);
+			__m128i v = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_floor_pd(xy)), _mm_cvttpd_epi32(_mm_floor_pd(zw)));
+			v = _mm_and_si128(_mm_insert_epi32(v, 1, 3), _mm_set1_epi32(-valid));
+			_mm_storeu_si128((__m128i*)(voxels + 4 * i), v);
+		}
+	}
+
+	__attribute__((target("sse4.2")))
+	size_t cropSSE42(const PointType* in, PointType* out, size_t n, const Eigen::Vector3f& c, float squared_radius)
+	{
+		const __m128 center = _mm_setr_ps(c[0], c[1], c[2], 0);
+		const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+		const __m128 r = _mm_set1_ps(squared_radius);
+		size_t k = 0;
+		for(size_t i = 0; i < n; i++)
+		{
+			__m128 p = _mm_loadu_ps(in[i].data);
+			__m128 d = _mm_and_ps(_mm_sub_ps(p, center), xyz);
+			__m128 s = _mm_mul_ps(d, d);
+			s = _mm_add_ps(s, _mm_shuffle_ps(s, s, 0xB1));
+			s = _mm_add_ps(s, _mm_shuffle_ps(s, s, 0x4E));
+			_mm_storeu_ps(out[k].data, p);
+			k += _mm_movemask_ps(_mm_cmple_ps(s, r)) & 1;
+		}
+		return k;
+	}
+
+	// AVX2 with FMA, two points per register
+
+	__attribute__((target("avx2,fma")))
+	void transformAVX2(const PointType* in, PointType* out, size_t n, const Eigen::Matrix4f& tf)
+	{
+		const float* m = tf.data();
+		const __m256 c0 = _mm256_setr_ps(m[0], m[1], m[2], 0, m[0], m[1], m[2], 0);
+		const __m256 c1 = _mm256_setr_ps(m[4], m[5], m[6], 0, m[4], m[5], m[6], 0);
+		const __m256 c2 = _mm256_setr_ps(m[8], m[9], m[10], 0, m[8], m[9], m[10], 0);
+		const __m256 c3 = _mm256_setr_ps(m[12], m[13], m[14], 1, m[12], m[13], m[14], 1);
+		size_t i = 0;
+		for(; i + 2 <= n; i += 2)
+		{
+			__m256 p = _mm256_loadu_ps(in[i].data);
+			__m256 r = _mm256_fmadd_ps(c0, _mm256_permute_ps(p, 0x00), c3);
+			r = _mm256_fmadd_ps(c1, _mm256_permute_ps(p, 0x55), r);
+			r = _mm256_fmadd_ps(c2, _mm256_permute_ps(p, 0xAA), r);
+			_mm256_storeu_ps(out[i].data, _mm256_blend_ps(r, c3, 0x88));
+		}
+		for(; i < n; i++)
+			transformPoint(in[i], out[i], m);
+	}
+
+	__attribute__((target("avx2,fma")))
+	void voxelizeAVX2(const PointType* in, int32_t* voxels, size_t n, double scale)
+	{
+		const __m256d s = _mm256_set1_pd(scale);
+		const __m256d limit = _mm256_set1_pd(std::numeric_limits<int32_t>::max());
+		const __m256d sign = _mm256_set1_pd(-0.0);
+		for(size_t i = 0; i < n; i++)
+		{
+			__m256d v = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(in[i].data)), s);
+			int valid = (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, v), limit, _CMP_LT_OQ)) & 7) == 7;
+			__m128i r = _mm_insert_epi32(_mm256_cvttpd_epi32(_mm256_floor_pd(v)), 1, 3);
+			_mm_storeu_si128((__m128i*)(voxels + 4 * i), _mm_and_si128(r, _mm_set1_epi32(-valid)));
+		}
+	}
+
+	__attribute__((target("avx2,fma")))
+	size_t cropAVX2(const PointType* in, PointType* out, size_t n, const Eigen::Vector3f& c, float squared_radius)
+	{
+		const __m256 center = _mm256_setr_ps(c[0], c[1], c[2], 0, c[0], c[1], c[2], 0);
+		const __m256 xyz = _mm256_castsi256_ps(_mm256_setr_epi32(-1, -1, -1, 0, -1, -1, -1, 0));
+		const __m256 r = _mm256_set1_ps(squared_radius);
+		size_t k = 0;
+		size_t i = 0;
+		for(; i + 2 <= n; i += 2)
+		{
+			__m256 p = _mm256_loadu_ps(in[i].data);
+			__m256 d = _mm256_and_ps(_mm256_sub_ps(p, center), xyz);
+			__m256 s = _mm256_mul_ps(d, d);
+			s = _mm256_add_ps(s, _mm256_permute_ps(s, 0xB1));
+			s = _mm256_add_ps(s, _mm256_permute_ps(s, 0x4E));
+			int inside = _mm256_movemask_ps(_mm256_cmp_ps(s, r, _CMP_LE_OQ));
+			_mm_storeu_ps(out[k].data, _mm256_castps256_ps128(p));
+			k += inside & 1;
+			_mm_storeu_ps(out[k].data, _mm256_extractf128_ps(p, 1));
+			k += (inside >> 4) & 1;
+		}
+		for(; i < n; i++)
+		{
+			if(isInside(in[i], c, squared_radius))
+				out[k++] = in[i];
+		}
+		return k;
+	}
+
+	// AVX-512, four points per register, remainders are handled with masks
+
+	// GCC's intrinsics pass _mm512_undefined_ps() as the unused source of
+	// unmasked operations, which it reports as uninitialized once inlined.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+	__attribute__((target("avx512f")))
+	void transformAVX512(const PointType* in, PointType* out, size_t n, const Eigen::Matrix4f& tf)
+	{
+		const float* m = tf.data();
+		const __m512 c0 = _mm512_broadcast_f32x4(_mm_setr_ps(m[0], m[1], m[2], 0));
+		const __m512 c1 = _mm512_broadcast_f32x4(_mm_setr_ps(m[4], m[5], m[6], 0));
+		const __m512 c2 = _mm512_broadcast_f32x4(_mm_setr_ps(m[8], m[9], m[10], 0));
+		const __m512 c3 = _mm512_broadcast_f32x4(_mm_setr_ps(m[12], m[13], m[14], 1));
+		for(size_t i = 0; i < n; i += 4)
+		{
+			__mmask16 mask = n - i >= 4 ? 0xFFFF : (1 << (4 * (n - i))) - 1;
+			__m512 p = _mm512_maskz_loadu_ps(mask, in[i].data);
+			__m512 r = _mm512_fmadd_ps(c0, _mm512_permute_ps(p, 0x00), c3);
+			r = _mm512_fmadd_ps(c1, _mm512_permute_ps(p, 0x55), r);
+			r = _mm512_fmadd_ps(c2, _mm512_permute_ps(p, 0xAA), r);
+			_mm512_mask_storeu_ps(out[i].data, mask, _mm512_mask_mov_ps(r, 0x8888, c3));
+		}
+	}
+
+	__attribute__((target("avx512f")))
+	void voxelizeAVX512(const PointType* in, int32_t* voxels, size_t n, double scale)
+	{
+		const __m512d s = _mm512_set1_pd(scale);
+		const __m512d limit = _mm512_set1_pd(std::numeric_limits<int32_t>::max());
+		const __m256i flags = _mm256_setr_epi32(0, 0, 0, 1, 0, 0, 0, 1);
+		size_t i = 0;
+		for(; i + 2 <= n; i += 2)
+		{
+			__m512d v = _mm512_mul_pd(_mm512_cvtps_pd(_mm256_loadu_ps(in[i].data)), s);
+			__mmask8 finite = _mm512_cmp_pd_mask(_mm512_abs_pd(v), limit, _CMP_LT_OQ);
+			int first = (finite & 0x07) == 0x07;
+			int second = (finite & 0x70) == 0x70;
+			__m256i r = _mm512_cvt_roundpd_epi32(v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+			__m256i keep = _mm256_setr_epi32(-first, -first, -first, -first, -second, -second, -second, -second);
+			r = _mm256_and_si256(_mm256_blend_epi32(r, flags, 0x88), keep);
+			_mm256_storeu_si256((__m256i*)(voxels + 4 * i), r);
+		}
+		for(; i < n; i++)
+			voxelizePoint(in[i], voxels + 4 * i, scale);
+	}
+
+	__attribute__((target("avx512f")))
+	size_t cropAVX512(const PointType* in, PointType* out, size_t n, const Eigen::Vector3f& c, float squared_radius)
+	{
+		const __m512 center = _mm512_broadcast_f32x4(_mm_setr_ps(c[0], c[1], c[2], 0));
+		const __mmask16 xyz = 0x7777;
+		const __m512 r = _mm512_set1_ps(squared_radius);
+		size_t k = 0;
+		for(size_t i = 0; i < n; i += 4)
+		{
+			__mmask16 mask = n - i >= 4 ? 0xFFFF : (1 << (4 * (n - i))) - 1;
+			__m512 p = _mm512_maskz_loadu_ps(mask, in[i].data);
+			__m512 d = _mm512_maskz_sub_ps(xyz, p, center);
+			__m512 s = _mm512_mul_ps(d, d);
+			s = _mm512_add_ps(s, _mm512_permute_ps(s, 0xB1));
+			s = _mm512_add_ps(s, _mm512_permute_ps(s, 0x4E));
+			__mmask16 inside = _mm512_mask_cmp_ps_mask(mask, s, r, _CMP_LE_OQ);
+			_mm512_mask_compressstoreu_ps(out[k].data, inside, p);
+			k += __builtin_popcount(inside) / 4;
+		}
+		return k;
+	}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+	const KernelTable tables[] =
+	{
+		{transformGeneric, voxelizeGeneric, cropGeneric},
+#ifdef SLAM3D_X86_KERNELS
+		{transformSSE42, voxelizeSSE42, cropSSE42},
+		{transformAVX2, voxelizeAVX2, cropAVX2},
+		{transformAVX512, voxelizeAVX512, cropAVX512},
+#endif
+	};
+
+	std::atomic<int> currentVariant(-1);
+
+	const KernelTable& getTable()
+	{
+		int v = currentVariant.load(std::memory_order_relaxed);
+		if(v < 0)
+		{
+			// The best supported variant, concurrent first calls agree on it
+			v = PointKernels::GENERIC;
+			for(int i = PointKernels::AVX512; i > PointKernels::GENERIC; i--)
+			{
+				if(PointKernels::isSupported((PointKernels::Variant)i))
+				{
+					v = i;
+					break;
+				}
+			}
+			currentVariant.store(v, std::memory_order_relaxed);
+		}
+		return tables[v];
+	}
+}
+
+void PointKernels::transform(const PointType* in, PointType* out, size_t n, const Eigen::Matrix4f& tf)
+{
+	getTable().transform(in, out, n, tf);
+}
+
+void PointKernels::voxelize(const PointType* in, int32_t* voxels, size_t n, double inverse_leaf_size)
+{
+	getTable().voxelize(in, voxels, n, inverse_leaf_size);
+}
+
+size_t PointKernels::crop(const PointType* in, PointType* out, size_t n,
+                          const Eigen::Vector3f& center, float squared_radius)
+{
+	return getTable().crop(in, out, n, center, squared_radius);
+}
+
+PointKernels::Variant PointKernels::getVariant()
+{
+	getTable();
+	return (Variant)currentVariant.load(std::memory_order_relaxed);
+}
+
+bool PointKernels::setVariant(Variant v)
+{
+	if(!isSupported(v))
+		return false;
+	currentVariant.store(v, std::memory_order_relaxed);
+	return true;
+}
+
+bool PointKernels::isSupported(Variant v)
+{
+#ifdef SLAM3D_X86_KERNELS
+	__builtin_cpu_init();
+	switch(v)
+	{
+	case GENERIC: return true;
+	case SSE42:   return __builtin_cpu_supports("sse4.2");
+	case AVX2:    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case AVX512:  return __builtin_cpu_supports("avx512f");
+	}
+	return false;
+#else
+	return v == GENERIC;
+#endif
+}
+
+const char* PointKernels::getName(Variant v)
+{
+	switch(v)
+	{
+	case GENERIC: return "generic";
+	case SSE42:   return "sse4.2";
+	case AVX2:    return "avx2";
+	case AVX512:  return "avx512";
+	}
+	return "unknown";
+}
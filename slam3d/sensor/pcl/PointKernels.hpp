@@ -0,0 +1,117 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SLAM3D_POINTKERNELS_HPP
+#define SLAM3D_POINTKERNELS_HPP
+
+#include <slam3d/sensor/pcl/VoxelFilter.hpp>
+
+#include <Eigen/Core>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace slam3d
+{
+	/**
+	 * @class PointKernels
+	 * @brief Inner loops of the point cloud processing with several instruction set variants.
+	 * @details Each kernel exists in a generic version and in versions for
+	 * SSE4.2, AVX2 and AVX-512 on x86-64. The best variant supported by the
+	 * CPU is selected on the first call, so a single binary runs everywhere.
+	 * The variants of transform and crop may differ in the last bit of the
+	 * coordinates due to fused multiply-adds, voxelize gives identical results.
+	 * All kernels rely on the 16 byte layout of pcl::PointXYZ.
+	 */
+	class PointKernels
+	{
+	public:
+		enum Variant {GENERIC, SSE42, AVX2, AVX512};
+
+		/**
+		 * @brief Transforms points by an affine transformation.
+		 * @details The fourth coordinate of the output points is set to 1.
+		 * Input and output may be the same array.
+		 * @param in source points
+		 * @param out transformed points
+		 * @param n number of points
+		 * @param tf affine transformation
+		 */
+		static void transform(const PointType* in, PointType* out, size_t n, const Eigen::Matrix4f& tf);
+
+		/**
+		 * @brief Computes the integer voxel coordinates of points.
+		 * @details Coordinates are computed in double precision and rounded
+		 * towards negative infinity, like VoxelFilter does. Each point gets
+		 * four values x, y, z and a flag, which is 0 if the point is not
+		 * finite or too far from the origin to be represented.
+		 * @param in source points
+		 * @param voxels output array of 4 * n values
+		 * @param n number of points
+		 * @param inverse_leaf_size inverse edge length of the voxels
+		 */
+		static void voxelize(const PointType* in, int32_t* voxels, size_t n, double inverse_leaf_size);
+
+		/**
+		 * @brief Keeps the points within a sphere.
+		 * @details The remaining points keep their order. Input and output
+		 * may be the same array.
+		 * @param in source points
+		 * @param out points within the sphere
+		 * @param n number of source points
+		 * @param center center of the sphere
+		 * @param squared_radius squared radius of the sphere
+		 * @return number of points written to out
+		 */
+		static size_t crop(const PointType* in, PointType* out, size_t n,
+		                   const Eigen::Vector3f& center, float squared_radius);
+
+		/**
+		 * @brief Get the variant that is currently in use.
+		 */
+		static Variant getVariant();
+
+		/**
+		 * @brief Use a specific variant for all following calls.
+		 * @details This is meant for benchmarks and tests.
+		 * @param v the variant to use
+		 * @return false if the variant is not supported by this CPU
+		 */
+		static bool setVariant(Variant v);
+
+		/**
+		 * @brief Check whether the variant can run on this CPU.
+		 */
+		static bool isSupported(Variant v);
+
+		/**
+		 * @brief Get the name of a variant.
+		 */
+		static const char* getName(Variant v);
+	};
+}
+
+#endif
@@ -0,0 +1,164 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Measures the time of the point kernels and of the voxel filter with every
+// variant of the kernels that is supported by this CPU. The cloud is random
+// with the extent of a typical outdoor scan.
+
+#include "PointKernels.hpp"
+
+#include <boost/format.hpp>
+
+#include <Eigen/Geometry>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+using namespace slam3d;
+
+struct Timing
+{
+	double transform;  // mean time per call in ms
+	double voxelize;
+	double crop;
+	double filter;
+};
+
+typedef std::chrono::steady_clock BenchmarkClock;
+
+static double elapsed(const BenchmarkClock::time_point& start, unsigned repetitions)
+{
+	return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count() / repetitions;
+}
+
+static Timing measure(const PointCloud& cloud, unsigned repetitions)
+{
+	const size_t n = cloud.size();
+	Eigen::Affine3f tf(Eigen::AngleAxisf(0.3, Eigen::Vector3f::UnitZ()));
+	tf.translation() = Eigen::Vector3f(1.0, -2.0, 0.5);
+	PointCloud buffer = cloud;
+	std::vector<int32_t> voxels(4 * n);
+	VoxelFilter filter(0.2);
+	PointCloud filtered;
+
+	// Warm up the caches and the buffers of the filter
+	filter.filter(cloud, filtered);
+
+	Timing t;
+	BenchmarkClock::time_point start = BenchmarkClock::now();
+	for(unsigned r = 0; r < repetitions; r++)
+		PointKernels::transform(cloud.points.data(), buffer.points.data(), n, tf.matrix());
+	t.transform = elapsed(start, repetitions);
+
+	start = BenchmarkClock::now();
+	for(unsigned r = 0; r < repetitions; r++)
+		PointKernels::voxelize(cloud.points.data(), voxels.data(), n, 1.0 / 0.2);
+	t.voxelize = elapsed(start, repetitions);
+
+	// Cropping works in place, so copy the cloud each time and subtract it
+	start = BenchmarkClock::now();
+	for(unsigned r = 0; r < repetitions; r++)
+		buffer.points = cloud.points;
+	double copy = elapsed(start, repetitions);
+	start = BenchmarkClock::now();
+	for(unsigned r = 0; r < repetitions; r++)
+	{
+		buffer.points = cloud.points;
+		PointKernels::crop(buffer.points.data(), buffer.points.data(), n, Eigen::Vector3f(5, 5, 0), 900);
+	}
+	t.crop = std::max(0.0, elapsed(start, repetitions) - copy);
+
+	start = BenchmarkClock::now();
+	for(unsigned r = 0; r < repetitions; r++)
+		filter.filter(cloud, filtered);
+	t.filter = elapsed(start, repetitions);
+	return t;
+}
+
+static void printUsage()
+{
+	std::cerr << "Usage: point_kernels_benchmark [options]" << std::endl
+	          << "  --points n       number of points in the cloud, default is 1000000" << std::endl
+	          << "  --repetitions r  number of calls per measurement, default is 20" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	size_t points = 1000000;
+	unsigned repetitions = 20;
+	for(int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if(arg == "--points" && i + 1 < argc)
+		{
+			points = atol(argv[++i]);
+		}else if(arg == "--repetitions" && i + 1 < argc)
+		{
+			repetitions = atoi(argv[++i]);
+		}else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if(points == 0 || repetitions == 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> horizontal(-50, 50);
+	std::uniform_real_distribution<float> vertical(-2, 10);
+	PointCloud cloud;
+	cloud.resize(points);
+	for(size_t i = 0; i < points; i++)
+		cloud[i] = PointType(horizontal(rng), horizontal(rng), vertical(rng));
+
+	const PointKernels::Variant selected = PointKernels::getVariant();
+	std::cout << "variant transform_ms voxelize_ms crop_ms filter_ms transform_x voxelize_x crop_x filter_x" << std::endl;
+	Timing generic = {0, 0, 0, 0};
+	for(int v = PointKernels::GENERIC; v <= PointKernels::AVX512; v++)
+	{
+		PointKernels::Variant variant = (PointKernels::Variant)v;
+		if(!PointKernels::setVariant(variant))
+		{
+			std::cout << PointKernels::getName(variant) << " not supported" << std::endl;
+			continue;
+		}
+		Timing t = measure(cloud, repetitions);
+		if(variant == PointKernels::GENERIC)
+			generic = t;
+		std::cout << boost::format("%1%%2% %3$.3f %4$.3f %5$.3f %6$.3f %7$.2f %8$.2f %9$.2f %10$.2f")
+			% PointKernels::getName(variant) % (variant == selected ? "*" : "")
+			% t.transform % t.voxelize % t.crop % t.filter
+			% (generic.transform / t.transform) % (generic.voxelize / t.voxelize)
+			% (generic.crop / t.crop) % (generic.filter / t.filter) << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+#define BOOST_TEST_MODULE "PointKernelsTest"
+
+#include <boost/test/unit_test.hpp>
+
+#include "PointKernels.hpp"
+
+#include <Eigen/Geometry>
+
+#include <cmath>
+#include <limits>
+#include <random>
+
+using namespace slam3d;
+
+// Random points with some that are not finite or too large for a voxel.
+// The sizes are not multiples of the vector widths to test the remainders.
+static std::vector<PointType> createPoints(size_t n)
+{
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> uniform(-50, 50);
+	std::vector<PointType> points(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		points[i] = PointType(uniform(rng), uniform(rng), uniform(rng));
+		if(i % 7 == 3)
+			points[i].y = std::numeric_limits<float>::quiet_NaN();
+		if(i % 11 == 5)
+			points[i].z = 1e30;
+		if(i % 13 == 2)
+			points[i].x = -std::numeric_limits<float>::infinity();
+	}
+	return points;
+}
+
+BOOST_AUTO_TEST_CASE(point_kernels_voxelize)
+{
+	PointType points[] = {PointType(0.1, -0.1, 2.5), PointType(-2.5, 0, 1e30)};
+	int32_t voxels[8];
+	PointKernels::voxelize(points, voxels, 2, 2.0);
+	BOOST_CHECK_EQUAL(voxels[0], 0);
+	BOOST_CHECK_EQUAL(voxels[1], -1);
+	BOOST_CHECK_EQUAL(voxels[2], 5);
+	BOOST_CHECK_EQUAL(voxels[3], 1);
+	BOOST_CHECK_EQUAL(voxels[7], 0);
+}
+
+BOOST_AUTO_TEST_CASE(point_kernels_variants)
+{
+	const PointKernels::Variant selected = PointKernels::getVariant();
+	Eigen::Affine3f tf(Eigen::AngleAxisf(0.3, Eigen::Vector3f(1, 2, 3).normalized()));
+	tf.translation() = Eigen::Vector3f(1, -2, 3);
+	const Eigen::Vector3f center(1, 2, 3);
+
+	for(size_t n = 0; n < 20; n++)
+	{
+		std::vector<PointType> in = createPoints(n);
+		BOOST_REQUIRE(PointKernels::setVariant(PointKernels::GENERIC));
+		std::vector<PointType> transformed(n);
+		PointKernels::transform(in.data(), transformed.data(), n, tf.matrix());
+		std::vector<int32_t> voxels(4 * n);
+		PointKernels::voxelize(in.data(), voxels.data(), n, 2.0);
+		std::vector<PointType> cropped(in);
+		cropped.resize(PointKernels::crop(cropped.data(), cropped.data(), n, center, 900));
+
+		for(int v = PointKernels::SSE42; v <= PointKernels::AVX512; v++)
+		{
+			if(!PointKernels::setVariant((PointKernels::Variant)v))
+				continue;
+
+			std::vector<PointType> t(n);
+			PointKernels::transform(in.data(), t.data(), n, tf.matrix());
+			for(size_t i = 0; i < n; i++)
+			{
+				BOOST_CHECK_EQUAL(t[i].data[3], 1.0f);
+				for(int k = 0; k < 3; k++)
+				{
+					if(std::isfinite(transformed[i].data[k]))
+						BOOST_CHECK_SMALL(t[i].data[k] - transformed[i].data[k], 1e-4f);
+					else
+						BOOST_CHECK(!std::isfinite(t[i].data[k]));
+				}
+			}
+
+			// Voxels are computed without sums, so they must not differ at all
+			std::vector<int32_t> vx(4 * n);
+			PointKernels::voxelize(in.data(), vx.data(), n, 2.0);
+			BOOST_CHECK(vx == voxels);
+
+			std::vector<PointType> c(in);
+			c.resize(PointKernels::crop(c.data(), c.data(), n, center, 900));
+			BOOST_REQUIRE_EQUAL(c.size(), cropped.size());
+			for(size_t i = 0; i < c.size(); i++)
+			{
+				BOOST_CHECK_EQUAL(c[i].x, cropped[i].x);
+				BOOST_CHECK_EQUAL(c[i].z, cropped[i].z);
+			}
+		}
+	}
+	PointKernels::setVariant(selected);
+}
@@ -0,0 +1,498 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "QueryServer.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_PAYLOAD 64
+#define CLIENT_TIMEOUT 1 // seconds a client may take to send a request or receive a response
+
+using namespace slam3d;
+
+static bool receiveAll(int socket, char* data, size_t size)
+{
+	while(size > 0)
+	{
+		ssize_t n = recv(socket, data, size, 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool setNonBlocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static bool sendAll(int socket, const char* data, size_t size)
+{
+	while(size > 0)
+	{
+		ssize_t n = send(socket, data, size, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+template <typename T>
+static void append(std::vector<char>& buffer, const T& value)
+{
+	const char* data = (const char*)&value;
+	buffer.insert(buffer.end(), data, data + sizeof(T));
+}
+
+static QueryServer::PoseRecord toRecord(const Transform& tf)
+{
+	Eigen::Quaternion<ScalarType> q(tf.rotation());
+	QueryServer::PoseRecord r = {tf.translation()[0], tf.translation()[1], tf.translation()[2], q.w(), q.x(), q.y(), q.z()};
+	return r;
+}
+
+QueryServer::QueryServer(Graph* graph, const std::string& sensor, Logger* logger)
+ : mGraph(graph), mSensor(sensor), mLogger(logger), mMap(NULL), mListenSocket(-1), mRunning(false)
+{
+	mWakePipe[0] = -1;
+	mWakePipe[1] = -1;
+}
+
+QueryServer::~QueryServer()
+{
+	stop();
+}
+
+void QueryServer::start(const std::string& path, unsigned workers)
+{
+	if(mRunning)
+		throw std::runtime_error("QueryServer has already been started!");
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path))
+		throw std::runtime_error((boost::format("Socket path '%1%' is too long.") % path).str());
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	mListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(mListenSocket < 0)
+		throw std::runtime_error((boost::format("Failed to create socket: %1%") % strerror(errno)).str());
+
+	unlink(path.c_str());
+	if(bind(mListenSocket, (sockaddr*)&address, sizeof(address)) != 0 || listen(mListenSocket, 16) != 0 ||
+	   !setNonBlocking(mListenSocket) || pipe(mWakePipe) != 0 || !setNonBlocking(mWakePipe[0]) || !setNonBlocking(mWakePipe[1]))
+	{
+		std::string error = strerror(errno);
+		close(mListenSocket);
+		mListenSocket = -1;
+		for(unsigned i = 0; i < 2; i++)
+		{
+			if(mWakePipe[i] >= 0)
+				close(mWakePipe[i]);
+			mWakePipe[i] = -1;
+		}
+		throw std::runtime_error((boost::format("Failed to listen on '%1%': %2%") % path % error).str());
+	}
+
+	mPath = path;
+	mRunning = true;
+	mThreads.create_thread(boost::bind(&QueryServer::dispatch, this));
+	for(unsigned i = 0; i < std::max(1u, workers); i++)
+		mThreads.create_thread(boost::bind(&QueryServer::work, this));
+	mLogger->message(INFO, (boost::format("QueryServer listening on '%1%' with %2% workers.") % path % workers).str());
+}
+
+void QueryServer::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(mQueueMutex);
+		if(!mRunning)
+			return;
+		mRunning = false;
+
+		// Wake up the dispatcher and all workers blocked in recv()
+		char wake = 0;
+		if(write(mWakePipe[1], &wake, 1) < 0)
+			mLogger->message(WARNING, (boost::format("Failed to wake up the QueryServer: %1%") % strerror(errno)).str());
+		for(std::set<int>::iterator c = mConnections.begin(); c != mConnections.end(); ++c)
+			shutdown(*c, SHUT_RDWR);
+	}
+	mQueueCondition.notify_all();
+	mThreads.join_all();
+
+	for(std::set<int>::iterator c = mConnections.begin(); c != mConnections.end(); ++c)
+		close(*c);
+	mQueue.clear();
+	mReturned.clear();
+	mConnections.clear();
+	close(mListenSocket);
+	mListenSocket = -1;
+	for(unsigned i = 0; i < 2; i++)
+	{
+		close(mWakePipe[i]);
+		mWakePipe[i] = -1;
+	}
+	unlink(mPath.c_str());
+}
+
+void QueryServer::dispatch()
+{
+	std::vector<int> idle;
+	std::vector<pollfd> fds;
+	while(true)
+	{
+		fds.clear();
+		pollfd listener = {mListenSocket, POLLIN, 0};
+		pollfd wake = {mWakePipe[0], POLLIN, 0};
+		fds.push_back(listener);
+		fds.push_back(wake);
+		for(std::vector<int>::const_iterator c = idle.begin(); c != idle.end(); ++c)
+		{
+			pollfd connection = {*c, POLLIN, 0};
+			fds.push_back(connection);
+		}
+
+		if(poll(fds.data(), fds.size(), -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			mLogger->message(ERROR, (boost::format("QueryServer stops dispatching requests: %1%") % strerror(errno)).str());
+			return;
+		}
+
+		std::lock_guard<std::mutex> guard(mQueueMutex);
+		if(!mRunning)
+			return;
+
+		// Connections with a request (or a hang-up) go to the workers
+		idle.clear();
+		for(size_t i = 2; i < fds.size(); i++)
+		{
+			if(fds[i].revents)
+			{
+				mQueue.push_back(fds[i].fd);
+				mQueueCondition.notify_one();
+			}else
+			{
+				idle.push_back(fds[i].fd);
+			}
+		}
+
+		// Watch the connections again that the workers are done with
+		if(fds[1].revents)
+		{
+			char buffer[64];
+			while(read(mWakePipe[0], buffer, sizeof(buffer)) > 0)
+				continue;
+		}
+		idle.insert(idle.end(), mReturned.begin(), mReturned.end());
+		mReturned.clear();
+
+		if(fds[0].revents)
+		{
+			int connection = accept(mListenSocket, NULL, NULL);
+			if(connection >= 0)
+			{
+				// A client that stalls within a request must not block a worker
+				timeval timeout = {CLIENT_TIMEOUT, 0};
+				setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+				mConnections.insert(connection);
+				idle.push_back(connection);
+			}else if(errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				mLogger->message(ERROR, (boost::format("QueryServer failed to accept a connection: %1%") % strerror(errno)).str());
+			}
+		}
+	}
+}
+
+void QueryServer::work()
+{
+	while(true)
+	{
+		int connection;
+		{
+			std::unique_lock<std::mutex> lock(mQueueMutex);
+			while(mRunning && mQueue.empty())
+				mQueueCondition.wait(lock);
+			if(!mRunning)
+				return;
+			connection = mQueue.front();
+			mQueue.pop_front();
+		}
+
+		bool keep = serve(connection);
+
+		std::lock_guard<std::mutex> guard(mQueueMutex);
+		if(keep && mRunning)
+		{
+			mReturned.push_back(connection);
+			char wake = 0;
+			if(write(mWakePipe[1], &wake, 1) < 0 && errno != EAGAIN)
+				mLogger->message(WARNING, (boost::format("Failed to wake up the QueryServer: %1%") % strerror(errno)).str());
+		}else if(mRunning)
+		{
+			mConnections.erase(connection);
+			close(connection);
+		}
+	}
+}
+
+// Answers a single request, returns false if the connection should be closed
+bool QueryServer::serve(int connection)
+{
+	std::vector<char> response;
+	char payload[MAX_PAYLOAD];
+	MessageHeader request;
+	if(!receiveAll(connection, (char*)&request, sizeof(request)))
+		return false;
+
+	Status status = BAD_REQUEST;
+	bool valid = request.size <= MAX_PAYLOAD;
+	if(valid && !receiveAll(connection, payload, request.size))
+		return false;
+
+	response.resize(sizeof(MessageHeader));
+	if(valid)
+		status = handle(request, payload, response);
+	if(status != OK)
+		response.resize(sizeof(MessageHeader));
+
+	MessageHeader header = {(uint32_t)status, (uint32_t)(response.size() - sizeof(MessageHeader))};
+	memcpy(&response[0], &header, sizeof(header));
+	return sendAll(connection, &response[0], response.size()) && valid;
+}
+
+QueryServer::Status QueryServer::handle(const MessageHeader& request, const char* payload, std::vector<char>& response)
+{
+	switch(request.type)
+	{
+	case POSE_AT_TIME:
+		if(request.size != 2 * sizeof(int64_t))
+			return BAD_REQUEST;
+		return poseAtTime(payload, response);
+	case NEIGHBORS:
+		if(request.size != 4 * sizeof(double))
+			return BAD_REQUEST;
+		return neighbors(payload, response);
+	case LOCAL_MAP:
+		if(request.size != 5 * sizeof(double))
+			return BAD_REQUEST;
+		return localMap(payload, response);
+	default:
+		return BAD_REQUEST;
+	}
+}
+
+QueryServer::SnapshotPtr QueryServer::getSnapshot()
+{
+	RevisionType revision = mGraph->getRevision();
+	SnapshotPtr current;
+	{
+		std::lock_guard<std::mutex> guard(mSnapshotMutex);
+		current = mSnapshot;
+	}
+	if(current && current->revision == revision)
+		return current;
+
+	// The new snapshot is derived from the current one without holding the
+	// lock, only the poses that changed since then are copied from the graph.
+	RevisionType since = current ? current->revision : 0;
+	boost::shared_ptr<Snapshot> snapshot(new Snapshot);
+	snapshot->revision = revision;
+	if(current)
+		snapshot->trajectory = current->trajectory;
+	std::vector<StampedPose>& trajectory = snapshot->trajectory;
+
+	// Drop the removed vertices
+	size_t removed = trajectory.empty() ? 0 : mGraph->exportRemovals(NULL, 0, mSensor, since);
+	if(removed > 0)
+	{
+		std::vector<IdType> removed_ids(removed);
+		removed_ids.resize(std::min(removed, mGraph->exportRemovals(&removed_ids[0], removed, mSensor, since)));
+		std::sort(removed_ids.begin(), removed_ids.end());
+		std::vector<StampedPose>::iterator out = trajectory.begin();
+		for(std::vector<StampedPose>::const_iterator p = trajectory.begin(); p != trajectory.end(); ++p)
+		{
+			if(!std::binary_search(removed_ids.begin(), removed_ids.end(), p->id))
+				*out++ = *p;
+		}
+		trajectory.erase(out, trajectory.end());
+	}
+
+	// Copy the changed poses
+	size_t count = mGraph->exportTrajectory(NULL, NULL, NULL, NULL, 0, mSensor, since);
+	std::vector<IdType> ids(count);
+	std::vector<timeval> stamps(count);
+	std::vector<ScalarType> translations(3 * count);
+	std::vector<ScalarType> rotations(4 * count);
+	if(count > 0)
+		count = std::min(count, mGraph->exportTrajectory(&ids[0], &stamps[0], &translations[0], &rotations[0],
+		                                                 count, mSensor, since));
+
+	// The time of a vertex does not change, so existing ones are found
+	// by their time. New vertices are merged in instead of sorting again.
+	std::vector<StampedPose> added;
+	for(size_t i = 0; i < count; i++)
+	{
+		const ScalarType* t = &translations[3 * i];
+		const ScalarType* r = &rotations[4 * i];
+		StampedPose p;
+		p.time = stamps[i].tv_sec + stamps[i].tv_usec * 1e-6;
+		p.id = ids[i];
+		PoseRecord pose = {t[0], t[1], t[2], r[3], r[0], r[1], r[2]};
+		p.pose = pose;
+
+		std::vector<StampedPose>::iterator e = std::lower_bound(trajectory.begin(), trajectory.end(), p, compareTime);
+		while(e != trajectory.end() && e->time == p.time && e->id != p.id)
+			++e;
+		if(e != trajectory.end() && e->time == p.time)
+			e->pose = p.pose;
+		else
+			added.push_back(p);
+	}
+	std::stable_sort(added.begin(), added.end(), compareTime);
+	size_t previous = trajectory.size();
+	trajectory.insert(trajectory.end(), added.begin(), added.end());
+	std::inplace_merge(trajectory.begin(), trajectory.begin() + previous, trajectory.end(), compareTime);
+
+	// Another thread might have stored a newer snapshot in the meantime
+	std::lock_guard<std::mutex> guard(mSnapshotMutex);
+	if(!mSnapshot || mSnapshot->revision < revision)
+		mSnapshot = snapshot;
+	return snapshot;
+}
+
+bool QueryServer::compareTime(const StampedPose& a, const StampedPose& b)
+{
+	return a.time < b.time;
+}
+
+bool QueryServer::isBefore(double time, const StampedPose& pose)
+{
+	return time < pose.time;
+}
+
+QueryServer::Status QueryServer::poseAtTime(const char* payload, std::vector<char>& response)
+{
+	int64_t stamp[2];
+	memcpy(stamp, payload, sizeof(stamp));
+	double time = stamp[0] + stamp[1] * 1e-6;
+
+	SnapshotPtr snapshot = getSnapshot();
+	const std::vector<StampedPose>& t = snapshot->trajectory;
+	std::vector<StampedPose>::const_iterator after = std::upper_bound(t.begin(), t.end(), time, isBefore);
+	if(after == t.begin())
+		return NOT_FOUND;
+	std::vector<StampedPose>::const_iterator before = after - 1;
+	if(before->time == time)
+	{
+		append(response, before->pose);
+		return OK;
+	}
+	if(after == t.end())
+		return NOT_FOUND;
+
+	// Interpolate linearly between the adjacent vertices
+	const PoseRecord& a = before->pose;
+	const PoseRecord& b = after->pose;
+	double s = (time - before->time) / (after->time - before->time);
+	Eigen::Quaterniond qa(a.qw, a.qx, a.qy, a.qz);
+	Eigen::Quaterniond qb(b.qw, b.qx, b.qy, b.qz);
+	Eigen::Quaterniond q = qa.slerp(s, qb);
+	PoseRecord r = {a.x + s * (b.x - a.x), a.y + s * (b.y - a.y), a.z + s * (b.z - a.z), q.w(), q.x(), q.y(), q.z()};
+	append(response, r);
+	return OK;
+}
+
+QueryServer::Status QueryServer::neighbors(const char* payload, std::vector<char>& response)
+{
+	double query[4];
+	memcpy(query, payload, sizeof(query));
+	if(!(query[3] >= 0))
+		return BAD_REQUEST;
+
+	// The spatial index of the graph is kept up to date with every change
+	Transform center(Eigen::Translation<ScalarType, 3>(query[0], query[1], query[2]));
+	VertexObjectList vertices = mGraph->getNearbyVertices(mSensor, center, query[3]);
+	uint32_t count = vertices.size();
+	append(response, count);
+	for(VertexObjectList::const_iterator v = vertices.begin(); v != vertices.end(); ++v)
+	{
+		VertexRecord record = {v->index, toRecord(v->corrected_pose)};
+		append(response, record);
+	}
+	return OK;
+}
+
+QueryServer::Status QueryServer::localMap(const char* payload, std::vector<char>& response)
+{
+	double query[5];
+	memcpy(query, payload, sizeof(query));
+	if(!(query[3] >= 0) || !(query[4] > 0))
+		return BAD_REQUEST;
+	if(!mMap)
+		return UNAVAILABLE;
+
+	Position center(query[0], query[1], query[2]);
+	Position extent(query[3], query[3], query[3]);
+	PointCloud cloud;
+	mMap->getMap(center - extent, center + extent, query[4], cloud);
+
+	uint32_t count = cloud.size();
+	append(response, count);
+	response.reserve(response.size() + count * 3 * sizeof(float));
+	for(PointCloud::const_iterator p = cloud.begin(); p != cloud.end(); ++p)
+	{
+		append(response, p->x);
+		append(response, p->y);
+		append(response, p->z);
+	}
+	return OK;
+}
@@ -0,0 +1,190 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SLAM3D_QUERYSERVER_HPP
+#define SLAM3D_QUERYSERVER_HPP
+
+#include <slam3d/sensor/pcl/MultiResolutionMap.hpp>
+#include <slam3d/core/Graph.hpp>
+
+#include <boost/thread.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace slam3d
+{
+	/**
+	 * @class QueryServer
+	 * @brief Answers pose, neighbor and local map requests over a Unix socket.
+	 * @details A dispatcher thread waits with poll() for new connections and
+	 * for requests on the open ones. Each request is queued for a pool of
+	 * worker threads, which hand the connection back to the dispatcher after
+	 * answering it. So idle connections do not occupy a worker, and any
+	 * number of clients can be connected. Pose requests are answered from a
+	 * snapshot of a sensor's trajectory, which is updated with the poses that
+	 * changed when the revision of the graph changes. Neighbors are found with
+	 * the graph's spatial index. Serializing a response does not hold any lock
+	 * of the graph. Local maps are taken from a MultiResolutionMap, if one
+	 * has been set.
+	 *
+	 * All messages start with a header of two 32 bit values in host byte
+	 * order: the type (request) or status (response) and the size of the
+	 * following payload in bytes. A connection can be used for any number of
+	 * requests. See Request for the payloads.
+	 */
+	class QueryServer
+	{
+	public:
+		/**
+		 * @brief Request types and their payloads.
+		 */
+		enum Request
+		{
+			/// int64 seconds, int64 microseconds; returns a PoseRecord
+			/// interpolated between the vertices before and after the time
+			POSE_AT_TIME = 1,
+
+			/// double x, y, z, radius; returns a uint32 count followed by
+			/// the VertexRecords within the radius, sorted by distance
+			NEIGHBORS = 2,
+
+			/// double x, y, z, radius, resolution; returns a uint32 count
+			/// followed by float x, y, z of each point within the cube
+			/// around the center with half edge length radius
+			LOCAL_MAP = 3
+		};
+
+		enum Status
+		{
+			OK = 0,
+			NOT_FOUND = 1,
+			BAD_REQUEST = 2,
+			UNAVAILABLE = 3
+		};
+
+		struct MessageHeader
+		{
+			uint32_t type;
+			uint32_t size;
+		};
+
+		struct PoseRecord
+		{
+			double x, y, z;
+			double qw, qx, qy, qz;
+		};
+
+		struct VertexRecord
+		{
+			uint64_t id;
+			PoseRecord pose;
+		};
+
+	public:
+		/**
+		 * @brief Constructor, the server is not started yet.
+		 * @param graph graph to take the trajectory from
+		 * @param sensor name of the sensor whose vertices form the trajectory
+		 * @param logger
+		 */
+		QueryServer(Graph* graph, const std::string& sensor, Logger* logger);
+		~QueryServer();
+
+		/**
+		 * @brief Sets the map to answer local map requests.
+		 * @param map shared map, which is not owned by the server
+		 */
+		void setMap(MultiResolutionMap* map) { mMap = map; }
+
+		/**
+		 * @brief Start to listen on the given socket.
+		 * @details An existing socket file at that path is replaced.
+		 * @param path file system path of the socket
+		 * @param workers number of threads that handle requests
+		 * @throw std::runtime_error
+		 */
+		void start(const std::string& path, unsigned workers = 4);
+
+		/**
+		 * @brief Close all connections and wait for the threads to finish.
+		 */
+		void stop();
+
+	protected:
+		struct StampedPose
+		{
+			double time;
+			IdType id;
+			PoseRecord pose;
+		};
+
+		struct Snapshot
+		{
+			RevisionType revision;
+			std::vector<StampedPose> trajectory; // sorted by time
+		};
+		typedef boost::shared_ptr<const Snapshot> SnapshotPtr;
+
+		static bool compareTime(const StampedPose& a, const StampedPose& b);
+		static bool isBefore(double time, const StampedPose& pose);
+		SnapshotPtr getSnapshot();
+		void dispatch();
+		void work();
+		bool serve(int connection);
+		Status handle(const MessageHeader& request, const char* payload, std::vector<char>& response);
+		Status poseAtTime(const char* payload, std::vector<char>& response);
+		Status neighbors(const char* payload, std::vector<char>& response);
+		Status localMap(const char* payload, std::vector<char>& response);
+
+	protected:
+		Graph* mGraph;
+		std::string mSensor;
+		Logger* mLogger;
+		MultiResolutionMap* mMap;
+
+		std::mutex mSnapshotMutex;
+		SnapshotPtr mSnapshot;
+
+		std::string mPath;
+		int mListenSocket;
+		bool mRunning;
+		boost::thread_group mThreads;
+
+		int mWakePipe[2]; // wakes the dispatcher when connections are returned
+
+		std::mutex mQueueMutex;
+		std::condition_variable mQueueCondition;
+		std::deque<int> mQueue;       // connections with a pending request
+		std::vector<int> mReturned;   // connections to be watched again
+		std::set<int> mConnections;   // all open connections
+	};
+}
+
+#endif
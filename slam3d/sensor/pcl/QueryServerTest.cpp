@@ -0,0 +1,135 @@
+#define BOOST_TEST_MODULE "QueryServerTest"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "QueryServer.hpp"
+
+#include <slam3d/graph/boost/BoostGraph.hpp>
+
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace slam3d;
+
+static int connectTo(const std::string& path)
+{
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	BOOST_REQUIRE(s >= 0);
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+	BOOST_REQUIRE_EQUAL(connect(s, (sockaddr*)&address, sizeof(address)), 0);
+
+	// Fail instead of hanging if the server does not answer
+	timeval timeout = {10, 0};
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	return s;
+}
+
+// Send a request and return the status of its response
+static uint32_t request(int s, uint32_t type, const void* payload, uint32_t size, std::vector<char>& response)
+{
+	QueryServer::MessageHeader header = {type, size};
+	BOOST_REQUIRE_EQUAL(send(s, &header, sizeof(header), 0), (ssize_t)sizeof(header));
+	if(size > 0)
+		BOOST_REQUIRE_EQUAL(send(s, payload, size, 0), (ssize_t)size);
+
+	BOOST_REQUIRE_EQUAL(recv(s, &header, sizeof(header), MSG_WAITALL), (ssize_t)sizeof(header));
+	response.resize(header.size);
+	if(header.size > 0)
+		BOOST_REQUIRE_EQUAL(recv(s, &response[0], header.size, MSG_WAITALL), (ssize_t)header.size);
+	return header.type;
+}
+
+static Measurement::Ptr createMeasurement(long seconds)
+{
+	timeval stamp;
+	stamp.tv_sec = seconds;
+	stamp.tv_usec = 0;
+	return Measurement::Ptr(new Measurement("R1", "S1", Transform::Identity(), boost::uuids::nil_uuid(), stamp));
+}
+
+BOOST_AUTO_TEST_CASE(query_server_round_trip)
+{
+	Clock clock;
+	Logger logger(clock);
+	BoostGraph boost_graph(&logger);
+	Graph& graph = boost_graph;
+	std::vector<IdType> ids;
+	for(int i = 0; i < 5; i++)
+		ids.push_back(graph.addVertex(createMeasurement(10 + i), Transform(Eigen::Translation<ScalarType, 3>(2 * i, 0, 0))));
+
+	const std::string path = "/tmp/slam3d_query_server_test_" + boost::lexical_cast<std::string>(getpid());
+	QueryServer server(&graph, "S1", &logger);
+	server.start(path, 2);
+
+	// More idle connections than workers, the last one is served first
+	std::vector<int> connections;
+	for(int i = 0; i < 5; i++)
+		connections.push_back(connectTo(path));
+	std::vector<char> response;
+	int64_t stamp[2] = {11, 500000};
+	for(std::vector<int>::reverse_iterator c = connections.rbegin(); c != connections.rend(); ++c)
+	{
+		BOOST_REQUIRE_EQUAL(request(*c, QueryServer::POSE_AT_TIME, stamp, sizeof(stamp), response), QueryServer::OK);
+		BOOST_REQUIRE_EQUAL(response.size(), sizeof(QueryServer::PoseRecord));
+		QueryServer::PoseRecord pose;
+		memcpy(&pose, &response[0], sizeof(pose));
+		BOOST_CHECK_CLOSE(pose.x, 3.0, 1e-6);
+		BOOST_CHECK_CLOSE(pose.qw, 1.0, 1e-6);
+	}
+
+	// Several requests on one connection
+	int s = connections.front();
+	stamp[0] = 20;
+	BOOST_CHECK_EQUAL(request(s, QueryServer::POSE_AT_TIME, stamp, sizeof(stamp), response), QueryServer::NOT_FOUND);
+
+	double neighbors[4] = {4, 0, 0, 2.5};
+	BOOST_REQUIRE_EQUAL(request(s, QueryServer::NEIGHBORS, neighbors, sizeof(neighbors), response), QueryServer::OK);
+	uint32_t count = 0;
+	memcpy(&count, &response[0], sizeof(count));
+	BOOST_REQUIRE_EQUAL(count, 3);
+	BOOST_REQUIRE_EQUAL(response.size(), sizeof(count) + count * sizeof(QueryServer::VertexRecord));
+	QueryServer::VertexRecord nearest;
+	memcpy(&nearest, &response[sizeof(count)], sizeof(nearest));
+	BOOST_CHECK_EQUAL(nearest.id, ids[2]);
+	BOOST_CHECK_EQUAL(nearest.pose.x, 4);
+
+	double local_map[5] = {0, 0, 0, 1, 1};
+	BOOST_CHECK_EQUAL(request(s, QueryServer::LOCAL_MAP, local_map, sizeof(local_map), response), QueryServer::UNAVAILABLE);
+	BOOST_CHECK_EQUAL(request(s, 42, local_map, sizeof(local_map), response), QueryServer::BAD_REQUEST);
+
+	// New vertices are visible in the next request
+	graph.addVertex(createMeasurement(15), Transform(Eigen::Translation<ScalarType, 3>(100, 0, 0)));
+	stamp[0] = 15;
+	stamp[1] = 0;
+	BOOST_REQUIRE_EQUAL(request(s, QueryServer::POSE_AT_TIME, stamp, sizeof(stamp), response), QueryServer::OK);
+	QueryServer::PoseRecord pose;
+	memcpy(&pose, &response[0], sizeof(pose));
+	BOOST_CHECK_EQUAL(pose.x, 100);
+
+	// Moved and removed vertices are updated in the next revision
+	graph.setCorrectedPose(ids[1], Transform(Eigen::Translation<ScalarType, 3>(50, 0, 0)));
+	graph.removeVertex(ids[4]);
+	stamp[0] = 11;
+	BOOST_REQUIRE_EQUAL(request(s, QueryServer::POSE_AT_TIME, stamp, sizeof(stamp), response), QueryServer::OK);
+	memcpy(&pose, &response[0], sizeof(pose));
+	BOOST_CHECK_EQUAL(pose.x, 50);
+	stamp[0] = 14;
+	BOOST_REQUIRE_EQUAL(request(s, QueryServer::POSE_AT_TIME, stamp, sizeof(stamp), response), QueryServer::OK);
+	memcpy(&pose, &response[0], sizeof(pose));
+	BOOST_CHECK_CLOSE(pose.x, 53.0, 1e-6);
+	neighbors[0] = 8;
+	neighbors[3] = 0.5;
+	BOOST_REQUIRE_EQUAL(request(s, QueryServer::NEIGHBORS, neighbors, sizeof(neighbors), response), QueryServer::OK);
+	memcpy(&count, &response[0], sizeof(count));
+	BOOST_CHECK_EQUAL(count, 0);
+
+	server.stop();
+	for(std::vector<int>::iterator c = connections.begin(); c != connections.end(); ++c)
+		close(*c);
+}
@@ -104,6 +104,21 @@ namespace slam3d
 		                           step_size(0.05),
 		                           outlier_ratio(0.35){};
 	};
+
+	/**
+	 * @class RegistrationStatistics
+	 * @brief Outcome of a single registration, e.g. to tune the parameters.
+	 */
+	struct RegistrationStatistics
+	{
+		// number of iterations done by the registration algorithm
+		int iterations;
+
+		// fitness score of the final alignment
+		double fitness_score;
+
+		RegistrationStatistics() : iterations(0), fitness_score(0) {};
+	};
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,385 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Runs the registration of the PointCloudSensor with a grid of parameters
+// on pairs of point clouds and reports the trade-off between speed and
+// accuracy. The clouds are raw arrays of pcl::PointXYZ, like test/cloud*.bin.
+//
+// Without --pairs, every cloud is registered against a copy of itself that
+// has been moved by a random perturbation, so the ground truth is known.
+// With --pairs, consecutive files form pairs. Their ground truth is read from
+// the file given by --truth, with one line "x y z qx qy qz qw" per pair that
+// holds the pose of the target in the source's frame. Without it, the result
+// of a reference registration with the default parameters is used instead,
+// which only shows the deviation from the defaults.
+
+#include "PointCloudSensor.hpp"
+
+#include <slam3d/core/FileLogger.hpp>
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+using namespace slam3d;
+
+struct Pair
+{
+	PointCloudMeasurement::Ptr source;
+	PointCloudMeasurement::Ptr target;
+	Transform truth;
+};
+
+struct Result
+{
+	RegistrationParameters parameters;
+	unsigned matched;
+	double time;         // mean time per registration in ms
+	double iterations;   // mean number of iterations
+	double fitness;      // mean fitness score of successful registrations
+	double translation;  // maximum translation error in m
+	double rotation;     // maximum rotation error in rad
+	bool pareto;
+};
+
+static PointCloud::Ptr loadCloud(const std::string& filename)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+	if(!file.good())
+		throw std::runtime_error("Could not open " + filename);
+	size_t size = file.tellg();
+	file.seekg(0);
+
+	PointCloud::Ptr cloud(new PointCloud);
+	cloud->resize(size / sizeof(PointType));
+	file.read((char*)cloud->points.data(), cloud->size() * sizeof(PointType));
+	cloud->width = cloud->size();
+	cloud->height = 1;
+	return cloud;
+}
+
+static std::vector<Transform> loadTruth(const std::string& filename)
+{
+	std::ifstream file(filename.c_str());
+	if(!file.good())
+		throw std::runtime_error("Could not open " + filename);
+
+	std::vector<Transform> poses;
+	std::string line;
+	while(std::getline(file, line))
+	{
+		if(line.empty() || line[0] == '#')
+			continue;
+		std::istringstream values(line);
+		ScalarType x, y, z, qx, qy, qz, qw;
+		if(!(values >> x >> y >> z >> qx >> qy >> qz >> qw))
+			throw std::runtime_error("Invalid pose in " + filename + ": " + line);
+		Transform pose = Transform::Identity();
+		pose.translation() = Eigen::Matrix<ScalarType, 3, 1>(x, y, z);
+		pose.linear() = Eigen::Quaternion<ScalarType>(qw, qx, qy, qz).normalized().toRotationMatrix();
+		poses.push_back(pose);
+	}
+	return poses;
+}
+
+static Measurement::Ptr toMeasurement(PointCloud::Ptr cloud)
+{
+	return Measurement::Ptr(new PointCloudMeasurement(cloud, "sweep", "sweep", Transform::Identity()));
+}
+
+static Transform randomPerturbation(std::mt19937& rng, double translation, double rotation)
+{
+	std::normal_distribution<ScalarType> normal;
+	std::uniform_real_distribution<ScalarType> uniform(0, 1);
+	Eigen::Matrix<ScalarType, 3, 1> t(normal(rng), normal(rng), normal(rng));
+	Eigen::Matrix<ScalarType, 3, 1> axis(normal(rng), normal(rng), normal(rng));
+	Transform tf = Transform::Identity();
+	tf.translation() = t.normalized() * translation * uniform(rng);
+	tf.linear() = Eigen::AngleAxis<ScalarType>(rotation * uniform(rng), axis.normalized()).toRotationMatrix();
+	return tf;
+}
+
+// All combinations of the swept parameters, based on the defaults
+static std::vector<RegistrationParameters> createGrid()
+{
+	const double densities[] = {0.1, 0.2, 0.4};
+	const double distances[] = {0.5, 1.0, 2.5};
+	const int randomness[] = {10, 20};
+	const float resolutions[] = {0.5, 1.0, 2.0};
+
+	std::vector<RegistrationParameters> grid;
+	for(unsigned d = 0; d < 3; d++)
+	{
+		for(unsigned c = 0; c < 3; c++)
+		{
+			RegistrationParameters p;
+			p.point_cloud_density = densities[d];
+			p.max_correspondence_distance = distances[c];
+			p.registration_algorithm = GICP;
+			for(unsigned r = 0; r < 2; r++)
+			{
+				p.correspondence_randomness = randomness[r];
+				grid.push_back(p);
+			}
+			p.registration_algorithm = NDT;
+			for(unsigned r = 0; r < 3; r++)
+			{
+				p.resolution = resolutions[r];
+				grid.push_back(p);
+			}
+		}
+	}
+	return grid;
+}
+
+static Result evaluate(PointCloudSensor& sensor, const std::vector<Pair>& pairs, const RegistrationParameters& parameters)
+{
+	Result result;
+	result.parameters = parameters;
+	result.matched = 0;
+	result.time = 0;
+	result.iterations = 0;
+	result.fitness = 0;
+	result.translation = 0;
+	result.rotation = 0;
+	result.pareto = false;
+
+	sensor.setFineConfiguaration(parameters);
+	for(std::vector<Pair>::const_iterator pair = pairs.begin(); pair != pairs.end(); ++pair)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		try
+		{
+			Constraint::Ptr c = sensor.createConstraint(pair->source, pair->target, Transform::Identity(), false);
+			Transform estimate = boost::static_pointer_cast<SE3Constraint>(c)->getRelativePose().transform;
+			Transform error = pair->truth.inverse() * estimate;
+			RegistrationStatistics stats = PointCloudSensor::getLastRegistrationStatistics();
+			result.matched++;
+			result.fitness += stats.fitness_score;
+			result.translation = std::max<double>(result.translation, error.translation().norm());
+			result.rotation = std::max<double>(result.rotation, Eigen::AngleAxis<ScalarType>(error.rotation()).angle());
+		}catch(NoMatch& e)
+		{
+		}
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		result.time += std::chrono::duration<double, std::milli>(end - start).count();
+		result.iterations += PointCloudSensor::getLastRegistrationStatistics().iterations;
+	}
+	result.time /= pairs.size();
+	result.iterations /= pairs.size();
+	if(result.matched > 0)
+		result.fitness /= result.matched;
+	return result;
+}
+
+// A result is on the Pareto front, if no other one is at least as fast and
+// as accurate in translation and rotation while matching at least as many pairs.
+static void markParetoFront(std::vector<Result>& results)
+{
+	for(std::vector<Result>::iterator a = results.begin(); a != results.end(); ++a)
+	{
+		if(a->matched == 0)
+			continue;
+		a->pareto = true;
+		for(std::vector<Result>::const_iterator b = results.begin(); b != results.end(); ++b)
+		{
+			if(b == a || b->matched < a->matched || b->time > a->time ||
+			   b->translation > a->translation || b->rotation > a->rotation)
+				continue;
+			if(b->matched > a->matched || b->time < a->time ||
+			   b->translation < a->translation || b->rotation < a->rotation)
+			{
+				a->pareto = false;
+				break;
+			}
+		}
+	}
+}
+
+static const char* algorithmName(RegistrationAlgorithm a)
+{
+	switch(a)
+	{
+	case ICP: return "ICP";
+	case GICP: return "GICP";
+	case NDT: return "NDT";
+	}
+	return "unknown";
+}
+
+static void printUsage()
+{
+	std::cerr << "Usage: registration_sweep [options] cloud.bin [cloud.bin ...]" << std::endl
+	          << "  --pairs            register consecutive clouds against each other" << std::endl
+	          << "  --truth file       ground truth of the pairs, one line \"x y z qx qy qz qw\"" << std::endl
+	          << "                     per pair, default is a reference registration" << std::endl
+	          << "  --perturbation t r maximum translation (m) and rotation (deg) of the" << std::endl
+	          << "                     perturbed copies, default is 1.0 and 10" << std::endl
+	          << "  --accuracy e       translation error (m) to be met by the recommended" << std::endl
+	          << "                     configuration, default is 0.05" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	bool use_pairs = false;
+	double max_translation = 1.0;
+	double max_rotation = 10.0;
+	double accuracy = 0.05;
+	std::string truth_file;
+	std::vector<std::string> files;
+	for(int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if(arg == "--pairs")
+		{
+			use_pairs = true;
+		}else if(arg == "--perturbation" && i + 2 < argc)
+		{
+			max_translation = atof(argv[++i]);
+			max_rotation = atof(argv[++i]);
+		}else if(arg == "--truth" && i + 1 < argc)
+		{
+			truth_file = argv[++i];
+		}else if(arg == "--accuracy" && i + 1 < argc)
+		{
+			accuracy = atof(argv[++i]);
+		}else if(arg.compare(0, 2, "--") == 0)
+		{
+			printUsage();
+			return 1;
+		}else
+		{
+			files.push_back(arg);
+		}
+	}
+	if(files.empty() || (use_pairs && files.size() % 2 != 0) || (!use_pairs && !truth_file.empty()))
+	{
+		printUsage();
+		return 1;
+	}
+
+	Clock clock;
+	FileLogger logger(clock, "registration_sweep.log");
+	logger.setLogLevel(WARNING);
+	PointCloudSensor sensor("sweep", &logger);
+	sensor.setCoarseConfiguaration(RegistrationParameters());
+
+	std::vector<Pair> pairs;
+	std::vector<Transform> truth;
+	std::mt19937 rng(42);
+	try
+	{
+		if(!truth_file.empty())
+		{
+			truth = loadTruth(truth_file);
+			if(truth.size() != files.size() / 2)
+				throw std::runtime_error((boost::format("%1% contains %2% poses for %3% pairs")
+					% truth_file % truth.size() % (files.size() / 2)).str());
+		}else if(use_pairs)
+		{
+			std::cerr << "No ground truth given, errors are relative to a reference registration." << std::endl;
+		}
+
+		for(unsigned i = 0; i < files.size(); i++)
+		{
+			Pair pair;
+			PointCloud::Ptr cloud = loadCloud(files[i]);
+			pair.source = boost::static_pointer_cast<PointCloudMeasurement>(toMeasurement(cloud));
+			if(use_pairs)
+			{
+				PointCloud::Ptr target = loadCloud(files[++i]);
+				pair.target = boost::static_pointer_cast<PointCloudMeasurement>(toMeasurement(target));
+				if(!truth.empty())
+				{
+					pair.truth = truth[pairs.size()];
+				}else
+				{
+					sensor.setFineConfiguaration(RegistrationParameters());
+					Constraint::Ptr c = sensor.createConstraint(pair.source, pair.target, Transform::Identity(), true);
+					pair.truth = boost::static_pointer_cast<SE3Constraint>(c)->getRelativePose().transform;
+				}
+			}else
+			{
+				// The registration estimates the pose of the target in the
+				// source's frame, which is the inverse of the perturbation.
+				Transform perturbation = randomPerturbation(rng, max_translation, max_rotation * M_PI / 180.0);
+				PointCloud::Ptr target = sensor.transform(cloud, perturbation);
+				pair.target = boost::static_pointer_cast<PointCloudMeasurement>(toMeasurement(target));
+				pair.truth = perturbation.inverse();
+			}
+			pairs.push_back(pair);
+		}
+	}catch(std::exception& e)
+	{
+		std::cerr << "Failed to prepare the clouds: " << e.what() << std::endl;
+		return 1;
+	}
+
+	std::vector<RegistrationParameters> grid = createGrid();
+	std::vector<Result> results;
+	for(std::vector<RegistrationParameters>::const_iterator p = grid.begin(); p != grid.end(); ++p)
+	{
+		results.push_back(evaluate(sensor, pairs, *p));
+	}
+	markParetoFront(results);
+
+	std::cout << "algorithm density distance randomness resolution matched time_ms iterations fitness err_m err_deg pareto" << std::endl;
+	const Result* best = NULL;
+	for(std::vector<Result>::const_iterator r = results.begin(); r != results.end(); ++r)
+	{
+		const RegistrationParameters& p = r->parameters;
+		std::cout << boost::format("%1% %2% %3% %4% %5% %6%/%7% %8$.1f %9$.1f %10$.4f %11$.4f %12$.3f %13%")
+			% algorithmName(p.registration_algorithm) % p.point_cloud_density % p.max_correspondence_distance
+			% p.correspondence_randomness % p.resolution % r->matched % pairs.size() % r->time % r->iterations
+			% r->fitness % r->translation % (r->rotation * 180.0 / M_PI) % (r->pareto ? "*" : "") << std::endl;
+		if(r->matched == pairs.size() && r->translation <= accuracy && (!best || r->time < best->time))
+			best = &(*r);
+	}
+
+	if(!best)
+	{
+		std::cout << std::endl << "No configuration matched all pairs within " << accuracy << " m." << std::endl;
+		return 2;
+	}
+
+	const RegistrationParameters& p = best->parameters;
+	std::cout << std::endl << "Fastest configuration within " << accuracy << " m:" << std::endl
+	          << "registration_algorithm: " << algorithmName(p.registration_algorithm) << std::endl
+	          << "point_cloud_density: " << p.point_cloud_density << std::endl
+	          << "max_correspondence_distance: " << p.max_correspondence_distance << std::endl;
+	if(p.registration_algorithm == NDT)
+		std::cout << "resolution: " << p.resolution << std::endl;
+	else
+		std::cout << "correspondence_randomness: " << p.correspondence_randomness << std::endl;
+	return 0;
+}
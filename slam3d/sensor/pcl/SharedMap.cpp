@@ -0,0 +1,349 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "SharedMap.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHARED_MAP_MAGIC 0x534c414d33444d31ULL // "SLAM3DM1"
+
+using namespace slam3d;
+
+// Cache line alignment, so that the slots do not share lines
+static size_t align(size_t offset)
+{
+	return (offset + 63) & ~(size_t)63;
+}
+
+static std::runtime_error systemError(const std::string& what, const std::string& name)
+{
+	return std::runtime_error((boost::format("%1% '%2%' failed: %3%") % what % name % strerror(errno)).str());
+}
+
+SharedMap::SharedMap(const std::string& name)
+ : mName(name), mFile(-1), mMemory(NULL), mSize(0), mHeader(NULL)
+{
+}
+
+SharedMap::~SharedMap()
+{
+	if(mMemory)
+		munmap(mMemory, mSize);
+	if(mFile >= 0)
+		close(mFile);
+}
+
+SharedMap::Layout SharedMap::computeLayout(uint32_t max_poses, uint32_t max_points, uint32_t max_tiles)
+{
+	Layout l;
+	size_t offset = align(sizeof(Slot));
+	l.ids = offset; offset = align(offset + max_poses * sizeof(IdType));
+	l.x   = offset; offset = align(offset + max_poses * sizeof(double));
+	l.y   = offset; offset = align(offset + max_poses * sizeof(double));
+	l.z   = offset; offset = align(offset + max_poses * sizeof(double));
+	l.qw  = offset; offset = align(offset + max_poses * sizeof(double));
+	l.qx  = offset; offset = align(offset + max_poses * sizeof(double));
+	l.qy  = offset; offset = align(offset + max_poses * sizeof(double));
+	l.qz  = offset; offset = align(offset + max_poses * sizeof(double));
+	l.tiles = offset; offset = align(offset + max_tiles * sizeof(Tile));
+	l.px  = offset; offset = align(offset + max_points * sizeof(float));
+	l.py  = offset; offset = align(offset + max_points * sizeof(float));
+	l.pz  = offset; offset = align(offset + max_points * sizeof(float));
+	l.size = offset;
+	return l;
+}
+
+SharedMap::Slot* SharedMap::getSlot(uint32_t index) const
+{
+	return (Slot*)(mMemory + align(sizeof(Header)) + index * mLayout.size);
+}
+
+void SharedMap::map(size_t size, bool writable)
+{
+	int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	void* memory = mmap(NULL, size, protection, MAP_SHARED, mFile, 0);
+	if(memory == MAP_FAILED)
+		throw systemError("Mapping shared memory", mName);
+	mMemory = (char*)memory;
+	mSize = size;
+	mHeader = (Header*)mMemory;
+}
+
+const SharedMap::Tile* SharedMap::findTile(const View& view, int32_t x, int32_t y, int32_t z)
+{
+	Tile key = {x, y, z, 0, 0};
+	const Tile* end = view.tile + view.tiles;
+	const Tile* t = std::lower_bound(view.tile, end, key, tileLess);
+	if(t != end && t->x == x && t->y == y && t->z == z)
+		return t;
+	return NULL;
+}
+
+bool SharedMap::tileLess(const Tile& a, const Tile& b)
+{
+	if(a.x != b.x) return a.x < b.x;
+	if(a.y != b.y) return a.y < b.y;
+	return a.z < b.z;
+}
+
+// Writer
+// ------
+
+SharedMapWriter::SharedMapWriter(const std::string& name, uint32_t max_poses, uint32_t max_points,
+                                 uint32_t max_tiles, float tile_size)
+ : SharedMap(name)
+{
+	if(!(tile_size > 0))
+		throw std::invalid_argument("SharedMapWriter requires a positive tile size!");
+
+	mLayout = computeLayout(max_poses, max_points, max_tiles);
+	size_t size = align(sizeof(Header)) + 2 * mLayout.size;
+
+	mFile = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+	if(mFile < 0)
+		throw systemError("Creating shared memory", name);
+
+	// The destructor will not run, so the object has to be removed here
+	try
+	{
+		// Truncate first to discard the content of a previous writer
+		if(ftruncate(mFile, 0) != 0 || ftruncate(mFile, size) != 0)
+			throw systemError("Resizing shared memory", name);
+		map(size, true);
+
+		new (mHeader) Header();
+		if(!mHeader->latest.is_lock_free())
+			throw std::runtime_error("SharedMap requires lock-free 64 bit atomics!");
+		mHeader->max_poses = max_poses;
+		mHeader->max_points = max_points;
+		mHeader->max_tiles = max_tiles;
+		mHeader->tile_size = tile_size;
+		mHeader->slot_size = mLayout.size;
+		mHeader->latest.store(0);
+		for(uint32_t i = 0; i < 2; i++)
+		{
+			Slot* slot = new (getSlot(i)) Slot();
+			slot->sequence.store(0);
+		}
+
+		// Readers check the magic number, so it is written last
+		std::atomic_thread_fence(std::memory_order_release);
+		mHeader->magic = SHARED_MAP_MAGIC;
+	}catch(...)
+	{
+		shm_unlink(name.c_str());
+		throw;
+	}
+}
+
+SharedMapWriter::~SharedMapWriter()
+{
+	shm_unlink(mName.c_str());
+}
+
+bool SharedMapWriter::Entry::operator<(const Entry& other) const
+{
+	if(tileLess(tile, other.tile)) return true;
+	if(tileLess(other.tile, tile)) return false;
+	return point < other.point;
+}
+
+void SharedMapWriter::publish(const VertexObjectList& vertices, const PointCloud& map, RevisionType revision)
+{
+	// Sort the points into tiles before touching the shared memory
+	mEntries.clear();
+	const double scale = 1.0 / mHeader->tile_size;
+	for(uint32_t i = 0; i < map.size(); i++)
+	{
+		const PointType& p = map[i];
+		if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+			continue;
+		Entry e;
+		e.tile.x = std::floor(p.x * scale);
+		e.tile.y = std::floor(p.y * scale);
+		e.tile.z = std::floor(p.z * scale);
+		e.point = i;
+		mEntries.push_back(e);
+	}
+	std::sort(mEntries.begin(), mEntries.end());
+
+	uint32_t tiles = 0;
+	for(size_t i = 0; i < mEntries.size(); i++)
+	{
+		if(i == 0 || tileLess(mEntries[i - 1].tile, mEntries[i].tile))
+			tiles++;
+	}
+
+	if(vertices.size() > mHeader->max_poses || mEntries.size() > mHeader->max_points || tiles > mHeader->max_tiles)
+		throw std::length_error((boost::format("SharedMap '%1%' cannot hold %2% poses, %3% points and %4% tiles.")
+			% mName % vertices.size() % mEntries.size() % tiles).str());
+
+	// Mark the slot as being written, readers will retry or fail validation
+	uint64_t next = mHeader->latest.load(std::memory_order_relaxed) + 1;
+	Slot* slot = getSlot(next & 1);
+	uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+	slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	char* base = (char*)slot;
+	IdType* ids = (IdType*)(base + mLayout.ids);
+	double* x  = (double*)(base + mLayout.x);
+	double* y  = (double*)(base + mLayout.y);
+	double* z  = (double*)(base + mLayout.z);
+	double* qw = (double*)(base + mLayout.qw);
+	double* qx = (double*)(base + mLayout.qx);
+	double* qy = (double*)(base + mLayout.qy);
+	double* qz = (double*)(base + mLayout.qz);
+	for(size_t i = 0; i < vertices.size(); i++)
+	{
+		const Transform& pose = vertices[i].corrected_pose;
+		Eigen::Quaternion<ScalarType> q(pose.rotation());
+		ids[i] = vertices[i].index;
+		x[i] = pose.translation()[0];
+		y[i] = pose.translation()[1];
+		z[i] = pose.translation()[2];
+		qw[i] = q.w();
+		qx[i] = q.x();
+		qy[i] = q.y();
+		qz[i] = q.z();
+	}
+
+	Tile* tile = (Tile*)(base + mLayout.tiles);
+	float* px = (float*)(base + mLayout.px);
+	float* py = (float*)(base + mLayout.py);
+	float* pz = (float*)(base + mLayout.pz);
+	uint32_t t = 0;
+	for(uint32_t i = 0; i < mEntries.size(); i++)
+	{
+		const Entry& e = mEntries[i];
+		if(i == 0 || tileLess(mEntries[i - 1].tile, e.tile))
+		{
+			if(i > 0)
+				tile[t++].end = i;
+			tile[t] = e.tile;
+			tile[t].begin = i;
+		}
+		const PointType& p = map[e.point];
+		px[i] = p.x;
+		py[i] = p.y;
+		pz[i] = p.z;
+	}
+	if(tiles > 0)
+		tile[t].end = mEntries.size();
+
+	slot->revision = revision;
+	slot->poses = vertices.size();
+	slot->tiles = tiles;
+	slot->points = mEntries.size();
+
+	slot->sequence.store(sequence + 2, std::memory_order_release);
+	mHeader->latest.store(next, std::memory_order_release);
+}
+
+// Reader
+// ------
+
+SharedMapReader::SharedMapReader(const std::string& name)
+ : SharedMap(name)
+{
+	mFile = shm_open(name.c_str(), O_RDONLY, 0);
+	if(mFile < 0)
+		throw systemError("Opening shared memory", name);
+
+	struct stat info;
+	if(fstat(mFile, &info) != 0)
+		throw systemError("Reading size of shared memory", name);
+	if((size_t)info.st_size < align(sizeof(Header)))
+		throw std::runtime_error((boost::format("Shared memory '%1%' is too small.") % name).str());
+	map(info.st_size, false);
+
+	if(mHeader->magic != SHARED_MAP_MAGIC)
+		throw std::runtime_error((boost::format("Shared memory '%1%' does not contain a map.") % name).str());
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	mLayout = computeLayout(mHeader->max_poses, mHeader->max_points, mHeader->max_tiles);
+	if(mLayout.size != mHeader->slot_size || align(sizeof(Header)) + 2 * mLayout.size > mSize)
+		throw std::runtime_error((boost::format("Shared memory '%1%' has an unknown layout.") % name).str());
+}
+
+bool SharedMapReader::acquire(View& view) const
+{
+	while(true)
+	{
+		uint64_t latest = mHeader->latest.load(std::memory_order_acquire);
+		if(latest == 0)
+			return false;
+
+		// If the slot is being written, a newer publication is complete
+		const Slot* slot = getSlot(latest & 1);
+		uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+		if(sequence & 1)
+			continue;
+
+		const char* base = (const char*)slot;
+		view.slot = latest & 1;
+		view.sequence = sequence;
+		view.revision = slot->revision;
+		view.poses = std::min(slot->poses, mHeader->max_poses);
+		view.ids = (const IdType*)(base + mLayout.ids);
+		view.x  = (const double*)(base + mLayout.x);
+		view.y  = (const double*)(base + mLayout.y);
+		view.z  = (const double*)(base + mLayout.z);
+		view.qw = (const double*)(base + mLayout.qw);
+		view.qx = (const double*)(base + mLayout.qx);
+		view.qy = (const double*)(base + mLayout.qy);
+		view.qz = (const double*)(base + mLayout.qz);
+		view.tile_size = mHeader->tile_size;
+		view.tiles = std::min(slot->tiles, mHeader->max_tiles);
+		view.tile = (const Tile*)(base + mLayout.tiles);
+		view.points = std::min(slot->points, mHeader->max_points);
+		view.px = (const float*)(base + mLayout.px);
+		view.py = (const float*)(base + mLayout.py);
+		view.pz = (const float*)(base + mLayout.pz);
+
+		// The counts must belong to the same publication as the data
+		if(validate(view))
+			return true;
+	}
+}
+
+bool SharedMapReader::validate(const View& view) const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return getSlot(view.slot)->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
@@ -0,0 +1,224 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SLAM3D_SHAREDMAP_HPP
+#define SLAM3D_SHAREDMAP_HPP
+
+#include <slam3d/sensor/pcl/VoxelFilter.hpp>
+#include <slam3d/core/Types.hpp>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace slam3d
+{
+	/**
+	 * @class SharedMap
+	 * @brief Layout of the trajectory and map in a POSIX shared memory region.
+	 * @details The region holds two slots, which are written alternately by
+	 * a single SharedMapWriter. Each slot is protected by a sequence counter
+	 * that is odd while the slot is being written. A reader takes the slot
+	 * of the latest publication, uses the data in place and checks afterwards
+	 * that the counter has not changed (see SharedMapReader::validate). As
+	 * the writer alternates the slots, readers have a full publication period
+	 * to use the data. Neither side ever blocks.
+	 *
+	 * Poses are stored as separate arrays (structure of arrays), the map as
+	 * cubic tiles sorted by their key, each referring to a range of points.
+	 */
+	class SharedMap
+	{
+	public:
+		struct Tile
+		{
+			int32_t x, y, z;  // tile coordinates, i.e. floor(point / tile_size)
+			uint32_t begin;   // range of the tile's points
+			uint32_t end;
+		};
+
+		/**
+		 * @brief Pointers into a slot of the shared memory.
+		 * @details The data is only consistent if SharedMapReader::validate
+		 * returns true after it has been used.
+		 */
+		struct View
+		{
+			RevisionType revision;
+
+			uint32_t poses;
+			const IdType* ids;
+			const double* x;
+			const double* y;
+			const double* z;
+			const double* qw;
+			const double* qx;
+			const double* qy;
+			const double* qz;
+
+			float tile_size;
+			uint32_t tiles;
+			const Tile* tile;
+
+			uint32_t points;
+			const float* px;
+			const float* py;
+			const float* pz;
+
+			uint32_t slot;
+			uint64_t sequence;
+		};
+
+		/**
+		 * @brief Find the tile with the given coordinates.
+		 * @return pointer to the tile or NULL if it does not exist
+		 */
+		static const Tile* findTile(const View& view, int32_t x, int32_t y, int32_t z);
+
+		/**
+		 * @brief Order of the tiles within the shared memory.
+		 */
+		static bool tileLess(const Tile& a, const Tile& b);
+
+	protected:
+		struct Header
+		{
+			uint64_t magic;
+			uint32_t max_poses;
+			uint32_t max_points;
+			uint32_t max_tiles;
+			float tile_size;
+			uint64_t slot_size;
+			std::atomic<uint64_t> latest;
+		};
+
+		struct Slot
+		{
+			std::atomic<uint64_t> sequence;
+			uint64_t revision;
+			uint32_t poses;
+			uint32_t tiles;
+			uint32_t points;
+		};
+
+		// Offsets of the arrays within a slot
+		struct Layout
+		{
+			size_t ids, x, y, z, qw, qx, qy, qz;
+			size_t tiles, px, py, pz;
+			size_t size;
+		};
+
+		SharedMap(const std::string& name);
+		~SharedMap();
+
+		static Layout computeLayout(uint32_t max_poses, uint32_t max_points, uint32_t max_tiles);
+		Slot* getSlot(uint32_t index) const;
+		void map(size_t size, bool writable);
+
+	protected:
+		std::string mName;
+		int mFile;
+		char* mMemory;
+		size_t mSize;
+		Header* mHeader;
+		Layout mLayout;
+	};
+
+	/**
+	 * @class SharedMapWriter
+	 * @brief Publishes the trajectory and map into shared memory.
+	 * @details There must only be one writer for each region. The region is
+	 * removed when the writer is destroyed, but readers keep their mapping.
+	 */
+	class SharedMapWriter : public SharedMap
+	{
+	public:
+		/**
+		 * @brief Create the shared memory region.
+		 * @param name name of the region, e.g. "/slam3d_map"
+		 * @param max_poses maximum number of poses
+		 * @param max_points maximum number of map points
+		 * @param max_tiles maximum number of map tiles
+		 * @param tile_size edge length of the map tiles
+		 * @throw std::runtime_error
+		 */
+		SharedMapWriter(const std::string& name, uint32_t max_poses, uint32_t max_points,
+		                uint32_t max_tiles, float tile_size);
+		~SharedMapWriter();
+
+		/**
+		 * @brief Write a new trajectory and map into the region.
+		 * @param vertices vertices with their corrected poses
+		 * @param map map in the same coordinate frame
+		 * @param revision revision of the graph, passed to the readers
+		 * @throw std::length_error if the data exceeds the capacity
+		 */
+		void publish(const VertexObjectList& vertices, const PointCloud& map, RevisionType revision);
+
+	private:
+		struct Entry
+		{
+			SharedMap::Tile tile;
+			uint32_t point;
+			bool operator<(const Entry& other) const;
+		};
+		std::vector<Entry> mEntries;
+	};
+
+	/**
+	 * @class SharedMapReader
+	 * @brief Reads the trajectory and map from shared memory without copies.
+	 */
+	class SharedMapReader : public SharedMap
+	{
+	public:
+		/**
+		 * @brief Open an existing shared memory region read-only.
+		 * @param name name of the region
+		 * @throw std::runtime_error
+		 */
+		SharedMapReader(const std::string& name);
+
+		/**
+		 * @brief Get the latest publication.
+		 * @param view pointers to the data of the latest publication
+		 * @return false if nothing has been published yet
+		 */
+		bool acquire(View& view) const;
+
+		/**
+		 * @brief Check that the data of a view has not been changed.
+		 * @details This must be called after the data has been used. If it
+		 * returns false, the results have to be discarded and the data has
+		 * to be acquired again.
+		 * @param view the view returned by acquire
+		 */
+		bool validate(const View& view) const;
+	};
+}
+
+#endif
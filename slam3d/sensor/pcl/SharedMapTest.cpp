@@ -0,0 +1,147 @@
+#define BOOST_TEST_MODULE "SharedMapTest"
+
+#include <boost/test/unit_test.hpp>
+
+#include "SharedMap.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace slam3d;
+
+#define PUBLICATIONS 2000
+#define TIMEOUT 60 // seconds
+
+// Kills the reader if the test fails before it has been waited for
+struct ChildProcess
+{
+	ChildProcess(pid_t p) : pid(p) {}
+	~ChildProcess()
+	{
+		if(pid > 0)
+		{
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+		}
+	}
+
+	// Wait for the child to exit, kill it after the timeout
+	bool wait(int& status)
+	{
+		for(int i = 0; i < TIMEOUT * 100; i++)
+		{
+			pid_t result = waitpid(pid, &status, WNOHANG);
+			if(result == pid)
+			{
+				pid = 0;
+				return true;
+			}
+			if(result < 0)
+				return false;
+			usleep(10000);
+		}
+		return false;
+	}
+
+	pid_t pid;
+};
+
+// Every publication contains only its revision, so a mix is easy to detect
+static bool isConsistent(const SharedMap::View& view)
+{
+	if(view.poses != 100 || view.points != 1000)
+		return false;
+	for(uint32_t i = 0; i < view.poses; i++)
+	{
+		if(view.ids[i] != i || view.x[i] != view.revision || view.qw[i] != 1.0)
+			return false;
+	}
+	const SharedMap::Tile* tile = SharedMap::findTile(view, view.revision, 0, 0);
+	if(!tile || tile->end - tile->begin != view.points)
+		return false;
+	for(uint32_t i = tile->begin; i < tile->end; i++)
+	{
+		if(view.px[i] != view.revision + 0.5f || view.py[i] != 0.5f)
+			return false;
+	}
+	return true;
+}
+
+static int readUntilLast(const std::string& name)
+{
+	// Wait for the writer to create the region
+	SharedMapReader* reader = NULL;
+	for(int i = 0; i < 1000 && !reader; i++)
+	{
+		try
+		{
+			reader = new SharedMapReader(name);
+		}catch(std::runtime_error& e)
+		{
+			usleep(1000);
+		}
+	}
+	if(!reader)
+		return 2;
+
+	RevisionType last = 0;
+	while(last < PUBLICATIONS)
+	{
+		SharedMap::View view;
+		if(!reader->acquire(view))
+			continue;
+		bool consistent = isConsistent(view);
+		if(!reader->validate(view))
+			continue;
+		if(!consistent || view.revision < last)
+			return 1;
+		last = view.revision;
+	}
+	delete reader;
+	return 0;
+}
+
+BOOST_AUTO_TEST_CASE(shared_map_two_processes)
+{
+	// Concurrent test runs must not share the region
+	const std::string name = "/slam3d_shared_map_test_" + boost::lexical_cast<std::string>(getpid());
+	ChildProcess child(fork());
+	BOOST_REQUIRE(child.pid >= 0);
+	if(child.pid == 0)
+	{
+		// The reader must not outlive a failed writer
+		alarm(TIMEOUT);
+		_exit(readUntilLast(name));
+	}
+
+	SharedMapWriter writer(name, 100, 1000, 10, 1.0);
+	VertexObjectList vertices(100);
+	PointCloud map;
+	map.resize(1000);
+	for(RevisionType r = 1; r <= PUBLICATIONS; r++)
+	{
+		for(unsigned i = 0; i < vertices.size(); i++)
+		{
+			vertices[i].index = i;
+			vertices[i].corrected_pose = Transform::Identity();
+			vertices[i].corrected_pose.translation()[0] = r;
+		}
+		for(unsigned i = 0; i < map.size(); i++)
+		{
+			map[i] = PointType(r + 0.5f, 0.5f, 0.5f);
+		}
+		writer.publish(vertices, map, r);
+	}
+
+	int status = 0;
+	BOOST_REQUIRE(child.wait(status));
+	BOOST_REQUIRE(WIFEXITED(status));
+	BOOST_CHECK_EQUAL(WEXITSTATUS(status), 0);
+
+	// The capacity must not be exceeded
+	map.resize(1001);
+	BOOST_CHECK_THROW(writer.publish(vertices, map, PUBLICATIONS + 1), std::length_error);
+}
@@ -0,0 +1,335 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "VoxelFilter.hpp"
+#include "PointKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define SHARD_BITS 8
+#define SHARDS (1 << SHARD_BITS)
+#define INVALID_SHARD 0xFFFF
+
+using namespace slam3d;
+
+VoxelFilter::VoxelFilter(double leaf_size, VoxelMode mode)
+ : mLeafSize(leaf_size), mInverseLeafSize(1.0 / leaf_size), mMode(mode),
+   mMinNeighbors(0), mShards(SHARDS)
+{
+}
+
+int32_t VoxelFilter::distance(const Offset& o)
+{
+	return o.x * o.x + o.y * o.y + o.z * o.z;
+}
+
+bool VoxelFilter::closer(const Offset& a, const Offset& b)
+{
+	return distance(a) < distance(b);
+}
+
+void VoxelFilter::setMinSupport(unsigned min_neighbors, unsigned range)
+{
+	mMinNeighbors = min_neighbors;
+	mNeighborhood.clear();
+	const int32_t r = range;
+	for(int32_t x = -r; x <= r; x++)
+		for(int32_t y = -r; y <= r; y++)
+			for(int32_t z = -r; z <= r; z++)
+			{
+				Offset o = {x, y, z};
+				if(distance(o) > 0)
+					mNeighborhood.push_back(o);
+			}
+
+	// Close neighbors are most likely occupied, so look at them first
+	std::stable_sort(mNeighborhood.begin(), mNeighborhood.end(), closer);
+}
+
+// Rounds towards negative infinity, faster than std::floor
+static inline int32_t floorToInt(double v)
+{
+	int32_t i = (int32_t)v;
+	return i - (v < i);
+}
+
+template <typename P>
+bool VoxelFilter::getVoxel(const P& p, int32_t& x, int32_t& y, int32_t& z) const
+{
+	const double limit = std::numeric_limits<int32_t>::max();
+	double vx = p.x * mInverseLeafSize;
+	double vy = p.y * mInverseLeafSize;
+	double vz = p.z * mInverseLeafSize;
+
+	// This also rejects NaN and infinite coordinates
+	if(!(std::fabs(vx) < limit && std::fabs(vy) < limit && std::fabs(vz) < limit))
+		return false;
+	x = floorToInt(vx);
+	y = floorToInt(vy);
+	z = floorToInt(vz);
+	return true;
+}
+
+uint64_t VoxelFilter::hash(int32_t x, int32_t y, int32_t z)
+{
+	uint64_t h = (uint64_t)(uint32_t)x * 0x9E3779B97F4A7C15ULL;
+	h ^= (uint64_t)(uint32_t)y * 0xC2B2AE3D27D4EB4FULL;
+	h ^= (uint64_t)(uint32_t)z * 0x165667B19E3779F9ULL;
+	return h ^ (h >> 29);
+}
+
+// The upper bits of the hash select the shard, the lower ones the slot.
+VoxelFilter::Voxel& VoxelFilter::insert(Shard& shard, int32_t x, int32_t y, int32_t z, uint64_t h)
+{
+	// Keep the load factor below 0.5
+	if(2 * (shard.used + 1) > shard.table.size())
+	{
+		std::vector<Voxel> old;
+		old.swap(shard.table);
+		Voxel empty = {0, 0, 0, 0, 0, 0, 0, 0};
+		shard.table.assign(old.empty() ? 64 : 2 * old.size(), empty);
+		shard.used = 0;
+		for(std::vector<Voxel>::const_iterator v = old.begin(); v != old.end(); ++v)
+		{
+			if(v->count > 0)
+				insert(shard, v->x, v->y, v->z, hash(v->x, v->y, v->z)) = *v;
+		}
+	}
+
+	size_t mask = shard.table.size() - 1;
+	for(size_t i = h & mask;; i = (i + 1) & mask)
+	{
+		Voxel& v = shard.table[i];
+		if(v.count == 0)
+		{
+			v.x = x;
+			v.y = y;
+			v.z = z;
+			shard.used++;
+			return v;
+		}
+		if(v.x == x && v.y == y && v.z == z)
+			return v;
+	}
+}
+
+// Number of points in the given voxel, the tables must not change meanwhile
+uint32_t VoxelFilter::count(int64_t x, int64_t y, int64_t z) const
+{
+	const int64_t min = std::numeric_limits<int32_t>::min();
+	const int64_t max = std::numeric_limits<int32_t>::max();
+	if(x < min || x > max || y < min || y > max || z < min || z > max)
+		return 0;
+
+	uint64_t h = hash(x, y, z);
+	const std::vector<Voxel>& table = mShards[h >> (64 - SHARD_BITS)].table;
+	size_t mask = table.size() - 1;
+	for(size_t i = h & mask;; i = (i + 1) & mask)
+	{
+		const Voxel& v = table[i];
+		if(v.count == 0)
+			return 0;
+		if(v.x == x && v.y == y && v.z == z)
+			return v.count;
+	}
+}
+
+bool VoxelFilter::isSupported(const Voxel& v) const
+{
+	uint64_t support = v.count;
+	for(std::vector<Offset>::const_iterator o = mNeighborhood.begin(); support <= mMinNeighbors; ++o)
+	{
+		if(o == mNeighborhood.end())
+			return false;
+		support += count((int64_t)v.x + o->x, (int64_t)v.y + o->y, (int64_t)v.z + o->z);
+	}
+	return true;
+}
+
+void VoxelFilter::reduce(Shard& shard)
+{
+	// Size the table for a few points per voxel, but use all memory that
+	// has been allocated before, so a warm filter does not allocate again.
+	Voxel empty = {0, 0, 0, 0, 0, 0, 0, 0};
+	size_t size = 64;
+	while(size < (shard.end - shard.begin) / 2 || 2 * size <= shard.table.capacity())
+		size *= 2;
+	shard.table.assign(size, empty);
+	shard.used = 0;
+
+	for(size_t k = shard.begin; k < shard.end; k++)
+	{
+		const Entry& p = mEntries[k];
+		int32_t x = 0, y = 0, z = 0;
+		getVoxel(p, x, y, z);
+		Voxel& v = insert(shard, x, y, z, hash(x, y, z));
+		if(v.count == 0)
+			v.first = p.index;
+		v.count++;
+		v.dx += p.x - x * mLeafSize;
+		v.dy += p.y - y * mLeafSize;
+		v.dz += p.z - z * mLeafSize;
+	}
+}
+
+void VoxelFilter::select(Shard& shard) const
+{
+	shard.selected.clear();
+	for(size_t i = 0; i < shard.table.size(); i++)
+	{
+		const Voxel& v = shard.table[i];
+		if(v.count > 0 && (mMinNeighbors == 0 || isSupported(v)))
+			shard.selected.push_back(i);
+	}
+}
+
+void VoxelFilter::filter(const PointCloud& in, PointCloud& out)
+{
+	if(&in == &out)
+		throw std::invalid_argument("VoxelFilter cannot filter a point cloud in place!");
+	if(mLeafSize <= 0)
+		throw std::invalid_argument("VoxelFilter requires a positive leaf size!");
+
+	const size_t n = in.size();
+	int chunks = 1;
+#ifdef _OPENMP
+	chunks = omp_get_max_threads();
+#endif
+	mShardOfPoint.resize(n);
+	mVoxelOfPoint.resize(4 * n);
+	mEntries.resize(n);
+	mCounts.assign(chunks * SHARDS, 0);
+
+	// Assign each point to a shard and count the points per chunk and shard
+	#pragma omp parallel for schedule(static)
+	for(int c = 0; c < chunks; c++)
+	{
+		size_t* counts = &mCounts[c * SHARDS];
+		const size_t begin = n * c / chunks;
+		const size_t end = n * (c + 1) / chunks;
+		PointKernels::voxelize(in.points.data() + begin, mVoxelOfPoint.data() + 4 * begin, end - begin, mInverseLeafSize);
+		for(size_t i = begin; i < end; i++)
+		{
+			const int32_t* v = &mVoxelOfPoint[4 * i];
+			if(v[3])
+			{
+				uint16_t s = hash(v[0], v[1], v[2]) >> (64 - SHARD_BITS);
+				mShardOfPoint[i] = s;
+				counts[s]++;
+			}else
+			{
+				mShardOfPoint[i] = INVALID_SHARD;
+			}
+		}
+	}
+
+	// Turn the counts into offsets, the points of a shard keep their order
+	size_t offset = 0;
+	for(int s = 0; s < SHARDS; s++)
+	{
+		mShards[s].begin = offset;
+		for(int c = 0; c < chunks; c++)
+		{
+			size_t count = mCounts[c * SHARDS + s];
+			mCounts[c * SHARDS + s] = offset;
+			offset += count;
+		}
+		mShards[s].end = offset;
+	}
+
+	#pragma omp parallel for schedule(static)
+	for(int c = 0; c < chunks; c++)
+	{
+		size_t* offsets = &mCounts[c * SHARDS];
+		for(size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++)
+		{
+			uint16_t s = mShardOfPoint[i];
+			if(s != INVALID_SHARD)
+			{
+				Entry& e = mEntries[offsets[s]++];
+				e.x = in[i].x;
+				e.y = in[i].y;
+				e.z = in[i].z;
+				e.index = i;
+			}
+		}
+	}
+
+	// Reduce all shards independently
+	#pragma omp parallel for schedule(dynamic)
+	for(int s = 0; s < SHARDS; s++)
+	{
+		reduce(mShards[s]);
+	}
+
+	// Select the voxels to keep, this reads the tables of all shards
+	#pragma omp parallel for schedule(dynamic)
+	for(int s = 0; s < SHARDS; s++)
+	{
+		select(mShards[s]);
+	}
+
+	size_t voxels = 0;
+	for(int s = 0; s < SHARDS; s++)
+	{
+		mShards[s].output = voxels;
+		voxels += mShards[s].selected.size();
+	}
+
+	out.header = in.header;
+	out.resize(voxels);
+	out.width = voxels;
+	out.height = 1;
+	out.is_dense = true;
+
+	// Write one point per voxel
+	#pragma omp parallel for schedule(dynamic)
+	for(int s = 0; s < SHARDS; s++)
+	{
+		const Shard& shard = mShards[s];
+		size_t k = shard.output;
+		for(std::vector<uint32_t>::const_iterator i = shard.selected.begin(); i != shard.selected.end(); ++i)
+		{
+			const Voxel* v = &shard.table[*i];
+			PointType& p = out[k++];
+			if(mMode == FIRST_POINT)
+			{
+				p = in[v->first];
+			}else
+			{
+				p.x = v->x * mLeafSize + v->dx / v->count;
+				p.y = v->y * mLeafSize + v->dy / v->count;
+				p.z = v->z * mLeafSize + v->dz / v->count;
+			}
+		}
+	}
+}
@@ -0,0 +1,153 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_VOXELFILTER_HPP
+#define SLAM3D_VOXELFILTER_HPP
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <vector>
+#include <stdint.h>
+
+namespace slam3d
+{
+	typedef pcl::PointXYZ PointType;
+	typedef pcl::PointCloud<PointType> PointCloud;
+
+	enum VoxelMode {CENTROID, FIRST_POINT};
+
+	/**
+	 * @class VoxelFilter
+	 * @brief Reduces a point cloud to one point per occupied voxel.
+	 * @details Points are distributed to a fixed number of shards by the hash
+	 * of their voxel, then each shard is reduced within its own open-addressing
+	 * hash table. The shards are processed in parallel if OpenMP is available.
+	 * Optionally, voxels with too little support from points in their own and
+	 * the neighboring voxels are dropped, which removes outliers in the same
+	 * pass without a search tree.
+	 * Voxels are identified by their full integer coordinates, so there is no
+	 * restriction on the extent of the cloud. The internal buffers are kept
+	 * between calls, so a filter should be reused for many clouds. A single
+	 * instance must not be used by multiple threads at the same time.
+	 */
+	class VoxelFilter
+	{
+	public:
+		/**
+		 * @brief Constructor.
+		 * @param leaf_size edge length of the voxels
+		 * @param mode whether to keep the centroid or the first point of each voxel
+		 */
+		VoxelFilter(double leaf_size, VoxelMode mode = CENTROID);
+
+		void setLeafSize(double leaf_size) { mLeafSize = leaf_size; mInverseLeafSize = 1.0 / leaf_size; }
+		double getLeafSize() const { return mLeafSize; }
+
+		void setMode(VoxelMode mode) { mMode = mode; }
+		VoxelMode getMode() const { return mMode; }
+
+		/**
+		 * @brief Drop voxels that are not supported by enough points.
+		 * @details A voxel is kept, if the voxels within the given range
+		 * (including itself) contain more than min_neighbors points. This
+		 * resembles a radius outlier removal with a radius of about
+		 * range * leaf_size, but works on voxels instead of single points.
+		 * @param min_neighbors minimum number of neighbors, 0 to disable
+		 * @param range number of neighboring voxels in each direction
+		 */
+		void setMinSupport(unsigned min_neighbors, unsigned range = 1);
+
+		/**
+		 * @brief Downsample the input cloud into the given output cloud.
+		 * @details The output is resized to the number of occupied voxels, so
+		 * its memory is reused. Points that are not finite are dropped, as
+		 * well as unsupported voxels if setMinSupport has been used. The
+		 * order of the output does not depend on the number of threads, but it
+		 * may differ between the first and later calls of a filter.
+		 * @param in source cloud
+		 * @param out downsampled cloud, must not be the same as in
+		 * @throw std::invalid_argument
+		 */
+		void filter(const PointCloud& in, PointCloud& out);
+
+	protected:
+		struct Voxel
+		{
+			int32_t x, y, z;
+			uint32_t count;   // number of points, 0 for empty slots
+			uint32_t first;   // index of the first point
+			float dx, dy, dz; // sum of the offsets to the voxel's corner
+		};
+
+		// Points are copied to their shard to be read sequentially
+		struct Entry
+		{
+			float x, y, z;
+			uint32_t index;
+		};
+
+		struct Shard
+		{
+			std::vector<Voxel> table;
+			size_t used;
+			size_t begin;  // range of the shard's points in mEntries
+			size_t end;
+			size_t output; // position of the first voxel in the result
+			std::vector<uint32_t> selected; // slots of the voxels to be written
+		};
+
+		struct Offset
+		{
+			int32_t x, y, z;
+		};
+
+		template <typename P>
+		bool getVoxel(const P& p, int32_t& x, int32_t& y, int32_t& z) const;
+		static uint64_t hash(int32_t x, int32_t y, int32_t z);
+		static Voxel& insert(Shard& shard, int32_t x, int32_t y, int32_t z, uint64_t h);
+		static int32_t distance(const Offset& o);
+		static bool closer(const Offset& a, const Offset& b);
+		uint32_t count(int64_t x, int64_t y, int64_t z) const;
+		bool isSupported(const Voxel& v) const;
+		void reduce(Shard& shard);
+		void select(Shard& shard) const;
+
+	protected:
+		double mLeafSize;
+		double mInverseLeafSize;
+		VoxelMode mMode;
+		unsigned mMinNeighbors;
+		std::vector<Offset> mNeighborhood;
+
+		std::vector<uint16_t> mShardOfPoint;
+		std::vector<int32_t> mVoxelOfPoint; // voxel and validity of each point
+		std::vector<Entry> mEntries;
+		std::vector<size_t> mCounts;
+		std::vector<Shard> mShards;
+	};
+}
+
+#endif
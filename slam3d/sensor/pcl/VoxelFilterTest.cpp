@@ -0,0 +1,105 @@
+#define BOOST_TEST_MODULE "VoxelFilterTest"
+
+#include <boost/test/unit_test.hpp>
+
+#include "VoxelFilter.hpp"
+
+#include <Eigen/Core>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Count all heap allocations to check that a warm filter does not allocate.
+// Point clouds use Eigen's aligned_allocator, which calls malloc directly,
+// so malloc itself is counted where the C library allows to replace it.
+static std::atomic<size_t> gAllocations(0);
+
+#ifdef __GLIBC__
+extern "C" void* __libc_malloc(size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+	gAllocations++;
+	return __libc_malloc(size);
+}
+#else
+void* operator new(std::size_t size)
+{
+	gAllocations++;
+	void* p = std::malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+#endif
+
+using namespace slam3d;
+
+BOOST_AUTO_TEST_CASE(voxel_filter_centroid)
+{
+	PointCloud in;
+	in.push_back(PointType(0.1, 0.1, 0.1));
+	in.push_back(PointType(0.3, 0.3, 0.3));
+	in.push_back(PointType(-0.2, 0.1, 0.1));
+	in.push_back(PointType(5.0, 5.0, 5.0));
+
+	PointCloud out;
+	VoxelFilter filter(1.0);
+	filter.filter(in, out);
+	BOOST_REQUIRE_EQUAL(out.size(), 3);
+
+	bool found = false;
+	for(PointCloud::const_iterator p = out.begin(); p != out.end(); ++p)
+	{
+		if(p->x > 0 && p->x < 1)
+		{
+			BOOST_CHECK_CLOSE(p->x, 0.2, 1e-3);
+			BOOST_CHECK_CLOSE(p->y, 0.2, 1e-3);
+			BOOST_CHECK_CLOSE(p->z, 0.2, 1e-3);
+			found = true;
+		}
+	}
+	BOOST_CHECK(found);
+
+	// The isolated points are not supported by any neighbors
+	filter.setMinSupport(1, 1);
+	filter.filter(in, out);
+	BOOST_CHECK_EQUAL(out.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(voxel_filter_allocations)
+{
+	// The counter sees both ways memory of a point cloud is allocated
+	size_t before = gAllocations;
+	delete new int(0);
+	Eigen::aligned_allocator<PointType> aligned;
+	aligned.deallocate(aligned.allocate(4), 4);
+#ifdef __GLIBC__
+	BOOST_CHECK_EQUAL(gAllocations - before, 2);
+#else
+	BOOST_WARN_EQUAL(gAllocations - before, 2);
+#endif
+
+	// One point per voxel, so the hash tables have to grow on the first call
+	PointCloud in;
+	for(int i = 0; i < 100000; i++)
+		in.push_back(PointType((i % 50) * 0.2 + 0.1, (i / 50 % 50) * 0.2 + 0.1, (i / 2500) * 0.2 + 0.1));
+
+	PointCloud out;
+	VoxelFilter filter(0.2);
+	filter.setMinSupport(2, 1);
+	filter.filter(in, out);
+	size_t voxels = out.size();
+
+	before = gAllocations;
+	for(int i = 0; i < 3; i++)
+		filter.filter(in, out);
+	BOOST_CHECK_EQUAL(gAllocations - before, 0);
+	BOOST_CHECK_EQUAL(out.size(), voxels);
+}
@@ -65,8 +65,8 @@ Constraint::Ptr Scan2DSensor::createConstraint(const Measurement::Ptr& source,
 	Transform guess = source->getInverseSensorPose() * odometry * target->getSensorPose();
 
 	// Cast to this sensors measurement type
-	Scan2DMeasurement::Ptr sourceScan = boost::dynamic_pointer_cast<Scan2DMeasurement>(source);
-	Scan2DMeasurement::Ptr targetScan = boost::dynamic_pointer_cast<Scan2DMeasurement>(target);
+	const Scan2DMeasurement* sourceScan = source->getAs<Scan2DMeasurement>();
+	const Scan2DMeasurement* targetScan = target->getAs<Scan2DMeasurement>();
 	if(!sourceScan || !targetScan)
 	{
 		mLogger->message(ERROR, "Measurement given to calculateTransform() is not a Scan!");
@@ -93,7 +93,7 @@ Constraint::Ptr Scan2DSensor::createConstraint(const Measurement::Ptr& source,
 	twc.transform = source->getSensorPose() * icp_result * target->getInverseSensorPose();
 	twc.covariance = Covariance<6>::Identity() * mCovarianceScale;
 	
-	return Constraint::Ptr(new SE3Constraint(mName, twc));
+	return SE3Constraint::create(mName, twc);
 }
 
 Measurement::Ptr Scan2DSensor::createCombinedMeasurement(const VertexObjectList& vertices, Transform pose) const
@@ -102,7 +102,7 @@ Measurement::Ptr Scan2DSensor::createCombinedMeasurement(const VertexObjectList&
 	PM::DataPoints accu = createDataPoints();
 	for(VertexObjectList::const_iterator it = vertices.begin(); it != vertices.end(); it++)
 	{
-		Scan2DMeasurement::Ptr scan = boost::dynamic_pointer_cast<Scan2DMeasurement>(it->measurement);
+		const Scan2DMeasurement* scan = it->measurement->getAs<Scan2DMeasurement>();
 		if(!scan)
 		{
 			mLogger->message(WARNING, "Measurement is not a Scan2D!");
@@ -43,13 +43,14 @@ namespace slam3d
 	{
 	public:
 		typedef boost::shared_ptr<Scan2DMeasurement> Ptr;
+		static const MeasurementType TYPE = MeasurementType::SCAN_2D;
 
 		Scan2DMeasurement(const PM::DataPoints& points, timeval t,
 	                    const std::string& r, const std::string& s,
 	                    const Transform& p, const boost::uuids::uuid id = boost::uuids::nil_uuid())
-		: Measurement(r, s, p, id), mDataPoints(points) { mStamp = t; }
+		: Measurement(r, s, p, id), mDataPoints(points) { mType = TYPE; mStamp = t; }
 
-		const PM::DataPoints& getDataPoints() { return mDataPoints; }
+		const PM::DataPoints& getDataPoints() const { return mDataPoints; }
 
 	protected:
 		PM::DataPoints mDataPoints;
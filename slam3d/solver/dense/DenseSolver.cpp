@@ -0,0 +1,428 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "DenseSolver.hpp"
+
+#include <boost/format.hpp>
+
+#include <Eigen/Cholesky>
+#include <algorithm>
+#include <fstream>
+
+#define EDGES_PER_VERTEX 8
+#define NUMERIC_STEP 1e-6
+#define DAMPING 1e-9
+
+using namespace slam3d;
+
+typedef Eigen::Matrix<double,6,1> Vector6;
+
+// Translation and the vector part of the normalized quaternion (w >= 0)
+static Vector6 toVector(const Eigen::Isometry3d& t)
+{
+	Eigen::Quaterniond q(t.linear());
+	q.normalize();
+	if(q.w() < 0)
+		q.coeffs() *= -1;
+	Vector6 v;
+	v.head<3>() = t.translation();
+	v.tail<3>() = q.vec();
+	return v;
+}
+
+static Eigen::Isometry3d fromVector(const Vector6& v)
+{
+	Eigen::Vector3d qv = v.tail<3>();
+	double w = 1 - qv.squaredNorm();
+	Eigen::Quaterniond q(w > 0 ? std::sqrt(w) : 0, qv(0), qv(1), qv(2));
+	q.normalize();
+	Eigen::Isometry3d t = Eigen::Isometry3d::Identity();
+	t.linear() = q.toRotationMatrix();
+	t.translation() = v.head<3>();
+	return t;
+}
+
+DenseSolver::DenseSolver(Logger* logger, unsigned capacity)
+ : Solver(logger), mCapacity(capacity), mEpsilon(1e-10)
+{
+	mVertices.reserve(mCapacity);
+	mVertexIndex.reserve(mCapacity);
+	mEdges.reserve(mCapacity * EDGES_PER_VERTEX);
+	mCorrections.reserve(mCapacity);
+	mHessian.resize(6 * mCapacity, 6 * mCapacity);
+	mGradient.resize(6 * mCapacity);
+}
+
+DenseSolver::~DenseSolver()
+{
+}
+
+typedef std::pair<IdType, unsigned> IndexEntry;
+
+static bool idLess(const IndexEntry& entry, IdType id)
+{
+	return entry.first < id;
+}
+
+int DenseSolver::findVertex(IdType id) const
+{
+	std::vector<IndexEntry>::const_iterator i = std::lower_bound(mVertexIndex.begin(), mVertexIndex.end(), id, idLess);
+	if(i == mVertexIndex.end() || i->first != id)
+		return -1;
+	return i->second;
+}
+
+void DenseSolver::addVertex(IdType id, const Transform& pose)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	if(findVertex(id) >= 0)
+	{
+		throw DuplicateVertex(id);
+	}
+	if(mVertices.size() >= mCapacity)
+	{
+		mLogger->message(ERROR, (boost::format("Cannot add vertex %1%, DenseSolver is limited to %2% vertices!") % id % mCapacity).str());
+		throw std::length_error("DenseSolver capacity exceeded!");
+	}
+
+	Vertex v;
+	v.id = id;
+	v.pose = pose.cast<Scalar>();
+	v.fixed = false;
+	v.block = -1;
+	mVertices.push_back(v);
+
+	// Within the capacity, this does not allocate memory
+	std::vector<IndexEntry>::iterator i = std::lower_bound(mVertexIndex.begin(), mVertexIndex.end(), id, idLess);
+	mVertexIndex.insert(i, IndexEntry(id, mVertices.size() - 1));
+}
+
+void DenseSolver::removeVertex(IdType id)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	int index = findVertex(id);
+	if(index < 0)
+	{
+		throw UnknownVertex(id);
+	}
+	mVertices.erase(mVertices.begin() + index);
+	std::vector<IndexEntry>::iterator i = mVertexIndex.begin();
+	while(i != mVertexIndex.end())
+	{
+		if(i->first == id)
+		{
+			i = mVertexIndex.erase(i);
+			continue;
+		}
+		if(i->second > (unsigned)index) i->second--;
+		++i;
+	}
+
+	// Remove its edges and update the indices of the others
+	std::vector<Edge>::iterator e = mEdges.begin();
+	while(e != mEdges.end())
+	{
+		if(e->source == (unsigned)index || e->target == (unsigned)index)
+		{
+			e = mEdges.erase(e);
+			continue;
+		}
+		if(e->source > (unsigned)index) e->source--;
+		if(e->target > (unsigned)index) e->target--;
+		++e;
+	}
+}
+
+void DenseSolver::storeEdge(const Edge& edge)
+{
+	if(mEdges.size() == mEdges.capacity())
+	{
+		mLogger->message(WARNING, "DenseSolver has to allocate memory for more constraints.");
+	}
+	mEdges.push_back(edge);
+}
+
+void DenseSolver::addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	int s = findVertex(source);
+	int t = findVertex(target);
+	if(s < 0 || t < 0)
+	{
+		throw BadEdge(source, target);
+	}
+
+	const TransformWithCovariance& twc = se3->getRelativePose();
+	Edge edge;
+	edge.source = s;
+	edge.target = t;
+	edge.type = SE3;
+	edge.measurement = twc.transform.cast<Scalar>();
+	edge.information = twc.covariance.inverse().cast<Scalar>();
+	storeEdge(edge);
+}
+
+void DenseSolver::addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	int v = findVertex(vertex);
+	if(v < 0)
+	{
+		throw BadEdge(vertex, 0);
+	}
+
+	Edge edge;
+	edge.source = v;
+	edge.target = v;
+	edge.type = GRAVITY;
+	edge.direction = grav->getDirection().cast<Scalar>().normalized();
+	edge.reference = grav->getReference().cast<Scalar>().normalized();
+	edge.information.setZero();
+	edge.information.topLeftCorner<2,2>() = grav->getCovariance().inverse().cast<Scalar>();
+	storeEdge(edge);
+}
+
+void DenseSolver::addEdgePosition(IdType vertex, PositionConstraint::Ptr pos)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	int v = findVertex(vertex);
+	if(v < 0)
+	{
+		throw BadEdge(vertex, 0);
+	}
+
+	Edge edge;
+	edge.source = v;
+	edge.target = v;
+	edge.type = POSITION;
+	edge.reference = pos->getPosition().cast<Scalar>();
+	edge.information.setZero();
+	edge.information.topLeftCorner<3,3>() = pos->getCovariance().inverse().cast<Scalar>();
+	storeEdge(edge);
+}
+
+void DenseSolver::setFixed(IdType id)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	int v = findVertex(id);
+	if(v < 0)
+	{
+		mLogger->message(ERROR, (boost::format("Could not fix vertex with ID %1%!") % id).str());
+		throw UnknownVertex(id);
+	}
+	mVertices[v].fixed = true;
+}
+
+// Same error functions as the corresponding g2o edges
+unsigned DenseSolver::computeError(const Edge& edge, const Pose& source, const Pose& target, Vector6& error) const
+{
+	switch(edge.type)
+	{
+	case SE3:
+		error = toVector(edge.measurement.inverse() * source.inverse() * target);
+		return 6;
+	case GRAVITY:
+		error.head<2>() = (source.linear().transpose() * edge.reference - edge.direction).head<2>();
+		return 2;
+	case POSITION:
+		error.head<3>() = source.translation() - edge.reference;
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+DenseSolver::Scalar DenseSolver::linearize(unsigned dimension)
+{
+	mHessian.topLeftCorner(dimension, dimension).setZero();
+	mGradient.head(dimension).setZero();
+
+	Scalar chi2 = 0;
+	Matrix6 J[2];
+	Vector6 error, e_plus, e_minus;
+	for(std::vector<Edge>::const_iterator e = mEdges.begin(); e != mEdges.end(); ++e)
+	{
+		const Vertex* v[2] = {&mVertices[e->source], &mVertices[e->target]};
+		error.setZero();
+		computeError(*e, v[0]->pose, v[1]->pose, error);
+		chi2 += error.transpose() * e->information * error;
+
+		// Unused rows of unary errors stay zero, as does their information.
+		// Numeric jacobians for the perturbation of source and target
+		unsigned vertices = (e->source == e->target) ? 1 : 2;
+		for(unsigned k = 0; k < vertices; k++)
+		{
+			J[k].setZero();
+			if(v[k]->block < 0)
+				continue;
+			for(unsigned i = 0; i < 6; i++)
+			{
+				Vector6 delta = Vector6::Zero();
+				delta(i) = NUMERIC_STEP;
+				Pose plus[2] = {v[0]->pose, v[1]->pose};
+				Pose minus[2] = {v[0]->pose, v[1]->pose};
+				plus[k] = v[k]->pose * fromVector(delta);
+				minus[k] = v[k]->pose * fromVector(-delta);
+				if(vertices == 1)
+				{
+					plus[1] = plus[0];
+					minus[1] = minus[0];
+				}
+				e_plus.setZero();
+				e_minus.setZero();
+				computeError(*e, plus[0], plus[1], e_plus);
+				computeError(*e, minus[0], minus[1], e_minus);
+				J[k].col(i) = (e_plus - e_minus) / (2 * NUMERIC_STEP);
+			}
+		}
+
+		// Add the blocks to the system
+		for(unsigned a = 0; a < vertices; a++)
+		{
+			int ba = v[a]->block;
+			if(ba < 0)
+				continue;
+			Matrix6 JtO = J[a].transpose() * e->information;
+			mGradient.segment<6>(6 * ba) += JtO * error;
+			for(unsigned b = 0; b < vertices; b++)
+			{
+				int bb = v[b]->block;
+				if(bb >= 0)
+					mHessian.block<6,6>(6 * ba, 6 * bb) += JtO * J[b];
+			}
+		}
+	}
+	return chi2;
+}
+
+bool DenseSolver::compute(unsigned iterations)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	// Clear previous optimization result
+	mCorrections.clear();
+
+	// Assign the free vertices to blocks in the system
+	unsigned blocks = 0;
+	for(std::vector<Vertex>::iterator v = mVertices.begin(); v != mVertices.end(); ++v)
+	{
+		v->block = v->fixed ? -1 : blocks++;
+	}
+
+	unsigned dimension = 6 * blocks;
+	Scalar chi2 = 0;
+	unsigned iter = 0;
+	while(dimension > 0 && iter < iterations)
+	{
+		iter++;
+		chi2 = linearize(dimension);
+
+		// Solve in place within the preallocated memory
+		Eigen::Ref<Matrix> H(mHessian.topLeftCorner(dimension, dimension));
+		Eigen::Ref<Vector> b(mGradient.head(dimension));
+		H.diagonal().array() += DAMPING;
+		Eigen::LLT< Eigen::Ref<Matrix> > llt(H);
+		if(llt.info() != Eigen::Success)
+		{
+			mLogger->message(ERROR, "Optimization failed, the system is not positive definite!");
+			return false;
+		}
+		llt.solveInPlace(b);
+
+		// Apply the update
+		for(std::vector<Vertex>::iterator v = mVertices.begin(); v != mVertices.end(); ++v)
+		{
+			if(v->block >= 0)
+			{
+				Vector6 step = -b.segment<6>(6 * v->block);
+				v->pose = v->pose * fromVector(step);
+			}
+		}
+		if(b.squaredNorm() < mEpsilon)
+			break;
+	}
+	if(mLogger->isEnabled(DEBUG))
+	{
+		mLogger->message(DEBUG, (boost::format("Optimization finished after %1% iterations (chi2 = %2%).") % iter % chi2).str());
+	}
+
+	// Write the result so it can be used by the mapper
+	for(std::vector<Vertex>::const_iterator v = mVertices.begin(); v != mVertices.end(); ++v)
+	{
+		mCorrections.push_back(IdPose(v->id, v->pose.cast<ScalarType>()));
+	}
+	return true;
+}
+
+IdPoseVector DenseSolver::getCorrections()
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	return mCorrections;
+}
+
+void DenseSolver::clear()
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mVertices.clear();
+	mVertexIndex.clear();
+	mEdges.clear();
+	mCorrections.clear();
+}
+
+void DenseSolver::saveGraph(std::string filename)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	std::ofstream file(filename.c_str());
+	for(std::vector<Vertex>::const_iterator v = mVertices.begin(); v != mVertices.end(); ++v)
+	{
+		Vector6 p = toVector(v->pose);
+		Eigen::Quaterniond q(v->pose.linear());
+		file << "VERTEX_SE3:QUAT " << v->id << " " << p(0) << " " << p(1) << " " << p(2) << " "
+		     << q.x() << " " << q.y() << " " << q.z() << " " << q.w() << std::endl;
+		if(v->fixed)
+			file << "FIX " << v->id << std::endl;
+	}
+	for(std::vector<Edge>::const_iterator e = mEdges.begin(); e != mEdges.end(); ++e)
+	{
+		if(e->type != SE3)
+			continue;
+		Eigen::Quaterniond q(e->measurement.linear());
+		Eigen::Vector3d t = e->measurement.translation();
+		file << "EDGE_SE3:QUAT " << mVertices[e->source].id << " " << mVertices[e->target].id << " "
+		     << t(0) << " " << t(1) << " " << t(2) << " " << q.x() << " " << q.y() << " " << q.z() << " " << q.w();
+		for(unsigned r = 0; r < 6; r++)
+			for(unsigned c = r; c < 6; c++)
+				file << " " << e->information(r,c);
+		file << std::endl;
+	}
+
+	if(file.good())
+	{
+		mLogger->message(INFO, (boost::format("Saved current graph in %1%.") % filename).str());
+	}else
+	{
+		mLogger->message(ERROR, (boost::format("Could not save %1%.") % filename).str());
+	}
+}
@@ -0,0 +1,134 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_DENSE_SOLVER_HPP
+#define SLAM_DENSE_SOLVER_HPP
+
+#include <slam3d/core/Solver.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace slam3d
+{
+	/**
+	 * @class DenseSolver
+	 * @brief A lightweight solver for small graphs like local map patches.
+	 * @details The complete problem is solved by Gauss-Newton on a dense
+	 * information matrix, with numerically differentiated 6x6 blocks for
+	 * each constraint. It uses the same error functions as the G2oSolver.
+	 * All memory is allocated upon construction for the given number of
+	 * vertices, so building and solving a graph does not allocate memory.
+	 * As the runtime grows cubic with the number of vertices, this is only
+	 * suitable for graphs of a few dozen vertices, e.g. as patch solver.
+	 */
+	class DenseSolver : public Solver
+	{
+	public:
+		/**
+		 * @brief Constructor.
+		 * @param logger pointer to the logger used by the solver
+		 * @param capacity maximum number of vertices
+		 */
+		DenseSolver(Logger* logger, unsigned capacity = 32);
+		~DenseSolver();
+
+		/**
+		 * @brief Adds a vertex to the internal graph representation.
+		 * @throw std::length_error if the capacity is exceeded
+		 */
+		void addVertex(IdType id, const Transform& pose);
+		void removeVertex(IdType id);
+		void addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3);
+		void addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav);
+		void addEdgePosition(IdType vertex, PositionConstraint::Ptr pos);
+		void setFixed(IdType id);
+		bool compute(unsigned iterations);
+		void clear();
+
+		/**
+		 * @brief Save the vertices and SE3 constraints in g2o's text format.
+		 * @param filename
+		 */
+		void saveGraph(std::string filename);
+
+		IdPoseVector getCorrections();
+
+		/**
+		 * @brief Set the threshold on the squared norm of an update step to stop the iteration.
+		 * @param epsilon
+		 */
+		void setConvergenceThreshold(ScalarType epsilon) { mEpsilon = epsilon; }
+
+	protected:
+		// The system is always solved in double precision, the poses are
+		// only converted from and to ScalarType at the interface.
+		typedef double Scalar;
+		typedef Eigen::Isometry3d Pose;
+		typedef Eigen::Vector3d Vector3;
+		typedef Eigen::Matrix<Scalar,6,1> Vector6;
+		typedef Eigen::Matrix<Scalar,6,6> Matrix6;
+		typedef Eigen::Matrix<Scalar,Eigen::Dynamic,Eigen::Dynamic> Matrix;
+		typedef Eigen::Matrix<Scalar,Eigen::Dynamic,1> Vector;
+
+		struct Vertex
+		{
+			IdType id;
+			Pose pose;
+			bool fixed;
+			int block; // position in the system, -1 if fixed
+		};
+
+		// Constraints are copied, so adding them does not allocate memory.
+		// Unary constraints have the same source and target, the information
+		// matrix is only used up to the dimension of the error.
+		struct Edge
+		{
+			unsigned source;
+			unsigned target;
+			ConstraintType type;
+			Pose measurement;
+			Vector3 direction;
+			Vector3 reference;
+			Matrix6 information;
+		};
+
+		int findVertex(IdType id) const;
+		unsigned computeError(const Edge& edge, const Pose& source, const Pose& target, Vector6& error) const;
+		void storeEdge(const Edge& edge);
+		Scalar linearize(unsigned dimension);
+
+	protected:
+		unsigned mCapacity;
+		ScalarType mEpsilon;
+		std::vector<Vertex> mVertices;
+		std::vector< std::pair<IdType, unsigned> > mVertexIndex; // id --> position in mVertices, sorted by id
+		std::vector<Edge> mEdges;
+		Matrix mHessian;
+		Vector mGradient;
+		IdPoseVector mCorrections;
+		boost::mutex mMutex;
+	};
+}
+
+#endif
@@ -0,0 +1,109 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Measures the time to build and optimize patches of different sizes with
+// the DenseSolver. Each vertex is connected to its two successors, like the
+// scans of a local map patch. The sizes can be given as arguments.
+
+#include "DenseSolver.hpp"
+
+#include <slam3d/core/FileLogger.hpp>
+
+#include <boost/format.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using namespace slam3d;
+
+typedef std::chrono::steady_clock BenchmarkClock;
+
+static double elapsed(const BenchmarkClock::time_point& start, unsigned repetitions)
+{
+	return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count() / repetitions;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<unsigned> sizes;
+	for(int i = 1; i < argc; i++)
+		sizes.push_back(std::atoi(argv[i]));
+	if(sizes.empty())
+	{
+		sizes.push_back(8);
+		sizes.push_back(16);
+		sizes.push_back(32);
+		sizes.push_back(64);
+	}
+
+	Clock clock;
+	FileLogger logger(clock, "dense_solver_benchmark.log");
+	logger.setLogLevel(WARNING);
+	const unsigned repetitions = 20;
+
+	std::cout << boost::format("%1$10s %2$12s %3$12s") % "vertices" % "build [ms]" % "solve [ms]" << std::endl;
+	for(std::vector<unsigned>::const_iterator n = sizes.begin(); n != sizes.end(); ++n)
+	{
+		std::vector<Transform> truth;
+		for(unsigned i = 0; i < *n; i++)
+		{
+			Transform t = Transform::Identity();
+			t.translation() << i, 0.2 * i, 0.1 * i;
+			t.linear() = Eigen::AngleAxis<ScalarType>(0.1 * i, Direction::UnitZ()).toRotationMatrix();
+			truth.push_back(t);
+		}
+		Transform noise = Transform::Identity();
+		noise.translation() << 0.3, -0.2, 0.1;
+
+		DenseSolver solver(&logger, *n);
+		double build = 0, solve = 0;
+		for(unsigned r = 0; r < repetitions; r++)
+		{
+			solver.clear();
+			BenchmarkClock::time_point start = BenchmarkClock::now();
+			for(unsigned i = 0; i < *n; i++)
+				solver.addVertex(i + 1, i == 0 ? truth[i] : Transform(truth[i] * noise));
+			solver.setFixed(1);
+			for(unsigned i = 0; i < *n; i++)
+			{
+				for(unsigned j = i + 1; j < *n && j < i + 3; j++)
+				{
+					TransformWithCovariance twc(truth[i].inverse() * truth[j], Covariance<6>::Identity());
+					solver.addEdge(i + 1, j + 1, SE3Constraint::create("Patch", twc));
+				}
+			}
+			build += elapsed(start, repetitions);
+
+			start = BenchmarkClock::now();
+			if(!solver.compute(10))
+				std::cerr << "Optimization of " << *n << " vertices failed!" << std::endl;
+			solve += elapsed(start, repetitions);
+		}
+		std::cout << boost::format("%1$10d %2$12.3f %3$12.3f") % *n % build % solve << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,66 @@
+#define BOOST_TEST_MODULE "DenseSolverTest"
+
+#include "DenseSolver.hpp"
+
+#include <slam3d/core/FileLogger.hpp>
+#include <slam3d/core/SolverTest.hpp>
+
+#include <type_traits>
+
+using namespace slam3d;
+
+BOOST_AUTO_TEST_CASE(dense_optimization)
+{
+	Clock clock;
+	FileLogger logger(clock, "dense_solver.log");
+	logger.setLogLevel(DEBUG);
+	Solver* solver = new DenseSolver(&logger);
+	test_optimization(solver);
+	delete solver;
+}
+
+BOOST_AUTO_TEST_CASE(dense_accuracy)
+{
+	Clock clock;
+	FileLogger logger(clock, "dense_accuracy.log");
+	DenseSolver solver(&logger, 8);
+
+	// A small patch with consistent measurements and a perturbed start
+	std::vector<Transform> truth;
+	for(unsigned i = 0; i < 8; i++)
+	{
+		Transform t = Transform::Identity();
+		t.translation() = Position(i, 0.2 * i * i, 0.1 * i);
+		t.linear() = Eigen::AngleAxis<ScalarType>(0.3 * i, Direction::UnitZ()).toRotationMatrix();
+		truth.push_back(t);
+
+		Transform noise = Transform::Identity();
+		noise.translation() = Position(0.3, -0.2, 0.1);
+		noise.linear() = Eigen::AngleAxis<ScalarType>(0.1, Direction::UnitX()).toRotationMatrix();
+		solver.addVertex(i + 1, i == 0 ? t : t * noise);
+	}
+	BOOST_CHECK_THROW(solver.addVertex(9, Transform::Identity()), std::length_error);
+	solver.setFixed(1);
+
+	for(unsigned i = 0; i < 8; i++)
+	{
+		for(unsigned j = i + 1; j < 8 && j < i + 3; j++)
+		{
+			TransformWithCovariance twc(truth[i].inverse() * truth[j], Covariance<6>::Identity());
+			solver.addEdge(i + 1, j + 1, SE3Constraint::Ptr(new SE3Constraint("DummySensor", twc)));
+		}
+	}
+	Direction up(0, 0, 1);
+	solver.addEdge(8, 0, GravityConstraint::Ptr(new GravityConstraint("DummySensor", truth[7].linear().transpose() * up, up, Covariance<2>::Identity())));
+
+	BOOST_CHECK(solver.compute(20));
+	IdPoseVector corr = solver.getCorrections();
+	BOOST_REQUIRE_EQUAL(corr.size(), 8);
+	const ScalarType tolerance = std::is_same<ScalarType, float>::value ? 1e-4 : 1e-6;
+	for(IdPoseVector::iterator c = corr.begin(); c != corr.end(); ++c)
+	{
+		Transform diff = truth[c->first - 1].inverse() * c->second;
+		BOOST_CHECK_SMALL(diff.translation().norm(), tolerance);
+		BOOST_CHECK_SMALL(Eigen::AngleAxis<ScalarType>(diff.linear()).angle(), tolerance);
+	}
+}
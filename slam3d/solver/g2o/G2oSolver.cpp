@@ -30,41 +30,384 @@
 #include <g2o/core/sparse_optimizer.h>
 #include <g2o/core/block_solver.h>
 #include <g2o/core/optimization_algorithm_levenberg.h>
+#include <g2o/core/optimization_algorithm_gauss_newton.h>
+#include <g2o/core/optimization_algorithm_dogleg.h>
 #include <g2o/types/slam3d/types_slam3d.h>
 #include <g2o/solvers/cholmod/linear_solver_cholmod.h>
+#ifdef SLAM3D_G2O_CSPARSE
+#include <g2o/solvers/csparse/linear_solver_csparse.h>
+#endif
+#ifdef SLAM3D_G2O_EIGEN
+#include <g2o/solvers/eigen/linear_solver_eigen.h>
+#endif
+#ifdef SLAM3D_G2O_PCG
+#include <g2o/solvers/pcg/linear_solver_pcg.h>
+#endif
 #include <g2o/core/sparse_optimizer_terminate_action.h>
+#include <g2o/core/sparse_block_matrix.h>
 
 #include <boost/format.hpp>
+#include <Eigen/Sparse>
+#include <set>
 
 using namespace slam3d;
 
-typedef g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType> SlamLinearSolver;
+typedef g2o::BlockSolver_6_3::PoseMatrixType PoseMatrix;
+
+// ==============================================
+// Chordal initialization
+// ==============================================
+
+typedef Eigen::Triplet<double> Triplet;
+typedef std::vector<Triplet> TripletList;
+typedef std::map<int, int> ColumnMap;
+
+// Mean chi2 of the given SE3 edges with the current estimates
+static double meanError(const g2o::HyperGraph::EdgeSet& edges)
+{
+	double chi2 = 0;
+	unsigned count = 0;
+	for(g2o::HyperGraph::EdgeSet::const_iterator e = edges.begin(); e != edges.end(); ++e)
+	{
+		g2o::EdgeSE3* edge = dynamic_cast<g2o::EdgeSE3*>(*e);
+		if(!edge)
+			continue;
+		edge->computeError();
+		chi2 += edge->chi2();
+		count++;
+	}
+	return count > 0 ? chi2 / count : 0;
+}
+
+// Solve the least squares problem A*x = b with a small regularization towards x0,
+// so that vertices without constraints keep their current estimate.
+static bool solveRegularized(const Eigen::SparseMatrix<double>& A, const Eigen::VectorXd& b, Eigen::VectorXd& x)
+{
+	const double lambda = 1e-6;
+	Eigen::SparseMatrix<double> AtA = A.transpose() * A;
+	Eigen::VectorXd Atb = A.transpose() * b + lambda * x;
+	for(int i = 0; i < AtA.cols(); i++)
+		AtA.coeffRef(i, i) += lambda;
+
+	Eigen::SimplicialLDLT< Eigen::SparseMatrix<double> > solver(AtA);
+	if(solver.info() != Eigen::Success)
+		return false;
+	x = solver.solve(Atb);
+	return solver.info() == Eigen::Success;
+}
+
+// Chordal relaxation: First the rotations are estimated by relaxing the
+// constraint R_j = R_i * R_ij to a linear problem in the matrix entries,
+// which are projected to SO(3) afterwards. Then the translations are found
+// from t_j - t_i = R_i * t_ij with the fixed rotations.
+static bool chordalInitialization(g2o::SparseOptimizer& optimizer, unsigned& vertices, unsigned& constraints)
+{
+	// Enumerate the free vertices, one is held in place if none is fixed
+	std::vector<g2o::VertexSE3*> free;
+	ColumnMap column;
+	bool has_fixed = false;
+	g2o::VertexSE3* gauge = NULL;
+	for(g2o::HyperGraph::VertexIDMap::iterator it = optimizer.vertices().begin(); it != optimizer.vertices().end(); ++it)
+	{
+		g2o::VertexSE3* v = dynamic_cast<g2o::VertexSE3*>(it->second);
+		if(!v)
+			continue;
+		if(v->fixed())
+			has_fixed = true;
+		else if(!gauge || v->id() < gauge->id())
+			gauge = v;
+	}
+	for(g2o::HyperGraph::VertexIDMap::iterator it = optimizer.vertices().begin(); it != optimizer.vertices().end(); ++it)
+	{
+		g2o::VertexSE3* v = dynamic_cast<g2o::VertexSE3*>(it->second);
+		if(!v || v->fixed() || (!has_fixed && v == gauge))
+			continue;
+		column[v->id()] = free.size();
+		free.push_back(v);
+	}
+
+	std::vector<g2o::EdgeSE3*> edges;
+	for(g2o::HyperGraph::EdgeSet::iterator it = optimizer.edges().begin(); it != optimizer.edges().end(); ++it)
+	{
+		g2o::EdgeSE3* e = dynamic_cast<g2o::EdgeSE3*>(*it);
+		if(e && dynamic_cast<g2o::VertexSE3*>(e->vertices()[0]) && dynamic_cast<g2o::VertexSE3*>(e->vertices()[1]))
+			edges.push_back(e);
+	}
+	vertices = free.size();
+	constraints = edges.size();
+	if(free.empty() || edges.empty())
+		return true;
+
+	// Rotations
+	TripletList triplets;
+	Eigen::VectorXd b = Eigen::VectorXd::Zero(9 * edges.size());
+	Eigen::VectorXd x(9 * free.size());
+	for(unsigned k = 0; k < free.size(); k++)
+	{
+		Eigen::Matrix3d R = free[k]->estimate().linear();
+		for(unsigned r = 0; r < 3; r++)
+			for(unsigned c = 0; c < 3; c++)
+				x(9*k + 3*r + c) = R(r,c);
+	}
+	for(unsigned k = 0; k < edges.size(); k++)
+	{
+		g2o::VertexSE3* vi = static_cast<g2o::VertexSE3*>(edges[k]->vertices()[0]);
+		g2o::VertexSE3* vj = static_cast<g2o::VertexSE3*>(edges[k]->vertices()[1]);
+		ColumnMap::iterator ci = column.find(vi->id());
+		ColumnMap::iterator cj = column.find(vj->id());
+		Eigen::Matrix3d Rij = edges[k]->measurement().linear();
+		Eigen::Matrix3d Ri = vi->estimate().linear();
+		Eigen::Matrix3d Rj = vj->estimate().linear();
+		double w = std::sqrt(edges[k]->information().block<3,3>(3,3).trace() / 3.0);
+		for(unsigned r = 0; r < 3; r++)
+		{
+			for(unsigned c = 0; c < 3; c++)
+			{
+				unsigned row = 9*k + 3*r + c;
+				if(cj != column.end())
+					triplets.push_back(Triplet(row, 9*cj->second + 3*r + c, w));
+				else
+					b(row) -= w * Rj(r,c);
+				for(unsigned l = 0; l < 3; l++)
+				{
+					if(ci != column.end())
+						triplets.push_back(Triplet(row, 9*ci->second + 3*r + l, -w * Rij(l,c)));
+					else
+						b(row) += w * Rij(l,c) * Ri(r,l);
+				}
+			}
+		}
+	}
+	Eigen::SparseMatrix<double> A(9 * edges.size(), 9 * free.size());
+	A.setFromTriplets(triplets.begin(), triplets.end());
+	if(!solveRegularized(A, b, x))
+		return false;
+
+	std::vector<Eigen::Matrix3d> rotations(free.size());
+	for(unsigned k = 0; k < free.size(); k++)
+	{
+		Eigen::Matrix3d M;
+		for(unsigned r = 0; r < 3; r++)
+			for(unsigned c = 0; c < 3; c++)
+				M(r,c) = x(9*k + 3*r + c);
+		Eigen::JacobiSVD<Eigen::Matrix3d> svd(M, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		Eigen::Matrix3d U = svd.matrixU();
+		if((U * svd.matrixV().transpose()).determinant() < 0)
+			U.col(2) *= -1;
+		rotations[k] = U * svd.matrixV().transpose();
+	}
+
+	// Translations
+	triplets.clear();
+	b = Eigen::VectorXd::Zero(3 * edges.size());
+	x.resize(3 * free.size());
+	for(unsigned k = 0; k < free.size(); k++)
+		x.segment<3>(3*k) = free[k]->estimate().translation();
+	for(unsigned k = 0; k < edges.size(); k++)
+	{
+		g2o::VertexSE3* vi = static_cast<g2o::VertexSE3*>(edges[k]->vertices()[0]);
+		g2o::VertexSE3* vj = static_cast<g2o::VertexSE3*>(edges[k]->vertices()[1]);
+		ColumnMap::iterator ci = column.find(vi->id());
+		ColumnMap::iterator cj = column.find(vj->id());
+		Eigen::Matrix3d Ri = (ci != column.end()) ? rotations[ci->second] : vi->estimate().linear();
+		Eigen::Vector3d tij = Ri * edges[k]->measurement().translation();
+		double w = std::sqrt(edges[k]->information().block<3,3>(0,0).trace() / 3.0);
+		for(unsigned r = 0; r < 3; r++)
+		{
+			unsigned row = 3*k + r;
+			b(row) = w * tij(r);
+			if(cj != column.end())
+				triplets.push_back(Triplet(row, 3*cj->second + r, w));
+			else
+				b(row) -= w * vj->estimate().translation()(r);
+			if(ci != column.end())
+				triplets.push_back(Triplet(row, 3*ci->second + r, -w));
+			else
+				b(row) += w * vi->estimate().translation()(r);
+		}
+	}
+	A.resize(3 * edges.size(), 3 * free.size());
+	A.setFromTriplets(triplets.begin(), triplets.end());
+	if(!solveRegularized(A, b, x))
+		return false;
+
+	for(unsigned k = 0; k < free.size(); k++)
+	{
+		Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+		pose.linear() = rotations[k];
+		pose.translation() = x.segment<3>(3*k);
+		free[k]->setEstimate(pose);
+	}
+	return true;
+}
+
+// Changes since a checkpoint, the estimates are stored within the vertices
+struct Checkpoint
+{
+	g2o::HyperGraph::VertexSet pushed;
+	g2o::HyperGraph::VertexSet addedVertices;
+	g2o::HyperGraph::EdgeSet addedEdges;
+	g2o::HyperGraph::VertexSet fixedVertices;
+};
 
 struct G2oSolver::Internal
 {
 	g2o::SparseOptimizer optimizer;
 	g2o::HyperGraph::VertexSet newVertices;
 	g2o::HyperGraph::EdgeSet newEdges;
+	std::unique_ptr<g2o::OptimizationAlgorithm> algorithm;
+	std::vector<Checkpoint> checkpoints;
 };
 
-G2oSolver::G2oSolver(Logger* logger) : Solver(logger), mInt(new Internal)
+// Create the optimization algorithm with the given linear solver
+static g2o::OptimizationAlgorithm* createAlgorithm(G2oLinearSolver solver, G2oAlgorithm algorithm, bool ordering)
 {
-	// Initialize the SparseOptimizer
-	std::unique_ptr<SlamLinearSolver> linearSolver(new SlamLinearSolver);
-	linearSolver->setBlockOrdering(true);
+	std::unique_ptr<g2o::BlockSolver_6_3::LinearSolverType> linearSolver;
+	switch(solver)
+	{
+#ifdef SLAM3D_G2O_CSPARSE
+	case G2oLinearSolver::CSPARSE:
+	{
+		g2o::LinearSolverCSparse<PoseMatrix>* csparse = new g2o::LinearSolverCSparse<PoseMatrix>;
+		csparse->setBlockOrdering(ordering);
+		linearSolver.reset(csparse);
+		break;
+	}
+#endif
+#ifdef SLAM3D_G2O_EIGEN
+	case G2oLinearSolver::EIGEN:
+	{
+		g2o::LinearSolverEigen<PoseMatrix>* eigen = new g2o::LinearSolverEigen<PoseMatrix>;
+		eigen->setBlockOrdering(ordering);
+		linearSolver.reset(eigen);
+		break;
+	}
+#endif
+#ifdef SLAM3D_G2O_PCG
+	case G2oLinearSolver::PCG:
+		linearSolver.reset(new g2o::LinearSolverPCG<PoseMatrix>);
+		break;
+#endif
+	default:
+	{
+		g2o::LinearSolverCholmod<PoseMatrix>* cholmod = new g2o::LinearSolverCholmod<PoseMatrix>;
+		cholmod->setBlockOrdering(ordering);
+		linearSolver.reset(cholmod);
+	}
+	}
+
 	std::unique_ptr<g2o::BlockSolver_6_3> blockSolver(new g2o::BlockSolver_6_3(std::move(linearSolver)));
-	mInt->optimizer.setAlgorithm(new g2o::OptimizationAlgorithmLevenberg(std::move(blockSolver)));
+	switch(algorithm)
+	{
+	case G2oAlgorithm::GAUSS_NEWTON:
+		return new g2o::OptimizationAlgorithmGaussNewton(std::move(blockSolver));
+	case G2oAlgorithm::DOGLEG:
+		return new g2o::OptimizationAlgorithmDogleg(std::move(blockSolver));
+	default:
+		return new g2o::OptimizationAlgorithmLevenberg(std::move(blockSolver));
+	}
+}
+
+static const char* linearSolverName(G2oLinearSolver solver)
+{
+	switch(solver)
+	{
+	case G2oLinearSolver::CSPARSE: return "CSparse";
+	case G2oLinearSolver::EIGEN:   return "Eigen";
+	case G2oLinearSolver::PCG:     return "PCG";
+	case G2oLinearSolver::CHOLMOD: return "Cholmod";
+	default:                       return "Auto";
+	}
+}
+
+bool G2oSolver::isAvailable(G2oLinearSolver solver)
+{
+	switch(solver)
+	{
+#ifndef SLAM3D_G2O_CSPARSE
+	case G2oLinearSolver::CSPARSE:
+#endif
+#ifndef SLAM3D_G2O_EIGEN
+	case G2oLinearSolver::EIGEN:
+#endif
+#ifndef SLAM3D_G2O_PCG
+	case G2oLinearSolver::PCG:
+#endif
+	case G2oLinearSolver::AUTO:
+		return solver == G2oLinearSolver::AUTO;
+	default:
+		return true;
+	}
+}
+
+G2oSolver::G2oSolver(Logger* logger, const G2oSolverConfiguration& config)
+ : Solver(logger), mConfig(config), mInt(new Internal)
+{
+	// Initialize the SparseOptimizer
+	mLinearSolver = G2oLinearSolver::AUTO;
+	mConfigChanged = true;
+	updateAlgorithm();
 	
 	// Set the default terminate action
 	g2o::SparseOptimizerTerminateAction* terminateAction = new g2o::SparseOptimizerTerminateAction;
 	mInt->optimizer.addPostIterationAction(terminateAction);
 	
 	mInitialized = false;
+	mChordalThreshold = 0;
 }
 
 G2oSolver::~G2oSolver()
 {
 	clear();
+	mInt->optimizer.setAlgorithm(NULL);
+}
+
+void G2oSolver::setConfiguration(const G2oSolverConfiguration& config)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mConfig = config;
+	mConfigChanged = true;
+}
+
+G2oLinearSolver G2oSolver::selectLinearSolver() const
+{
+	G2oLinearSolver solver = mConfig.linear_solver;
+	if(solver == G2oLinearSolver::AUTO)
+	{
+		unsigned size = mInt->optimizer.vertices().size();
+		if(size < mConfig.small_graph_size)
+			solver = G2oLinearSolver::EIGEN;
+		else if(size > mConfig.large_graph_size)
+			solver = G2oLinearSolver::PCG;
+		else
+			solver = G2oLinearSolver::CHOLMOD;
+	}
+	return isAvailable(solver) ? solver : G2oLinearSolver::CHOLMOD;
+}
+
+void G2oSolver::updateAlgorithm()
+{
+	G2oLinearSolver solver = selectLinearSolver();
+	if(!mConfigChanged && solver == mLinearSolver)
+		return;
+
+	// The optimizer would only delete the last algorithm, so it is owned here
+	g2o::OptimizationAlgorithm* algorithm = createAlgorithm(solver, mConfig.algorithm, mConfig.block_ordering);
+	mInt->optimizer.setAlgorithm(algorithm);
+	mInt->algorithm.reset(algorithm);
+	if(solver != mConfig.linear_solver && mConfig.linear_solver != G2oLinearSolver::AUTO)
+	{
+		mLogger->message(WARNING, (boost::format("Linear solver %1% is not available, using %2% instead.")
+			% linearSolverName(mConfig.linear_solver) % linearSolverName(solver)).str());
+	}
+	if(mLinearSolver != G2oLinearSolver::AUTO)
+	{
+		mLogger->message(INFO, (boost::format("Switched to linear solver %1% for %2% vertices.")
+			% linearSolverName(solver) % mInt->optimizer.vertices().size()).str());
+	}
+	mLinearSolver = solver;
+	mConfigChanged = false;
+	mInitialized = false;
 }
 
 void G2oSolver::addVertex(IdType id, const Transform& pose)
@@ -85,6 +428,38 @@ void G2oSolver::addVertex(IdType id, const Transform& pose)
 	// Add the vertex to the optimizer
 	mInt->optimizer.addVertex(poseVertex);
 	mInt->newVertices.insert(poseVertex);
+	if(!mInt->checkpoints.empty())
+		mInt->checkpoints.back().addedVertices.insert(poseVertex);
+}
+
+void G2oSolver::removeVertex(IdType id)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	
+	g2o::OptimizableGraph::Vertex* v = mInt->optimizer.vertex(id);
+	if(!v)
+	{
+		throw UnknownVertex(id);
+	}
+	
+	// Deleted vertices and edges cannot be restored
+	if(!mInt->checkpoints.empty())
+	{
+		mLogger->message(WARNING, (boost::format("Removing vertex %1% discards all checkpoints!") % id).str());
+		discardCheckpoints();
+	}
+	
+	// The vertex and its edges will be deleted by the optimizer
+	for(g2o::HyperGraph::EdgeSet::iterator e = v->edges().begin(); e != v->edges().end(); ++e)
+	{
+		mInt->newEdges.erase(*e);
+	}
+	mInt->newVertices.erase(v);
+	mInt->optimizer.removeVertex(v);
+	
+	// The optimizer's internal structure has to be rebuilt
+	mInitialized = false;
+	mMarginals.clear();
 }
 
 void G2oSolver::addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3)
@@ -111,28 +486,34 @@ void G2oSolver::addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3)
 	// Add the constraint to the optimizer
 	mInt->optimizer.addEdge(constraint);
 	mInt->newEdges.insert(constraint);
+	if(!mInt->checkpoints.empty())
+		mInt->checkpoints.back().addedEdges.insert(constraint);
 }
 
 void G2oSolver::addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav)
 {
 	boost::unique_lock<boost::mutex> guard(mMutex);
-	g2o::EdgeDirectionPrior* prior = new g2o::EdgeDirectionPrior(grav->getDirection(), grav->getReference());
+	g2o::EdgeDirectionPrior* prior = new g2o::EdgeDirectionPrior(grav->getDirection().cast<double>(), grav->getReference().cast<double>());
 	prior->vertices()[0] = mInt->optimizer.vertex(vertex);
 	prior->setInformation(grav->getCovariance().inverse().cast<double>());
 	
 	mInt->optimizer.addEdge(prior);
 	mInt->newEdges.insert(prior);
+	if(!mInt->checkpoints.empty())
+		mInt->checkpoints.back().addedEdges.insert(prior);
 }
 
 void G2oSolver::addEdgePosition(IdType vertex, PositionConstraint::Ptr pos)
 {
 	boost::unique_lock<boost::mutex> guard(mMutex);
-	g2o::EdgePositionPrior* prior = new g2o::EdgePositionPrior(pos->getPosition());
+	g2o::EdgePositionPrior* prior = new g2o::EdgePositionPrior(pos->getPosition().cast<double>());
 	prior->vertices()[0] = mInt->optimizer.vertex(vertex);
 	prior->setInformation(pos->getCovariance().inverse().cast<double>());
 	
 	mInt->optimizer.addEdge(prior);
 	mInt->newEdges.insert(prior);
+	if(!mInt->checkpoints.empty())
+		mInt->checkpoints.back().addedEdges.insert(prior);
 }
 
 void G2oSolver::setFixed(IdType id)
@@ -146,6 +527,8 @@ void G2oSolver::setFixed(IdType id)
 		mLogger->message(ERROR, (boost::format("Could not fix vertex with ID %1%!") % id).str());
 		throw UnknownVertex(id);
 	}
+	if(!v->fixed() && !mInt->checkpoints.empty())
+		mInt->checkpoints.back().fixedVertices.insert(v);
 	v->setFixed(true);
 }
 
@@ -156,6 +539,7 @@ bool G2oSolver::compute(unsigned iterations)
 	
 	// need to do something?
 	boost::unique_lock<boost::mutex> guard(mMutex);
+	mMarginals.clear();
 	if(mInt->optimizer.activeVertices().size() == 0 && mInt->newVertices.size() < 2)
 		return true;
 	
@@ -173,6 +557,24 @@ bool G2oSolver::compute(unsigned iterations)
 		*stopFlag = false;
 	}
 	
+	// Apply a changed configuration or graph size
+	updateAlgorithm();
+
+	// Find a better initial guess after large corrections (e.g. loop closures)
+	if(mChordalThreshold > 0)
+	{
+		double error = meanError(mInt->newEdges);
+		if(error > mChordalThreshold)
+		{
+			unsigned vertices, constraints;
+			if(chordalInitialization(mInt->optimizer, vertices, constraints))
+				mLogger->message(DEBUG, (boost::format("Chordal initialization of %1% vertices with %2% constraints (mean error was %3%).")
+					% vertices % constraints % error).str());
+			else
+				mLogger->message(WARNING, "Chordal initialization failed, using current estimate.");
+		}
+	}
+	
 	// Do the graph optimization
 	if(mInitialized)
 	{
@@ -200,7 +602,7 @@ bool G2oSolver::compute(unsigned iterations)
 	{
 		g2o::VertexSE3* vertex = dynamic_cast<g2o::VertexSE3*>(*n);
 		assert(vertex);
-		Transform iso = Transform(vertex->estimate());
+		Transform iso = vertex->estimate().cast<ScalarType>();
 		mCorrections.push_back(IdPose((*n)->id(), iso));
 	}
 	return true;
@@ -214,9 +616,201 @@ IdPoseVector G2oSolver::getCorrections()
 void G2oSolver::clear()
 {
 	boost::unique_lock<boost::mutex> guard(mMutex);
+	mInt->checkpoints.clear();
 	mInt->optimizer.clear();
 	mInitialized = false;
 	mCorrections.clear();
+	mMarginals.clear();
+}
+
+bool G2oSolver::checkpoint()
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mInt->checkpoints.push_back(Checkpoint());
+	Checkpoint& cp = mInt->checkpoints.back();
+	for(g2o::HyperGraph::VertexIDMap::iterator it = mInt->optimizer.vertices().begin(); it != mInt->optimizer.vertices().end(); ++it)
+	{
+		g2o::OptimizableGraph::Vertex* v = static_cast<g2o::OptimizableGraph::Vertex*>(it->second);
+		v->push();
+		cp.pushed.insert(v);
+	}
+	mLogger->message(DEBUG, (boost::format("Created checkpoint %1% with %2% vertices.")
+		% mInt->checkpoints.size() % cp.pushed.size()).str());
+	return true;
+}
+
+bool G2oSolver::rollback()
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	if(mInt->checkpoints.empty())
+	{
+		mLogger->message(ERROR, "Cannot rollback, there is no checkpoint!");
+		return false;
+	}
+	Checkpoint& cp = mInt->checkpoints.back();
+	for(g2o::HyperGraph::VertexSet::iterator v = cp.fixedVertices.begin(); v != cp.fixedVertices.end(); ++v)
+	{
+		static_cast<g2o::OptimizableGraph::Vertex*>(*v)->setFixed(false);
+	}
+
+	// Edges are deleted first, as they might belong to added vertices
+	for(g2o::HyperGraph::EdgeSet::iterator e = cp.addedEdges.begin(); e != cp.addedEdges.end(); ++e)
+	{
+		mInt->newEdges.erase(*e);
+		mInt->optimizer.removeEdge(*e);
+	}
+	for(g2o::HyperGraph::VertexSet::iterator v = cp.addedVertices.begin(); v != cp.addedVertices.end(); ++v)
+	{
+		mInt->newVertices.erase(*v);
+		mInt->optimizer.removeVertex(*v);
+	}
+	for(g2o::HyperGraph::VertexSet::iterator v = cp.pushed.begin(); v != cp.pushed.end(); ++v)
+	{
+		static_cast<g2o::OptimizableGraph::Vertex*>(*v)->pop();
+	}
+	if(!cp.addedEdges.empty() || !cp.addedVertices.empty())
+	{
+		mInitialized = false;
+	}
+	mMarginals.clear();
+	mLogger->message(DEBUG, (boost::format("Rollback removed %1% vertices and %2% edges.")
+		% cp.addedVertices.size() % cp.addedEdges.size()).str());
+	mInt->checkpoints.pop_back();
+
+	// Provide the restored estimates
+	mCorrections.clear();
+	for(g2o::HyperGraph::VertexIDMap::iterator it = mInt->optimizer.vertices().begin(); it != mInt->optimizer.vertices().end(); ++it)
+	{
+		g2o::VertexSE3* vertex = dynamic_cast<g2o::VertexSE3*>(it->second);
+		if(vertex)
+			mCorrections.push_back(IdPose(vertex->id(), vertex->estimate().cast<ScalarType>()));
+	}
+	return true;
+}
+
+bool G2oSolver::releaseCheckpoint()
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	if(mInt->checkpoints.empty())
+	{
+		return false;
+	}
+	Checkpoint cp = mInt->checkpoints.back();
+	mInt->checkpoints.pop_back();
+	for(g2o::HyperGraph::VertexSet::iterator v = cp.pushed.begin(); v != cp.pushed.end(); ++v)
+	{
+		static_cast<g2o::OptimizableGraph::Vertex*>(*v)->discardTop();
+	}
+
+	// The changes now belong to the enclosing checkpoint
+	if(!mInt->checkpoints.empty())
+	{
+		Checkpoint& outer = mInt->checkpoints.back();
+		outer.addedVertices.insert(cp.addedVertices.begin(), cp.addedVertices.end());
+		outer.addedEdges.insert(cp.addedEdges.begin(), cp.addedEdges.end());
+		outer.fixedVertices.insert(cp.fixedVertices.begin(), cp.fixedVertices.end());
+	}
+	return true;
+}
+
+// Get a block of the inverse, which is zero for fixed vertices
+static Covariance<6> marginalBlock(const g2o::SparseBlockMatrix<Eigen::MatrixXd>& spinv, int row, int col)
+{
+	if(row < 0 || col < 0)
+		return Covariance<6>::Zero();
+	const Eigen::MatrixXd* block = spinv.block(std::min(row, col), std::max(row, col));
+	if(!block)
+		return Covariance<6>::Zero();
+	if(row <= col)
+		return block->cast<ScalarType>();
+	return block->transpose().cast<ScalarType>();
+}
+
+bool G2oSolver::getJointMarginals(const IdPairVector& pairs, JointCovarianceVector& marginals)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	if(!mInitialized)
+	{
+		mLogger->message(WARNING, "Marginals are only available after optimization.");
+		return false;
+	}
+
+	// Collect the blocks for all pairs that are not cached
+	typedef std::pair<int, int> Block;
+	std::set<Block> blocks;
+	IdPairVector missing;
+	for(IdPairVector::const_iterator p = pairs.begin(); p != pairs.end(); ++p)
+	{
+		if(mMarginals.find(*p) != mMarginals.end())
+			continue;
+		g2o::OptimizableGraph::Vertex* v[2] = {mInt->optimizer.vertex(p->first), mInt->optimizer.vertex(p->second)};
+		int index[2];
+		for(unsigned k = 0; k < 2; k++)
+		{
+			if(!v[k])
+			{
+				throw UnknownVertex(k == 0 ? p->first : p->second);
+			}
+			index[k] = v[k]->hessianIndex();
+			if(index[k] < 0 && !v[k]->fixed())
+			{
+				mLogger->message(WARNING, (boost::format("Vertex %1% has not been optimized, there are no marginals.") % v[k]->id()).str());
+				return false;
+			}
+		}
+		if(index[0] >= 0)
+			blocks.insert(Block(index[0], index[0]));
+		if(index[1] >= 0)
+			blocks.insert(Block(index[1], index[1]));
+		if(index[0] >= 0 && index[1] >= 0)
+			blocks.insert(Block(std::min(index[0], index[1]), std::max(index[0], index[1])));
+		missing.push_back(*p);
+	}
+
+	// Recover only these blocks of the inverse from the factorization
+	if(!blocks.empty())
+	{
+		g2o::SparseBlockMatrix<Eigen::MatrixXd> spinv;
+		std::vector<Block> indices(blocks.begin(), blocks.end());
+		if(!mInt->optimizer.computeMarginals(spinv, indices))
+		{
+			mLogger->message(ERROR, (boost::format("Linear solver %1% failed to compute the marginals!")
+				% linearSolverName(mLinearSolver)).str());
+			return false;
+		}
+		for(IdPairVector::iterator p = missing.begin(); p != missing.end(); ++p)
+		{
+			int a = mInt->optimizer.vertex(p->first)->hessianIndex();
+			int b = mInt->optimizer.vertex(p->second)->hessianIndex();
+			Covariance<12> joint;
+			joint.topLeftCorner<6,6>() = marginalBlock(spinv, a, a);
+			joint.topRightCorner<6,6>() = marginalBlock(spinv, a, b);
+			joint.bottomLeftCorner<6,6>() = marginalBlock(spinv, b, a);
+			joint.bottomRightCorner<6,6>() = marginalBlock(spinv, b, b);
+			mMarginals[*p] = joint;
+		}
+		mLogger->message(DEBUG, (boost::format("Computed %1% blocks of the marginal covariance.") % indices.size()).str());
+	}
+
+	marginals.clear();
+	marginals.reserve(pairs.size());
+	for(IdPairVector::const_iterator p = pairs.begin(); p != pairs.end(); ++p)
+	{
+		marginals.push_back(mMarginals[*p]);
+	}
+	return true;
+}
+
+void G2oSolver::discardCheckpoints()
+{
+	for(std::vector<Checkpoint>::iterator cp = mInt->checkpoints.begin(); cp != mInt->checkpoints.end(); ++cp)
+	{
+		for(g2o::HyperGraph::VertexSet::iterator v = cp->pushed.begin(); v != cp->pushed.end(); ++v)
+		{
+			static_cast<g2o::OptimizableGraph::Vertex*>(*v)->discardTop();
+		}
+	}
+	mInt->checkpoints.clear();
 }
 
 void G2oSolver::saveGraph(std::string filename)
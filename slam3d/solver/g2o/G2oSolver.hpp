@@ -27,7 +27,9 @@
 #define SLAM_G2O_SOLVER_HPP
 
 #include <slam3d/core/Solver.hpp>
+#include <slam3d/solver/g2o/G2oSolverConfiguration.hpp>
 #include <boost/thread/mutex.hpp>
+#include <map>
 
 namespace slam3d
 {	
@@ -40,10 +42,11 @@ namespace slam3d
 	class G2oSolver : public Solver
 	{
 	public:
-		G2oSolver(Logger* logger);
+		G2oSolver(Logger* logger, const G2oSolverConfiguration& config = G2oSolverConfiguration());
 		~G2oSolver();
 		
 		void addVertex(IdType id, const Transform& pose);
+		void removeVertex(IdType id);
 		void addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3);
 		void addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav);
 		void addEdgePosition(IdType vertex, PositionConstraint::Ptr pos);
@@ -53,10 +56,67 @@ namespace slam3d
 		void saveGraph(std::string filename);
 		
 		IdPoseVector getCorrections();
+
+		/**
+		 * @brief Store the current estimates and start recording added vertices and edges.
+		 * @details The estimates are saved with g2o's push(). Removing a vertex
+		 * while a checkpoint exists discards all checkpoints.
+		 */
+		bool checkpoint();
+		bool rollback();
+		bool releaseCheckpoint();
+
+		/**
+		 * @brief Get the joint marginals of pairs of vertices from the last optimization.
+		 * @details Only the required blocks of the covariance are recovered
+		 * from the Cholesky factor of the last linearization. They are cached
+		 * until the next optimization. This is not supported by the PCG solver.
+		 * Vertices added after the last optimization have no marginals yet.
+		 */
+		bool getJointMarginals(const IdPairVector& pairs, JointCovarianceVector& marginals);
+
+		/**
+		 * @brief Initialize all poses by chordal relaxation, if new constraints have a large error.
+		 * @details Rotations and translations are estimated by solving two linear
+		 * least squares problems on the SE3 constraints. This provides a good
+		 * starting point for the nonlinear optimization after large loop closures.
+		 * @param threshold mean chi2 of the new constraints to trigger the initialization, 0 to disable
+		 */
+		void setChordalInitialization(ScalarType threshold) { mChordalThreshold = threshold; }
+
+		/**
+		 * @brief Change the linear solver and optimization algorithm.
+		 * @details The new configuration is applied before the next optimization.
+		 * @param config
+		 */
+		void setConfiguration(const G2oSolverConfiguration& config);
+
+		/**
+		 * @brief Get the linear solver used in the last optimization.
+		 * @details This is never G2oLinearSolver::AUTO, but the solver chosen for the current graph.
+		 */
+		G2oLinearSolver getLinearSolver() const { return mLinearSolver; }
+
+		/**
+		 * @brief Whether the g2o component of the given linear solver was found when building.
+		 * @details Unavailable solvers are replaced by CHOLMOD.
+		 * @param solver
+		 */
+		static bool isAvailable(G2oLinearSolver solver);
 		
+	protected:
+		G2oLinearSolver selectLinearSolver() const;
+		void updateAlgorithm();
+		void discardCheckpoints();
+
 	protected:
 		IdPoseVector mCorrections;
 		bool mInitialized;
+		ScalarType mChordalThreshold;
+		G2oSolverConfiguration mConfig;
+		G2oLinearSolver mLinearSolver;
+		bool mConfigChanged;
+		std::map<IdPair, Covariance<12> > mMarginals;
 		boost::mutex mMutex;
 
 	private:
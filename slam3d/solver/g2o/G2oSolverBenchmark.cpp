@@ -0,0 +1,99 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Compares the time and accuracy of all linear solvers and optimization
+// algorithms on grid graphs of different sizes. The sizes (number of rows and
+// columns) can be given as arguments, the default is 10, 32 and 64.
+
+#include "G2oSolver.hpp"
+#include "GridGraph.hpp"
+
+#include <slam3d/core/FileLogger.hpp>
+
+#include <boost/format.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+using namespace slam3d;
+
+int main(int argc, char** argv)
+{
+	std::vector<unsigned> sizes;
+	for(int i = 1; i < argc; i++)
+		sizes.push_back(std::atoi(argv[i]));
+	if(sizes.empty())
+	{
+		sizes.push_back(10);
+		sizes.push_back(32);
+		sizes.push_back(64);
+	}
+
+	Clock clock;
+	FileLogger logger(clock, "g2o_solver_benchmark.log");
+	logger.setLogLevel(WARNING);
+
+	const G2oLinearSolver solvers[] = {G2oLinearSolver::CHOLMOD, G2oLinearSolver::CSPARSE, G2oLinearSolver::EIGEN, G2oLinearSolver::PCG};
+	const char* solver_names[] = {"Cholmod", "CSparse", "Eigen", "PCG"};
+	const G2oAlgorithm algorithms[] = {G2oAlgorithm::GAUSS_NEWTON, G2oAlgorithm::LEVENBERG, G2oAlgorithm::DOGLEG};
+	const char* algorithm_names[] = {"GaussNewton", "Levenberg", "Dogleg"};
+
+	std::cout << boost::format("%1$10s %2$10s %3$12s %4$10s %5$10s") % "vertices" % "solver" % "algorithm" % "time [ms]" % "rmse [m]" << std::endl;
+	for(std::vector<unsigned>::const_iterator s = sizes.begin(); s != sizes.end(); ++s)
+	{
+		for(unsigned l = 0; l < 4; l++)
+		{
+			if(!G2oSolver::isAvailable(solvers[l]))
+				continue;
+			for(unsigned a = 0; a < 3; a++)
+			{
+				G2oSolverConfiguration config;
+				config.linear_solver = solvers[l];
+				config.algorithm = algorithms[a];
+				G2oSolver solver(&logger, config);
+				std::vector<Transform> truth;
+				createGridGraph(solver, *s, *s, truth);
+
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				bool ok = solver.compute(10);
+				std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+
+				double error = 0;
+				IdPoseVector corr = solver.getCorrections();
+				for(IdPoseVector::iterator c = corr.begin(); c != corr.end(); ++c)
+					error += (c->second.translation() - truth[c->first - 1].translation()).squaredNorm();
+				error = std::sqrt(error / corr.size());
+
+				std::cout << boost::format("%1$10d %2$10s %3$12s %4$10.1f %5$10.3f%6%")
+					% truth.size() % solver_names[l] % algorithm_names[a] % duration.count() % error
+					% (ok ? "" : " (failed)") << std::endl;
+			}
+		}
+	}
+	return 0;
+}
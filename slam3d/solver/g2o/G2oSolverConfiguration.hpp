@@ -0,0 +1,75 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_G2O_SOLVER_CONFIGURATION_HPP
+#define SLAM3D_G2O_SOLVER_CONFIGURATION_HPP
+
+namespace slam3d
+{
+	/**
+	 * @brief Linear solvers for the block system.
+	 * @details CSPARSE, EIGEN and PCG are only available if the corresponding
+	 * g2o component was found, see G2oSolver::isAvailable.
+	 */
+	enum class G2oLinearSolver {AUTO, CHOLMOD, CSPARSE, EIGEN, PCG};
+
+	/**
+	 * @brief Nonlinear optimization algorithms.
+	 */
+	enum class G2oAlgorithm {GAUSS_NEWTON, LEVENBERG, DOGLEG};
+
+	/**
+	 * @class G2oSolverConfiguration
+	 * @brief Parameters for the G2oSolver.
+	 */
+	struct G2oSolverConfiguration
+	{
+		// the linear solver for the block system
+		G2oLinearSolver linear_solver;
+
+		// the nonlinear optimization algorithm
+		G2oAlgorithm algorithm;
+
+		// reorder the block system to reduce the fill-in (not used by PCG)
+		bool block_ordering;
+
+	// Parameters for G2oLinearSolver::AUTO
+	// -----------------------------------
+
+		// graphs with less vertices use EIGEN, which has the lowest setup cost
+		unsigned small_graph_size;
+
+		// graphs with more vertices use PCG, others use CHOLMOD
+		unsigned large_graph_size;
+
+		G2oSolverConfiguration() : linear_solver(G2oLinearSolver::CHOLMOD),
+		                           algorithm(G2oAlgorithm::LEVENBERG),
+		                           block_ordering(true),
+		                           small_graph_size(500),
+		                           large_graph_size(100000){};
+	};
+}
+
+#endif
@@ -1,6 +1,7 @@
 #define BOOST_TEST_MODULE "G2oSolverTest"
 
 #include "G2oSolver.hpp"
+#include "GridGraph.hpp"
 
 #include <slam3d/core/FileLogger.hpp>
 #include <slam3d/core/SolverTest.hpp>
@@ -16,3 +17,117 @@ BOOST_AUTO_TEST_CASE(g2o_optimization)
 	test_optimization(solver);
 	delete solver;
 }
+
+BOOST_AUTO_TEST_CASE(g2o_checkpoint)
+{
+	Clock clock;
+	FileLogger logger(clock, "checkpoint.log");
+	logger.setLogLevel(DEBUG);
+	G2oSolver solver(&logger);
+	test_checkpoint(&solver);
+}
+
+BOOST_AUTO_TEST_CASE(g2o_marginals)
+{
+	Clock clock;
+	FileLogger logger(clock, "marginals.log");
+	G2oSolver solver(&logger);
+
+	Covariance<6> cov = Covariance<6>::Identity() * 0.01;
+	TransformWithCovariance step(Transform(Eigen::Translation<ScalarType, 3>(1,0,0)), cov);
+	for(IdType id = 1; id <= 3; id++)
+	{
+		solver.addVertex(id, Transform(Eigen::Translation<ScalarType, 3>(id - 1, 0, 0)));
+		if(id > 1)
+			solver.addEdge(id - 1, id, SE3Constraint::Ptr(new SE3Constraint("DummySensor", step)));
+	}
+	solver.setFixed(1);
+
+	IdPairVector pairs;
+	pairs.push_back(IdPair(1, 2));
+	pairs.push_back(IdPair(2, 3));
+	JointCovarianceVector marginals;
+	BOOST_CHECK(!solver.getJointMarginals(pairs, marginals));
+	BOOST_REQUIRE(solver.compute(10));
+	BOOST_REQUIRE(solver.getJointMarginals(pairs, marginals));
+	BOOST_REQUIRE_EQUAL(marginals.size(), 2);
+
+	// The fixed vertex has no uncertainty, the next one that of the constraint
+	BOOST_CHECK((marginals[0].topLeftCorner<6,6>().isZero()));
+	BOOST_CHECK((marginals[0].bottomRightCorner<6,6>().isApprox(cov, 1e-3)));
+	BOOST_CHECK((marginals[1].topLeftCorner<6,6>().isApprox(cov, 1e-3)));
+	BOOST_CHECK_GT((marginals[1].bottomRightCorner<6,6>().trace()), cov.trace());
+
+	// Cached results are the same
+	JointCovarianceVector cached;
+	BOOST_REQUIRE(solver.getJointMarginals(IdPairVector(1, IdPair(2, 3)), cached));
+	BOOST_CHECK(cached[0].isApprox(marginals[1]));
+
+	// New vertices have no marginals before the next optimization
+	solver.addVertex(4, Transform::Identity());
+	BOOST_CHECK(!solver.getJointMarginals(IdPairVector(1, IdPair(3, 4)), marginals));
+	BOOST_CHECK_THROW(solver.getJointMarginals(IdPairVector(1, IdPair(3, 5)), marginals), Solver::UnknownVertex);
+}
+
+BOOST_AUTO_TEST_CASE(g2o_chordal_initialization)
+{
+	Clock clock;
+	FileLogger logger(clock, "chordal.log");
+	logger.setLogLevel(DEBUG);
+	G2oSolver solver(&logger);
+	solver.setChordalInitialization(1.0);
+
+	// A loop where all vertices start at the origin
+	const unsigned N = 30;
+	std::vector<Transform> truth;
+	for(unsigned i = 0; i < N; i++)
+	{
+		ScalarType a = 2 * M_PI * i / N;
+		Transform t = Transform::Identity();
+		t.translation() = Position(10 * std::cos(a), 10 * std::sin(a), 0.1 * i);
+		t.linear() = Eigen::AngleAxis<ScalarType>(a + ScalarType(M_PI / 2), Direction::UnitZ()).toRotationMatrix();
+		truth.push_back(t);
+		solver.addVertex(i + 1, i == 0 ? t : Transform::Identity());
+	}
+	solver.setFixed(1);
+	for(unsigned i = 0; i < N; i++)
+	{
+		unsigned j = (i + 1) % N;
+		TransformWithCovariance twc(truth[i].inverse() * truth[j], Covariance<6>::Identity() * 0.01);
+		solver.addEdge(i + 1, j + 1, SE3Constraint::Ptr(new SE3Constraint("DummySensor", twc)));
+	}
+
+	// Few iterations are enough when starting from the relaxed solution
+	BOOST_REQUIRE(solver.compute(3));
+	IdPoseVector corr = solver.getCorrections();
+	BOOST_CHECK_EQUAL(corr.size(), N);
+	for(IdPoseVector::iterator c = corr.begin(); c != corr.end(); ++c)
+	{
+		BOOST_CHECK_SMALL((c->second.translation() - truth[c->first - 1].translation()).norm(), (ScalarType)0.01);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(g2o_automatic_solver)
+{
+	Clock clock;
+	FileLogger logger(clock, "g2o_configurations.log");
+	logger.setLogLevel(WARNING);
+
+	// The automatic mode selects the linear solver by the graph size
+	G2oSolverConfiguration config;
+	config.linear_solver = G2oLinearSolver::AUTO;
+	config.small_graph_size = 500;
+	G2oSolver solver(&logger, config);
+	std::vector<Transform> truth;
+	createGridGraph(solver, 10, 10, truth);
+	BOOST_CHECK(solver.compute(10));
+	if(G2oSolver::isAvailable(G2oLinearSolver::EIGEN))
+		BOOST_CHECK(solver.getLinearSolver() == G2oLinearSolver::EIGEN);
+	else
+		BOOST_CHECK(solver.getLinearSolver() == G2oLinearSolver::CHOLMOD);
+
+	config.small_graph_size = 50;
+	solver.setConfiguration(config);
+	BOOST_CHECK(solver.compute(10));
+	BOOST_CHECK(solver.getLinearSolver() == G2oLinearSolver::CHOLMOD);
+}
@@ -0,0 +1,87 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM3D_G2O_GRID_GRAPH_HPP
+#define SLAM3D_G2O_GRID_GRAPH_HPP
+
+#include <slam3d/core/Solver.hpp>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+
+namespace slam3d
+{
+	/**
+	 * @brief Create a lawnmower trajectory on a grid with loop closures between neighboring rows.
+	 * @details Initial poses and odometry are disturbed by a fixed random sequence,
+	 * the loop closures are exact. It is used by the tests and the benchmark.
+	 * @param solver to add the vertices and edges to
+	 * @param rows number of rows
+	 * @param cols number of vertices per row
+	 * @param truth receives the true pose of each vertex (id - 1)
+	 */
+	inline void createGridGraph(Solver& solver, unsigned rows, unsigned cols, std::vector<Transform>& truth)
+	{
+		boost::random::mt19937 rng(42);
+		boost::random::normal_distribution<ScalarType> noise(0.0f, 0.05f);
+		Covariance<6> cov = Covariance<6>::Identity() * ScalarType(0.0025);
+
+		truth.clear();
+		for(unsigned r = 0; r < rows; r++)
+		{
+			for(unsigned i = 0; i < cols; i++)
+			{
+				unsigned c = (r % 2 == 0) ? i : cols - 1 - i;
+				Transform t = Transform::Identity();
+				t.translation() << c, r, 0;
+				truth.push_back(t);
+
+				Transform guess = t;
+				guess.translation() += Position(noise(rng), noise(rng), noise(rng)) * 10;
+				solver.addVertex(truth.size(), guess);
+			}
+		}
+		solver.setFixed(1);
+
+		for(unsigned id = 1; id < truth.size(); id++)
+		{
+			TransformWithCovariance odom(truth[id - 1].inverse() * truth[id], cov);
+			odom.transform.translation() += Position(noise(rng), noise(rng), noise(rng));
+			solver.addEdge(id, id + 1, SE3Constraint::Ptr(new SE3Constraint("Odometry", odom)));
+		}
+		for(unsigned r = 0; r + 1 < rows; r++)
+		{
+			for(unsigned c = 0; c < cols; c += 5)
+			{
+				unsigned a = r * cols + ((r % 2 == 0) ? c : cols - 1 - c);
+				unsigned b = (r + 1) * cols + ((r % 2 == 1) ? c : cols - 1 - c);
+				TransformWithCovariance loop(truth[a].inverse() * truth[b], cov);
+				solver.addEdge(a + 1, b + 1, SE3Constraint::Ptr(new SE3Constraint("Loop", loop)));
+			}
+		}
+	}
+}
+
+#endif
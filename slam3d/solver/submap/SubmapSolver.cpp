@@ -0,0 +1,332 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "SubmapSolver.hpp"
+
+#include <boost/format.hpp>
+
+using namespace slam3d;
+
+SubmapSolver::SubmapSolver(Logger* logger, Solver* global, Solver* local, unsigned size)
+ : Solver(logger), mGlobalSolver(global), mLocalSolver(local), mSubmapSize(size)
+{
+	if(mSubmapSize == 0)
+		mSubmapSize = 1;
+}
+
+SubmapSolver::~SubmapSolver()
+{
+}
+
+SubmapSolver::Submap& SubmapSolver::getSubmap(IdType id)
+{
+	std::map<IdType, unsigned>::iterator it = mSubmapIndex.find(id);
+	if(it == mSubmapIndex.end())
+		throw UnknownVertex(id);
+	return mSubmaps[it->second];
+}
+
+void SubmapSolver::addVertex(IdType id, const Transform& pose)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	if(mSubmapIndex.find(id) != mSubmapIndex.end())
+	{
+		throw DuplicateVertex(id);
+	}
+
+	// Start a new submap with this vertex as anchor
+	if(mSubmaps.empty() || mSubmaps.back().poses.size() >= mSubmapSize)
+	{
+		Submap submap;
+		submap.anchor = id;
+		submap.anchor_pose = pose;
+		submap.fixed = false;
+		mSubmaps.push_back(submap);
+		mLogger->message(DEBUG, (boost::format("Created submap %1% with anchor %2%.") % (mSubmaps.size() - 1) % id).str());
+	}
+
+	Submap& submap = mSubmaps.back();
+	submap.poses[id] = submap.anchor_pose.inverse() * pose;
+	submap.changed = true;
+	mSubmapIndex[id] = mSubmaps.size() - 1;
+}
+
+void SubmapSolver::removeVertex(IdType id)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	Submap& submap = getSubmap(id);
+	submap.poses.erase(id);
+	submap.changed = true;
+	mSubmapIndex.erase(id);
+
+	removeEdges(submap.edges, id);
+	removeEdges(mSkeletonEdges, id);
+	removeEdges(mUnaryEdges, id);
+
+	// Move the anchor to the first remaining vertex of the submap
+	if(id == submap.anchor && !submap.poses.empty())
+	{
+		Transform offset = submap.poses.begin()->second;
+		Transform inverse = offset.inverse();
+		submap.anchor = submap.poses.begin()->first;
+		submap.anchor_pose = submap.anchor_pose * offset;
+		for(std::map<IdType, Transform>::iterator p = submap.poses.begin(); p != submap.poses.end(); ++p)
+		{
+			p->second = inverse * p->second;
+		}
+	}
+}
+
+void SubmapSolver::addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	std::map<IdType, unsigned>::iterator s = mSubmapIndex.find(source);
+	std::map<IdType, unsigned>::iterator t = mSubmapIndex.find(target);
+	if(s == mSubmapIndex.end() || t == mSubmapIndex.end())
+	{
+		throw BadEdge(source, target);
+	}
+
+	Edge edge;
+	edge.source = source;
+	edge.target = target;
+	edge.constraint = se3;
+	if(s->second == t->second)
+	{
+		mSubmaps[s->second].edges.push_back(edge);
+		mSubmaps[s->second].changed = true;
+	}else
+	{
+		mSkeletonEdges.push_back(edge);
+	}
+}
+
+void SubmapSolver::addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	if(mSubmapIndex.find(vertex) == mSubmapIndex.end())
+	{
+		throw BadEdge(vertex, 0);
+	}
+
+	Edge edge;
+	edge.source = vertex;
+	edge.target = 0;
+	edge.constraint = grav;
+	mUnaryEdges.push_back(edge);
+}
+
+void SubmapSolver::addEdgePosition(IdType vertex, PositionConstraint::Ptr pos)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	if(mSubmapIndex.find(vertex) == mSubmapIndex.end())
+	{
+		throw BadEdge(vertex, 0);
+	}
+
+	Edge edge;
+	edge.source = vertex;
+	edge.target = 0;
+	edge.constraint = pos;
+	mUnaryEdges.push_back(edge);
+}
+
+void SubmapSolver::setFixed(IdType id)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	try
+	{
+		getSubmap(id).fixed = true;
+	}catch(UnknownVertex &e)
+	{
+		mLogger->message(ERROR, (boost::format("Could not fix vertex with ID %1%!") % id).str());
+		throw;
+	}
+}
+
+bool SubmapSolver::optimizeSubmap(Submap& submap, unsigned iterations)
+{
+	submap.changed = false;
+	if(submap.poses.size() < 2 || submap.edges.empty())
+		return true;
+
+	// The anchor holds the submap in place
+	mLocalSolver->clear();
+	for(std::map<IdType, Transform>::const_iterator p = submap.poses.begin(); p != submap.poses.end(); ++p)
+	{
+		mLocalSolver->addVertex(p->first, p->second);
+	}
+	mLocalSolver->setFixed(submap.anchor);
+	for(EdgeList::const_iterator e = submap.edges.begin(); e != submap.edges.end(); ++e)
+	{
+		mLocalSolver->addEdge(e->source, e->target, e->constraint);
+	}
+
+	if(!mLocalSolver->compute(iterations))
+	{
+		mLogger->message(ERROR, (boost::format("Optimization of submap with anchor %1% failed!") % submap.anchor).str());
+		return false;
+	}
+
+	IdPoseVector result = mLocalSolver->getCorrections();
+	for(IdPoseVector::const_iterator r = result.begin(); r != result.end(); ++r)
+	{
+		std::map<IdType, Transform>::iterator p = submap.poses.find(r->first);
+		if(p != submap.poses.end())
+			p->second = r->second;
+	}
+	return true;
+}
+
+bool SubmapSolver::optimizeSkeleton(unsigned iterations)
+{
+	mGlobalSolver->clear();
+	for(std::vector<Submap>::const_iterator s = mSubmaps.begin(); s != mSubmaps.end(); ++s)
+	{
+		if(s->poses.empty())
+			continue;
+		mGlobalSolver->addVertex(s->anchor, s->anchor_pose);
+		if(s->fixed)
+			mGlobalSolver->setFixed(s->anchor);
+	}
+
+	// Constraints between submaps are converted to constraints between their anchors
+	for(EdgeList::const_iterator e = mSkeletonEdges.begin(); e != mSkeletonEdges.end(); ++e)
+	{
+		const Submap& source = getSubmap(e->source);
+		const Submap& target = getSubmap(e->target);
+		TransformWithCovariance source_pose(source.poses.at(e->source), Covariance<6>::Zero());
+		TransformWithCovariance target_pose(target.poses.at(e->target).inverse(), Covariance<6>::Zero());
+		const TransformWithCovariance& twc = boost::static_pointer_cast<SE3Constraint>(e->constraint)->getRelativePose();
+		SE3Constraint::Ptr se3 = SE3Constraint::create(e->constraint->getSensorName(), source_pose * twc * target_pose);
+		mGlobalSolver->addEdgeSE3(source.anchor, target.anchor, se3);
+	}
+
+	// Unary constraints are approximated with the current pose within the submap
+	for(EdgeList::const_iterator e = mUnaryEdges.begin(); e != mUnaryEdges.end(); ++e)
+	{
+		const Submap& submap = getSubmap(e->source);
+		const Transform& pose = submap.poses.at(e->source);
+		if(e->constraint->getType() == GRAVITY)
+		{
+			GravityConstraint::Ptr grav = boost::static_pointer_cast<GravityConstraint>(e->constraint);
+			Direction direction = pose.linear() * grav->getDirection();
+			mGlobalSolver->addEdgeGravity(submap.anchor, GravityConstraint::create(
+				grav->getSensorName(), direction, grav->getReference(), grav->getCovariance()));
+		}else
+		{
+			PositionConstraint::Ptr pos = boost::static_pointer_cast<PositionConstraint>(e->constraint);
+			Position position = pos->getPosition() - submap.anchor_pose.linear() * pose.translation();
+			mGlobalSolver->addEdgePosition(submap.anchor, PositionConstraint::create(
+				pos->getSensorName(), position, pos->getCovariance()));
+		}
+	}
+
+	if(!mGlobalSolver->compute(iterations))
+	{
+		mLogger->message(ERROR, "Optimization of the skeleton graph failed!");
+		return false;
+	}
+
+	IdPoseVector result = mGlobalSolver->getCorrections();
+	for(IdPoseVector::const_iterator r = result.begin(); r != result.end(); ++r)
+	{
+		getSubmap(r->first).anchor_pose = r->second;
+	}
+	return true;
+}
+
+bool SubmapSolver::compute(unsigned iterations)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+
+	// Clear previous optimization result
+	mCorrections.clear();
+	if(mSubmaps.empty())
+		return true;
+
+	// Optimize all submaps that have changed
+	unsigned changed = 0;
+	for(std::vector<Submap>::iterator s = mSubmaps.begin(); s != mSubmaps.end(); ++s)
+	{
+		if(!s->changed)
+			continue;
+		if(!optimizeSubmap(*s, iterations))
+			return false;
+		changed++;
+	}
+
+	// Optimize the anchors
+	if(!optimizeSkeleton(iterations))
+		return false;
+	mLogger->message(DEBUG, (boost::format("Optimized %1% of %2% submaps and a skeleton with %3% constraints.")
+		% changed % mSubmaps.size() % mSkeletonEdges.size()).str());
+
+	// Write the result so it can be used by the mapper
+	for(std::vector<Submap>::const_iterator s = mSubmaps.begin(); s != mSubmaps.end(); ++s)
+	{
+		for(std::map<IdType, Transform>::const_iterator p = s->poses.begin(); p != s->poses.end(); ++p)
+		{
+			mCorrections.push_back(IdPose(p->first, s->anchor_pose * p->second));
+		}
+	}
+	return true;
+}
+
+IdPoseVector SubmapSolver::getCorrections()
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	return mCorrections;
+}
+
+void SubmapSolver::clear()
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mSubmaps.clear();
+	mSubmapIndex.clear();
+	mSkeletonEdges.clear();
+	mUnaryEdges.clear();
+	mCorrections.clear();
+	mGlobalSolver->clear();
+	mLocalSolver->clear();
+}
+
+void SubmapSolver::saveGraph(std::string filename)
+{
+	boost::unique_lock<boost::mutex> guard(mMutex);
+	mGlobalSolver->saveGraph(filename);
+}
+
+void SubmapSolver::removeEdges(EdgeList& edges, IdType id)
+{
+	EdgeList::iterator e = edges.begin();
+	while(e != edges.end())
+	{
+		if(e->source == id || e->target == id)
+			e = edges.erase(e);
+		else
+			++e;
+	}
+}
@@ -0,0 +1,130 @@
+// slam3d - Frontend for graph-based SLAM
+// Copyright (C) 2017 S. Kasperski
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SLAM_SUBMAPSOLVER_HPP
+#define SLAM_SUBMAPSOLVER_HPP
+
+#include <slam3d/core/Solver.hpp>
+
+#include <boost/thread/mutex.hpp>
+#include <set>
+
+namespace slam3d
+{
+	/**
+	 * @class SubmapSolver
+	 * @brief Hierarchical solver that optimizes submaps and their skeleton separately.
+	 * @details Consecutively added vertices are grouped into submaps of a fixed
+	 * size, the first vertex of each submap is its anchor. The poses within a
+	 * submap are stored relative to the anchor and are optimized with the local
+	 * solver, using only the constraints inside the submap. This is only done
+	 * for submaps that have changed since the last optimization.
+	 *
+	 * Constraints between different submaps are converted to constraints
+	 * between their anchors, which form a coarse skeleton graph that is
+	 * optimized with the global solver. The global pose of each vertex is then
+	 * given by its anchor's pose and its pose within the submap. Thus each
+	 * optimization only touches the changed submaps and a graph that is
+	 * smaller than the original by the submap size.
+	 *
+	 * Gravity and position constraints are approximately converted to
+	 * constraints on the anchor, using the current pose within the submap.
+	 * The SubmapSolver does not take ownership of the given solvers.
+	 */
+	class SubmapSolver : public Solver
+	{
+	public:
+		/**
+		 * @brief Constructor.
+		 * @param logger pointer to the logger used by the solver
+		 * @param global solver used for the skeleton graph of anchors
+		 * @param local solver used for the submaps, it is cleared before each use
+		 * @param size number of vertices per submap
+		 */
+		SubmapSolver(Logger* logger, Solver* global, Solver* local, unsigned size = 100);
+		~SubmapSolver();
+
+		void addVertex(IdType id, const Transform& pose);
+		void removeVertex(IdType id);
+		void addEdgeSE3(IdType source, IdType target, SE3Constraint::Ptr se3);
+		void addEdgeGravity(IdType vertex, GravityConstraint::Ptr grav);
+		void addEdgePosition(IdType vertex, PositionConstraint::Ptr pos);
+		void setFixed(IdType id);
+		bool compute(unsigned iterations);
+		void clear();
+
+		/**
+		 * @brief Save the skeleton graph with the global solver.
+		 * @param filename
+		 */
+		void saveGraph(std::string filename);
+
+		IdPoseVector getCorrections();
+
+		/**
+		 * @brief Get the number of submaps.
+		 */
+		unsigned getNumberOfSubmaps() const { return mSubmaps.size(); }
+
+	protected:
+		struct Edge
+		{
+			IdType source;
+			IdType target;
+			Constraint::Ptr constraint;
+		};
+		typedef std::vector<Edge> EdgeList;
+
+		struct Submap
+		{
+			IdType anchor;
+			Transform anchor_pose;
+			std::map<IdType, Transform> poses; // relative to the anchor
+			EdgeList edges;                    // SE3 constraints within the submap
+			bool changed;
+			bool fixed;
+		};
+
+		bool optimizeSubmap(Submap& submap, unsigned iterations);
+		bool optimizeSkeleton(unsigned iterations);
+		Submap& getSubmap(IdType id);
+		static void removeEdges(EdgeList& edges, IdType id);
+
+	protected:
+		Solver* mGlobalSolver;
+		Solver* mLocalSolver;
+		unsigned mSubmapSize;
+
+		std::vector<Submap> mSubmaps;
+		std::map<IdType, unsigned> mSubmapIndex; // vertex-id --> submap
+		EdgeList mSkeletonEdges;                 // SE3 constraints between submaps
+		EdgeList mUnaryEdges;                    // gravity and position constraints
+
+		IdPoseVector mCorrections;
+		boost::mutex mMutex;
+	};
+}
+
+#endif
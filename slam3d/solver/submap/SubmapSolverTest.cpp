@@ -0,0 +1,63 @@
+#define BOOST_TEST_MODULE "SubmapSolverTest"
+
+#include "SubmapSolver.hpp"
+
+#include <slam3d/core/FileLogger.hpp>
+#include <slam3d/core/SolverTest.hpp>
+#include <slam3d/solver/g2o/G2oSolver.hpp>
+#include <slam3d/solver/g2o/GridGraph.hpp>
+
+#include <boost/format.hpp>
+
+using namespace slam3d;
+
+BOOST_AUTO_TEST_CASE(submap_optimization)
+{
+	Clock clock;
+	FileLogger logger(clock, "submap_solver.log");
+	logger.setLogLevel(DEBUG);
+	G2oSolver global(&logger);
+	G2oSolver local(&logger);
+	Solver* solver = new SubmapSolver(&logger, &global, &local, 2);
+	test_optimization(solver);
+	delete solver;
+}
+
+BOOST_AUTO_TEST_CASE(submap_accuracy)
+{
+	Clock clock;
+	FileLogger logger(clock, "submap_accuracy.log");
+	logger.setLogLevel(WARNING);
+
+	// Each row of the grid is a submap, loop closures connect the rows
+	G2oSolver reference(&logger);
+	G2oSolver global(&logger);
+	G2oSolver local(&logger);
+	SubmapSolver submaps(&logger, &global, &local, 10);
+	std::vector<Transform> truth;
+	createGridGraph(reference, 10, 10, truth);
+	createGridGraph(submaps, 10, 10, truth);
+	BOOST_CHECK_EQUAL(submaps.getNumberOfSubmaps(), 10);
+	BOOST_REQUIRE(reference.compute(10));
+	BOOST_REQUIRE(submaps.compute(10));
+
+	IdPoseVector ref_corr = reference.getCorrections();
+	IdPoseVector sub_corr = submaps.getCorrections();
+	BOOST_REQUIRE_EQUAL(sub_corr.size(), ref_corr.size());
+	std::map<IdType, Transform> sub_poses(sub_corr.begin(), sub_corr.end());
+
+	// The hierarchical result is close to the full optimization
+	double ref_error = 0, sub_error = 0;
+	for(IdPoseVector::iterator c = ref_corr.begin(); c != ref_corr.end(); ++c)
+	{
+		BOOST_REQUIRE(sub_poses.count(c->first));
+		const Transform& sub = sub_poses[c->first];
+		BOOST_CHECK_SMALL((sub.translation() - c->second.translation()).norm(), (ScalarType)1.0);
+		ref_error += (c->second.translation() - truth[c->first - 1].translation()).squaredNorm();
+		sub_error += (sub.translation() - truth[c->first - 1].translation()).squaredNorm();
+	}
+	ref_error = std::sqrt(ref_error / ref_corr.size());
+	sub_error = std::sqrt(sub_error / ref_corr.size());
+	BOOST_TEST_MESSAGE(boost::format("RMSE of full optimization: %1%, of submaps: %2%") % ref_error % sub_error);
+	BOOST_CHECK_LT(sub_error, 1.1 * ref_error + 0.05);
+}